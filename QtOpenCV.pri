@@ -1,11 +1,39 @@
 include(opencv.pri)
 
+#CONFIG += qtocv_cuda to provide the cv::cuda::GpuMat conversions, which need opencv_cudaimgproc
+qtocv_cuda: DEFINES += QTOCV_WITH_CUDA
+
 INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
 HEADERS += \
-    $$PWD/cvmatandqimage.h
+    $$PWD/asyncconversion.h \
+    $$PWD/cvmatandqimage.h \
+    $$PWD/framepool.h \
+    $$PWD/framering.h \
+    $$PWD/rawframefile.h \
+    $$PWD/rowkernels.h \
+    $$PWD/stripconversion.h
 
-SOURCES += \
-    $$PWD/cvmatandqimage.cpp
+#CONFIG += qtocv_lib to link the static library built by QtOpenCV.pro, instead of compiling the sources
+#into this project. The library is looked for in QTOCV_LIBPATH, which can be set as OPENCV_LIBPATH of
+#opencv.pri, and defaults to the lib directory next to this file
+isEmpty(QTOCV_LIBPATH):QTOCV_LIBPATH = $$(QTOCV_LIBPATH)
+isEmpty(QTOCV_LIBPATH):QTOCV_LIBPATH = $$[QTOCV_LIBPATH]
+isEmpty(QTOCV_LIBPATH):QTOCV_LIBPATH = $$PWD/lib
+QTOCV_LIBNAME = QtOpenCV
+win32:CONFIG(debug, debug|release):QTOCV_LIBNAME = $${QTOCV_LIBNAME}d
 
+qtocv_lib:!qtocv_build_lib {
+    LIBS += -L$$QTOCV_LIBPATH -l$$QTOCV_LIBNAME
+    win32-msvc*:PRE_TARGETDEPS += $$QTOCV_LIBPATH/$${QTOCV_LIBNAME}.lib
+    else:PRE_TARGETDEPS += $$QTOCV_LIBPATH/lib$${QTOCV_LIBNAME}.a
+} else {
+    SOURCES += \
+        $$PWD/asyncconversion.cpp \
+        $$PWD/cvmatandqimage.cpp \
+        $$PWD/framepool.cpp \
+        $$PWD/framering.cpp \
+        $$PWD/rawframefile.cpp \
+        $$PWD/stripconversion.cpp
+}
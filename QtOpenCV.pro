@@ -0,0 +1,32 @@
+#Usage:
+#
+#Build QtOpenCV as a static library, then link it from any project by
+#   CONFIG += qtocv_lib
+#   include(QtOpenCV.pri)
+#
+#The library is built with its own flags, whatever the flags of the project linking it are.
+#It's -O3 for gcc and clang, and more can be given to qmake
+#   qmake "CONFIG += qtocv_native" QtOpenCV.pro             #-march=native, for the cpu of this machine
+#   qmake "QTOCV_CXXFLAGS = -march=haswell" QtOpenCV.pro
+#   qmake "CONFIG += ltcg" QtOpenCV.pro                     #Link time optimization, the project needs ltcg too
+#
+#The SIMD kernels don't depend on these flags. Each one is compiled for its own instruction set, and
+#selected at runtime, so a library built for the generic cpu still uses AVX2 when it's available.
+
+CONFIG += qtocv_build_lib
+include(QtOpenCV.pri)
+
+TEMPLATE = lib
+CONFIG += staticlib
+TARGET = $$QTOCV_LIBNAME
+DESTDIR = $$QTOCV_LIBPATH
+
+qtocv_cuda: add_opencv_modules(core imgproc cudaimgproc)
+else: add_opencv_modules(core imgproc)
+
+!win32-msvc*:!msvc {
+    QMAKE_CXXFLAGS_RELEASE -= -O2
+    QMAKE_CXXFLAGS_RELEASE += -O3
+    qtocv_native: QMAKE_CXXFLAGS += -march=native
+}
+QMAKE_CXXFLAGS += $$QTOCV_CXXFLAGS
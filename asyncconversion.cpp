@@ -0,0 +1,310 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+
+#include "asyncconversion.h"
+#include <QFutureInterface>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QList>
+
+namespace QtOcv {
+
+namespace {
+
+//A conversion waiting in the pool, which is deleted once it is run or canceled
+class ConversionJob
+{
+public:
+    virtual ~ConversionJob() {}
+    virtual void run() = 0;
+    virtual void cancel() = 0;
+};
+
+template<typename T>
+class ConversionJob_ : public ConversionJob
+{
+public:
+    ConversionJob_()
+    {
+        m_interface.reportStarted();
+    }
+
+    QFuture<T> future()
+    {
+        return m_interface.future();
+    }
+
+    void run()
+    {
+        //Canceled by the caller before it is taken
+        if (!m_interface.isCanceled())
+            m_interface.reportResult(convert());
+        m_interface.reportFinished();
+    }
+
+    void cancel()
+    {
+        m_interface.cancel();
+        m_interface.reportFinished();
+    }
+
+protected:
+    virtual T convert() const = 0;
+
+private:
+    QFutureInterface<T> m_interface;
+};
+
+class Mat2ImageJob : public ConversionJob_<QImage>
+{
+public:
+    Mat2ImageJob(const cv::Mat &mat, QImage::Format format, MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+        : m_mat(mat), m_format(format), m_rgbOrder(matRgbOrder), m_colorTable(colorTable)
+    {
+    }
+
+protected:
+    QImage convert() const
+    {
+        QImage img;
+        QtOcv::mat2Image(m_mat, img, m_format, m_rgbOrder, m_colorTable);
+        return img;
+    }
+
+private:
+    cv::Mat m_mat;
+    QImage::Format m_format;
+    MatChannelOrder m_rgbOrder;
+    QVector<QRgb> m_colorTable;
+};
+
+class Image2MatJob : public ConversionJob_<cv::Mat>
+{
+public:
+    Image2MatJob(const QImage &img, int matType, MatChannelOrder matRgbOrder)
+        : m_image(img), m_matType(matType), m_rgbOrder(matRgbOrder)
+    {
+    }
+
+protected:
+    cv::Mat convert() const
+    {
+        cv::Mat mat;
+        QtOcv::image2Mat(m_image, mat, m_matType, m_rgbOrder);
+        return mat;
+    }
+
+private:
+    QImage m_image;
+    int m_matType;
+    MatChannelOrder m_rgbOrder;
+};
+
+} //namespace
+
+/* The waiting conversions and the threads of a ConversionPool
+ *
+ * - One runner is started for each conversion submitted, which runs the oldest waiting one.
+ *   Runners of the superseded conversions find nothing to run, and return at once.
+ */
+class ConversionPoolCore
+{
+public:
+    ConversionPoolCore(int maxThreads, int maxPending)
+        : maxPending(qMax(1, maxPending)), dropped(0)
+    {
+        threads.setMaxThreadCount(qMax(1, maxThreads));
+    }
+
+    void submit(ConversionJob *job);
+    void runNext();
+    void cancelPending();
+
+    mutable QMutex mutex;
+    //Oldest first
+    QList<ConversionJob*> pending;
+    int maxPending;
+    qint64 dropped;
+    QThreadPool threads;
+};
+
+namespace {
+
+class ConversionRunner : public QRunnable
+{
+public:
+    explicit ConversionRunner(ConversionPoolCore *core) : m_core(core) {}
+
+    void run()
+    {
+        m_core->runNext();
+    }
+
+private:
+    ConversionPoolCore *m_core;
+};
+
+//Canceled out of the lock, as the threads waiting for the QFutures are woken
+void cancelJobs(const QList<ConversionJob*> &jobs)
+{
+    for (int i=0; i<jobs.size(); ++i) {
+        jobs[i]->cancel();
+        delete jobs[i];
+    }
+}
+
+Q_GLOBAL_STATIC(ConversionPool, globalConversionPool)
+
+} //namespace
+
+void ConversionPoolCore::submit(ConversionJob *job)
+{
+    QList<ConversionJob*> superseded;
+    mutex.lock();
+    pending.append(job);
+    while (pending.size() > maxPending) {
+        superseded.append(pending.takeFirst());
+        ++dropped;
+    }
+    mutex.unlock();
+
+    cancelJobs(superseded);
+    threads.start(new ConversionRunner(this));
+}
+
+void ConversionPoolCore::runNext()
+{
+    mutex.lock();
+    ConversionJob *job = pending.isEmpty() ? 0 : pending.takeFirst();
+    mutex.unlock();
+
+    if (job) {
+        job->run();
+        delete job;
+    }
+}
+
+void ConversionPoolCore::cancelPending()
+{
+    mutex.lock();
+    const QList<ConversionJob*> jobs = pending;
+    pending.clear();
+    mutex.unlock();
+
+    cancelJobs(jobs);
+}
+
+ConversionPool::ConversionPool(int maxThreads, int maxPending)
+    : d(new ConversionPoolCore(maxThreads, maxPending))
+{
+}
+
+ConversionPool::~ConversionPool()
+{
+    clear();
+    delete d;
+}
+
+/* Convert mat to QImage in the threads of the pool, same as QtOcv::mat2Image()
+ */
+QFuture<QImage> ConversionPool::mat2Image(const cv::Mat &mat, QImage::Format format, MatChannelOrder matRgbOrder,
+                                          const QVector<QRgb> &colorTable)
+{
+    Mat2ImageJob *job = new Mat2ImageJob(mat, format, matRgbOrder, colorTable);
+    const QFuture<QImage> future = job->future();
+    d->submit(job);
+    return future;
+}
+
+/* Convert img to cv::Mat in the threads of the pool, same as QtOcv::image2Mat()
+ */
+QFuture<cv::Mat> ConversionPool::image2Mat(const QImage &img, int matType, MatChannelOrder matRgbOrder)
+{
+    Image2MatJob *job = new Image2MatJob(img, matType, matRgbOrder);
+    const QFuture<cv::Mat> future = job->future();
+    d->submit(job);
+    return future;
+}
+
+void ConversionPool::setMaxThreads(int threads)
+{
+    d->threads.setMaxThreadCount(qMax(1, threads));
+}
+
+int ConversionPool::maxThreads() const
+{
+    return d->threads.maxThreadCount();
+}
+
+//Conversions already waiting beyond the new count are superseded by the next one submitted
+void ConversionPool::setMaxPending(int count)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maxPending = qMax(1, count);
+}
+
+int ConversionPool::maxPending() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maxPending;
+}
+
+qint64 ConversionPool::droppedCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->dropped;
+}
+
+void ConversionPool::clear()
+{
+    d->cancelPending();
+    d->threads.waitForDone();
+}
+
+//Wait until all the conversions submitted so far are finished
+void ConversionPool::waitForDone()
+{
+    d->threads.waitForDone();
+}
+
+//One thread and one waiting conversion, so the newest frame is always the next one converted
+ConversionPool *ConversionPool::globalInstance()
+{
+    return globalConversionPool();
+}
+
+QFuture<QImage> mat2ImageAsync(const cv::Mat &mat, QImage::Format format, MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    return ConversionPool::globalInstance()->mat2Image(mat, format, matRgbOrder, colorTable);
+}
+
+QFuture<cv::Mat> image2MatAsync(const QImage &img, int matType, MatChannelOrder matRgbOrder)
+{
+    return ConversionPool::globalInstance()->image2Mat(img, matType, matRgbOrder);
+}
+
+} //namespace QtOcv
@@ -0,0 +1,82 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+
+#ifndef ASYNCCONVERSION_H
+#define ASYNCCONVERSION_H
+
+#include <QFuture>
+#include "cvmatandqimage.h"
+
+namespace QtOcv {
+
+class ConversionPoolCore;
+
+/* Threads which convert frames off the thread that submits them, such as the GUI thread
+ *
+ * - Each conversion is a QFuture, whose result is a null QImage or an empty cv::Mat on failure.
+ * - At most maxPending conversions wait to be started. A new one supersedes the oldest waiting
+ *   one when that's full, whose QFuture is canceled, so a slow consumer always gets the newest
+ *   frames instead of a growing backlog. Canceling a QFuture which hasn't started skips it too.
+ * - The data of the cv::Mat or QImage submitted is shared, not copied, so it mustn't be written
+ *   until the QFuture is finished, same as a frame given to another thread.
+ * - Thread safe, conversions can be submitted from any thread.
+ */
+class ConversionPool
+{
+public:
+    explicit ConversionPool(int maxThreads = 1, int maxPending = 1);
+    ~ConversionPool();
+
+    QFuture<QImage> mat2Image(const cv::Mat &mat, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                              const QVector<QRgb> &colorTable = QVector<QRgb>());
+    QFuture<cv::Mat> image2Mat(const QImage &img, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+
+    void setMaxThreads(int threads);
+    int maxThreads() const;
+    void setMaxPending(int count);
+    int maxPending() const;
+    //Conversions superseded by newer ones since the pool was created
+    qint64 droppedCount() const;
+
+    //Cancel the conversions which haven't started, and wait for the running ones
+    void clear();
+    void waitForDone();
+
+    //Used by mat2ImageAsync() and image2MatAsync()
+    static ConversionPool *globalInstance();
+
+private:
+    Q_DISABLE_COPY(ConversionPool)
+    ConversionPoolCore *d;
+};
+
+QFuture<QImage> mat2ImageAsync(const cv::Mat &mat, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                               const QVector<QRgb> &colorTable = QVector<QRgb>());
+QFuture<cv::Mat> image2MatAsync(const QImage &img, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+
+} //namespace QtOcv
+
+#endif // ASYNCCONVERSION_H
@@ -24,521 +24,4009 @@
 ****************************************************************************/
 
 #include "cvmatandqimage.h"
+#include "rowkernels.h"
 #include <QImage>
 #include <QSysInfo>
 #include <QDebug>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMap>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <limits>
 #include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
+#ifdef QTOCV_WITH_CUDA
+#include "opencv2/cudaimgproc.hpp"
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  define QTOCV_X86_SIMD
+#  include <emmintrin.h>
+#  include <tmmintrin.h>
+#  include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define QTOCV_NEON_SIMD
+#  include <arm_neon.h>
+#endif
+
+//Compile the SIMD kernels without -msse* / -mavx* flags, they are only called after runtime check.
+#if defined(__GNUC__) || defined(__clang__)
+#  define QTOCV_TARGET(isa) __attribute__((target(isa)))
+#else
+#  define QTOCV_TARGET(isa)
+#endif
 
 namespace {
 
-template<typename T>
-QImage mat2Image_(const cv::Mat & mat, QImage::Format format, QtOcv::MatChannelOrder matRgbOrder, double scalefactor)
+//The scalar kernels, which the SIMD ones fall back to for the tail of rows
+using namespace QtOcv::RowKernels;
+
+/* Row swizzle kernels for 8-bit data
+ *
+ * All of them work on raw bytes: swapRB exchanges byte 0 and byte 2 of each
+ * pixel, the 4th byte of 4 channels pixel is alpha(255 when opaque is set).
+ * So B G R A in little endian QRgb can be handled just as OpenCV's B G R A.
+ */
+typedef void (*RowSwizzleFunc)(const uchar *src, uchar *dst, int width);
+
+#if defined(QTOCV_X86_SIMD)
+
+/* SSE2 has no byte shuffle, only the 4 => 4 case is worth doing.
+ */
+template<bool swapRB, bool opaque>
+QTOCV_TARGET("sse2") void swizzleRow4To4_sse2(const uchar *src, uchar *dst, int width)
+{
+    const __m128i rbMask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i gaMask = _mm_set1_epi32(int(0xff00ff00));
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+    int x = 0;
+    for (; x+4<=width; x+=4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*4));
+        if (swapRB) {
+            const __m128i rb = _mm_and_si128(v, rbMask);
+            v = _mm_or_si128(_mm_and_si128(v, gaMask),
+                             _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+        }
+        if (opaque)
+            v = _mm_or_si128(v, alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*4), v);
+    }
+    swizzleRow4To4_<swapRB, opaque>(src + x*4, dst + x*4, width - x);
+}
+
+/* Each iteration converts 5 pixels(15 bytes) but loads and stores 16 bytes,
+ * the extra byte will be rewritten by next iteration or the scalar tail.
+ */
+template<bool swapRB>
+QTOCV_TARGET("ssse3") void swizzleRow3To3_ssse3(const uchar *src, uchar *dst, int width)
+{
+    if (!swapRB) {
+        std::memcpy(dst, src, width*3);
+        return;
+    }
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+    int x = 0;
+    for (; x+6<=width; x+=5) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*3), _mm_shuffle_epi8(v, mask));
+    }
+    swizzleRow3To3_<swapRB>(src + x*3, dst + x*3, width - x);
+}
+
+template<bool swapRB>
+QTOCV_TARGET("ssse3") void swizzleRow3To4_ssse3(const uchar *src, uchar *dst, int width)
+{
+    const __m128i mask = swapRB ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                                : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+    int x = 0;
+    for (; x+6<=width; x+=4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*4), _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+    }
+    swizzleRow3To4_<swapRB>(src + x*3, dst + x*4, width - x);
+}
+
+template<bool swapRB>
+QTOCV_TARGET("ssse3") void swizzleRow4To3_ssse3(const uchar *src, uchar *dst, int width)
+{
+    const __m128i mask = swapRB ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+                                : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int x = 0;
+    for (; x+6<=width; x+=4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*3), _mm_shuffle_epi8(v, mask));
+    }
+    swizzleRow4To3_<swapRB>(src + x*4, dst + x*3, width - x);
+}
+
+template<bool swapRB, bool opaque>
+QTOCV_TARGET("ssse3") void swizzleRow4To4_ssse3(const uchar *src, uchar *dst, int width)
+{
+    if (!swapRB)
+        return swizzleRow4To4_sse2<swapRB, opaque>(src, dst, width);
+
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m128i alpha = _mm_set1_epi32(opaque ? int(0xff000000) : 0);
+    int x = 0;
+    for (; x+4<=width; x+=4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*4), _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+    }
+    swizzleRow4To4_<swapRB, opaque>(src + x*4, dst + x*4, width - x);
+}
+
+/* AVX2 shuffles bytes within 128-bit lanes only, so for 3 channels data each
+ * lane is loaded from its own (overlapped) position.
+ */
+QTOCV_TARGET("avx2") inline __m256i loadTwoLanes_avx2(const uchar *lo, const uchar *hi)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lo))),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi)), 1);
+}
+
+QTOCV_TARGET("avx2") inline void storeTwoLanes_avx2(uchar *lo, uchar *hi, __m256i v)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lo), _mm256_castsi256_si128(v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(hi), _mm256_extracti128_si256(v, 1));
+}
+
+template<bool swapRB>
+QTOCV_TARGET("avx2") void swizzleRow3To3_avx2(const uchar *src, uchar *dst, int width)
+{
+    if (!swapRB) {
+        std::memcpy(dst, src, width*3);
+        return;
+    }
+    const __m256i mask = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15));
+    int x = 0;
+    for (; x+11<=width; x+=10) {
+        const __m256i v = loadTwoLanes_avx2(src + x*3, src + x*3 + 15);
+        storeTwoLanes_avx2(dst + x*3, dst + x*3 + 15, _mm256_shuffle_epi8(v, mask));
+    }
+    swizzleRow3To3_ssse3<swapRB>(src + x*3, dst + x*3, width - x);
+}
+
+template<bool swapRB>
+QTOCV_TARGET("avx2") void swizzleRow3To4_avx2(const uchar *src, uchar *dst, int width)
+{
+    const __m256i mask = _mm256_broadcastsi128_si256(
+                swapRB ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                       : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+    int x = 0;
+    for (; x+10<=width; x+=8) {
+        const __m256i v = loadTwoLanes_avx2(src + x*3, src + x*3 + 12);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x*4), _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
+    }
+    swizzleRow3To4_ssse3<swapRB>(src + x*3, dst + x*4, width - x);
+}
+
+template<bool swapRB>
+QTOCV_TARGET("avx2") void swizzleRow4To3_avx2(const uchar *src, uchar *dst, int width)
+{
+    const __m256i mask = _mm256_broadcastsi128_si256(
+                swapRB ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+                       : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+    int x = 0;
+    for (; x+10<=width; x+=8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x*4));
+        storeTwoLanes_avx2(dst + x*3, dst + x*3 + 12, _mm256_shuffle_epi8(v, mask));
+    }
+    swizzleRow4To3_ssse3<swapRB>(src + x*4, dst + x*3, width - x);
+}
+
+template<bool swapRB, bool opaque>
+QTOCV_TARGET("avx2") void swizzleRow4To4_avx2(const uchar *src, uchar *dst, int width)
+{
+    const __m256i mask = _mm256_broadcastsi128_si256(
+                swapRB ? _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+                       : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    const __m256i alpha = _mm256_set1_epi32(opaque ? int(0xff000000) : 0);
+    int x = 0;
+    for (; x+8<=width; x+=8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x*4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x*4), _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
+    }
+    swizzleRow4To4_ssse3<swapRB, opaque>(src + x*4, dst + x*4, width - x);
+}
+
+#elif defined(QTOCV_NEON_SIMD)
+
+template<bool swapRB>
+void swizzleRow3To3_neon(const uchar *src, uchar *dst, int width)
+{
+    if (!swapRB) {
+        std::memcpy(dst, src, width*3);
+        return;
+    }
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        uint8x16x3_t v = vld3q_u8(src + x*3);
+        const uint8x16_t r = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = r;
+        vst3q_u8(dst + x*3, v);
+    }
+    swizzleRow3To3_<swapRB>(src + x*3, dst + x*3, width - x);
+}
+
+template<bool swapRB>
+void swizzleRow3To4_neon(const uchar *src, uchar *dst, int width)
+{
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        const uint8x16x3_t v = vld3q_u8(src + x*3);
+        uint8x16x4_t out;
+        out.val[0] = v.val[swapRB ? 2 : 0];
+        out.val[1] = v.val[1];
+        out.val[2] = v.val[swapRB ? 0 : 2];
+        out.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + x*4, out);
+    }
+    swizzleRow3To4_<swapRB>(src + x*3, dst + x*4, width - x);
+}
+
+template<bool swapRB>
+void swizzleRow4To3_neon(const uchar *src, uchar *dst, int width)
+{
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        const uint8x16x4_t v = vld4q_u8(src + x*4);
+        uint8x16x3_t out;
+        out.val[0] = v.val[swapRB ? 2 : 0];
+        out.val[1] = v.val[1];
+        out.val[2] = v.val[swapRB ? 0 : 2];
+        vst3q_u8(dst + x*3, out);
+    }
+    swizzleRow4To3_<swapRB>(src + x*4, dst + x*3, width - x);
+}
+
+template<bool swapRB, bool opaque>
+void swizzleRow4To4_neon(const uchar *src, uchar *dst, int width)
+{
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        uint8x16x4_t v = vld4q_u8(src + x*4);
+        if (swapRB) {
+            const uint8x16_t r = v.val[0];
+            v.val[0] = v.val[2];
+            v.val[2] = r;
+        }
+        if (opaque)
+            v.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + x*4, v);
+    }
+    swizzleRow4To4_<swapRB, opaque>(src + x*4, dst + x*4, width - x);
+}
+
+#endif
+
+struct RowSwizzleTable
+{
+    RowSwizzleFunc c3ToC3[2];    //[swapRB]
+    RowSwizzleFunc c3ToC4[2];    //[swapRB]
+    RowSwizzleFunc c4ToC3[2];    //[swapRB]
+    RowSwizzleFunc c4ToC4[2][2]; //[swapRB][opaque]
+};
+
+#define QTOCV_ROW_SWIZZLE_TABLE(c3ToC3, c3ToC4, c4ToC3, c4ToC4) \
+    { {c3ToC3<false>, c3ToC3<true>}, {c3ToC4<false>, c3ToC4<true>}, {c4ToC3<false>, c4ToC3<true>}, \
+      {{c4ToC4<false, false>, c4ToC4<false, true>}, {c4ToC4<true, false>, c4ToC4<true, true>}} }
+
+const RowSwizzleTable swizzleTable_scalar =
+        QTOCV_ROW_SWIZZLE_TABLE(swizzleRow3To3_, swizzleRow3To4_, swizzleRow4To3_, swizzleRow4To4_);
+#if defined(QTOCV_X86_SIMD)
+const RowSwizzleTable swizzleTable_sse2 =
+        QTOCV_ROW_SWIZZLE_TABLE(swizzleRow3To3_, swizzleRow3To4_, swizzleRow4To3_, swizzleRow4To4_sse2);
+const RowSwizzleTable swizzleTable_ssse3 =
+        QTOCV_ROW_SWIZZLE_TABLE(swizzleRow3To3_ssse3, swizzleRow3To4_ssse3, swizzleRow4To3_ssse3, swizzleRow4To4_ssse3);
+const RowSwizzleTable swizzleTable_avx2 =
+        QTOCV_ROW_SWIZZLE_TABLE(swizzleRow3To3_avx2, swizzleRow3To4_avx2, swizzleRow4To3_avx2, swizzleRow4To4_avx2);
+#elif defined(QTOCV_NEON_SIMD)
+const RowSwizzleTable swizzleTable_neon =
+        QTOCV_ROW_SWIZZLE_TABLE(swizzleRow3To3_neon, swizzleRow3To4_neon, swizzleRow4To3_neon, swizzleRow4To4_neon);
+#endif
+
+/* Select the best kernel for current cpu.
+ *
+ * checkHardwareSupport() is cheap, and it honors cv::setUseOptimized(false),
+ * which can be used to force the scalar version.
+ */
+RowSwizzleFunc rowSwizzleFunc(int srcChannels, int dstChannels, bool swapRB, bool opaque = false)
+{
+    Q_ASSERT((srcChannels == 3 || srcChannels == 4) && (dstChannels == 3 || dstChannels == 4));
+
+    const RowSwizzleTable *table = &swizzleTable_scalar;
+#if defined(QTOCV_X86_SIMD)
+#  ifdef CV_CPU_AVX2
+    if (cv::checkHardwareSupport(CV_CPU_AVX2))
+        table = &swizzleTable_avx2;
+    else
+#  endif
+    if (cv::checkHardwareSupport(CV_CPU_SSSE3))
+        table = &swizzleTable_ssse3;
+    else if (cv::checkHardwareSupport(CV_CPU_SSE2))
+        table = &swizzleTable_sse2;
+#elif defined(QTOCV_NEON_SIMD)
+    if (cv::useOptimized())
+        table = &swizzleTable_neon;
+#endif
+
+    if (srcChannels == 3)
+        return dstChannels == 3 ? table->c3ToC3[swapRB] : table->c3ToC4[swapRB];
+    return dstChannels == 3 ? table->c4ToC3[swapRB] : table->c4ToC4[swapRB][opaque];
+}
+
+/* Premultiply kernels for 8-bit data
+ *
+ * Swizzle 4 channels pixels whose alpha is the last component, and multiply the colors by
+ * alpha in the same pass. The 8-bit math has the same rounding as qPremultiply() and
+ * qUnpremultiply(), so the results are the same as the ones of QImage::convertToFormat().
+ */
+
+#if defined(QTOCV_X86_SIMD)
+
+//p holds 2 pixels of 16-bit components, the alpha of each is broadcast to its 4 lanes
+QTOCV_TARGET("sse2") inline __m128i premultiplyTwo_sse2(__m128i p)
+{
+    const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i t = _mm_mullo_epi16(p, a);
+    t = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), _mm_set1_epi16(0x80)), 8);
+    return _mm_or_si128(_mm_andnot_si128(alphaMask, t), _mm_and_si128(alphaMask, p));
+}
+
+//Works in place too
+template<bool swapRB>
+QTOCV_TARGET("sse2") void premultiplyRow4To4_sse2(const uchar *src, uchar *dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rbMask = _mm_set1_epi32(0x00ff00ff);
+    const __m128i gaMask = _mm_set1_epi32(int(0xff00ff00));
+    int x = 0;
+    for (; x+4<=width; x+=4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*4));
+        if (swapRB) {
+            const __m128i rb = _mm_and_si128(v, rbMask);
+            v = _mm_or_si128(_mm_and_si128(v, gaMask),
+                             _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+        }
+        const __m128i lo = premultiplyTwo_sse2(_mm_unpacklo_epi8(v, zero));
+        const __m128i hi = premultiplyTwo_sse2(_mm_unpackhi_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x*4), _mm_packus_epi16(lo, hi));
+    }
+    premultiplyRow4To4_<swapRB>(src + x*4, dst + x*4, width - x);
+}
+
+#elif defined(QTOCV_NEON_SIMD)
+
+//(t + (t >> 8) + 0x80) >> 8 of t = c * a
+inline uint8x8_t premultiplyEight_neon(uint8x8_t c, uint8x8_t a)
+{
+    const uint16x8_t t = vmull_u8(c, a);
+    return vrshrn_n_u16(vsraq_n_u16(t, t, 8), 8);
+}
+
+template<bool swapRB>
+void premultiplyRow4To4_neon(const uchar *src, uchar *dst, int width)
+{
+    int x = 0;
+    for (; x+8<=width; x+=8) {
+        const uint8x8x4_t v = vld4_u8(src + x*4);
+        uint8x8x4_t out;
+        out.val[0] = premultiplyEight_neon(v.val[swapRB ? 2 : 0], v.val[3]);
+        out.val[1] = premultiplyEight_neon(v.val[1], v.val[3]);
+        out.val[2] = premultiplyEight_neon(v.val[swapRB ? 0 : 2], v.val[3]);
+        out.val[3] = v.val[3];
+        vst4_u8(dst + x*4, out);
+    }
+    premultiplyRow4To4_<swapRB>(src + x*4, dst + x*4, width - x);
+}
+
+#endif
+
+RowSwizzleFunc rowPremultiplyFunc(bool swapRB)
+{
+    static const RowSwizzleFunc scalarFuncs[2] = {premultiplyRow4To4_<false>, premultiplyRow4To4_<true>};
+    const RowSwizzleFunc *funcs = scalarFuncs;
+#if defined(QTOCV_X86_SIMD)
+    static const RowSwizzleFunc sse2Funcs[2] = {premultiplyRow4To4_sse2<false>, premultiplyRow4To4_sse2<true>};
+    if (cv::checkHardwareSupport(CV_CPU_SSE2))
+        funcs = sse2Funcs;
+#elif defined(QTOCV_NEON_SIMD)
+    static const RowSwizzleFunc neonFuncs[2] = {premultiplyRow4To4_neon<false>, premultiplyRow4To4_neon<true>};
+    if (cv::useOptimized())
+        funcs = neonFuncs;
+#endif
+    return funcs[swapRB];
+}
+
+/* Grayscale kernels
+ *
+ * All the conversions use the same fixed-point ITU-R BT.601 luma, which has
+ * the same coefficients and rounding as cv::cvtColor(), so the result is same
+ * whichever direction we convert.
+ */
+typedef void (*RowGrayFunc)(const uchar *src, uchar *dst, int width);
+
+#if defined(QTOCV_X86_SIMD)
+
+/* v holds 4 pixels of 4 channels, returns 4 luma values as 32-bit integers.
+ */
+QTOCV_TARGET("sse2") inline __m128i grayFour_sse2(__m128i v, __m128i coeffs)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), coeffs); //c0+c1, c2+c3 of pixel 0, 1
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), coeffs); //c0+c1, c2+c3 of pixel 2, 3
+    __m128i sum = _mm_add_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)),
+                                                   _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0))),
+                                _mm_unpackhi_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)),
+                                                   _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0))));
+    sum = _mm_add_epi32(sum, _mm_set1_epi32(1 << 13));
+    return _mm_srai_epi32(sum, 14);
+}
+
+QTOCV_TARGET("sse2") inline __m128i grayCoeffs_sse2(int redIndex)
+{
+    return redIndex == 0 ? _mm_setr_epi16(4899, 9617, 1868, 0, 4899, 9617, 1868, 0)
+                         : _mm_setr_epi16(1868, 9617, 4899, 0, 1868, 9617, 4899, 0);
+}
+
+template<int srcChannels, int redIndex>
+QTOCV_TARGET("sse2") void grayRow_sse2(const uchar *src, uchar *dst, int width)
+{
+    Q_ASSERT(srcChannels == 4);
+    const __m128i coeffs = grayCoeffs_sse2(redIndex);
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        const __m128i *s = reinterpret_cast<const __m128i*>(src + x*4);
+        const __m128i g0 = _mm_packs_epi32(grayFour_sse2(_mm_loadu_si128(s), coeffs), grayFour_sse2(_mm_loadu_si128(s+1), coeffs));
+        const __m128i g1 = _mm_packs_epi32(grayFour_sse2(_mm_loadu_si128(s+2), coeffs), grayFour_sse2(_mm_loadu_si128(s+3), coeffs));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(g0, g1));
+    }
+    grayRow_<srcChannels, redIndex>(src + x*srcChannels, dst + x, width - x);
+}
+
+//Expand 3 channels pixels to 4 channels with pshufb, then same as SSE2 version
+template<int srcChannels, int redIndex>
+QTOCV_TARGET("ssse3") void grayRow_ssse3(const uchar *src, uchar *dst, int width)
+{
+    if (srcChannels == 4)
+        return grayRow_sse2<srcChannels, redIndex>(src, dst, width);
+
+    const __m128i coeffs = grayCoeffs_sse2(redIndex);
+    const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    int x = 0;
+    for (; x+18<=width; x+=16) {
+        const uchar *s = src + x*3;
+        const __m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s)), expand);
+        const __m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 12)), expand);
+        const __m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 24)), expand);
+        const __m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 36)), expand);
+        const __m128i g0 = _mm_packs_epi32(grayFour_sse2(v0, coeffs), grayFour_sse2(v1, coeffs));
+        const __m128i g1 = _mm_packs_epi32(grayFour_sse2(v2, coeffs), grayFour_sse2(v3, coeffs));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(g0, g1));
+    }
+    grayRow_<srcChannels, redIndex>(src + x*srcChannels, dst + x, width - x);
+}
+
+#elif defined(QTOCV_NEON_SIMD)
+
+template<int srcChannels, int redIndex>
+void grayRow_neon(const uchar *src, uchar *dst, int width)
+{
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        uint8x16_t r, g, b;
+        if (srcChannels == 3) {
+            const uint8x16x3_t v = vld3q_u8(src + x*3);
+            r = v.val[redIndex]; g = v.val[1]; b = v.val[2-redIndex];
+        } else {
+            const uint8x16x4_t v = vld4q_u8(src + x*4);
+            r = v.val[redIndex]; g = v.val[1]; b = v.val[2-redIndex];
+        }
+        uint16x8_t gray[2];
+        for (int half=0; half<2; ++half) {
+            const uint16x8_t r16 = vmovl_u8(half ? vget_high_u8(r) : vget_low_u8(r));
+            const uint16x8_t g16 = vmovl_u8(half ? vget_high_u8(g) : vget_low_u8(g));
+            const uint16x8_t b16 = vmovl_u8(half ? vget_high_u8(b) : vget_low_u8(b));
+            uint32x4_t lo = vmull_n_u16(vget_low_u16(r16), 4899);
+            lo = vmlal_n_u16(lo, vget_low_u16(g16), 9617);
+            lo = vmlal_n_u16(lo, vget_low_u16(b16), 1868);
+            uint32x4_t hi = vmull_n_u16(vget_high_u16(r16), 4899);
+            hi = vmlal_n_u16(hi, vget_high_u16(g16), 9617);
+            hi = vmlal_n_u16(hi, vget_high_u16(b16), 1868);
+            gray[half] = vcombine_u16(vrshrn_n_u32(lo, 14), vrshrn_n_u32(hi, 14));
+        }
+        vst1q_u8(dst + x, vcombine_u8(vmovn_u16(gray[0]), vmovn_u16(gray[1])));
+    }
+    grayRow_<srcChannels, redIndex>(src + x*srcChannels, dst + x, width - x);
+}
+
+#endif
+
+RowGrayFunc rowGrayFunc(int srcChannels, int redIndex)
+{
+    Q_ASSERT((srcChannels == 3 || srcChannels == 4) && (redIndex == 0 || redIndex == 2));
+
+    static const RowGrayFunc scalarFuncs[2][2] = {{grayRow_<3, 0>, grayRow_<3, 2>}, {grayRow_<4, 0>, grayRow_<4, 2>}};
+    const RowGrayFunc *funcs = scalarFuncs[srcChannels - 3];
+#if defined(QTOCV_X86_SIMD)
+    static const RowGrayFunc sse2Funcs[2][2] = {{grayRow_<3, 0>, grayRow_<3, 2>}, {grayRow_sse2<4, 0>, grayRow_sse2<4, 2>}};
+    static const RowGrayFunc ssse3Funcs[2][2] = {{grayRow_ssse3<3, 0>, grayRow_ssse3<3, 2>}, {grayRow_ssse3<4, 0>, grayRow_ssse3<4, 2>}};
+    if (cv::checkHardwareSupport(CV_CPU_SSSE3))
+        funcs = ssse3Funcs[srcChannels - 3];
+    else if (cv::checkHardwareSupport(CV_CPU_SSE2))
+        funcs = sse2Funcs[srcChannels - 3];
+#elif defined(QTOCV_NEON_SIMD)
+    static const RowGrayFunc neonFuncs[2][2] = {{grayRow_neon<3, 0>, grayRow_neon<3, 2>}, {grayRow_neon<4, 0>, grayRow_neon<4, 2>}};
+    if (cv::useOptimized())
+        funcs = neonFuncs[srcChannels - 3];
+#endif
+    return funcs[redIndex / 2];
+}
+
+/* Planar float kernels for tensors
+ *
+ * Convert a row of 8-bit pixels to 3 float planes, v * scale[c] + offset[c] for the
+ * component index[c] of each pixel, so B G R or R G B planes are written in one pass.
+ * All the versions do the same float math, so the results are exactly the same.
+ */
+typedef void (*RowPlanarFunc)(const uchar *src, int width, const int *index, const float *scale,
+                              const float *offset, float * const *planes);
+
+#if defined(QTOCV_X86_SIMD)
+
+/* v holds 4 pixels of 4 components, which are transposed to 4 vectors of
+ * one component, and the ones of index[] are stored to the planes at x.
+ */
+QTOCV_TARGET("sse2") inline void planarFour_sse2(__m128i v, const int *index, const __m128 *scale, const __m128 *offset,
+                                                 float * const *planes, int x)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128 comps[4] = {_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)),
+                       _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero))};
+    _MM_TRANSPOSE4_PS(comps[0], comps[1], comps[2], comps[3]);
+    for (int c=0; c<3; ++c)
+        _mm_storeu_ps(planes[c] + x, _mm_add_ps(_mm_mul_ps(comps[index[c]], scale[c]), offset[c]));
+}
+
+template<int srcChannels>
+QTOCV_TARGET("sse2") void planarRow_sse2(const uchar *src, int width, const int *index, const float *scale,
+                                         const float *offset, float * const *planes)
+{
+    Q_ASSERT(srcChannels == 4);
+    const __m128 scales[3] = {_mm_set1_ps(scale[0]), _mm_set1_ps(scale[1]), _mm_set1_ps(scale[2])};
+    const __m128 offsets[3] = {_mm_set1_ps(offset[0]), _mm_set1_ps(offset[1]), _mm_set1_ps(offset[2])};
+    int x = 0;
+    for (; x+4<=width; x+=4)
+        planarFour_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*4)), index, scales, offsets, planes, x);
+
+    float * const tails[3] = {planes[0] + x, planes[1] + x, planes[2] + x};
+    planarRow_<srcChannels>(src + x*4, width - x, index, scale, offset, tails);
+}
+
+//Expand 3 channels pixels to 4 channels with pshufb, then same as SSE2 version
+template<int srcChannels>
+QTOCV_TARGET("ssse3") void planarRow_ssse3(const uchar *src, int width, const int *index, const float *scale,
+                                           const float *offset, float * const *planes)
+{
+    if (srcChannels == 4)
+        return planarRow_sse2<srcChannels>(src, width, index, scale, offset, planes);
+
+    const __m128 scales[3] = {_mm_set1_ps(scale[0]), _mm_set1_ps(scale[1]), _mm_set1_ps(scale[2])};
+    const __m128 offsets[3] = {_mm_set1_ps(offset[0]), _mm_set1_ps(offset[1]), _mm_set1_ps(offset[2])};
+    const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    int x = 0;
+    //Each load reads 16 bytes for 4 pixels(12 bytes)
+    for (; x+6<=width; x+=4) {
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x*3)), expand);
+        planarFour_sse2(v, index, scales, offsets, planes, x);
+    }
+
+    float * const tails[3] = {planes[0] + x, planes[1] + x, planes[2] + x};
+    planarRow_<srcChannels>(src + x*3, width - x, index, scale, offset, tails);
+}
+
+#elif defined(QTOCV_NEON_SIMD)
+
+inline void planarStore_neon(uint8x8_t v, float scale, float offset, float *dst)
+{
+    const uint16x8_t v16 = vmovl_u8(v);
+    const float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v16)));
+    const float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(v16)));
+    const float32x4_t s = vdupq_n_f32(scale);
+    const float32x4_t o = vdupq_n_f32(offset);
+    vst1q_f32(dst, vaddq_f32(vmulq_f32(lo, s), o));
+    vst1q_f32(dst + 4, vaddq_f32(vmulq_f32(hi, s), o));
+}
+
+template<int srcChannels>
+void planarRow_neon(const uchar *src, int width, const int *index, const float *scale, const float *offset, float * const *planes)
+{
+    int x = 0;
+    for (; x+8<=width; x+=8) {
+        uint8x8_t comps[4];
+        if (srcChannels == 3) {
+            const uint8x8x3_t v = vld3_u8(src + x*3);
+            comps[0] = v.val[0]; comps[1] = v.val[1]; comps[2] = v.val[2]; comps[3] = v.val[2];
+        } else {
+            const uint8x8x4_t v = vld4_u8(src + x*4);
+            comps[0] = v.val[0]; comps[1] = v.val[1]; comps[2] = v.val[2]; comps[3] = v.val[3];
+        }
+        for (int c=0; c<3; ++c)
+            planarStore_neon(comps[index[c]], scale[c], offset[c], planes[c] + x);
+    }
+
+    float * const tails[3] = {planes[0] + x, planes[1] + x, planes[2] + x};
+    planarRow_<srcChannels>(src + x*srcChannels, width - x, index, scale, offset, tails);
+}
+
+#endif
+
+RowPlanarFunc rowPlanarFunc(int srcChannels)
+{
+    Q_ASSERT(srcChannels == 3 || srcChannels == 4);
+
+    static const RowPlanarFunc scalarFuncs[2] = {planarRow_<3>, planarRow_<4>};
+    const RowPlanarFunc *funcs = scalarFuncs;
+#if defined(QTOCV_X86_SIMD)
+    static const RowPlanarFunc sse2Funcs[2] = {planarRow_<3>, planarRow_sse2<4>};
+    static const RowPlanarFunc ssse3Funcs[2] = {planarRow_ssse3<3>, planarRow_ssse3<4>};
+    if (cv::checkHardwareSupport(CV_CPU_SSSE3))
+        funcs = ssse3Funcs;
+    else if (cv::checkHardwareSupport(CV_CPU_SSE2))
+        funcs = sse2Funcs;
+#elif defined(QTOCV_NEON_SIMD)
+    static const RowPlanarFunc neonFuncs[2] = {planarRow_neon<3>, planarRow_neon<4>};
+    if (cv::useOptimized())
+        funcs = neonFuncs;
+#endif
+    return funcs[srcChannels - 3];
+}
+
+/* YUV kernels for 8-bit data
+ *
+ * Convert a row of BT.601 limited range YUV, whose chroma is shared by each 2 pixels, to
+ * 4 channels pixels of alpha 255, with R at redIndex. Chroma samples are uvStep bytes apart,
+ * 1 for planar rows and 2 for interleaved ones, where u and v are next to each other.
+ * The 13-bit fixed point math fits _mm_madd_epi16() and vmull_s16(), so all the versions
+ * give the same results.
+ */
+typedef void (*RowYuvFunc)(const uchar *y, const uchar *u, const uchar *v, int uvStep, uchar *dst, int width);
+
+#if defined(QTOCV_X86_SIMD)
+
+//(a[i] * ca + b[i] * cb + round) >> YuvShift of 8 pixels, saturated to int16
+QTOCV_TARGET("sse2") inline __m128i yuvTerm_sse2(__m128i a, __m128i b, int ca, int cb, __m128i extra0, __m128i extra1)
+{
+    const __m128i coeffs = _mm_set1_epi32(int((unsigned(cb) << 16) | (unsigned(ca) & 0xffffu)));
+    const __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), coeffs), extra0);
+    const __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), coeffs), extra1);
+    return _mm_packs_epi32(_mm_srai_epi32(lo, YuvShift), _mm_srai_epi32(hi, YuvShift));
+}
+
+//R, G and B of 8 pixels, from y - 16 and the chroma upsampled to each pixel
+QTOCV_TARGET("sse2") inline void yuvPixels_sse2(__m128i yw, __m128i uw, __m128i vw, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (YuvShift - 1));
+    //CVG * v + round is added to the G terms
+    const __m128i vgCoeffs = _mm_set1_epi32(YuvCVG & 0xffff);
+    const __m128i vgLo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(vw, zero), vgCoeffs), round);
+    const __m128i vgHi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(vw, zero), vgCoeffs), round);
+    r = yuvTerm_sse2(yw, vw, YuvCY, YuvCVR, round, round);
+    g = yuvTerm_sse2(yw, uw, YuvCY, YuvCUG, vgLo, vgHi);
+    b = yuvTerm_sse2(yw, uw, YuvCY, YuvCUB, round, round);
+}
+
+template<int redIndex>
+QTOCV_TARGET("sse2") void yuvRow_sse2(const uchar *y, const uchar *u, const uchar *v, int uvStep, uchar *dst, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i luma16 = _mm_set1_epi16(16);
+    const __m128i chroma128 = _mm_set1_epi16(128);
+    const __m128i byteMask = _mm_set1_epi16(0x00ff);
+    const __m128i alpha = _mm_set1_epi8(char(0xff));
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        //8 chroma samples of each, for 16 pixels
+        __m128i u8, v8;
+        if (uvStep == 1) {
+            u8 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + x/2)), zero);
+            v8 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + x/2)), zero);
+        } else {
+            const bool uFirst = u < v;
+            const __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>((uFirst ? u : v) + x));
+            const __m128i even = _mm_and_si128(uv, byteMask);
+            const __m128i odd = _mm_srli_epi16(uv, 8);
+            u8 = uFirst ? even : odd;
+            v8 = uFirst ? odd : even;
+        }
+        u8 = _mm_sub_epi16(u8, chroma128);
+        v8 = _mm_sub_epi16(v8, chroma128);
+
+        const __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        __m128i rgb[2][3];
+        for (int h=0; h<2; ++h) {
+            const __m128i yw = _mm_subs_epu16(h ? _mm_unpackhi_epi8(yv, zero) : _mm_unpacklo_epi8(yv, zero), luma16);
+            const __m128i uw = h ? _mm_unpackhi_epi16(u8, u8) : _mm_unpacklo_epi16(u8, u8);
+            const __m128i vw = h ? _mm_unpackhi_epi16(v8, v8) : _mm_unpacklo_epi16(v8, v8);
+            yuvPixels_sse2(yw, uw, vw, rgb[h][0], rgb[h][1], rgb[h][2]);
+        }
+        const __m128i r = _mm_packus_epi16(rgb[0][0], rgb[1][0]);
+        const __m128i g = _mm_packus_epi16(rgb[0][1], rgb[1][1]);
+        const __m128i b = _mm_packus_epi16(rgb[0][2], rgb[1][2]);
+        const __m128i c0 = redIndex == 0 ? r : b;
+        const __m128i c2 = redIndex == 0 ? b : r;
+
+        const __m128i c01Lo = _mm_unpacklo_epi8(c0, g);
+        const __m128i c01Hi = _mm_unpackhi_epi8(c0, g);
+        const __m128i c23Lo = _mm_unpacklo_epi8(c2, alpha);
+        const __m128i c23Hi = _mm_unpackhi_epi8(c2, alpha);
+        __m128i *out = reinterpret_cast<__m128i*>(dst + x*4);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(c01Lo, c23Lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(c01Lo, c23Lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(c01Hi, c23Hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(c01Hi, c23Hi));
+    }
+    yuvRow_<redIndex>(y + x, u + (x/2)*uvStep, v + (x/2)*uvStep, uvStep, dst + x*4, width - x);
+}
+
+#elif defined(QTOCV_NEON_SIMD)
+
+//(y * CY + c * coeff) >> YuvShift rounded and saturated, for 8 pixels
+inline int16x8_t yuvTerm_neon(int16x8_t yw, int16x8_t cw, int16_t coeff)
+{
+    const int32x4_t lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(yw), YuvCY), vget_low_s16(cw), coeff);
+    const int32x4_t hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(yw), YuvCY), vget_high_s16(cw), coeff);
+    return vcombine_s16(vqrshrn_n_s32(lo, YuvShift), vqrshrn_n_s32(hi, YuvShift));
+}
+
+inline int16x8_t yuvGreen_neon(int16x8_t yw, int16x8_t uw, int16x8_t vw)
+{
+    int32x4_t lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(yw), YuvCY), vget_low_s16(uw), YuvCUG);
+    int32x4_t hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(yw), YuvCY), vget_high_s16(uw), YuvCUG);
+    lo = vmlal_n_s16(lo, vget_low_s16(vw), YuvCVG);
+    hi = vmlal_n_s16(hi, vget_high_s16(vw), YuvCVG);
+    return vcombine_s16(vqrshrn_n_s32(lo, YuvShift), vqrshrn_n_s32(hi, YuvShift));
+}
+
+template<int redIndex>
+void yuvRow_neon(const uchar *y, const uchar *u, const uchar *v, int uvStep, uchar *dst, int width)
+{
+    const uint16x8_t luma16 = vdupq_n_u16(16);
+    const int16x8_t chroma128 = vdupq_n_s16(128);
+    int x = 0;
+    for (; x+16<=width; x+=16) {
+        uint8x8_t u8, v8;
+        if (uvStep == 1) {
+            u8 = vld1_u8(u + x/2);
+            v8 = vld1_u8(v + x/2);
+        } else {
+            const bool uFirst = u < v;
+            const uint8x8x2_t uv = vld2_u8((uFirst ? u : v) + x);
+            u8 = uFirst ? uv.val[0] : uv.val[1];
+            v8 = uFirst ? uv.val[1] : uv.val[0];
+        }
+        const uint8x8x2_t uz = vzip_u8(u8, u8);
+        const uint8x8x2_t vz = vzip_u8(v8, v8);
+        const uint8x16_t yv = vld1q_u8(y + x);
+
+        for (int h=0; h<2; ++h) {
+            const int16x8_t yw = vreinterpretq_s16_u16(vqsubq_u16(vmovl_u8(h ? vget_high_u8(yv) : vget_low_u8(yv)), luma16));
+            const int16x8_t uw = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uz.val[h])), chroma128);
+            const int16x8_t vw = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vz.val[h])), chroma128);
+            uint8x8x4_t pixels;
+            pixels.val[redIndex] = vqmovun_s16(yuvTerm_neon(yw, vw, YuvCVR));
+            pixels.val[1] = vqmovun_s16(yuvGreen_neon(yw, uw, vw));
+            pixels.val[2 - redIndex] = vqmovun_s16(yuvTerm_neon(yw, uw, YuvCUB));
+            pixels.val[3] = vdup_n_u8(255);
+            vst4_u8(dst + (x + h*8)*4, pixels);
+        }
+    }
+    yuvRow_<redIndex>(y + x, u + (x/2)*uvStep, v + (x/2)*uvStep, uvStep, dst + x*4, width - x);
+}
+
+#endif
+
+RowYuvFunc rowYuvFunc(int redIndex)
+{
+    Q_ASSERT(redIndex == 0 || redIndex == 2);
+
+    static const RowYuvFunc scalarFuncs[2] = {yuvRow_<0>, yuvRow_<2>};
+    const RowYuvFunc *funcs = scalarFuncs;
+#if defined(QTOCV_X86_SIMD)
+    static const RowYuvFunc sse2Funcs[2] = {yuvRow_sse2<0>, yuvRow_sse2<2>};
+    if (cv::checkHardwareSupport(CV_CPU_SSE2))
+        funcs = sse2Funcs;
+#elif defined(QTOCV_NEON_SIMD)
+    static const RowYuvFunc neonFuncs[2] = {yuvRow_neon<0>, yuvRow_neon<2>};
+    if (cv::useOptimized())
+        funcs = neonFuncs;
+#endif
+    return funcs[redIndex / 2];
+}
+
+/* Memory layout of the QImage formats which are supported natively
+ *
+ * - red, green, blue and alpha are the index of the components in one pixel,
+ *   the size of which is 1 byte, or 2 bytes when depth16 is set.
+ * - channels is 1 for gray formats(Indexed8 is treated as gray too), 0 for unsupported formats.
+ * - Premultiplied formats have the same layout as the straight ones, see straightFormat().
+ */
+struct PixelLayout
+{
+    int channels;
+    int red;
+    int green;
+    int blue;
+    int alpha;      //-1 means no alpha
+    bool opaque;    //alpha always be the max value
+    bool depth16;
+    bool premultiplied;
+};
+
+PixelLayout makeLayout(int channels, int red, int green, int blue, int alpha, bool opaque = false, bool depth16 = false,
+                       bool premultiplied = false)
+{
+    PixelLayout layout = {channels, red, green, blue, alpha, opaque, depth16, premultiplied};
+    return layout;
+}
+
+PixelLayout pixelLayout(QImage::Format format)
+{
+    const bool littleEndian = QSysInfo::ByteOrder == QSysInfo::LittleEndian;
+
+    switch (format) {
+    case QImage::Format_Indexed8:
+#if QT_VERSION >= 0x050500
+    case QImage::Format_Grayscale8:
+#endif
+        return makeLayout(1, 0, 0, 0, -1);
+#if QT_VERSION >= 0x050D00
+    case QImage::Format_Grayscale16:
+        return makeLayout(1, 0, 0, 0, -1, false, true);
+#endif
+    case QImage::Format_RGB888:
+        return makeLayout(3, 0, 1, 2, -1);
+#if QT_VERSION >= 0x050E00
+    case QImage::Format_BGR888:
+        return makeLayout(3, 2, 1, 0, -1);
+#endif
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        //QRgb is stored as B G R A in little endian system, and A R G B in big endian system
+        if (littleEndian)
+            return makeLayout(4, 2, 1, 0, 3, format == QImage::Format_RGB32, false, format == QImage::Format_ARGB32_Premultiplied);
+        return makeLayout(4, 1, 2, 3, 0, format == QImage::Format_RGB32, false, format == QImage::Format_ARGB32_Premultiplied);
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+        return makeLayout(4, 0, 1, 2, 3, format == QImage::Format_RGBX8888, false, format == QImage::Format_RGBA8888_Premultiplied);
+#endif
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+        return makeLayout(4, 0, 1, 2, 3, format == QImage::Format_RGBX64, true, format == QImage::Format_RGBA64_Premultiplied);
+#endif
+    default:
+        return makeLayout(0, 0, 0, 0, -1);
+    }
+}
+
+//Format of the same layout whose color components aren't multiplied by alpha
+QImage::Format straightFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_ARGB32_Premultiplied:
+        return QImage::Format_ARGB32;
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBA8888_Premultiplied:
+        return QImage::Format_RGBA8888;
+#endif
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBA64_Premultiplied:
+        return QImage::Format_RGBA64;
+#endif
+    default:
+        return format;
+    }
+}
+
+//Premultiply or unpremultiply one pixel of 8-bit or 16-bit components
+template<typename T>
+void premultiplyPixel_(const T *src, T *dst, const PixelLayout &layout)
+{
+    const uint a = src[layout.alpha];
+    const bool depth16 = sizeof(T) == 2;
+    dst[layout.red] = T(depth16 ? premultiply16(src[layout.red], a) : premultiply8(src[layout.red], a));
+    dst[layout.green] = T(depth16 ? premultiply16(src[layout.green], a) : premultiply8(src[layout.green], a));
+    dst[layout.blue] = T(depth16 ? premultiply16(src[layout.blue], a) : premultiply8(src[layout.blue], a));
+    dst[layout.alpha] = T(a);
+}
+
+template<typename T>
+void unpremultiplyPixel_(const T *src, T *dst, const PixelLayout &layout)
+{
+    const uint a = src[layout.alpha];
+    const bool depth16 = sizeof(T) == 2;
+    dst[layout.red] = T(depth16 ? unpremultiply16(src[layout.red], a) : unpremultiply8(src[layout.red], a));
+    dst[layout.green] = T(depth16 ? unpremultiply16(src[layout.green], a) : unpremultiply8(src[layout.green], a));
+    dst[layout.blue] = T(depth16 ? unpremultiply16(src[layout.blue], a) : unpremultiply8(src[layout.blue], a));
+    dst[layout.alpha] = T(a);
+}
+
+//Premultiply rows of a 4 channels layout in place, which have been written as the straight format
+void premultiplyRows(uchar *data, int step, int rows, int width, const PixelLayout &layout)
+{
+    const RowSwizzleFunc premultiply = !layout.depth16 && layout.alpha == 3 ? rowPremultiplyFunc(false) : 0;
+    for (int i=0; i<rows; ++i) {
+        uchar * row = data + i*step;
+        if (premultiply) {
+            premultiply(row, row, width);
+        } else if (layout.depth16) {
+            quint16 * p = reinterpret_cast<quint16*>(row);
+            for (int j=0; j<width; ++j, p+=4)
+                premultiplyPixel_(p, p, layout);
+        } else {
+            for (int j=0; j<width; ++j, row+=4)
+                premultiplyPixel_(row, row, layout);
+        }
+    }
+}
+
+//Unpremultiply rows of a 4 channels layout to dst, which is read as the straight format then
+void unpremultiplyRows(const uchar *src, int srcStep, uchar *dst, int dstStep, int rows, int width, const PixelLayout &layout)
+{
+    for (int i=0; i<rows; ++i) {
+        if (layout.depth16) {
+            const quint16 * s = reinterpret_cast<const quint16*>(src + i*srcStep);
+            quint16 * d = reinterpret_cast<quint16*>(dst + i*dstStep);
+            for (int j=0; j<width; ++j, s+=4, d+=4)
+                unpremultiplyPixel_(s, d, layout);
+        } else {
+            const uchar * s = src + i*srcStep;
+            uchar * d = dst + i*dstStep;
+            for (int j=0; j<width; ++j, s+=4, d+=4)
+                unpremultiplyPixel_(s, d, layout);
+        }
+    }
+}
+
+//Gray, or R G B (A) / B G R (A) layouts, which are the same as the ones of cv::Mat
+bool isCvColorLayout(const PixelLayout &layout)
+{
+    return layout.channels == 1 || (layout.channels >= 3 && layout.green == 1 && (layout.red == 0 || layout.red == 2)
+                                    && (layout.channels == 3 || layout.alpha == 3));
+}
+
+//8-bit layouts whose red and blue can be exchanged by the swizzle kernels
+bool isSwizzleLayout(const PixelLayout &layout)
+{
+    return !layout.depth16 && layout.channels >= 3 && isCvColorLayout(layout);
+}
+
+/* Mapping from the values of cv::Mat to the 8-bit values of QImage
+ *
+ * - v * scale + offset, or log(1 + v + offset) * scale when log is true.
+ * - Values of 16-bit QImages are mapped to the 8-bit range and then multiplied by 257.
+ */
+struct ValueMapping
+{
+    double scale;
+    double offset;
+    bool log;
+};
+
+ValueMapping makeMapping(double scale, double offset = 0., bool log = false)
+{
+    ValueMapping mapping = {scale, offset, log};
+    return mapping;
+}
+
+/* Component converters
+ */
+template<typename T>
+struct ScaleTo
+{
+    explicit ScaleTo(double scaleFactor, double offsetValue = 0.) : scale(scaleFactor), offset(offsetValue) {}
+    template<typename S>
+    T operator()(S v) const { return cv::saturate_cast<T>(v * scale + offset); }
+    double scale;
+    double offset;
+};
+
+template<typename T>
+struct LogScaleTo
+{
+    LogScaleTo(double scaleFactor, double offsetValue) : scale(scaleFactor), offset(offsetValue) {}
+    template<typename S>
+    T operator()(S v) const { return cv::saturate_cast<T>(std::log(1. + (v + offset)) * scale); }
+    double scale;
+    double offset;
+};
+
+//For the default scale factor 255/65535, v*255/65535 equals to v/257, and
+//((v+128) * 0xff01) >> 24 rounds it exactly the same as the double version does.
+struct Div257To8u
+{
+    uchar operator()(quint16 v) const { return uchar(((v + 128u) * 0xff01u) >> 24); }
+};
+
+struct Mul257To16u
+{
+    quint16 operator()(uchar v) const { return quint16(v * 257); }
+};
+
+struct NoScale
+{
+    template<typename S>
+    S operator()(S v) const { return v; }
+};
+
+//All the components of 8-bit source can be converted by a lookup table
+template<typename T>
+struct LutFrom8u
+{
+    explicit LutFrom8u(const T *table) : lut(table) {}
+    T operator()(uchar v) const { return lut[v]; }
+    const T *lut;
+};
+
+/* Generic per-pixel conversion from cv::Mat(T) to QImage(U)
+ */
+template<typename T, typename U, typename Conv>
+void mat2ImageWith_(const cv::Mat & mat, uchar *outData, int outStep, const PixelLayout &layout, QtOcv::MatChannelOrder matRgbOrder, const Conv &conv)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+    Q_ASSERT(layout.channels != 0);
+
+    const int mat_channels = mat.channels();
+    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
+    const int mat_blue = 2 - mat_red;
+    const U maxValue = std::numeric_limits<U>::max();
+
+    for (int i=0; i<mat.rows; ++i) {
+        const T * src = mat.ptr<T>(i);
+        U * dst = reinterpret_cast<U*>(outData + i*outStep);
+        for (int j=0; j<mat.cols; ++j, src+=mat_channels, dst+=layout.channels) {
+            if (mat_channels == 1) {
+                const U val = conv(src[0]);
+                if (layout.channels == 1) {
+                    dst[0] = val;
+                    continue;
+                }
+                dst[layout.red] = val;
+                dst[layout.green] = val;
+                dst[layout.blue] = val;
+            } else {
+                const U r = conv(src[mat_red]);
+                const U g = conv(src[1]);
+                const U b = conv(src[mat_blue]);
+                if (layout.channels == 1) {
+                    dst[0] = U(grayPixel(r, g, b));
+                    continue;
+                }
+                dst[layout.red] = r;
+                dst[layout.green] = g;
+                dst[layout.blue] = b;
+            }
+            if (layout.alpha >= 0)
+                dst[layout.alpha] = (mat_channels == 4 && !layout.opaque) ? conv(src[3]) : maxValue;
+        }
+    }
+}
+
+/* Linear mapping by cv::Mat::convertTo(), which is vectorized by OpenCV
+ *
+ * - Only used when the QImage has the same channels and channel order as mat, so that
+ *   its scanlines can be written as a cv::Mat directly. Return false otherwise.
+ */
+bool convertibleLayout(int matChannels, const PixelLayout &layout, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+{
+    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
+    return !mapping.log && layout.channels == matChannels && !layout.opaque && isCvColorLayout(layout)
+            && (layout.channels == 1 || layout.red == mat_red);
+}
+
+bool convertTo_(const cv::Mat & mat, uchar *outData, int outStep, const PixelLayout &layout, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+{
+    if (!convertibleLayout(mat.channels(), layout, matRgbOrder, mapping))
+        return false;
+
+    const double range = layout.depth16 ? 257. : 1.;
+    cv::Mat dst(mat.rows, mat.cols, CV_MAKETYPE(layout.depth16 ? CV_16U : CV_8U, layout.channels), outData, outStep);
+    mat.convertTo(dst, dst.type(), mapping.scale * range, mapping.offset * range);
+    return true;
+}
+
+//Any mapping from any depth
+template<typename T>
+void mat2ImageMapped_(const cv::Mat & mat, uchar *outData, int outStep, const PixelLayout &layout, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+{
+    if (mapping.log && layout.depth16)
+        mat2ImageWith_<T, quint16>(mat, outData, outStep, layout, matRgbOrder, LogScaleTo<quint16>(mapping.scale * 257., mapping.offset));
+    else if (mapping.log)
+        mat2ImageWith_<T, uchar>(mat, outData, outStep, layout, matRgbOrder, LogScaleTo<uchar>(mapping.scale, mapping.offset));
+    else if (convertTo_(mat, outData, outStep, layout, matRgbOrder, mapping))
+        return;
+    else if (layout.depth16)
+        mat2ImageWith_<T, quint16>(mat, outData, outStep, layout, matRgbOrder, ScaleTo<quint16>(mapping.scale * 257., mapping.offset * 257.));
+    else
+        mat2ImageWith_<T, uchar>(mat, outData, outStep, layout, matRgbOrder, ScaleTo<uchar>(mapping.scale, mapping.offset));
+}
+
+typedef void (*Mat2ImageFunc)(const cv::Mat &, uchar *, int, QImage::Format, QtOcv::MatChannelOrder, const ValueMapping &);
+typedef void (*Image2MatFunc)(const uchar *, int, QImage::Format, cv::Mat &, QtOcv::MatChannelOrder, double);
+
+/* Compile-time layouts of the 8-bit formats, the same as the ones of pixelLayout()
+ */
+template<int Channels, int Red, int Green, int Blue, int Alpha, bool Opaque>
+struct StaticLayout
+{
+    enum {
+        channels = Channels,
+        red = Red,
+        green = Green,
+        blue = Blue,
+        alpha = Alpha,
+        opaque = Opaque,
+        //Same as isSwizzleLayout()
+        swizzle = Channels >= 3 && Green == 1 && (Red == 0 || Red == 2) && (Channels == 3 || Alpha == 3)
+    };
+};
+
+template<QImage::Format Format>
+struct FormatLayout;
+
+template<> struct FormatLayout<QImage::Format_Indexed8> : StaticLayout<1, 0, 0, 0, -1, false> {};
+template<> struct FormatLayout<QImage::Format_RGB888> : StaticLayout<3, 0, 1, 2, -1, false> {};
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+template<> struct FormatLayout<QImage::Format_RGB32> : StaticLayout<4, 2, 1, 0, 3, true> {};
+template<> struct FormatLayout<QImage::Format_ARGB32> : StaticLayout<4, 2, 1, 0, 3, false> {};
+#else
+template<> struct FormatLayout<QImage::Format_RGB32> : StaticLayout<4, 1, 2, 3, 0, true> {};
+template<> struct FormatLayout<QImage::Format_ARGB32> : StaticLayout<4, 1, 2, 3, 0, false> {};
+#endif
+#if QT_VERSION >= 0x050200
+template<> struct FormatLayout<QImage::Format_RGBX8888> : StaticLayout<4, 0, 1, 2, 3, true> {};
+template<> struct FormatLayout<QImage::Format_RGBA8888> : StaticLayout<4, 0, 1, 2, 3, false> {};
+#endif
+#if QT_VERSION >= 0x050500
+template<> struct FormatLayout<QImage::Format_Grayscale8> : StaticLayout<1, 0, 0, 0, -1, false> {};
+#endif
+#if QT_VERSION >= 0x050E00
+template<> struct FormatLayout<QImage::Format_BGR888> : StaticLayout<3, 2, 1, 0, -1, false> {};
+#endif
+
+/* Per-pixel conversion between 8-bit data whose layouts are known at compile time
+ *
+ * - All the conditions are constants, so each instantiation is a loop without branch,
+ *   which can be vectorized by compiler.
+ * - Same signatures as mat2Image_() and image2Mat_(), the other parameters are not used.
+ */
+template<int MatChannels, int MatRed, typename L>
+void mat2ImageStatic_(const cv::Mat & mat, uchar *outData, int outStep, QImage::Format, QtOcv::MatChannelOrder, const ValueMapping &)
+{
+    const int MatBlue = 2 - MatRed;
+
+    for (int i=0; i<mat.rows; ++i) {
+        const uchar * src = mat.ptr(i);
+        uchar * dst = outData + i*outStep;
+        for (int j=0; j<mat.cols; ++j, src+=MatChannels, dst+=L::channels) {
+            if (MatChannels == 1 && L::channels == 1) {
+                dst[0] = src[0];
+            } else if (MatChannels == 1) {
+                dst[L::red] = src[0];
+                dst[L::green] = src[0];
+                dst[L::blue] = src[0];
+            } else if (L::channels == 1) {
+                dst[0] = uchar(grayPixel(src[MatRed], src[1], src[MatBlue]));
+            } else {
+                dst[L::red] = src[MatRed];
+                dst[L::green] = src[1];
+                dst[L::blue] = src[MatBlue];
+            }
+            if (L::alpha >= 0)
+                dst[L::alpha] = (MatChannels == 4 && !L::opaque) ? src[3] : 255;
+        }
+    }
+}
+
+template<typename L, int MatChannels, int MatRed>
+void image2MatStatic_(const uchar *imageData, int imageStep, QImage::Format, cv::Mat &mat, QtOcv::MatChannelOrder, double)
+{
+    const int MatBlue = 2 - MatRed;
+
+    for (int i=0; i<mat.rows; ++i) {
+        const uchar * src = imageData + i*imageStep;
+        uchar * dst = mat.ptr(i);
+        for (int j=0; j<mat.cols; ++j, src+=L::channels, dst+=MatChannels) {
+            if (L::channels == 1) {
+                dst[0] = src[0];
+                if (MatChannels == 1)
+                    continue;
+                dst[1] = src[0];
+                dst[2] = src[0];
+            } else if (MatChannels == 1) {
+                dst[0] = uchar(grayPixel(src[L::red], src[L::green], src[L::blue]));
+                continue;
+            } else {
+                dst[MatRed] = src[L::red];
+                dst[1] = src[L::green];
+                dst[MatBlue] = src[L::blue];
+            }
+            if (MatChannels == 4)
+                dst[3] = L::alpha >= 0 ? src[L::alpha] : 255;
+        }
+    }
+}
+
+/* Same kernels as mat2Image_<uchar>() and image2Mat_<uchar>() select at runtime:
+ * the SIMD swizzle and gray ones when applicable, the static ones otherwise.
+ */
+template<int MatChannels, int MatRed, typename L>
+void mat2ImageBest_(const cv::Mat & mat, uchar *outData, int outStep, QImage::Format format, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+{
+    if (MatChannels != 1 && L::swizzle) {
+        const RowSwizzleFunc swizzle = rowSwizzleFunc(MatChannels, L::channels, L::red != MatRed, L::opaque);
+        for (int i=0; i<mat.rows; ++i)
+            swizzle(mat.ptr(i), outData + i*outStep, mat.cols);
+    } else if (MatChannels != 1 && L::channels == 1) {
+        const RowGrayFunc toGray = rowGrayFunc(MatChannels, MatRed);
+        for (int i=0; i<mat.rows; ++i)
+            toGray(mat.ptr(i), outData + i*outStep, mat.cols);
+    } else {
+        mat2ImageStatic_<MatChannels, MatRed, L>(mat, outData, outStep, format, matRgbOrder, mapping);
+    }
+}
+
+template<typename L, int MatChannels, int MatRed>
+void image2MatBest_(const uchar *imageData, int imageStep, QImage::Format format, cv::Mat &mat, QtOcv::MatChannelOrder matRgbOrder, double scaleFactor)
+{
+    if (MatChannels != 1 && L::swizzle) {
+        const RowSwizzleFunc swizzle = rowSwizzleFunc(L::channels, MatChannels, L::red != MatRed);
+        for (int i=0; i<mat.rows; ++i)
+            swizzle(imageData + i*imageStep, mat.ptr(i), mat.cols);
+    } else if (MatChannels == 1 && L::swizzle) {
+        const RowGrayFunc toGray = rowGrayFunc(L::channels, L::red);
+        for (int i=0; i<mat.rows; ++i)
+            toGray(imageData + i*imageStep, mat.ptr(i), mat.cols);
+    } else {
+        image2MatStatic_<L, MatChannels, MatRed>(imageData, imageStep, format, mat, matRgbOrder, scaleFactor);
+    }
+}
+
+/* Dispatch tables of the static kernels, for the layouts which the runtime paths have no SIMD kernel
+ *
+ * - Return null if format isn't an 8-bit one.
+ */
+template<typename L>
+Mat2ImageFunc staticMat2ImageFunc_(int matChannels, int matRed)
+{
+    static const Mat2ImageFunc funcs[3][2] = {
+        {mat2ImageStatic_<1, 0, L>, mat2ImageStatic_<1, 2, L>},
+        {mat2ImageStatic_<3, 0, L>, mat2ImageStatic_<3, 2, L>},
+        {mat2ImageStatic_<4, 0, L>, mat2ImageStatic_<4, 2, L>}
+    };
+    return funcs[matChannels == 1 ? 0 : matChannels - 2][matRed ? 1 : 0];
+}
+
+template<typename L>
+Image2MatFunc staticImage2MatFunc_(int matChannels, int matRed)
+{
+    static const Image2MatFunc funcs[3][2] = {
+        {image2MatStatic_<L, 1, 0>, image2MatStatic_<L, 1, 2>},
+        {image2MatStatic_<L, 3, 0>, image2MatStatic_<L, 3, 2>},
+        {image2MatStatic_<L, 4, 0>, image2MatStatic_<L, 4, 2>}
+    };
+    return funcs[matChannels == 1 ? 0 : matChannels - 2][matRed ? 1 : 0];
+}
+
+Mat2ImageFunc staticMat2ImageFunc(int matChannels, int matRed, QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_Indexed8:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_Indexed8> >(matChannels, matRed);
+    case QImage::Format_RGB888:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_RGB888> >(matChannels, matRed);
+    case QImage::Format_RGB32:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_RGB32> >(matChannels, matRed);
+    case QImage::Format_ARGB32:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_ARGB32> >(matChannels, matRed);
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBX8888:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_RGBX8888> >(matChannels, matRed);
+    case QImage::Format_RGBA8888:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_RGBA8888> >(matChannels, matRed);
+#endif
+#if QT_VERSION >= 0x050500
+    case QImage::Format_Grayscale8:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_Grayscale8> >(matChannels, matRed);
+#endif
+#if QT_VERSION >= 0x050E00
+    case QImage::Format_BGR888:
+        return staticMat2ImageFunc_<FormatLayout<QImage::Format_BGR888> >(matChannels, matRed);
+#endif
+    default:
+        return 0;
+    }
+}
+
+Image2MatFunc staticImage2MatFunc(int matChannels, int matRed, QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_Indexed8:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_Indexed8> >(matChannels, matRed);
+    case QImage::Format_RGB888:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_RGB888> >(matChannels, matRed);
+    case QImage::Format_RGB32:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_RGB32> >(matChannels, matRed);
+    case QImage::Format_ARGB32:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_ARGB32> >(matChannels, matRed);
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBX8888:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_RGBX8888> >(matChannels, matRed);
+    case QImage::Format_RGBA8888:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_RGBA8888> >(matChannels, matRed);
+#endif
+#if QT_VERSION >= 0x050500
+    case QImage::Format_Grayscale8:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_Grayscale8> >(matChannels, matRed);
+#endif
+#if QT_VERSION >= 0x050E00
+    case QImage::Format_BGR888:
+        return staticImage2MatFunc_<FormatLayout<QImage::Format_BGR888> >(matChannels, matRed);
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Convert all rows of mat to the image data which starts from outData
+ *
+ * - Only called through convertRows(), mat may be a slice of the whole cv::Mat.
+ */
+template<typename T>
+void mat2Image_(const cv::Mat & mat, uchar *outData, int outStep, QImage::Format format, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+{
+    mat2ImageMapped_<T>(mat, outData, outStep, pixelLayout(format), matRgbOrder, mapping);
+}
+
+template<>
+void mat2Image_<quint16>(const cv::Mat & mat, uchar *outData, int outStep, QImage::Format format, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+{
+    const PixelLayout layout = pixelLayout(format);
+    if (mapping.scale != 255./65535. || mapping.offset != 0. || mapping.log)
+        mat2ImageMapped_<quint16>(mat, outData, outStep, layout, matRgbOrder, mapping);
+    else if (layout.depth16)
+        mat2ImageWith_<quint16, quint16>(mat, outData, outStep, layout, matRgbOrder, NoScale());
+    else
+        mat2ImageWith_<quint16, uchar>(mat, outData, outStep, layout, matRgbOrder, Div257To8u());
+}
+
+#if 1
+template<>
+void mat2Image_<uchar>(const cv::Mat & mat, uchar *outData, int outStep, QImage::Format format, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+
+    const PixelLayout layout = pixelLayout(format);
+    const int mat_channels = mat.channels();
+    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
+
+    if (mapping.scale != 1. || mapping.offset != 0. || mapping.log) {
+        mat2ImageMapped_<uchar>(mat, outData, outStep, layout, matRgbOrder, mapping);
+    } else if (layout.depth16) {
+        mat2ImageWith_<uchar, quint16>(mat, outData, outStep, layout, matRgbOrder, Mul257To16u());
+    } else if (layout.channels == 1) {
+        const RowGrayFunc toGray = mat_channels != 1 ? rowGrayFunc(mat_channels, mat_red) : 0;
+        for (int i=0; i<mat.rows; ++i) {
+            uchar * data = outData + i*outStep;
+            if (mat_channels == 1)
+                std::memcpy(data, mat.ptr(i), mat.cols);
+            else
+                toGray(mat.ptr(i), data, mat.cols);
+        }
+    } else if (mat_channels != 1 && isSwizzleLayout(layout)) {
+        //Premultiplied formats come here only for the fused kernels, see fusedPremultiply()
+        Q_ASSERT(!layout.premultiplied || mat_channels == 4);
+        const RowSwizzleFunc swizzle = layout.premultiplied ? rowPremultiplyFunc(layout.red != mat_red)
+                                                            : rowSwizzleFunc(mat_channels, layout.channels, layout.red != mat_red, layout.opaque);
+        for (int i=0; i<mat.rows; ++i)
+            swizzle(mat.ptr(i), outData + i*outStep, mat.cols);
+    } else { //CV_8UC1 to color formats, or QImage::Format_RGB32 || QImage::Format_ARGB32 in big endian system
+        const Mat2ImageFunc func = staticMat2ImageFunc(mat_channels, mat_red, format);
+        Q_ASSERT(func);
+        func(mat, outData, outStep, format, matRgbOrder, mapping);
+    }
+}
+#endif
+
+/* Generic per-pixel conversion from QImage(S) to cv::Mat(T)
+ */
+template<typename S, typename T, typename Conv>
+void image2MatWith_(const uchar *imageData, int imageStep, const PixelLayout &layout, cv::Mat &mat, QtOcv::MatChannelOrder matRgbOrder, const Conv &conv)
+{
+    Q_ASSERT(layout.channels != 0);
+
+    const int channels = mat.channels();
+    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
+    const int mat_blue = 2 - mat_red;
+    const T maxValue = conv(std::numeric_limits<S>::max());
+
+    for (int i=0; i<mat.rows; ++i) {
+        const S * src = reinterpret_cast<const S*>(imageData + i*imageStep);
+        T * dst = mat.ptr<T>(i);
+        for (int j=0; j<mat.cols; ++j, src+=layout.channels, dst+=channels) {
+            if (layout.channels == 1) {
+                const T val = conv(src[0]);
+                dst[0] = val;
+                if (channels == 1)
+                    continue;
+                dst[1] = val;
+                dst[2] = val;
+                if (channels == 4)
+                    dst[3] = maxValue;
+            } else if (channels == 1) {
+                dst[0] = conv(S(grayPixel(src[layout.red], src[layout.green], src[layout.blue])));
+            } else {
+                dst[mat_red] = conv(src[layout.red]);
+                dst[1] = conv(src[layout.green]);
+                dst[mat_blue] = conv(src[layout.blue]);
+                if (channels == 4)
+                    dst[3] = layout.alpha >= 0 ? conv(src[layout.alpha]) : maxValue;
+            }
+        }
+    }
+}
+
+/* Convert the image data which starts from imageData to all rows of mat
+ *
+ * - Only called through convertRows(), mat may be a slice of the whole cv::Mat.
+ */
+template<typename T>
+void image2Mat_(const uchar *imageData, int imageStep, QImage::Format format, cv::Mat &mat, QtOcv::MatChannelOrder matRgbOrder, double scaleFactor)
+{
+    const PixelLayout layout = pixelLayout(format);
+    if (layout.depth16) {
+        image2MatWith_<quint16, T>(imageData, imageStep, layout, mat, matRgbOrder, ScaleTo<T>(scaleFactor / 257.));
+        return;
+    }
+
+    //All the channels of source are 8-bit, so a lookup table can avoid the floating point math
+    T lut[256];
+    for (int i=0; i<256; ++i)
+        lut[i] = cv::saturate_cast<T>(i * scaleFactor);
+
+    if (mat.channels() == 1 && isSwizzleLayout(layout)) {
+        //Same 8-bit luma as image2Mat_<uchar>(), computed in small chunks and then scaled by the lut
+        const RowGrayFunc toGray = rowGrayFunc(layout.channels, layout.red);
+        uchar gray[256];
+        for (int i=0; i<mat.rows; ++i) {
+            const uchar * data = imageData + i*imageStep;
+            T * dst = mat.ptr<T>(i);
+            for (int j=0; j<mat.cols; j+=256) {
+                const int n = qMin(256, mat.cols - j);
+                toGray(data + j*layout.channels, gray, n);
+                for (int k=0; k<n; ++k)
+                    dst[j+k] = lut[gray[k]];
+            }
+        }
+        return;
+    }
+
+    image2MatWith_<uchar, T>(imageData, imageStep, layout, mat, matRgbOrder, LutFrom8u<T>(lut));
+}
+
+#if 1
+template<>
+void image2Mat_<uchar>(const uchar *imageData, int imageStep, QImage::Format format, cv::Mat &mat, QtOcv::MatChannelOrder matRgbOrder, double scaleFactor)
+{
+    Q_ASSERT(mat.depth() == CV_8U);
+
+    const PixelLayout layout = pixelLayout(format);
+    const int channels = mat.channels();
+    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
+
+    if (layout.depth16) {
+        image2MatWith_<quint16, uchar>(imageData, imageStep, layout, mat, matRgbOrder, Div257To8u());
+    } else if (layout.channels == 1 && channels == 1) {
+        for (int i=0; i<mat.rows; ++i)
+            std::memcpy(mat.ptr(i), imageData + i*imageStep, mat.cols);
+    } else if (channels == 1 && isSwizzleLayout(layout)) {
+        const RowGrayFunc toGray = rowGrayFunc(layout.channels, layout.red);
+        for (int i=0; i<mat.rows; ++i)
+            toGray(imageData + i*imageStep, mat.ptr(i), mat.cols);
+    } else if (channels != 1 && isSwizzleLayout(layout)) {
+        const RowSwizzleFunc swizzle = rowSwizzleFunc(layout.channels, channels, layout.red != mat_red);
+        for (int i=0; i<mat.rows; ++i)
+            swizzle(imageData + i*imageStep, mat.ptr(i), mat.cols);
+    } else { //gray QImage, or QImage::Format_RGB32 || QImage::Format_ARGB32 in big endian system
+        const Image2MatFunc func = staticImage2MatFunc(channels, mat_red, format);
+        Q_ASSERT(func);
+        func(imageData, imageStep, format, mat, matRgbOrder, scaleFactor);
+    }
+}
+#endif
+
+/* Row-parallel conversion
+ *
+ * Each row is independent, so the conversion functions above can be run on
+ * slices of the cv::Mat and the corresponding scanlines of the QImage.
+ */
+QAtomicInt conversionThreadCount(1);
+
+//Loaded once by each conversion, as setConversionThreads() may be called by other threads
+int resolvedConversionThreads()
+{
+#if QT_VERSION >= 0x050000
+    const int count = conversionThreadCount.loadAcquire();
+#else
+    const int count = conversionThreadCount;
+#endif
+    return count > 0 ? count : cv::getNumThreads();
+}
+
+//Smaller images are always converted in the caller's thread, as the cost of scheduling is not worth it.
+const double parallelMinPixels = 512 * 512;
+
+//Rows converted at a time for premultiplied formats, which are still in cache when (un)premultiplied
+const int premultiplyBlockRows = 16;
+
+//mat2Image_<uchar>() premultiplies 8-bit 4 channels data in the same pass as the swizzle
+bool fusedPremultiply(Mat2ImageFunc func, const cv::Mat &mat, const PixelLayout &layout, const ValueMapping &mapping)
+{
+    return func == mat2Image_<uchar> && mat.channels() == 4 && isSwizzleLayout(layout)
+            && mapping.scale == 1. && mapping.offset == 0. && !mapping.log;
+}
+
+class Mat2ImageInvoker : public cv::ParallelLoopBody
+{
+public:
+    Mat2ImageInvoker(Mat2ImageFunc func, const cv::Mat &mat, uchar *outData, int outStep,
+                     QImage::Format format, QtOcv::MatChannelOrder matRgbOrder, const ValueMapping &mapping)
+        : m_func(func), m_mat(mat), m_outData(outData), m_outStep(outStep)
+        , m_format(format), m_layout(pixelLayout(format)), m_rgbOrder(matRgbOrder), m_mapping(mapping)
+        , m_premultiply(false)
+    {
+        //Without alpha in mat, the result is opaque and the same as the straight one
+        if (m_layout.premultiplied && !fusedPremultiply(func, mat, m_layout, mapping)) {
+            m_premultiply = mat.channels() == 4;
+            m_format = straightFormat(format);
+        }
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        const cv::Mat mat = m_mat.rowRange(range.start, range.end);
+        uchar * const outData = m_outData + range.start*m_outStep;
+        if (!m_premultiply) {
+            m_func(mat, outData, m_outStep, m_format, m_rgbOrder, m_mapping);
+            return;
+        }
+        for (int i=0; i<mat.rows; i+=premultiplyBlockRows) {
+            const int rows = qMin(premultiplyBlockRows, mat.rows - i);
+            m_func(mat.rowRange(i, i + rows), outData + i*m_outStep, m_outStep, m_format, m_rgbOrder, m_mapping);
+            premultiplyRows(outData + i*m_outStep, m_outStep, rows, mat.cols, m_layout);
+        }
+    }
+
+private:
+    Mat2ImageFunc m_func;
+    cv::Mat m_mat;
+    uchar *m_outData;
+    int m_outStep;
+    QImage::Format m_format;
+    PixelLayout m_layout;
+    QtOcv::MatChannelOrder m_rgbOrder;
+    ValueMapping m_mapping;
+    bool m_premultiply;
+};
+
+class Image2MatInvoker : public cv::ParallelLoopBody
+{
+public:
+    Image2MatInvoker(Image2MatFunc func, const uchar *imageData, int imageStep, QImage::Format format,
+                     const cv::Mat &mat, QtOcv::MatChannelOrder matRgbOrder, double scaleFactor)
+        : m_func(func), m_imageData(imageData), m_imageStep(imageStep), m_format(format)
+        , m_layout(pixelLayout(format)), m_mat(mat), m_rgbOrder(matRgbOrder), m_scaleFactor(scaleFactor)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        cv::Mat mat = m_mat.rowRange(range.start, range.end);
+        const uchar * const imageData = m_imageData + range.start*m_imageStep;
+        if (!m_layout.premultiplied) {
+            m_func(imageData, m_imageStep, m_format, mat, m_rgbOrder, m_scaleFactor);
+            return;
+        }
+
+        //Unpremultiplied to a buffer of the straight format first, a block of rows at a time
+        const QImage::Format format = straightFormat(m_format);
+        const int bufferStep = mat.cols * (m_layout.depth16 ? 8 : 4);
+        std::vector<uchar> buffer(size_t(bufferStep) * qMin(premultiplyBlockRows, mat.rows));
+        for (int i=0; i<mat.rows; i+=premultiplyBlockRows) {
+            const int rows = qMin(premultiplyBlockRows, mat.rows - i);
+            unpremultiplyRows(imageData + i*m_imageStep, m_imageStep, &buffer[0], bufferStep, rows, mat.cols, m_layout);
+            cv::Mat block = mat.rowRange(i, i + rows);
+            m_func(&buffer[0], bufferStep, format, block, m_rgbOrder, m_scaleFactor);
+        }
+    }
+
+private:
+    Image2MatFunc m_func;
+    const uchar *m_imageData;
+    int m_imageStep;
+    QImage::Format m_format;
+    PixelLayout m_layout;
+    cv::Mat m_mat;
+    QtOcv::MatChannelOrder m_rgbOrder;
+    double m_scaleFactor;
+};
+
+/* Run one row kernel over the rows, such as a swizzle resolved by a converter plan
+ *
+ * - func null means the rows are copied as they are, rowBytes each.
+ */
+class RowFuncInvoker : public cv::ParallelLoopBody
+{
+public:
+    RowFuncInvoker(RowSwizzleFunc func, const uchar *src, size_t srcStep, uchar *dst, size_t dstStep, int width, size_t rowBytes)
+        : m_func(func), m_src(src), m_srcStep(srcStep), m_dst(dst), m_dstStep(dstStep), m_width(width), m_rowBytes(rowBytes)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for (int i=range.start; i<range.end; ++i) {
+            if (m_func)
+                m_func(m_src + i*m_srcStep, m_dst + i*m_dstStep, m_width);
+            else
+                std::memcpy(m_dst + i*m_dstStep, m_src + i*m_srcStep, m_rowBytes);
+        }
+    }
+
+private:
+    RowSwizzleFunc m_func;
+    const uchar *m_src;
+    size_t m_srcStep;
+    uchar *m_dst;
+    size_t m_dstStep;
+    int m_width;
+    size_t m_rowBytes;
+};
+
+void convertRows(const cv::ParallelLoopBody &body, int rows, int cols)
+{
+    const int threads = resolvedConversionThreads();
+    const int stripes = qMin(threads, rows);
+
+    if (stripes > 1 && double(rows) * cols >= parallelMinPixels)
+        cv::parallel_for_(cv::Range(0, rows), body, stripes);
+    else
+        body(cv::Range(0, rows));
+}
+
+/* Statistics and trace hook of the conversions
+ *
+ * - A ConversionProbe at each entry point records one call when it is destroyed, only if the
+ *   statistics are enabled or a hook is set, so it costs two loads otherwise.
+ * - Both can be changed while other threads are converting. Each probe loads them once, and
+ *   a call in progress keeps the ones it started with.
+ */
+QAtomicInt conversionStatsOn;
+QAtomicPointer<void> conversionTraceHook;
+
+bool loadConversionStatsOn()
+{
+#if QT_VERSION >= 0x050000
+    return conversionStatsOn.loadAcquire() != 0;
+#else
+    return int(conversionStatsOn) != 0;
+#endif
+}
+
+QtOcv::ConversionTraceHook loadConversionTraceHook()
+{
+#if QT_VERSION >= 0x050000
+    void *hook = conversionTraceHook.loadAcquire();
+#else
+    void *hook = conversionTraceHook;
+#endif
+    return reinterpret_cast<QtOcv::ConversionTraceHook>(hook);
+}
+
+struct ConversionStatsTable
+{
+    QMutex mutex;
+    //Keyed by direction, format and cv type
+    QMap<qint64, QtOcv::ConversionStats> stats;
+};
+
+Q_GLOBAL_STATIC(ConversionStatsTable, conversionStatsTable)
+
+class ConversionProbe
+{
+public:
+    ConversionProbe(QtOcv::ConversionDirection direction, QImage::Format format)
+        : m_statsOn(loadConversionStatsOn()), m_hook(loadConversionTraceHook()), m_active(m_statsOn || m_hook)
+    {
+        if (!m_active)
+            return;
+        m_stats.direction = direction;
+        m_stats.format = format;
+        m_stats.calls = 1;
+        m_timer.start();
+    }
+
+    ~ConversionProbe()
+    {
+        if (!m_active)
+            return;
+        m_stats.nsecs = m_timer.nsecsElapsed();
+        if (m_hook)
+            m_hook(m_stats);
+        if (!m_statsOn)
+            return;
+
+        ConversionStatsTable *table = conversionStatsTable();
+        const qint64 key = (qint64(m_stats.direction) << 48) | (qint64(m_stats.format) << 24) | m_stats.matType;
+        QMutexLocker locker(&table->mutex);
+        QtOcv::ConversionStats &stats = table->stats[key];
+        if (!stats.calls) {
+            stats.direction = m_stats.direction;
+            stats.format = m_stats.format;
+            stats.matType = m_stats.matType;
+        }
+        stats.calls += 1;
+        stats.bytes += m_stats.bytes;
+        stats.nsecs += m_stats.nsecs;
+        stats.slowPathCalls += m_stats.slowPathCalls;
+        stats.extraCopyCalls += m_stats.extraCopyCalls;
+    }
+
+    bool isActive() const { return m_active; }
+
+    //bytes of the cv::Mat, which is the source or the result
+    void setMat(const cv::Mat &mat)
+    {
+        setMat(mat, qint64(mat.total()));
+    }
+    //bytes of the pixels of mat which are converted, such as its dirty areas
+    void setMat(const cv::Mat &mat, qint64 pixels)
+    {
+        m_stats.matType = mat.type();
+        m_stats.bytes = pixels * qint64(mat.elemSize());
+    }
+    void setSlowPath(bool slowPath) { m_stats.slowPathCalls = slowPath; }
+    void setExtraCopy(bool extraCopy) { m_stats.extraCopyCalls = extraCopy; }
+
+private:
+    bool m_statsOn;
+    QtOcv::ConversionTraceHook m_hook;
+    bool m_active;
+    QElapsedTimer m_timer;
+    QtOcv::ConversionStats m_stats;
+};
+
+/* Whether the conversion runs the generic per-pixel loops, instead of memcpy, the SIMD kernels,
+ * the compile-time kernels or cv::Mat::convertTo()
+ */
+bool genericImage2Mat(const PixelLayout &layout, int matType)
+{
+    return CV_MAT_DEPTH(matType) != CV_8U || layout.depth16 || layout.premultiplied;
+}
+
+bool genericMat2Image(const cv::Mat &mat, const PixelLayout &layout, QtOcv::MatChannelOrder matRgbOrder,
+                      const ValueMapping &mapping, double defaultScale)
+{
+    const bool defaultMapping = mapping.scale == defaultScale && mapping.offset == 0. && !mapping.log;
+    if (mat.depth() == CV_8U && defaultMapping)
+        return layout.depth16;
+    if (mat.depth() == CV_16U && defaultMapping)
+        return true;
+    return !convertibleLayout(mat.channels(), layout, matRgbOrder, mapping);
+}
+
+/* Conversion functions for each depth of cv::Mat, and the scale between its values and 8-bit ones
+ *
+ * - Return false if the depth isn't supported.
+ */
+bool image2MatFunc(int depth, Image2MatFunc &func, double &scaleFactor)
+{
+    switch (depth) {
+    case CV_8U:
+        func = image2Mat_<uchar>;
+        scaleFactor = 1.0;
+        return true;
+    case CV_16U:
+        func = image2Mat_<quint16>;
+        scaleFactor = 65535./255.;
+        return true;
+    case CV_32S:
+        func = image2Mat_<qint32>;
+        scaleFactor = 65535./255.;
+        return true;
+    case CV_32F:
+        func = image2Mat_<float>;
+        scaleFactor = 1./255.;
+        return true;
+    case CV_64F:
+        func = image2Mat_<double>;
+        scaleFactor = 1./255.;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool mat2ImageFunc(int depth, Mat2ImageFunc &func, double &scaleFactor)
+{
+    switch (depth) {
+    case CV_8U:
+        func = mat2Image_<uchar>;
+        scaleFactor = 1.0;
+        return true;
+    case CV_16U:
+        func = mat2Image_<quint16>;
+        scaleFactor = 255./65535.;
+        return true;
+    case CV_32S:
+        func = mat2Image_<qint32>;
+        scaleFactor = 255./65535.;
+        return true;
+    case CV_32F:
+        func = mat2Image_<float>;
+        scaleFactor = 255.;
+        return true;
+    case CV_64F:
+        func = mat2Image_<double>;
+        scaleFactor = 255.;
+        return true;
+    default:
+        return false;
+    }
+}
+
+//Formats which don't have a PixelLayout are converted to the nearest one which has.
+QImage nativeImage(const QImage &img)
+{
+    switch (img.format()) {
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB:
+        return img.convertToFormat(QImage::Format_Indexed8);
+    case QImage::Format_RGB444:
+    case QImage::Format_RGB555:
+    case QImage::Format_RGB666:
+    case QImage::Format_RGB16:
+        return img.convertToFormat(QImage::Format_RGB888);
+    default:
+        return pixelLayout(img.format()).channels ? img : img.convertToFormat(QImage::Format_RGB32);
+    }
+}
+
+//Format of QImage selected for cv::Mat when the caller doesn't give one
+QImage::Format defaultImageFormat(int channels)
+{
+    if (channels == 1)
+        return QImage::Format_Indexed8;
+    else if (channels == 3)
+        return QImage::Format_RGB888;
+    return QImage::Format_ARGB32;
+}
+
+/* Convert the rect area of image to mat
+ *
+ * - image must have a PixelLayout, and rect must be inside of it.
+ * - Only the scanlines of the area are read, through the stride of image.
+ */
+bool image2MatRect(const QImage &image, const QRect &rect, cv::Mat &mat, int matType, QtOcv::MatChannelOrder matRgbOrder)
+{
+    Image2MatFunc func;
+    double scaleFactor;
+    if (!image2MatFunc(CV_MAT_DEPTH(matType), func, scaleFactor)) {
+        mat.release();
+        return false;
+    }
+
+    const int channels = CV_MAT_CN(matType)==CV_CN_MAX ? pixelLayout(image.format()).channels : CV_MAT_CN(matType);
+    const uchar *data = image.constBits() + rect.y()*image.bytesPerLine() + rect.x()*(image.depth()/8);
+
+    //create() does nothing when the size and type of mat are unchanged
+    mat.create(rect.height(), rect.width(), CV_MAKETYPE(matType, channels));
+    convertRows(Image2MatInvoker(func, data, image.bytesPerLine(), image.format(), mat, matRgbOrder, scaleFactor),
+                mat.rows, mat.cols);
+    return true;
+}
+
+/* The gray color table of Indexed8 results
+ *
+ * - Built once on first use, and then implicitly shared by all the QImages.
+ */
+struct GrayColorTable
+{
+    GrayColorTable()
+    {
+        table.reserve(256);
+        for (int i=0; i<256; ++i)
+            table.append(qRgb(i,i,i));
+    }
+    QVector<QRgb> table;
+};
+Q_GLOBAL_STATIC(GrayColorTable, grayColorTable)
+
+//An empty colorTable means the gray one, setColorTable() is skipped when img already shares it
+void setIndexed8ColorTable(QImage &img, const QVector<QRgb> &colorTable)
+{
+    const QVector<QRgb> &table = colorTable.isEmpty() ? grayColorTable()->table : colorTable;
+    if (img.colorTable() != table)
+        img.setColorTable(table);
+}
+
+/* Make outImage a QImage of size and format, whose data is reused when possible
+ *
+ * - Writing to a shared QImage would detach it, which is a hidden allocation too.
+ */
+void prepareImage(QImage &outImage, const QSize &size, QImage::Format format, const QVector<QRgb> &colorTable)
+{
+    if (outImage.size() != size || outImage.format() != format || !outImage.isDetached())
+        outImage = QImage(size, format);
+
+    if (format == QImage::Format_Indexed8)
+        setIndexed8ColorTable(outImage, colorTable);
+}
+
+/* Convert mat to outImage, whose data is reused when possible
+ *
+ * - mapping null means the default scale of the depth of mat.
+ */
+bool mat2ImageMapped(const cv::Mat &mat, QImage &outImage, QImage::Format format, QtOcv::MatChannelOrder matRgbOrder,
+                     const QVector<QRgb> &colorTable, const ValueMapping *mapping)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+    Q_ASSERT(format == QImage::Format_Invalid || pixelLayout(format).channels);
+
+    if (mat.empty() || (format != QImage::Format_Invalid && !pixelLayout(format).channels)) {
+        outImage = QImage();
+        return false;
+    }
+
+    if (format == QImage::Format_Invalid)
+        format = defaultImageFormat(mat.channels());
+
+    Mat2ImageFunc func;
+    double scaleFactor;
+    if (!mat2ImageFunc(mat.depth(), func, scaleFactor)) {
+        outImage = QImage();
+        return false;
+    }
+
+    ConversionProbe probe(QtOcv::CD_Mat2Image, format);
+    const ValueMapping valueMapping = mapping ? *mapping : makeMapping(scaleFactor);
+    prepareImage(outImage, QSize(mat.cols, mat.rows), format, colorTable);
+    convertRows(Mat2ImageInvoker(func, mat, outImage.bits(), outImage.bytesPerLine(), format, matRgbOrder, valueMapping),
+                mat.rows, mat.cols);
+    if (probe.isActive()) {
+        probe.setMat(mat);
+        probe.setSlowPath(genericMat2Image(mat, pixelLayout(format), matRgbOrder, valueMapping, scaleFactor));
+    }
+
+    return true;
+}
+
+int sharedMatType(const PixelLayout &layout)
+{
+    return CV_MAKETYPE(layout.depth16 ? CV_16U : CV_8U, layout.channels);
+}
+
+/* Format of the QImage which shares data with mat
+ *
+ * - Format_Invalid means selecting based on the type of mat.
+ * - Return Format_Invalid if the type of mat doesn't match the format.
+ */
+QImage::Format sharedImageFormat(const cv::Mat &mat, QImage::Format format)
+{
+    if (format == QImage::Format_Invalid) {
+        switch (mat.type()) {
+        case CV_8UC1:
+            return QImage::Format_Indexed8;
+        case CV_8UC3:
+            return QImage::Format_RGB888;
+        case CV_8UC4:
+            return QImage::Format_ARGB32;
+#if QT_VERSION >= 0x050D00
+        case CV_16UC1:
+            return QImage::Format_Grayscale16;
+#endif
+#if QT_VERSION >= 0x050C00
+        case CV_16UC4:
+            return QImage::Format_RGBA64;
+#endif
+        default:
+            return QImage::Format_Invalid;
+        }
+    }
+
+    const PixelLayout layout = pixelLayout(format);
+    return layout.channels && sharedMatType(layout) == mat.type() ? format : QImage::Format_Invalid;
+}
+
+/* Conversion of a batch of images, parallelized across the images
+ *
+ * - Same thread count as the row-parallel conversion, 1 (default) means converting in the caller's thread.
+ */
+void convertImages(const cv::ParallelLoopBody &body, int count)
+{
+    const int threads = resolvedConversionThreads();
+    const int stripes = qMin(threads, count);
+
+    if (stripes > 1)
+        cv::parallel_for_(cv::Range(0, count), body, stripes);
+    else
+        body(cv::Range(0, count));
+}
+
+class BatchInvoker : public cv::ParallelLoopBody
+{
+public:
+    BatchInvoker(const QVector<QImage> &images, std::vector<cv::Mat> &mats, std::vector<uchar> &results,
+                 int matType, QtOcv::MatChannelOrder matRgbOrder)
+        : m_images(images), m_mats(mats), m_results(results), m_matType(matType), m_rgbOrder(matRgbOrder)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for (int i=range.start; i<range.end; ++i)
+            m_results[i] = QtOcv::image2Mat(m_images[i], m_mats[i], m_matType, m_rgbOrder);
+    }
+
+private:
+    const QVector<QImage> &m_images;
+    std::vector<cv::Mat> &m_mats;
+    std::vector<uchar> &m_results;
+    int m_matType;
+    QtOcv::MatChannelOrder m_rgbOrder;
+};
+
+/* Mapping from the 8-bit components to the float values of a tensor
+ *
+ * - v * scale[c] + offset[c] for output channel c, so the normalization costs
+ *   nothing more than the conversion.
+ * - values holds the same results as lookup tables, for the layouts without a planar kernel.
+ */
+struct TensorMapping
+{
+    float scale[3];
+    float offset[3];
+    float values[3][256];
+};
+
+void makeTensorMapping(TensorMapping &mapping, int channels, const cv::Scalar &scale, const cv::Scalar &offset)
+{
+    for (int c=0; c<channels; ++c) {
+        mapping.scale[c] = float(scale[c]);
+        mapping.offset[c] = float(offset[c]);
+        for (int v=0; v<256; ++v)
+            mapping.values[c][v] = planarValue(uchar(v), mapping.scale[c], mapping.offset[c]);
+    }
+}
+
+/* The 8-bit data of img resized to size, which the tensor kernels read
+ *
+ * - image keeps the data of the result alive, converted and resized are the buffers
+ *   used when img isn't 8-bit or has another size.
+ */
+cv::Mat tensorSource(const QImage &img, const cv::Size &size, QImage &image, PixelLayout &layout,
+                     cv::Mat &converted, cv::Mat &resized)
+{
+    image = nativeImage(img);
+    layout = pixelLayout(image.format());
+    cv::Mat src(image.height(), image.width(), sharedMatType(layout), const_cast<uchar*>(image.constBits()),
+                image.bytesPerLine());
+    if (layout.depth16 || layout.premultiplied) {
+        //Same 8-bit straight components as the ones of image2Mat()
+        image2MatRect(image, image.rect(), converted, CV_8UC(layout.channels), QtOcv::MCO_RGB);
+        layout = makeLayout(layout.channels, 0, 1, 2, layout.channels == 4 ? 3 : -1);
+        src = converted;
+    }
+    if (src.size() != size) {
+        const bool shrink = size.width < src.cols && size.height < src.rows;
+        cv::resize(src, resized, size, 0, 0, shrink ? cv::INTER_AREA : cv::INTER_LINEAR);
+        src = resized;
+    }
+    return src;
+}
+
+/* Convert the 8-bit data of src to the rows of a tensor, which start from data
+ *
+ * - The tensor has 1 (gray) or 3 channels, pixelStep is 1 and channelStep is the size
+ *   of a plane for planes (NCHW), or channels and 1 for interleaved ones (NHWC).
+ * - src may be a slice of the whole image.
+ */
+void tensorRows_(const cv::Mat &src, const PixelLayout &layout, float *data, size_t channelStep, int pixelStep,
+                 int channels, QtOcv::MatChannelOrder matRgbOrder, const TensorMapping &mapping)
+{
+    //Index of the component in the source pixel for each channel of the tensor
+    int index[3] = {0, 0, 0};
+    if (channels == 3 && layout.channels > 1) {
+        index[0] = matRgbOrder == QtOcv::MCO_BGR ? layout.blue : layout.red;
+        index[1] = layout.green;
+        index[2] = matRgbOrder == QtOcv::MCO_BGR ? layout.red : layout.blue;
+    }
+    const RowPlanarFunc toPlanes = channels == 3 && pixelStep == 1 && layout.channels > 1
+            ? rowPlanarFunc(layout.channels) : 0;
+
+    for (int i=0; i<src.rows; ++i) {
+        const uchar * s = src.ptr(i);
+        float * d = data + size_t(i) * src.cols * pixelStep;
+        if (toPlanes) {
+            float * const planes[3] = {d, d + channelStep, d + 2*channelStep};
+            toPlanes(s, src.cols, index, mapping.scale, mapping.offset, planes);
+        } else if (channels == 1 && layout.channels > 1) {
+            for (int j=0; j<src.cols; ++j, s+=layout.channels)
+                d[j] = mapping.values[0][grayPixel(s[layout.red], s[layout.green], s[layout.blue])];
+        } else {
+            for (int c=0; c<channels; ++c) {
+                const uchar * sc = s + index[c];
+                const float * table = mapping.values[c];
+                float * dc = d + c*channelStep;
+                for (int j=0; j<src.cols; ++j)
+                    dc[j*pixelStep] = table[sc[j*layout.channels]];
+            }
+        }
+    }
+}
+
+class TensorInvoker : public cv::ParallelLoopBody
+{
+public:
+    TensorInvoker(const QVector<QImage> &images, cv::Mat &tensor, const cv::Size &size, QtOcv::TensorLayout tensorLayout,
+                  int channels, QtOcv::MatChannelOrder matRgbOrder, const TensorMapping &mapping)
+        : m_images(images), m_data(tensor.data), m_imageStep(tensor.step[0]), m_size(size), m_layout(tensorLayout)
+        , m_channels(channels), m_rgbOrder(matRgbOrder), m_mapping(mapping)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        const bool planar = m_layout == QtOcv::TL_NCHW;
+        //Reused by the images of this range
+        QImage image;
+        PixelLayout layout;
+        cv::Mat converted;
+        cv::Mat resized;
+        for (int n=range.start; n<range.end; ++n) {
+            const cv::Mat src = tensorSource(m_images[n], m_size, image, layout, converted, resized);
+            tensorRows_(src, layout, reinterpret_cast<float*>(m_data + n*m_imageStep), planar ? size_t(m_size.area()) : 1,
+                        planar ? 1 : m_channels, m_channels, m_rgbOrder, m_mapping);
+        }
+    }
+
+private:
+    const QVector<QImage> &m_images;
+    uchar *m_data;
+    size_t m_imageStep;
+    cv::Size m_size;
+    QtOcv::TensorLayout m_layout;
+    int m_channels;
+    QtOcv::MatChannelOrder m_rgbOrder;
+    const TensorMapping &m_mapping;
+};
+
+//Rows of one planar image, for the images big enough to be split across threads
+class PlanarRowsInvoker : public cv::ParallelLoopBody
+{
+public:
+    PlanarRowsInvoker(const cv::Mat &src, const PixelLayout &layout, float *data, int channels,
+                      QtOcv::MatChannelOrder matRgbOrder, const TensorMapping &mapping)
+        : m_src(src), m_layout(layout), m_data(data), m_channels(channels), m_rgbOrder(matRgbOrder), m_mapping(mapping)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        tensorRows_(m_src.rowRange(range.start, range.end), m_layout, m_data + size_t(range.start) * m_src.cols,
+                    size_t(m_src.rows) * m_src.cols, 1, m_channels, m_rgbOrder, m_mapping);
+    }
+
+private:
+    cv::Mat m_src;
+    PixelLayout m_layout;
+    float *m_data;
+    int m_channels;
+    QtOcv::MatChannelOrder m_rgbOrder;
+    const TensorMapping &m_mapping;
+};
+
+#if CV_MAJOR_VERSION >= 3
+/* cv::cvtColor() code between two channel layouts
+ *
+ * - red is the index of red component, 0 or 2, which is skipped by gray.
+ * - Return -1 when no conversion is needed.
+ */
+int cvtColorCode(int srcChannels, int srcRed, int dstChannels, int dstRed)
+{
+    const bool sameOrder = srcRed == dstRed;
+    switch (srcChannels * 10 + dstChannels) {
+    case 13:
+        return cv::COLOR_GRAY2BGR;
+    case 14:
+        return cv::COLOR_GRAY2BGRA;
+    case 31:
+        return srcRed == 2 ? cv::COLOR_BGR2GRAY : cv::COLOR_RGB2GRAY;
+    case 33:
+        return sameOrder ? -1 : cv::COLOR_BGR2RGB;
+    case 34:
+        return sameOrder ? cv::COLOR_BGR2BGRA : cv::COLOR_BGR2RGBA;
+    case 41:
+        return srcRed == 2 ? cv::COLOR_BGRA2GRAY : cv::COLOR_RGBA2GRAY;
+    case 43:
+        return sameOrder ? cv::COLOR_BGRA2BGR : cv::COLOR_BGRA2RGB;
+    case 44:
+        return sameOrder ? -1 : cv::COLOR_BGRA2RGBA;
+    default:
+        return -1;
+    }
+}
+
+/* Steps to convert between the raw data of QImage and a matrix on the device, such as cv::UMat
+ *
+ * - The raw data has rawType, which is the type of image2Mat_shared().
+ * - QImage to matrix: cv::cvtColor() by code, then convertTo() by scale.
+ * - Matrix to QImage: convertTo() by scale, then cv::cvtColor() by code and secondCode, where
+ *   secondCode resets the alpha for opaque formats. -1 means no cv::cvtColor() is needed.
+ * - Not valid for the depths which aren't supported, or the layouts which cv::cvtColor() can't
+ *   handle, such as ARGB32 in big endian systems.
+ */
+struct DevicePlan
+{
+    bool valid;
+    int rawType;
+    int code;
+    int secondCode;
+    double scale;
+};
+
+DevicePlan image2MatPlan(const PixelLayout &layout, int matType, QtOcv::MatChannelOrder matRgbOrder)
+{
+    DevicePlan plan = {false, sharedMatType(layout), -1, -1, 1.};
+    Image2MatFunc func;
+    //cv::cvtColor() doesn't unpremultiply, so they are converted on the host
+    if (!isCvColorLayout(layout) || layout.premultiplied || !image2MatFunc(CV_MAT_DEPTH(matType), func, plan.scale))
+        return plan;
+
+    plan.valid = true;
+    plan.code = cvtColorCode(layout.channels, layout.red, CV_MAT_CN(matType), matRgbOrder == QtOcv::MCO_BGR ? 2 : 0);
+    if (layout.depth16)
+        plan.scale /= 257.;
+    return plan;
+}
+
+DevicePlan mat2ImagePlan(int matType, QtOcv::MatChannelOrder matRgbOrder, const PixelLayout &layout)
+{
+    DevicePlan plan = {false, sharedMatType(layout), -1, -1, 1.};
+    Mat2ImageFunc func;
+    if (!isCvColorLayout(layout) || (layout.premultiplied && CV_MAT_CN(matType) == 4)
+            || !mat2ImageFunc(CV_MAT_DEPTH(matType), func, plan.scale))
+        return plan;
+
+    plan.valid = true;
+    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
+    if (layout.opaque && CV_MAT_CN(matType) == 4) {
+        plan.code = cvtColorCode(4, mat_red, 3, layout.red);
+        plan.secondCode = cvtColorCode(3, layout.red, 4, layout.red);
+    } else {
+        plan.code = cvtColorCode(CV_MAT_CN(matType), mat_red, layout.channels, layout.red);
+    }
+    if (layout.depth16)
+        plan.scale = CV_MAT_DEPTH(matType) == CV_16U ? 1. : plan.scale * 257.;
+    return plan;
+}
+#endif
+
+#if QT_VERSION >= 0x050000
+//Cleanup function of the QImage created by mat2Image_refShared()
+void releaseSharedMat(void *info)
+{
+    delete static_cast<cv::Mat*>(info);
+}
+#endif
+
+#if CV_MAJOR_VERSION >= 3
+
+#  if CV_MAJOR_VERSION >= 4
+typedef cv::AccessFlag MatAccessFlag;
+#  else
+typedef int MatAccessFlag;
+#  endif
+
+/* Keep a copy of the QImage in UMatData, so that its data lives as long as
+ * any cv::Mat refers to it.
+ *
+ * - Only used to wrap the existing data, the new buffers go to the default allocator.
+ */
+class QImageMatAllocator : public cv::MatAllocator
+{
+public:
+    cv::UMatData *wrap(const QImage &img) const
+    {
+        cv::UMatData *u = new cv::UMatData(this);
+        u->data = u->origdata = const_cast<uchar*>(img.constBits());
+        u->size = size_t(img.bytesPerLine()) * img.height();
+        u->userdata = new QImage(img);
+        return u;
+    }
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           MatAccessFlag flags, cv::UMatUsageFlags usageFlags) const
+    {
+        return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData *u, MatAccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const
+    {
+        return cv::Mat::getDefaultAllocator()->allocate(u, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData *u) const
+    {
+        if (!u || u->refcount != 0 || u->urefcount != 0)
+            return;
+        delete static_cast<QImage*>(u->userdata);
+        delete u;
+    }
+};
+
+#else
+
+/* OpenCV 2.x has no UMatData, cv::Mat only knows the refcount pointer, and
+ * calls the allocator of the cv::Mat once the count drops to zero.
+ *
+ * - refcount must be the first member, deallocate() gets the holder back from it.
+ * - cv::Mat::create() still uses this allocator, so the new buffers are owned by holders too.
+ */
+struct SharedImageHolder
+{
+    int refcount;
+    QImage image;
+    void *buffer;
+};
+
+class QImageMatAllocator : public cv::MatAllocator
+{
+public:
+    int *wrap(const QImage &img)
+    {
+        SharedImageHolder *holder = new SharedImageHolder;
+        holder->refcount = 1;
+        holder->image = img;
+        holder->buffer = 0;
+        return &holder->refcount;
+    }
+
+    void allocate(int dims, const int *sizes, int type, int *&refcount, uchar *&datastart, uchar *&data, size_t *step)
+    {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i=dims-1; i>=0; --i) {
+            step[i] = total;
+            total *= sizes[i];
+        }
+        SharedImageHolder *holder = new SharedImageHolder;
+        holder->refcount = 1;
+        holder->buffer = cv::fastMalloc(total);
+        refcount = &holder->refcount;
+        datastart = data = static_cast<uchar*>(holder->buffer);
+    }
+
+    void deallocate(int *refcount, uchar * /*datastart*/, uchar * /*data*/)
+    {
+        SharedImageHolder *holder = reinterpret_cast<SharedImageHolder*>(refcount);
+        if (holder->buffer)
+            cv::fastFree(holder->buffer);
+        delete holder;
+    }
+};
+
+#endif
+
+Q_GLOBAL_STATIC(QImageMatAllocator, qimageMatAllocator)
+
+
+/* Rows of a YUV frame, as the pointers given to the YUV kernels
+ *
+ * - Rows of 4:2:2 are split into the buffers first, so the same kernels are used. Their width is even.
+ */
+class YuvRows
+{
+public:
+    YuvRows(const uchar *const planes[3], const int strides[3], int width, QtOcv::YuvFormat format)
+        : m_format(format), m_width(width)
+    {
+        for (int i=0; i<3; ++i) {
+            m_planes[i] = planes[i];
+            m_strides[i] = strides[i];
+        }
+        if (isPacked()) {
+            m_buffer.resize(size_t(width) + 2 * ((width + 1) / 2));
+        }
+    }
+
+    bool isPacked() const
+    {
+        return m_format == QtOcv::YF_YUYV || m_format == QtOcv::YF_UYVY;
+    }
+
+    //Pointers of row i, which are valid until the next call
+    void row(int i, const uchar *&y, const uchar *&u, const uchar *&v, int &uvStep)
+    {
+        const uchar *chroma0 = m_planes[1] + (i / 2) * size_t(m_strides[1]);
+        switch (m_format) {
+        case QtOcv::YF_NV12:
+        case QtOcv::YF_NV21:
+            y = m_planes[0] + i * size_t(m_strides[0]);
+            u = m_format == QtOcv::YF_NV12 ? chroma0 : chroma0 + 1;
+            v = m_format == QtOcv::YF_NV12 ? chroma0 + 1 : chroma0;
+            uvStep = 2;
+            return;
+        case QtOcv::YF_I420:
+        case QtOcv::YF_YV12: {
+            const uchar *chroma1 = m_planes[2] + (i / 2) * size_t(m_strides[2]);
+            y = m_planes[0] + i * size_t(m_strides[0]);
+            u = m_format == QtOcv::YF_I420 ? chroma0 : chroma1;
+            v = m_format == QtOcv::YF_I420 ? chroma1 : chroma0;
+            uvStep = 1;
+            return;
+        }
+        default: {
+            //Y0 U Y1 V or U Y0 V Y1 of each 2 pixels
+            const uchar *src = m_planes[0] + i * size_t(m_strides[0]);
+            const int yIndex = m_format == QtOcv::YF_YUYV ? 0 : 1;
+            uchar *yRow = &m_buffer[0];
+            uchar *uRow = yRow + m_width;
+            uchar *vRow = uRow + (m_width + 1) / 2;
+            for (int x=0; x<m_width; x+=2, src+=4) {
+                yRow[x] = src[yIndex];
+                yRow[x + 1] = src[yIndex + 2];
+                uRow[x / 2] = src[1 - yIndex];
+                vRow[x / 2] = src[3 - yIndex];
+            }
+            y = yRow;
+            u = uRow;
+            v = vRow;
+            uvStep = 1;
+            return;
+        }
+        }
+    }
+
+private:
+    QtOcv::YuvFormat m_format;
+    int m_width;
+    const uchar *m_planes[3];
+    int m_strides[3];
+    std::vector<uchar> m_buffer;
+};
+
+/* Convert the rows of a YUV frame to the scanlines of outData
+ *
+ * - The kernels write 4 channels pixels, which are packed by pack for 3 channels formats.
+ */
+class Yuv2ImageInvoker : public cv::ParallelLoopBody
+{
+public:
+    Yuv2ImageInvoker(const uchar *const planes[3], const int strides[3], const QSize &size, QtOcv::YuvFormat format,
+                     uchar *outData, int outStep, const PixelLayout &layout)
+        : m_size(size), m_format(format), m_outData(outData), m_outStep(outStep)
+        , m_func(rowYuvFunc(layout.channels == 4 ? layout.red : 2))
+        , m_pack(layout.channels == 3 ? rowSwizzleFunc(4, 3, layout.red != 2) : 0)
+    {
+        for (int i=0; i<3; ++i) {
+            m_planes[i] = planes[i];
+            m_strides[i] = strides[i];
+        }
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        YuvRows rows(m_planes, m_strides, m_size.width(), m_format);
+        std::vector<uchar> buffer(m_pack ? size_t(m_size.width()) * 4 : 0);
+        for (int i=range.start; i<range.end; ++i) {
+            const uchar *y, *u, *v;
+            int uvStep;
+            rows.row(i, y, u, v, uvStep);
+            uchar *dst = m_outData + i * size_t(m_outStep);
+            if (!m_pack) {
+                m_func(y, u, v, uvStep, dst, m_size.width());
+            } else {
+                m_func(y, u, v, uvStep, &buffer[0], m_size.width());
+                m_pack(&buffer[0], dst, m_size.width());
+            }
+        }
+    }
+
+private:
+    const uchar *m_planes[3];
+    int m_strides[3];
+    QSize m_size;
+    QtOcv::YuvFormat m_format;
+    uchar *m_outData;
+    int m_outStep;
+    RowYuvFunc m_func;
+    RowSwizzleFunc m_pack;
+};
+
+/* Convert the scanlines of image to the planes of a YUV frame
+ *
+ * - image has a swizzle layout. Each range is of 2 rows for 4:2:0, which share one chroma row.
+ * - The width of image is even for 4:2:2, whose pixels are written in pairs.
+ */
+class Image2YuvInvoker : public cv::ParallelLoopBody
+{
+public:
+    Image2YuvInvoker(const QImage &image, QtOcv::YuvFormat format, uchar *const planes[3], const int strides[3])
+        : m_image(image), m_layout(pixelLayout(image.format())), m_format(format)
+    {
+        for (int i=0; i<3; ++i) {
+            m_planes[i] = planes[i];
+            m_strides[i] = strides[i];
+        }
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        const int width = m_image.width();
+        const int height = m_image.height();
+        const bool packed = m_format == QtOcv::YF_YUYV || m_format == QtOcv::YF_UYVY;
+        std::vector<uchar> buffer(packed ? size_t(width) + 2 * ((width + 1) / 2) : 0);
+        for (int i=range.start; i<range.end; ++i) {
+            if (packed) {
+                //Y0 U Y1 V or U Y0 V Y1 of each 2 pixels
+                uchar *yRow = &buffer[0];
+                uchar *uRow = yRow + width;
+                uchar *vRow = uRow + (width + 1) / 2;
+                rgbRowsToYuv(m_image.constScanLine(i), 0, m_layout.channels, m_layout.red, width, yRow, 0, uRow, vRow, 1);
+                uchar *dst = m_planes[0] + i * size_t(m_strides[0]);
+                const int yIndex = m_format == QtOcv::YF_YUYV ? 0 : 1;
+                for (int x=0; x<width; x+=2, dst+=4) {
+                    dst[yIndex] = yRow[x];
+                    dst[yIndex + 2] = yRow[x + 1];
+                    dst[1 - yIndex] = uRow[x / 2];
+                    dst[3 - yIndex] = vRow[x / 2];
+                }
+                continue;
+            }
+
+            const int row0 = i * 2;
+            const bool hasRow1 = row0 + 1 < height;
+            uchar *y0 = m_planes[0] + row0 * size_t(m_strides[0]);
+            uchar *y1 = hasRow1 ? y0 + m_strides[0] : 0;
+            uchar *chroma0 = m_planes[1] + i * size_t(m_strides[1]);
+            uchar *u, *v;
+            int uvStep = 1;
+            if (m_format == QtOcv::YF_NV12 || m_format == QtOcv::YF_NV21) {
+                u = m_format == QtOcv::YF_NV12 ? chroma0 : chroma0 + 1;
+                v = m_format == QtOcv::YF_NV12 ? chroma0 + 1 : chroma0;
+                uvStep = 2;
+            } else {
+                uchar *chroma1 = m_planes[2] + i * size_t(m_strides[2]);
+                u = m_format == QtOcv::YF_I420 ? chroma0 : chroma1;
+                v = m_format == QtOcv::YF_I420 ? chroma1 : chroma0;
+            }
+            rgbRowsToYuv(m_image.constScanLine(row0), hasRow1 ? m_image.constScanLine(row0 + 1) : 0,
+                         m_layout.channels, m_layout.red, width, y0, y1, u, v, uvStep);
+        }
+    }
+
+private:
+    QImage m_image;
+    PixelLayout m_layout;
+    QtOcv::YuvFormat m_format;
+    uchar *m_planes[3];
+    int m_strides[3];
+};
+
+//Planes of yuv in the layout of OpenCV, or false if its type or size doesn't match format
+bool matYuvPlanes(const cv::Mat &yuv, QtOcv::YuvFormat format, const uchar *planes[3], int strides[3], QSize &size)
+{
+    if (format == QtOcv::YF_YUYV || format == QtOcv::YF_UYVY) {
+        if (yuv.type() != CV_8UC2 || yuv.cols % 2)
+            return false;
+        planes[0] = planes[1] = planes[2] = yuv.data;
+        strides[0] = strides[1] = strides[2] = int(yuv.step);
+        size = QSize(yuv.cols, yuv.rows);
+        return true;
+    }
+
+    if (yuv.type() != CV_8UC1 || yuv.rows % 3 || yuv.cols % 2)
+        return false;
+    size = QSize(yuv.cols, yuv.rows / 3 * 2);
+    planes[0] = yuv.data;
+    strides[0] = int(yuv.step);
+    planes[1] = planes[2] = yuv.ptr(size.height());
+    strides[1] = strides[2] = int(yuv.step);
+    if (format == QtOcv::YF_I420 || format == QtOcv::YF_YV12) {
+        //Chroma rows of half width are packed one after another
+        if (!yuv.isContinuous())
+            return false;
+        strides[1] = strides[2] = yuv.cols / 2;
+        planes[2] = planes[1] + size_t(strides[1]) * (size.height() / 2);
+    }
+    return true;
+}
+
+
+/* Mark the blocks of mat which differ from previous, one byte for each block
+ *
+ * - Each range is of strips of blockSize rows, the rows of a strip are compared by memcmp()
+ *   only for the blocks not marked yet, so an unchanged strip is read once at memory speed.
+ */
+class BlockDiffInvoker : public cv::ParallelLoopBody
+{
+public:
+    BlockDiffInvoker(const cv::Mat &mat, const cv::Mat &previous, int blockSize, uchar *flags)
+        : m_mat(mat), m_previous(previous), m_blockSize(blockSize), m_flags(flags)
+        , m_blocksX((mat.cols + blockSize - 1) / blockSize)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        const size_t pixelBytes = m_mat.elemSize();
+        const size_t blockBytes = pixelBytes * m_blockSize;
+        const size_t rowBytes = pixelBytes * m_mat.cols;
+        for (int strip=range.start; strip<range.end; ++strip) {
+            uchar *flags = m_flags + strip * size_t(m_blocksX);
+            const int rowEnd = qMin(m_mat.rows, (strip + 1) * m_blockSize);
+            for (int row=strip*m_blockSize; row<rowEnd; ++row) {
+                const uchar *a = m_mat.ptr(row);
+                const uchar *b = m_previous.ptr(row);
+                for (int x=0; x<m_blocksX; ++x) {
+                    const size_t offset = x * blockBytes;
+                    if (!flags[x] && memcmp(a + offset, b + offset, qMin(blockBytes, rowBytes - offset)))
+                        flags[x] = 1;
+                }
+            }
+        }
+    }
+
+private:
+    cv::Mat m_mat;
+    cv::Mat m_previous;
+    int m_blockSize;
+    uchar *m_flags;
+    int m_blocksX;
+};
+
+//The changed blocks of mat, adjacent ones in a strip are merged into one rect
+std::vector<cv::Rect> changedBlocks(const cv::Mat &mat, const cv::Mat &previous, int blockSize)
+{
+    const int blocksX = (mat.cols + blockSize - 1) / blockSize;
+    const int blocksY = (mat.rows + blockSize - 1) / blockSize;
+    std::vector<uchar> flags(size_t(blocksX) * blocksY, 0);
+    convertRows(BlockDiffInvoker(mat, previous, blockSize, &flags[0]), blocksY, mat.cols * blockSize);
+
+    std::vector<cv::Rect> rects;
+    for (int y=0; y<blocksY; ++y) {
+        const uchar *strip = &flags[y * size_t(blocksX)];
+        for (int x=0; x<blocksX; ++x) {
+            if (!strip[x])
+                continue;
+            const int start = x;
+            while (x + 1 < blocksX && strip[x + 1])
+                ++x;
+            const cv::Rect rect(start * blockSize, y * blockSize, (x + 1 - start) * blockSize, blockSize);
+            rects.push_back(rect & cv::Rect(0, 0, mat.cols, mat.rows));
+        }
+    }
+    return rects;
+}
+
+//Whether img holds a previous result of mat2Image(mat, format), so that only the dirty areas need converting
+bool isPreviousImage(const cv::Mat &mat, const QImage &img, QImage::Format format)
+{
+    if (format == QImage::Format_Invalid)
+        format = defaultImageFormat(mat.channels());
+    return img.width() == mat.cols && img.height() == mat.rows && img.format() == format;
+}
+
+} //namespace
+
+namespace QtOcv {
+
+/* Convert QImage to cv::Mat
+ *
+ * - Supported mat channels are 0, 1, 3, 4,  where 0 means selecting based on QImage's format
+ */
+cv::Mat image2Mat(const QImage &img, int matType, MatChannelOrder matRgbOrder)
+{
+    cv::Mat mat;
+    image2Mat(img, mat, matType, matRgbOrder);
+    return mat;
+}
+
+/* Convert QImage to cv::Mat, and store the result in mat
+ *
+ * - The data of mat will be reused if its size and type are already the same as the result,
+ *   otherwise it will be reallocated.
+ * - Return false if the QImage is null or the depth of matType isn't supported.
+ */
+bool image2Mat(const QImage &img, cv::Mat &mat, int matType, MatChannelOrder matRgbOrder)
+{
+    Q_ASSERT(CV_MAT_CN(matType) == CV_CN_MAX || CV_MAT_CN(matType)==1 \
+             || CV_MAT_CN(matType)==3 || CV_MAT_CN(matType)==4);
+
+    if (img.isNull()) {
+        mat.release();
+        return false;
+    }
+
+    ConversionProbe probe(CD_Image2Mat, img.format());
+    const QImage image = nativeImage(img);
+    const bool ok = image2MatRect(image, image.rect(), mat, matType, matRgbOrder);
+    if (probe.isActive()) {
+        probe.setMat(mat);
+        probe.setSlowPath(genericImage2Mat(pixelLayout(image.format()), mat.type()));
+        probe.setExtraCopy(image.format() != img.format());
+    }
+    return ok;
+}
+
+/* Convert the rect area of QImage to cv::Mat, and store the result in mat
+ *
+ * - rect is clipped to the image. Only the area is read, so no QImage::copy() is needed,
+ *   except for the formats which have to be converted by QImage first.
+ * - mat may be a ROI of a bigger cv::Mat, which is written in place when its size and type
+ *   are already the same as the result.
+ * - Return false if the clipped area is empty or the depth of matType isn't supported.
+ */
+bool image2Mat(const QImage &img, const QRect &rect, cv::Mat &mat, int matType, MatChannelOrder matRgbOrder)
+{
+    Q_ASSERT(CV_MAT_CN(matType) == CV_CN_MAX || CV_MAT_CN(matType)==1 \
+             || CV_MAT_CN(matType)==3 || CV_MAT_CN(matType)==4);
+
+    const QRect area = rect & img.rect();
+    if (img.isNull() || area.isEmpty()) {
+        mat.release();
+        return false;
+    }
+
+    ConversionProbe probe(CD_Image2Mat, img.format());
+    const bool native = pixelLayout(img.format()).channels != 0;
+    const QImage image = native ? img : nativeImage(img.copy(area));
+    const bool ok = image2MatRect(image, native ? area : image.rect(), mat, matType, matRgbOrder);
+    if (probe.isActive()) {
+        probe.setMat(mat);
+        probe.setSlowPath(genericImage2Mat(pixelLayout(image.format()), mat.type()));
+        probe.setExtraCopy(!native);
+    }
+    return ok;
+}
+
+/* Convert cv::Mat to QImage
+ *
+ * Channels of cv::Mat should be 1, 3, 4
+ * Format of QImage should be ARGB32,RGB32,RGB888,Indexed8 or Invalid(means auto selection),
+ * or RGBX8888, RGBA8888, Grayscale8, Grayscale16, BGR888, RGBX64, RGBA64 when provided by Qt
+ */
+QImage mat2Image(const cv::Mat & mat, QImage::Format format, MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    QImage outImage;
+    mat2Image(mat, outImage, format, matRgbOrder, colorTable);
+    return outImage;
+}
+
+/* Convert cv::Mat to QImage, and store the result in outImage
+ *
+ * - The data of outImage will be reused if its size and format are already the same as
+ *   the result and it doesn't share data with other QImages, otherwise it will be reallocated.
+ * - colorTable is only used by QImage::Format_Indexed8, empty means the gray one.
+ * - Return false if the cv::Mat is empty or its depth isn't supported.
+ */
+bool mat2Image(const cv::Mat &mat, QImage &outImage, QImage::Format format, MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    return mat2ImageMapped(mat, outImage, format, matRgbOrder, colorTable, 0);
+}
+
+/* Convert cv::Mat to the area of QImage whose top-left corner is pos
+ *
+ * - The size, format and color table of img are kept, only the pixels covered by mat are
+ *   written through the stride of img. The area is clipped to the image.
+ * - mat may be a ROI of a bigger cv::Mat, which is read in place.
+ * - Return false if img is null or its format isn't supported, the clipped area is empty,
+ *   or the depth of mat isn't supported.
+ */
+bool mat2Image(const cv::Mat &mat, QImage &img, const QPoint &pos, MatChannelOrder matRgbOrder)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+
+    const QRect area = QRect(pos, QSize(mat.cols, mat.rows)) & img.rect();
+    Mat2ImageFunc func;
+    double scaleFactor;
+    if (mat.empty() || img.isNull() || !pixelLayout(img.format()).channels || area.isEmpty()
+            || !mat2ImageFunc(mat.depth(), func, scaleFactor))
+        return false;
+
+    ConversionProbe probe(CD_Mat2Image, img.format());
+    const cv::Mat src = mat(cv::Rect(area.x() - pos.x(), area.y() - pos.y(), area.width(), area.height()));
+    uchar *data = img.bits() + area.y()*img.bytesPerLine() + area.x()*(img.depth()/8);
+    convertRows(Mat2ImageInvoker(func, src, data, img.bytesPerLine(), img.format(), matRgbOrder, makeMapping(scaleFactor)),
+                src.rows, src.cols);
+    if (probe.isActive()) {
+        probe.setMat(src);
+        probe.setSlowPath(genericMat2Image(src, pixelLayout(img.format()), matRgbOrder, makeMapping(scaleFactor), scaleFactor));
+    }
+    return true;
+}
+
+/* Convert the dirty areas of cv::Mat into outImage, which holds the result of the previous frame
+ *
+ * - Only dirtyRects (clipped to mat) are converted, the rest of outImage is kept. changed is set
+ *   to the area written, which can be passed to QWidget::update() so that only it is repainted.
+ * - When outImage isn't of the size and format of the result, such as the first frame, mat is
+ *   converted in full by mat2Image(), and changed is the whole image.
+ * - A shared outImage is detached with its pixels, so it can be in use by the painter.
+ * - Return false if mat is empty, its depth or the format of outImage isn't supported.
+ */
+bool mat2Image_dirty(const cv::Mat &mat, QImage &outImage, const std::vector<cv::Rect> &dirtyRects, QRegion &changed,
+                     QImage::Format format, MatChannelOrder matRgbOrder)
+{
+    changed = QRegion();
+    if (mat.empty() || !isPreviousImage(mat, outImage, format)) {
+        if (!mat2Image(mat, outImage, format, matRgbOrder))
+            return false;
+        changed = QRegion(outImage.rect());
+        return true;
+    }
+
+    Mat2ImageFunc func;
+    double scaleFactor;
+    if (!pixelLayout(outImage.format()).channels || !mat2ImageFunc(mat.depth(), func, scaleFactor))
+        return false;
+
+    ConversionProbe probe(CD_Mat2Image, outImage.format());
+    const cv::Rect bounds(0, 0, mat.cols, mat.rows);
+    const int pixelBytes = outImage.depth() / 8;
+    qint64 pixels = 0;
+    for (size_t i=0; i<dirtyRects.size(); ++i) {
+        const cv::Rect rect = dirtyRects[i] & bounds;
+        if (rect.area() <= 0)
+            continue;
+        const cv::Mat src = mat(rect);
+        uchar *data = outImage.bits() + rect.y*outImage.bytesPerLine() + rect.x*pixelBytes;
+        convertRows(Mat2ImageInvoker(func, src, data, outImage.bytesPerLine(), outImage.format(), matRgbOrder,
+                                     makeMapping(scaleFactor)),
+                    src.rows, src.cols);
+        changed += QRect(rect.x, rect.y, rect.width, rect.height);
+        pixels += rect.area();
+    }
+    if (probe.isActive()) {
+        probe.setMat(mat, pixels);
+        probe.setSlowPath(genericMat2Image(mat, pixelLayout(outImage.format()), matRgbOrder, makeMapping(scaleFactor), scaleFactor));
+    }
+    return true;
+}
+
+/* Convert the blocks of cv::Mat which differ from previousMat into outImage
+ *
+ * - Same as mat2Image_dirty() with the dirty rects, which are found by comparing the
+ *   blocks of blockSize x blockSize pixels with memcmp(). Adjacent changed blocks of a row
+ *   are converted together.
+ * - previousMat is the frame converted into outImage last time, mat is converted in full
+ *   when it is empty or of another size or type.
+ */
+bool mat2Image_dirty(const cv::Mat &mat, const cv::Mat &previousMat, QImage &outImage, QRegion &changed,
+                     QImage::Format format, int blockSize, MatChannelOrder matRgbOrder)
+{
+    Q_ASSERT(blockSize > 0);
+
+    if (mat.empty() || blockSize <= 0 || previousMat.size() != mat.size() || previousMat.type() != mat.type()
+            || !isPreviousImage(mat, outImage, format)) {
+        changed = QRegion();
+        if (!mat2Image(mat, outImage, format, matRgbOrder))
+            return false;
+        changed = QRegion(outImage.rect());
+        return true;
+    }
+
+    return mat2Image_dirty(mat, outImage, changedBlocks(mat, previousMat, blockSize), changed, format, matRgbOrder);
+}
+
+/* Convert cv::Mat to QImage of the given size, such as a thumbnail for display
+ *
+ * - mat is resized by cv::resize() before its channels are converted, so only the small
+ *   result is converted and no full size QImage is created. When format has the same type
+ *   and channel order as mat, mat is resized into the QImage directly.
+ * - interpolation is one of cv::InterpolationFlags, -1 means cv::INTER_AREA for
+ *   downscaling and cv::INTER_LINEAR otherwise.
+ */
+QImage mat2Image_scaled(const cv::Mat &mat, const QSize &size, int interpolation, QImage::Format format,
+                        MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    QImage outImage;
+    mat2Image_scaled(mat, outImage, size, interpolation, format, matRgbOrder, colorTable);
+    return outImage;
+}
+
+/* Convert cv::Mat to QImage of the given size, and store the result in outImage
+ *
+ * - The data of outImage will be reused in the same way as mat2Image().
+ * - Return false if the cv::Mat or size is empty, or the depth of cv::Mat isn't supported.
+ */
+bool mat2Image_scaled(const cv::Mat &mat, QImage &outImage, const QSize &size, int interpolation, QImage::Format format,
+                      MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+    Q_ASSERT(format == QImage::Format_Invalid || pixelLayout(format).channels);
+
+    if (mat.empty() || size.isEmpty()) {
+        outImage = QImage();
+        return false;
+    }
+
+    if (size.width() == mat.cols && size.height() == mat.rows)
+        return mat2Image(mat, outImage, format, matRgbOrder, colorTable);
+
+    if (interpolation < 0)
+        interpolation = size.width() <= mat.cols && size.height() <= mat.rows ? cv::INTER_AREA : cv::INTER_LINEAR;
+    if (format == QImage::Format_Invalid)
+        format = defaultImageFormat(mat.channels());
+
+    const PixelLayout layout = pixelLayout(format);
+    const int mat_red = matRgbOrder == MCO_BGR ? 2 : 0;
+    if (layout.channels && sharedMatType(layout) == mat.type() && !layout.opaque && !layout.premultiplied
+            && (layout.channels == 1 || layout.red == mat_red)) {
+        prepareImage(outImage, size, format, colorTable);
+        cv::Mat dst = image2Mat_shared(outImage);
+        cv::resize(mat, dst, dst.size(), 0, 0, interpolation);
+        return true;
+    }
+
+    cv::Mat scaled;
+    cv::resize(mat, scaled, cv::Size(size.width(), size.height()), 0, 0, interpolation);
+    return mat2Image(scaled, outImage, format, matRgbOrder, colorTable);
+}
+
+/* Convert cv::Mat to QImage, mapping its values by v * alpha + beta
+ *
+ * - Same as cv::Mat::convertTo(CV_8U, alpha, beta) followed by mat2Image(), but done in the
+ *   same pass as the conversion, so no temporary cv::Mat is needed. The result is in the range
+ *   of 8-bit values, and multiplied by 257 for 16-bit formats.
+ */
+QImage mat2Image_linear(const cv::Mat &mat, double alpha, double beta, QImage::Format format,
+                        MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    QImage outImage;
+    mat2Image_linear(mat, outImage, alpha, beta, format, matRgbOrder, colorTable);
+    return outImage;
+}
+
+bool mat2Image_linear(const cv::Mat &mat, QImage &outImage, double alpha, double beta, QImage::Format format,
+                      MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    const ValueMapping mapping = makeMapping(alpha, beta);
+    return mat2ImageMapped(mat, outImage, format, matRgbOrder, colorTable, &mapping);
+}
+
+/* Convert cv::Mat to QImage, mapping the range of its values to the full range of QImage
+ *
+ * - NM_MinMax is the same as cv::normalize(NORM_MINMAX) followed by mat2Image(), but the values
+ *   are only read once to find the range, and then mapped in the same pass as the conversion.
+ * - NM_LogMinMax maps log(1 + v - min), which is useful for the spectrums of FFT.
+ */
+QImage mat2Image_normalized(const cv::Mat &mat, NormalizeMode mode, QImage::Format format,
+                            MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    QImage outImage;
+    mat2Image_normalized(mat, outImage, mode, format, matRgbOrder, colorTable);
+    return outImage;
+}
+
+bool mat2Image_normalized(const cv::Mat &mat, QImage &outImage, NormalizeMode mode, QImage::Format format,
+                          MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    if (mat.empty()) {
+        outImage = QImage();
+        return false;
+    }
+
+    double minVal, maxVal;
+    cv::minMaxLoc(mat.reshape(1), &minVal, &maxVal);
+    const double range = mode == NM_LogMinMax ? std::log(1. + (maxVal - minVal)) : maxVal - minVal;
+    //All values are mapped to 0 when they are the same, as cv::normalize() does
+    const double scale = range > std::numeric_limits<double>::epsilon() ? 255. / range : 0.;
+
+    const ValueMapping mapping = mode == NM_LogMinMax ? makeMapping(scale, -minVal, true)
+                                                      : makeMapping(scale, -minVal * scale);
+    return mat2ImageMapped(mat, outImage, format, matRgbOrder, colorTable, &mapping);
+}
+
+/* Convert cv::Mat to QImage, with the type, the format and the channel order known at compile time
+ *
+ * - Type of mat must be MatType, which is CV_8UC1, CV_8UC3 or CV_8UC4. Format is Indexed8, RGB888, RGB32,
+ *   ARGB32, or RGBX8888, RGBA8888, Grayscale8, BGR888 when provided by Qt.
+ * - The kernel of the combination is selected at compile time, and the result is stored in img
+ *   the same way as mat2Image() does.
+ */
+template<int MatType, QImage::Format Format, MatChannelOrder MatRgbOrder>
+bool convert(const cv::Mat &mat, QImage &img)
+{
+    const int matChannels = CV_MAT_CN(MatType);
+    const int matRed = MatRgbOrder == MCO_BGR ? 2 : 0;
+    Q_ASSERT(mat.empty() || mat.type() == MatType);
+
+    if (mat.empty() || mat.type() != MatType) {
+        img = QImage();
+        return false;
+    }
+
+    ConversionProbe probe(CD_Mat2Image, Format);
+    probe.setMat(mat);
+    prepareImage(img, QSize(mat.cols, mat.rows), Format, QVector<QRgb>());
+    convertRows(Mat2ImageInvoker(mat2ImageBest_<matChannels, matRed, FormatLayout<Format> >, mat, img.bits(), img.bytesPerLine(),
+                                 Format, MatRgbOrder, makeMapping(1.)),
+                mat.rows, mat.cols);
+    return true;
+}
+
+/* Convert QImage to cv::Mat, with the format, the type and the channel order known at compile time
+ *
+ * - Format of img must be Format, the supported ones are the same as the above.
+ * - The data of mat will be reused if its size and type are already the same as the result.
+ */
+template<QImage::Format Format, int MatType, MatChannelOrder MatRgbOrder>
+bool convert(const QImage &img, cv::Mat &mat)
+{
+    const int matChannels = CV_MAT_CN(MatType);
+    const int matRed = MatRgbOrder == MCO_BGR ? 2 : 0;
+    Q_ASSERT(img.isNull() || img.format() == Format);
+
+    if (img.isNull() || img.format() != Format) {
+        mat.release();
+        return false;
+    }
+
+    ConversionProbe probe(CD_Image2Mat, Format);
+    mat.create(img.height(), img.width(), MatType);
+    probe.setMat(mat);
+    convertRows(Image2MatInvoker(image2MatBest_<FormatLayout<Format>, matChannels, matRed>, img.constBits(), img.bytesPerLine(),
+                                 Format, mat, MatRgbOrder, 1.),
+                mat.rows, mat.cols);
+    return true;
+}
+
+#define QTOCV_INSTANTIATE_CONVERT(matType, format) \
+    template bool convert<matType, QImage::format, MCO_BGR>(const cv::Mat &, QImage &); \
+    template bool convert<matType, QImage::format, MCO_RGB>(const cv::Mat &, QImage &); \
+    template bool convert<QImage::format, matType, MCO_BGR>(const QImage &, cv::Mat &); \
+    template bool convert<QImage::format, matType, MCO_RGB>(const QImage &, cv::Mat &);
+
+#define QTOCV_INSTANTIATE_CONVERT_FORMAT(format) \
+    QTOCV_INSTANTIATE_CONVERT(CV_8UC1, format) \
+    QTOCV_INSTANTIATE_CONVERT(CV_8UC3, format) \
+    QTOCV_INSTANTIATE_CONVERT(CV_8UC4, format)
+
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_Indexed8)
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_RGB888)
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_RGB32)
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_ARGB32)
+#if QT_VERSION >= 0x050200
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_RGBX8888)
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_RGBA8888)
+#endif
+#if QT_VERSION >= 0x050500
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_Grayscale8)
+#endif
+#if QT_VERSION >= 0x050E00
+QTOCV_INSTANTIATE_CONVERT_FORMAT(Format_BGR888)
+#endif
+
+#undef QTOCV_INSTANTIATE_CONVERT_FORMAT
+#undef QTOCV_INSTANTIATE_CONVERT
+
+/* Everything a Mat2ImageConverter resolves up front
+ *
+ * - rowFunc is used when the conversion is one row kernel, or a copy when rowCopy is set,
+ *   otherwise func runs through the Mat2ImageInvoker as mat2Image() does.
+ */
+class Mat2ImageConverterPrivate
+{
+public:
+    Mat2ImageConverterPrivate()
+        : valid(false), matType(0), format(QImage::Format_Invalid), matRgbOrder(MCO_BGR), func(0)
+        , mapping(makeMapping(1.)), rowFunc(0), rowCopy(false), slowPath(false)
+    {
+    }
+
+    bool valid;
+    int matType;
+    QSize size;
+    QImage::Format format;
+    MatChannelOrder matRgbOrder;
+    QVector<QRgb> colorTable;
+    Mat2ImageFunc func;
+    ValueMapping mapping;
+    RowSwizzleFunc rowFunc;
+    bool rowCopy;
+    bool slowPath;
+    //Returned by run(mat), reused once the caller has released it
+    QImage image;
+};
+
+/* Plan of converting cv::Mat of matType and size to QImage of format
+ *
+ * - format Format_Invalid means selecting based on the channels, same as mat2Image().
+ * - scaleFactor 0 means the default scale of the depth, otherwise values are multiplied by it.
+ * - Not valid if the depth, the channels or the format isn't supported.
+ */
+Mat2ImageConverter::Mat2ImageConverter(int matType, const QSize &size, QImage::Format format, MatChannelOrder matRgbOrder,
+                                       double scaleFactor, const QVector<QRgb> &colorTable)
+    : d(new Mat2ImageConverterPrivate)
+{
+    const int channels = CV_MAT_CN(matType);
+    Q_ASSERT(channels==1 || channels==3 || channels==4);
+    Q_ASSERT(format == QImage::Format_Invalid || pixelLayout(format).channels);
+
+    d->matType = matType;
+    d->size = size;
+    d->matRgbOrder = matRgbOrder;
+    d->colorTable = colorTable;
+    d->format = format == QImage::Format_Invalid ? defaultImageFormat(channels) : format;
+
+    double defaultScale;
+    const PixelLayout layout = pixelLayout(d->format);
+    if (size.isEmpty() || !(channels==1 || channels==3 || channels==4) || !layout.channels
+            || !mat2ImageFunc(CV_MAT_DEPTH(matType), d->func, defaultScale))
+        return;
+
+    d->valid = true;
+    d->mapping = makeMapping(scaleFactor ? scaleFactor : defaultScale);
+    const cv::Mat mat(1, 1, matType);
+    d->slowPath = genericMat2Image(mat, layout, matRgbOrder, d->mapping, defaultScale);
+
+    //The same selection as mat2Image_<uchar>(), made once
+    const int mat_red = matRgbOrder == MCO_BGR ? 2 : 0;
+    if (d->func != mat2Image_<uchar> || d->mapping.scale != 1. || layout.depth16)
+        return;
+    if (layout.channels == 1) {
+        d->rowCopy = channels == 1;
+        d->rowFunc = channels == 1 ? 0 : rowGrayFunc(channels, mat_red);
+    } else if (channels != 1 && isSwizzleLayout(layout)) {
+        if (!layout.premultiplied)
+            d->rowFunc = rowSwizzleFunc(channels, layout.channels, layout.red != mat_red, layout.opaque);
+        else if (channels == 4)
+            d->rowFunc = rowPremultiplyFunc(layout.red != mat_red);
+    } else if (!layout.premultiplied) {
+        d->func = staticMat2ImageFunc(channels, mat_red, d->format);
+        Q_ASSERT(d->func);
+    }
+}
+
+Mat2ImageConverter::~Mat2ImageConverter()
+{
+    delete d;
+}
+
+bool Mat2ImageConverter::isValid() const
+{
+    return d->valid;
+}
+
+int Mat2ImageConverter::matType() const
+{
+    return d->matType;
+}
+
+QSize Mat2ImageConverter::size() const
+{
+    return d->size;
+}
+
+QImage::Format Mat2ImageConverter::format() const
+{
+    return d->format;
+}
+
+/* Convert mat, whose type and size must be the ones of the plan, to img
+ *
+ * - The data of img will be reused if its size and format are already the same as the result.
+ */
+bool Mat2ImageConverter::run(const cv::Mat &mat, QImage &img) const
+{
+    Q_ASSERT(d->valid);
+    Q_ASSERT(mat.type() == d->matType && mat.cols == d->size.width() && mat.rows == d->size.height());
+
+    if (!d->valid || mat.type() != d->matType || mat.cols != d->size.width() || mat.rows != d->size.height()) {
+        img = QImage();
+        return false;
+    }
+
+    ConversionProbe probe(CD_Mat2Image, d->format);
+    prepareImage(img, d->size, d->format, d->colorTable);
+    if (d->rowFunc || d->rowCopy) {
+        convertRows(RowFuncInvoker(d->rowFunc, mat.data, mat.step, img.bits(), img.bytesPerLine(), mat.cols, mat.cols * mat.elemSize()),
+                    mat.rows, mat.cols);
+    } else {
+        convertRows(Mat2ImageInvoker(d->func, mat, img.bits(), img.bytesPerLine(), d->format, d->matRgbOrder, d->mapping),
+                    mat.rows, mat.cols);
+    }
+    if (probe.isActive()) {
+        probe.setMat(mat);
+        probe.setSlowPath(d->slowPath);
+    }
+    return true;
+}
+
+//Convert mat to the QImage of this converter, a null QImage is returned on failure
+QImage Mat2ImageConverter::run(const cv::Mat &mat)
+{
+    if (!run(mat, d->image))
+        return QImage();
+    return d->image;
+}
+
+/* Everything an Image2MatConverter resolves up front
+ *
+ * - nativeFormat is the one images are converted to by QImage first, same as image2Mat(), when
+ *   format has no PixelLayout.
+ */
+class Image2MatConverterPrivate
+{
+public:
+    Image2MatConverterPrivate()
+        : valid(false), format(QImage::Format_Invalid), nativeFormat(QImage::Format_Invalid), matType(0)
+        , matRgbOrder(MCO_BGR), func(0), scaleFactor(1.), rowFunc(0), rowCopy(false), slowPath(false)
+    {
+    }
+
+    bool valid;
+    QImage::Format format;
+    QImage::Format nativeFormat;
+    QSize size;
+    int matType;
+    MatChannelOrder matRgbOrder;
+    Image2MatFunc func;
+    double scaleFactor;
+    RowSwizzleFunc rowFunc;
+    bool rowCopy;
+    bool slowPath;
+};
+
+/* Plan of converting QImage of format and size to cv::Mat of matType
+ *
+ * - matType CV_8UC(0) means the channels of format, same as image2Mat().
+ * - Not valid if the depth or the channels isn't supported.
+ */
+Image2MatConverter::Image2MatConverter(QImage::Format format, const QSize &size, int matType, MatChannelOrder matRgbOrder)
+    : d(new Image2MatConverterPrivate)
+{
+    Q_ASSERT(CV_MAT_CN(matType) == CV_CN_MAX || CV_MAT_CN(matType)==1 \
+             || CV_MAT_CN(matType)==3 || CV_MAT_CN(matType)==4);
+
+    d->format = format;
+    d->size = size;
+    d->matRgbOrder = matRgbOrder;
+    d->nativeFormat = nativeImage(QImage(1, 1, format)).format();
+
+    const PixelLayout layout = pixelLayout(d->nativeFormat);
+    const int channels = CV_MAT_CN(matType) == CV_CN_MAX ? layout.channels : CV_MAT_CN(matType);
+    d->matType = CV_MAKETYPE(CV_MAT_DEPTH(matType), channels);
+    if (format == QImage::Format_Invalid || size.isEmpty() || !(channels==1 || channels==3 || channels==4)
+            || !image2MatFunc(CV_MAT_DEPTH(matType), d->func, d->scaleFactor))
+        return;
+
+    d->valid = true;
+    d->slowPath = genericImage2Mat(layout, d->matType);
+
+    //The same selection as image2Mat_<uchar>(), made once
+    const int mat_red = matRgbOrder == MCO_BGR ? 2 : 0;
+    if (d->func != image2Mat_<uchar> || layout.depth16 || layout.premultiplied)
+        return;
+    if (layout.channels == 1 && channels == 1) {
+        d->rowCopy = true;
+    } else if (channels == 1 && isSwizzleLayout(layout)) {
+        d->rowFunc = rowGrayFunc(layout.channels, layout.red);
+    } else if (isSwizzleLayout(layout)) {
+        d->rowFunc = rowSwizzleFunc(layout.channels, channels, layout.red != mat_red);
+    } else {
+        d->func = staticImage2MatFunc(channels, mat_red, d->nativeFormat);
+        Q_ASSERT(d->func);
+    }
+}
+
+Image2MatConverter::~Image2MatConverter()
+{
+    delete d;
+}
+
+bool Image2MatConverter::isValid() const
+{
+    return d->valid;
+}
+
+QImage::Format Image2MatConverter::format() const
+{
+    return d->format;
+}
+
+QSize Image2MatConverter::size() const
+{
+    return d->size;
+}
+
+int Image2MatConverter::matType() const
+{
+    return d->matType;
+}
+
+/* Convert img, whose format and size must be the ones of the plan, to mat
+ *
+ * - The data of mat will be reused if its size and type are already the same as the result.
+ */
+bool Image2MatConverter::run(const QImage &img, cv::Mat &mat) const
+{
+    Q_ASSERT(d->valid);
+    Q_ASSERT(img.format() == d->format && img.size() == d->size);
+
+    if (!d->valid || img.format() != d->format || img.size() != d->size) {
+        mat.release();
+        return false;
+    }
+
+    ConversionProbe probe(CD_Image2Mat, d->format);
+    const QImage image = d->nativeFormat == d->format ? img : img.convertToFormat(d->nativeFormat);
+    mat.create(d->size.height(), d->size.width(), d->matType);
+    if (d->rowFunc || d->rowCopy) {
+        convertRows(RowFuncInvoker(d->rowFunc, image.constBits(), image.bytesPerLine(), mat.data, mat.step, mat.cols, mat.cols * mat.elemSize()),
+                    mat.rows, mat.cols);
+    } else {
+        convertRows(Image2MatInvoker(d->func, image.constBits(), image.bytesPerLine(), d->nativeFormat, mat, d->matRgbOrder, d->scaleFactor),
+                    mat.rows, mat.cols);
+    }
+    if (probe.isActive()) {
+        probe.setMat(mat);
+        probe.setSlowPath(d->slowPath);
+        probe.setExtraCopy(d->nativeFormat != d->format);
+    }
+    return true;
+}
+
+cv::Mat Image2MatConverter::run(const QImage &img) const
+{
+    cv::Mat mat;
+    run(img, mat);
+    return mat;
+}
+
+/* Convert a batch of images, such as the crops of detections, to cv::Mat
+ *
+ * - mats is resized to the number of images, and the data of each cv::Mat is reused
+ *   when its size and type match the result, same as image2Mat().
+ * - Images are converted in parallel when setConversionThreads() allows.
+ * - Return false if any image fails to convert, whose cv::Mat is empty.
+ */
+bool image2MatBatch(const QVector<QImage> &images, std::vector<cv::Mat> &mats, int matType, MatChannelOrder matRgbOrder)
+{
+    Q_ASSERT(CV_MAT_CN(matType) == CV_CN_MAX || CV_MAT_CN(matType)==1 \
+             || CV_MAT_CN(matType)==3 || CV_MAT_CN(matType)==4);
+
+    mats.resize(images.size());
+    std::vector<uchar> results(images.size(), 0);
+    convertImages(BatchInvoker(images, mats, results, matType, matRgbOrder), images.size());
+    return std::find(results.begin(), results.end(), 0) == results.end();
+}
+
+/* Pack a batch of images into one CV_32F tensor, such as the input of cv::dnn::Net
+ *
+ * - The tensor has 4 dimensions, N x C x H x W for TL_NCHW and N x H x W x C for TL_NHWC,
+ *   and C is 1 (gray) or 3 in the order of matRgbOrder.
+ * - Images are resized to size, empty size means the size of the first image.
+ * - Values are (v - mean) * scaleFactor for the 8-bit components v, same as cv::dnn::blobFromImages(),
+ *   and mean is in the channel order of the tensor.
+ * - The data of tensor is reused when its size is unchanged, images are converted in parallel
+ *   when setConversionThreads() allows.
+ * - Return false if images is empty or has a null image.
+ */
+bool image2Tensor(const QVector<QImage> &images, cv::Mat &tensor, const QSize &size, TensorLayout tensorLayout,
+                  int channels, MatChannelOrder matRgbOrder, double scaleFactor, const cv::Scalar &mean)
+{
+    Q_ASSERT(channels == 1 || channels == 3);
+
+    bool valid = !images.isEmpty() && (channels == 1 || channels == 3);
+    for (int i=0; valid && i<images.size(); ++i)
+        valid = !images[i].isNull();
+    const QSize tensorSize = size.isEmpty() && valid ? images[0].size() : size;
+    if (!valid || tensorSize.isEmpty()) {
+        tensor.release();
+        return false;
+    }
+
+    const int planarSizes[] = {images.size(), channels, tensorSize.height(), tensorSize.width()};
+    const int interleavedSizes[] = {images.size(), tensorSize.height(), tensorSize.width(), channels};
+    tensor.create(4, tensorLayout == TL_NCHW ? planarSizes : interleavedSizes, CV_32F);
+
+    TensorMapping mapping;
+    makeTensorMapping(mapping, channels, cv::Scalar::all(scaleFactor), mean * -scaleFactor);
+    convertImages(TensorInvoker(images, tensor, cv::Size(tensorSize.width(), tensorSize.height()), tensorLayout,
+                                channels, matRgbOrder, mapping),
+                  images.size());
+    return true;
+}
+
+/* Convert QImage to a planar CV_32F tensor, such as the input of cv::dnn::Net
+ *
+ * - mat has 4 dimensions, 1 x C x H x W, and C is 1 (gray) or 3 in the order of matRgbOrder.
+ * - Values are ((v / 255) - mean) / stddev for each channel, such as the mean (0.485, 0.456, 0.406)
+ *   and the stddev (0.229, 0.224, 0.225) of ImageNet in R G B order.
+ * - img is resized to size first when size isn't empty. Then the planes are written in one
+ *   pass from the scanlines, by SIMD kernels for the 3 and 4 channels formats.
+ * - The data of mat is reused when its size is unchanged, and rows of big images are
+ *   converted in parallel when setConversionThreads() allows.
+ * - Return false if img is null.
+ */
+bool image2Mat_planar(const QImage &img, cv::Mat &mat, const cv::Scalar &mean, const cv::Scalar &stddev, const QSize &size,
+                      int channels, MatChannelOrder matRgbOrder)
+{
+    Q_ASSERT(channels == 1 || channels == 3);
+    for (int c=0; c<channels; ++c)
+        Q_ASSERT(stddev[c] != 0);
+
+    if (img.isNull() || (channels != 1 && channels != 3)) {
+        mat.release();
+        return false;
+    }
+
+    const QSize planeSize = size.isEmpty() ? img.size() : size;
+    QImage image;
+    PixelLayout layout;
+    cv::Mat converted;
+    cv::Mat resized;
+    const cv::Mat src = tensorSource(img, cv::Size(planeSize.width(), planeSize.height()), image, layout, converted, resized);
+
+    const int sizes[] = {1, channels, src.rows, src.cols};
+    mat.create(4, sizes, CV_32F);
+
+    cv::Scalar scale;
+    cv::Scalar offset;
+    for (int c=0; c<channels; ++c) {
+        scale[c] = 1. / (255. * stddev[c]);
+        offset[c] = -mean[c] / stddev[c];
+    }
+    TensorMapping mapping;
+    makeTensorMapping(mapping, channels, scale, offset);
+    convertRows(PlanarRowsInvoker(src, layout, reinterpret_cast<float*>(mat.data), channels, matRgbOrder, mapping),
+                src.rows, src.cols);
+    return true;
+}
+
+/* Convert a YUV frame in the layout of OpenCV to QImage
+ *
+ * - See yuv2Image() with planes, the data of yuv is read in place.
+ */
+QImage yuv2Image(const cv::Mat &yuv, YuvFormat yuvFormat, QImage::Format format)
+{
+    QImage outImage;
+    yuv2Image(yuv, yuvFormat, outImage, format);
+    return outImage;
+}
+
+/* Convert a YUV frame in the layout of OpenCV to QImage, and store the result in outImage
+ *
+ * - Return false if yuv is empty, or its type or size doesn't match yuvFormat.
+ */
+bool yuv2Image(const cv::Mat &yuv, YuvFormat yuvFormat, QImage &outImage, QImage::Format format)
+{
+    const uchar *planes[3];
+    int strides[3];
+    QSize size;
+    if (yuv.empty() || !matYuvPlanes(yuv, yuvFormat, planes, strides, size)) {
+        outImage = QImage();
+        return false;
+    }
+    return yuv2Image(planes, strides, size, yuvFormat, outImage, format);
+}
+
+/* Convert a YUV frame given by its planes to QImage, and store the result in outImage
+ *
+ * - Rows are converted by SIMD kernels of fixed point, which write the 4 bytes pixels of
+ *   RGB32 / ARGB32 / RGBA8888 (and their X and premultiplied forms) directly. Those of
+ *   RGB888 and BGR888 are packed from them, other formats are converted from RGB888.
+ * - The data of outImage will be reused in the same way as mat2Image().
+ * - Return false if size is empty, or its width isn't even for YUYV and UYVY, whose pixels
+ *   are in pairs.
+ */
+bool yuv2Image(const uchar *const planes[3], const int strides[3], const QSize &size, YuvFormat yuvFormat,
+               QImage &outImage, QImage::Format format)
 {
-    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
-    Q_ASSERT(format == QImage::Format_ARGB32 || format == QImage::Format_RGB32 \
-             || format == QImage::Format_RGB888 || format == QImage::Format_Indexed8);
+    Q_ASSERT(pixelLayout(format).channels);
 
-    QImage outImage(mat.cols, mat.rows, format);
-    const int mat_channels = mat.channels();
-    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
-    const int mat_blue = 2 - mat_red;
+    const bool packed = yuvFormat == YF_YUYV || yuvFormat == YF_UYVY;
+    if (size.isEmpty() || (packed && size.width() % 2) || !planes[0] || !pixelLayout(format).channels) {
+        outImage = QImage();
+        return false;
+    }
 
-    if (format == QImage::Format_ARGB32 || format == QImage::Format_RGB32) {
-        for (int i=0; i<mat.rows; ++i) { //deal with one line by one lne
-            quint32 * data = reinterpret_cast<quint32*>(outImage.scanLine(i));
-            if (mat_channels == 1) {
-                for (int j=0; j<mat.cols; ++j) {
-                    uchar val = cv::saturate_cast<uchar>(mat.at<T>(i, j) * scalefactor);
-                    *data++ = qRgb(val, val, val);
-                }
-            } else if (mat_channels == 3) {
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec<T, 3> & vec = mat.at<cv::Vec<T,3> >(i, j);
-                    *data++ = qRgb(cv::saturate_cast<uchar>(vec[mat_red] * scalefactor),
-                                   cv::saturate_cast<uchar>(vec[1] * scalefactor),
-                                   cv::saturate_cast<uchar>(vec[mat_blue] * scalefactor));
-                }
-            } else { //channels == 4
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec<T, 4> & vec = mat.at<cv::Vec<T,4> >(i, j);
-                    *data++ = qRgba(cv::saturate_cast<uchar>(vec[mat_red] * scalefactor),
-                                    cv::saturate_cast<uchar>(vec[1] * scalefactor),
-                                    cv::saturate_cast<uchar>(vec[mat_blue] * scalefactor),
-                                    format == QImage::Format_ARGB32 ? cv::saturate_cast<uchar>(vec[3] * scalefactor) : 255);
-                }
-            }
-        }
-    } else if (format == QImage::Format_RGB888 /*R G B*/){
-        for (int i=0; i<mat.rows; ++i) {
-            uchar * data = outImage.scanLine(i);
-            if (mat_channels == 1) {
-                for (int j=0; j<mat.cols; ++j) {
-                    T val = cv::saturate_cast<uchar>(mat.at<T>(i, j) * scalefactor);
-                    *data++ = val;
-                    *data++ = val;
-                    *data++ = val;
-                }
-            } else if (mat_channels == 3) {
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec<T, 3> & vec = mat.at<cv::Vec<T,3> >(i, j);
-                    *data++ = cv::saturate_cast<uchar>(vec[mat_red] * scalefactor);
-                    *data++ = cv::saturate_cast<uchar>(vec[1] * scalefactor);
-                    *data++ = cv::saturate_cast<uchar>(vec[mat_blue] * scalefactor);
-                }
-            } else {
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec<T, 4> & vec = mat.at<cv::Vec<T,4> >(i, j);
-                    *data++ = cv::saturate_cast<uchar>(vec[mat_red] * scalefactor);
-                    *data++ = cv::saturate_cast<uchar>(vec[1] * scalefactor);
-                    *data++ = cv::saturate_cast<uchar>(vec[mat_blue] * scalefactor);
-                }
-            }
-        }
-    } else if (format == QImage::Format_Indexed8) {
-        QVector<QRgb> colorTable;
-        for (int i=0; i<256; ++i)
-            colorTable.append(qRgb(i,i,i));
-        outImage.setColorTable(colorTable);
+    ConversionProbe probe(CD_Mat2Image, format);
+    const bool direct = isSwizzleLayout(pixelLayout(format));
+    QImage converted;
+    QImage &image = direct ? outImage : converted;
+    prepareImage(image, size, direct ? format : QImage::Format_RGB888, QVector<QRgb>());
+    convertRows(Yuv2ImageInvoker(planes, strides, size, yuvFormat, image.bits(), image.bytesPerLine(),
+                                 pixelLayout(image.format())),
+                size.height(), size.width());
+    if (!direct)
+        outImage = converted.convertToFormat(format);
 
-        for (int i=0; i<mat.rows; ++i) {
-            uchar * data = outImage.scanLine(i);
-            if (mat_channels == 1) {
-                for (int j=0; j<mat.cols; ++j)
-                    *data++ = cv::saturate_cast<uchar>(mat.at<T>(i, j) * scalefactor);
-            } else if (mat_channels == 3) {
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec<T, 3> & vec = mat.at<cv::Vec<T,3> >(i, j);
-                    *data++  = cv::saturate_cast<uchar>((vec[mat_red] * 0.299 + vec[1] * 0.587 + vec[mat_blue]*0.114)*scalefactor);
-                }
-            } else {
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec<T, 4> & vec = mat.at<cv::Vec<T,4> >(i, j);
-                    *data++  = cv::saturate_cast<uchar>((vec[mat_red] * 0.299 + vec[1] * 0.587 + vec[mat_blue]*0.114)*scalefactor);
-                }
-            }
-        }
+    if (probe.isActive()) {
+        probe.setSlowPath(!direct);
+        probe.setExtraCopy(!direct);
     }
-
-    return outImage;
+    return true;
 }
 
-#if 1
-template<>
-QImage mat2Image_<uchar>(const cv::Mat & mat, QImage::Format format, QtOcv::MatChannelOrder matRgbOrder, double /*scalefactor*/)
+/* Convert QImage to a YUV frame in the layout of OpenCV
+ *
+ * - The data of yuv is reused when its size and type are unchanged.
+ * - Return false if img is null, or its width (and height for 4:2:0) isn't even.
+ */
+bool image2Yuv(const QImage &img, YuvFormat yuvFormat, cv::Mat &yuv)
 {
-    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
-    Q_ASSERT(format == QImage::Format_ARGB32 || format == QImage::Format_RGB32 \
-             || format == QImage::Format_RGB888 || format == QImage::Format_Indexed8);
+    const bool packed = yuvFormat == YF_YUYV || yuvFormat == YF_UYVY;
+    if (img.isNull() || img.width() % 2 || (!packed && img.height() % 2)) {
+        yuv.release();
+        return false;
+    }
 
-    QImage outImage(mat.cols, mat.rows, format);
-    const int mat_channels = mat.channels();
-    const int mat_red = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
-    const int mat_blue = 2 - mat_red;
+    if (packed)
+        yuv.create(img.height(), img.width(), CV_8UC2);
+    else
+        yuv.create(img.height() * 3 / 2, img.width(), CV_8UC1);
 
-    if (format == QImage::Format_ARGB32 || format == QImage::Format_RGB32) {
-        for (int i=0; i<mat.rows; ++i) {
-            quint32 * data = reinterpret_cast<quint32*>(outImage.scanLine(i));
-            if (mat_channels == 1) {
-                for (int j=0; j<mat.cols; ++j) {
-                    uchar val = mat.at<uchar>(i, j);
-                    *data++ = qRgb(val,val,val);
-                }
-            } else if (mat_channels == 3) {
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec3b & vec = mat.at<cv::Vec3b>(i, j);
-                    *data++ = qRgb(vec[mat_red], vec[1], vec[mat_blue]);
-                }
-            } else { //CV_8UC4
-                if (format == QImage::Format_ARGB32 && matRgbOrder == QtOcv::MCO_BGRA) {
-                    std::memcpy(data, mat.row(i).data, mat.cols*4);
-                } else {
-                    for (int j=0; j<mat.cols; ++j) {
-                        const cv::Vec4b & vec = mat.at<cv::Vec4b>(i, j);
-                        *data++ = qRgba(vec[mat_red], vec[1], vec[mat_blue], format==QImage::Format_ARGB32 ? vec[3]: 255);
-                    }
-                }
-            }
-        }
-    } else if (format == QImage::Format_RGB888 /*R G B*/){
-        for (int i=0; i<mat.rows; ++i) {
-            uchar * data = outImage.scanLine(i);
-            if (mat_channels == 1) {
-                for (int j=0; j<mat.cols; ++j) {
-                    uchar val = mat.at<uchar>(i, j);
-                    *data++ = val;
-                    *data++ = val;
-                    *data++ = val;
-                }
-            } else if (mat_channels == 3) {
-                if (matRgbOrder == QtOcv::MCO_RGB) {
-                    std::memcpy(data, mat.row(i).data, mat.cols*3);
-                } else {
-                    for (int j=0; j<mat.cols; ++j) {
-                        const cv::Vec3b & vec = mat.at<cv::Vec3b>(i, j);
-                        *data++ = vec[mat_red];
-                        *data++ = vec[1];
-                        *data++ = vec[mat_blue];
-                    }
-                }
-            } else {
-                for (int j=0; j<mat.cols; ++j) {
-                    const cv::Vec4b & vec = mat.at<cv::Vec4b>(i, j);
-                    *data++ = vec[mat_red];
-                    *data++ = vec[1];
-                    *data++ = vec[mat_blue];
-                }
-            }
-        }
-    } else if (format == QImage::Format_Indexed8) {
-        cv::Mat grayMat = mat;
-        if (mat_channels == 3)
-            cv::cvtColor(mat, grayMat, matRgbOrder == QtOcv::MCO_BGR ? CV_BGR2GRAY : CV_RGB2GRAY, 1);
-        else if (mat_channels == 4)
-            cv::cvtColor(mat, grayMat, matRgbOrder == QtOcv::MCO_BGR ? CV_BGRA2GRAY : CV_RGBA2GRAY, 1);
+    const uchar *planes[3];
+    int strides[3];
+    QSize size;
+    matYuvPlanes(yuv, yuvFormat, planes, strides, size);
+    uchar *outPlanes[3] = {yuv.data, const_cast<uchar*>(planes[1]), const_cast<uchar*>(planes[2])};
+    return image2Yuv(img, yuvFormat, outPlanes, strides);
+}
 
-        QVector<QRgb> colorTable;
-        for (int i=0; i<256; ++i)
-            colorTable.append(qRgb(i,i,i));
-        outImage.setColorTable(colorTable);
+/* Convert QImage to a YUV frame given by its planes
+ *
+ * - Chroma is the average of each 2 x 2 (or 2 x 1 for 4:2:2) pixels, those at an odd right
+ *   or bottom edge are averaged with fewer pixels.
+ * - Formats other than the 8-bit RGB ones with 3 or 4 channels are converted to RGB888 first.
+ * - Premultiplied colors are unpremultiplied first, same as image2Mat().
+ * - Return false if img is null, or its width isn't even for YUYV and UYVY, whose pixels
+ *   are in pairs.
+ */
+bool image2Yuv(const QImage &img, YuvFormat yuvFormat, uchar *const planes[3], const int strides[3])
+{
+    const bool packed = yuvFormat == YF_YUYV || yuvFormat == YF_UYVY;
+    if (img.isNull() || (packed && img.width() % 2) || !planes[0])
+        return false;
 
-        for (int i=0; i<grayMat.rows; ++i) {
-            uchar * data = outImage.scanLine(i);
-            std::memcpy(data, grayMat.row(i).data, grayMat.cols);
-        }
+    ConversionProbe probe(CD_Image2Mat, img.format());
+    const PixelLayout layout = pixelLayout(img.format());
+    const bool direct = isSwizzleLayout(layout) && !layout.premultiplied;
+    QImage::Format directFormat = QImage::Format_RGB888;
+    if (isSwizzleLayout(layout))
+        directFormat = straightFormat(img.format());
+    const QImage image = direct ? img : img.convertToFormat(directFormat);
+    const int rows = packed ? image.height() : (image.height() + 1) / 2;
+    convertRows(Image2YuvInvoker(image, yuvFormat, planes, strides), rows, image.width() * (packed ? 1 : 2));
+
+    if (probe.isActive()) {
+        probe.setSlowPath(!direct);
+        probe.setExtraCopy(!direct);
     }
+    return true;
+}
 
-    return outImage;
+/* Set the number of threads used by image2Mat() and mat2Image()
+ *
+ * - Rows of big images, and the images of batches, will be split across threads by the parallel framework of OpenCV.
+ * - 1 (default) means converting in the caller's thread, 0 means using cv::getNumThreads().
+ * - It can be called while other threads are converting, the conversions in progress keep the
+ *   number they started with.
+ */
+void setConversionThreads(int threads)
+{
+#if QT_VERSION >= 0x050000
+    conversionThreadCount.storeRelease(qMax(0, threads));
+#else
+    conversionThreadCount.fetchAndStoreRelease(qMax(0, threads));
+#endif
 }
+
+int conversionThreads()
+{
+#if QT_VERSION >= 0x050000
+    return conversionThreadCount.loadAcquire();
+#else
+    return conversionThreadCount;
 #endif
+}
 
-template<typename T>
-cv::Mat image2Mat_(const QImage &image, int matType, QtOcv::MatChannelOrder matRgbOrder, double scaleFactor)
+/* Collect the statistics of image2Mat() and mat2Image(), and the other functions built on them
+ *
+ * - One ConversionStats for each direction, QImage format and cv::Mat type, such as to find
+ *   the producers whose format makes the conversion take the slow path or an extra copy.
+ * - Disabled by default, and then nothing is measured. It can be switched at any time, such as
+ *   to scrape a running process for a while; the conversions in progress aren't affected.
+ */
+void setConversionStatsEnabled(bool enabled)
 {
-    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32 \
-             || image.format() == QImage::Format_RGB888 || image.format() == QImage::Format_Indexed8);
+#if QT_VERSION >= 0x050000
+    conversionStatsOn.storeRelease(enabled);
+#else
+    conversionStatsOn.fetchAndStoreRelease(enabled);
+#endif
+}
 
-    const int channels = CV_MAT_CN(matType);
-    cv::Mat mat = cv::Mat(image.height(), image.width(), matType);
+bool conversionStatsEnabled()
+{
+    return loadConversionStatsOn();
+}
 
-    if (channels == 1) {
-        for (int i=0; i<mat.rows; ++i) {
-            const uchar * data = image.scanLine(i);
-            if (image.format() == QImage::Format_Indexed8) {
-                for (int j=0; j<mat.cols; ++j)
-                    mat.at<T>(i, j) = *data * scaleFactor;
-            } else if (image.format() == QImage::Format_RGB888) {
-                for (int j=0; j<mat.cols; ++j, data+=3)
-                    mat.at<T>(i, j) = cv::saturate_cast<T>((data[0] * 0.299 + data[1] * 0.587 + data[2]*0.114) * scaleFactor);
-            } else {
-                const quint32 * d = reinterpret_cast<const quint32*>(data);
-                for (int j=0; j<mat.cols; ++j, d++)
-                    mat.at<T>(i, j) = cv::saturate_cast<T>((qRed(*d) * 0.299 + qGreen(*d) * 0.587 + qBlue(*d)*0.114) * scaleFactor);
-            }
-        }
-    } else if (channels == 3) {
-        for (int i=0; i<mat.rows; ++i) {
-            const uchar * data = image.scanLine(i);
-            if (image.format() == QImage::Format_Indexed8) {
-                for (int j=0; j<mat.cols; ++j, ++data) {
-                    T val = cv::saturate_cast<T>(*data * scaleFactor);
-                    mat.at<cv::Vec<T,3> >(i, j) = cv::Vec<T,3>(val, val, val);
-                }
-            } else if (image.format() == QImage::Format_RGB888) {
-                int first = matRgbOrder == QtOcv::MCO_BGR ? 2 : 0;
-                int third = 2 - first;
-                for (int j=0; j<mat.cols; ++j, data+=3) {
-                    cv::Vec<T,3> & vec = mat.at<cv::Vec<T,3> >(i, j);
-                    vec[0] = cv::saturate_cast<T>(data[first] * scaleFactor);
-                    vec[1] = cv::saturate_cast<T>(data[1] * scaleFactor);
-                    vec[2] = cv::saturate_cast<T>(data[third] * scaleFactor);
-                }
-            } else { //QImage::Format_RGB32 || QImage::Format_ARGB32
-                const quint32 * d = reinterpret_cast<const quint32*>(data);
-                for (int j=0; j<mat.cols; ++j, d++) {
-                    T r = cv::saturate_cast<T>(qRed(*d) * scaleFactor);
-                    T g = cv::saturate_cast<T>(qGreen(*d) * scaleFactor);
-                    T b = cv::saturate_cast<T>(qBlue(*d) * scaleFactor);
-                    mat.at<cv::Vec<T,3> >(i, j) = matRgbOrder==QtOcv::MCO_RGB ? cv::Vec<T,3>(r, g, b) : cv::Vec<T,3>(b, g, r);
-                }
-            }
-        }
-    } else if (channels == 4) {
-        T alpha = cv::saturate_cast<T>(255 * scaleFactor);
-        for (int i=0; i<mat.rows; ++i) {
-            const uchar * data = image.scanLine(i);
-            if (image.format() == QImage::Format_Indexed8) {
-                for (int j=0; j<mat.cols; ++j, ++data) {
-                    T val =  cv::saturate_cast<T>(*data * scaleFactor);
-                    mat.at<cv::Vec<T,4> >(i, j) = cv::Vec<T,4>(val, val, val, alpha);
-                }
-            } else if (image.format() == QImage::Format_RGB888) {
-                int first = matRgbOrder == QtOcv::MCO_BGRA ? 2 : 0;
-                int third = 2 - first;
-                for (int j=0; j<mat.cols; ++j, data+=3) {
-                    cv::Vec<T,4> &vec = mat.at<cv::Vec<T,4> >(i, j);
-                    vec[0] = cv::saturate_cast<T>(data[first] * scaleFactor);
-                    vec[1] = cv::saturate_cast<T>(data[1] * scaleFactor);
-                    vec[2] = cv::saturate_cast<T>(data[third] * scaleFactor);
-                    vec[3] = alpha;
-                }
-            } else { //QImage::Format_RGB32 || QImage::Format_ARGB32
-                const quint32 * d = reinterpret_cast<const quint32*>(data);
-                for (int j=0; j<mat.cols; ++j, d++) {
-                    T r = cv::saturate_cast<T>(qRed(*d) * scaleFactor);
-                    T g = cv::saturate_cast<T>(qGreen(*d) * scaleFactor);
-                    T b = cv::saturate_cast<T>(qBlue(*d) * scaleFactor);
-                    T a = cv::saturate_cast<T>(qAlpha(*d) * scaleFactor);
-                    mat.at<cv::Vec<T,4> >(i, j) = matRgbOrder==QtOcv::MCO_RGBA ? cv::Vec<T,4>(r, g, b, a) : cv::Vec<T,4>(b,g,r,a);
-                }
-            }
-        }
-    }
-    return mat;
+//Snapshot of the statistics collected so far, which can be read in any thread
+QVector<ConversionStats> conversionStats()
+{
+    ConversionStatsTable *table = conversionStatsTable();
+    QMutexLocker locker(&table->mutex);
+    QVector<ConversionStats> stats;
+    stats.reserve(table->stats.size());
+    for (QMap<qint64, ConversionStats>::const_iterator it = table->stats.constBegin(); it != table->stats.constEnd(); ++it)
+        stats.append(it.value());
+    return stats;
 }
 
-#if 1
-template<>
-cv::Mat image2Mat_<uchar>(const QImage &image, int matType, QtOcv::MatChannelOrder matRgbOrder, double /*scaleFactor*/ )
+void resetConversionStats()
 {
-    Q_ASSERT(CV_MAT_DEPTH(matType) == CV_8U);
-    Q_ASSERT(image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32 \
-             || image.format() == QImage::Format_RGB888 || image.format() == QImage::Format_Indexed8);
+    ConversionStatsTable *table = conversionStatsTable();
+    QMutexLocker locker(&table->mutex);
+    table->stats.clear();
+}
 
-    const int channels = CV_MAT_CN(matType);
-    cv::Mat mat = cv::Mat(image.height(), image.width(), matType);
+/* Set the function called after each conversion with the ConversionStats of that call
+ *
+ * - It is called in the thread which converts, such as to emit Q_TRACE(), LTTng or Perfetto
+ *   events of nsecs duration. 0 (default) means none.
+ * - Same as setConversionStatsEnabled(), it can be changed at any time. A conversion in progress
+ *   may still call the previous hook once, so it must stay callable after it is replaced.
+ */
+void setConversionTraceHook(ConversionTraceHook hook)
+{
+    void *value = reinterpret_cast<void*>(hook);
+#if QT_VERSION >= 0x050000
+    conversionTraceHook.storeRelease(value);
+#else
+    conversionTraceHook.fetchAndStoreRelease(value);
+#endif
+}
 
-    if (channels == 1) {
-        for (int i=0; i<mat.rows; ++i) {
-            const uchar * data = image.scanLine(i);
-            if (image.format() == QImage::Format_Indexed8) {
-                std::memcpy(mat.row(i).data, data, image.width());
-            } else if (image.format() == QImage::Format_RGB888) {
-                for (int j=0; j<mat.cols; ++j, data+=3)
-                    mat.at<uchar>(i, j) = (data[0] * 9798 + data[1] * 19238 + data[2]*3728)/32768;
-            } else {
-                const quint32 * d = reinterpret_cast<const quint32*>(data);
-                for (int j=0; j<mat.cols; ++j, d++)
-                    mat.at<uchar>(i, j) = (qRed(*d) * 9798 + qGreen(*d) * 19238 + qBlue(*d)*3728)/32768;
-            }
-        }
-    } else if (channels == 3) {
-        for (int i=0; i<mat.rows; ++i) {
-            const uchar * data = image.scanLine(i);
-            if (image.format() == QImage::Format_Indexed8) {
-                for (int j=0; j<mat.cols; ++j, ++data)
-                    mat.at<cv::Vec3b>(i, j) = cv::Vec3b(*data, *data, *data);
-            } else if (image.format() == QImage::Format_RGB888) {
-                if (matRgbOrder == QtOcv::MCO_RGB) {
-                    std::memcpy(mat.row(i).data, data, image.width()*3);
-                } else if (image.format() == QImage::Format_RGB888) { // BGR
-                    for (int j=0; j<mat.cols; ++j, data+=3)
-                        mat.at<cv::Vec3b>(i, j) = cv::Vec3b(data[2], data[1], data[0]);
-                }
-            } else { //QImage::Format_RGB32 || QImage::Format_ARGB32
-                const quint32 * d = reinterpret_cast<const quint32*>(data);
-                for (int j=0; j<mat.cols; ++j, d++) {
-                    mat.at<cv::Vec3b>(i, j) = matRgbOrder==QtOcv::MCO_RGB ? cv::Vec3b(qRed(*d), qGreen(*d), qBlue(*d))
-                                                                          : cv::Vec3b(qBlue(*d), qGreen(*d), qRed(*d));
-                }
-            }
-        }
-    } else if (channels == 4) {
-        for (int i=0; i<mat.rows; ++i) {
-            const uchar * data = image.scanLine(i);
-            if (image.format() == QImage::Format_Indexed8) {
-                for (int j=0; j<mat.cols; ++j, ++data)
-                    mat.at<cv::Vec4b>(i, j) = cv::Vec4b(*data, *data, *data, 255);
-            } else if (image.format() == QImage::Format_RGB888) {
-                int first = matRgbOrder == QtOcv::MCO_BGRA ? 2 : 0;
-                int third = 2 - first;
-                for (int j=0; j<mat.cols; ++j, data+=3)
-                    mat.at<cv::Vec4b>(i, j) = cv::Vec4b(data[first], data[1], data[third], 255);
-            } else { //QImage::Format_RGB32 || QImage::Format_ARGB32
-                if (matRgbOrder == QtOcv::MCO_BGRA && QSysInfo::ByteOrder == QSysInfo::LittleEndian) {
-                    std::memcpy(mat.row(i).data, data, image.width()*4);
-                } else {
-                    const quint32 * d = reinterpret_cast<const quint32*>(data);
-                    for (int j=0; j<mat.cols; ++j, d++) {
-                        mat.at<cv::Vec4b>(i, j) = matRgbOrder==QtOcv::MCO_RGBA ? cv::Vec4b(qRed(*d), qGreen(*d), qBlue(*d), qAlpha(*d))
-                                                                               : cv::Vec4b(qBlue(*d), qGreen(*d), qRed(*d), qAlpha(*d));
-                    }
-                }
-            }
-        }
-    }
-    return mat;
+/* Convert QImage to cv::Mat without data copy
+ *
+ * - Supported QImage format is QImage::Format_Indexed8, Format_RGB888, Format_RGB32, Format_ARGB32,
+ *   and Format_RGBX8888, Format_RGBA8888, Format_Grayscale8, Format_Grayscale16, Format_BGR888,
+ *   Format_RGBX64, Format_RGBA64 when provided by Qt
+ * - Type of generated cv::Mat is CV_8UC1, CV_8UC3(R G B order), CV_8UC4 (B G R A order in little endian system)
+ *   or CV_8UC4(A R G B order in big endian system) for the former formats. For the latter ones,
+ *   it is CV_8UC4 (R G B A), CV_8UC1, CV_16UC1, CV_8UC3 (B G R) and CV_16UC4 (R G B A).
+ */
+cv::Mat image2Mat_shared(const QImage &img)
+{
+    const PixelLayout layout = pixelLayout(img.format());
+    Q_ASSERT(img.isNull() || layout.channels);
+
+    if (img.isNull() || !layout.channels)
+        return cv::Mat();
+
+    return cv::Mat(img.height(), img.width(), sharedMatType(layout), (uchar*)img.bits(), img.bytesPerLine());
+}
+
+/* Convert  cv::Mat to QImage without data copy
+ *
+ * - Supported type of cv::Mat is CV_8UC1, CV_8UC3(R G B order)
+ *   , CV_8UC4 (B G R A order, in little endian system)
+ *   or CV_8UC4 (A R G B order, in big endian system)
+ * - QImage format is QImage::Format_Indexed8, Format_RGB888, Format_ARGB32 by default,
+ *   others formats of image2Mat_shared() can be used when the type of cv::Mat matches,
+ *   such as Format_BGR888 for CV_8UC3 (B G R order).
+ * - CV_16UC1 and CV_16UC4 (R G B A) are shared with Format_Grayscale16 and Format_RGBA64 by default.
+ * - colorTable is only used by QImage::Format_Indexed8, empty means the gray one.
+ */
+QImage mat2Image_shared(const cv::Mat &mat, QImage::Format format, const QVector<QRgb> &colorTable)
+{
+    format = sharedImageFormat(mat, format);
+    Q_ASSERT(format != QImage::Format_Invalid);
+
+    if (mat.empty() || format == QImage::Format_Invalid)
+        return QImage();
+
+    QImage img(mat.data, mat.cols, mat.rows, mat.step, format);
+    if (format == QImage::Format_Indexed8)
+        setIndexed8ColorTable(img, colorTable);
+
+    return img;
 }
+
+/* Convert QImage to cv::Mat without data copy, and keep the data alive
+ *
+ * - Same as image2Mat_shared(), but the cv::Mat holds a reference of img, so it
+ *   is still valid after img is destroyed and can be passed to other threads.
+ * - The data is shared with img as long as img is not modified (detached).
+ */
+cv::Mat image2Mat_refShared(const QImage &img)
+{
+    cv::Mat mat = image2Mat_shared(img);
+    if (mat.empty())
+        return mat;
+
+#if CV_MAJOR_VERSION >= 3
+    mat.u = qimageMatAllocator()->wrap(img);
+    mat.addref();
+#else
+    mat.refcount = qimageMatAllocator()->wrap(img);
+    mat.allocator = qimageMatAllocator();
 #endif
+    return mat;
+}
 
-} //namespace
+#if QT_VERSION >= 0x050000
+/* Convert cv::Mat to QImage without data copy, and keep the data alive
+ *
+ * - Same as mat2Image_shared(), but the QImage holds a reference of mat, so it
+ *   is still valid after mat is destroyed and can be passed through queued signals.
+ * - This needs mat to own its data. A cv::Mat wrapping user memory, such as cv::Mat(rows, cols, type, data)
+ *   or the frames of RawFrameReader::mat(), has no reference count, so the QImage dangles once that
+ *   memory is freed, same as mat2Image_shared(). clone() such a mat first.
+ * - Don't write new frames to mat (such as cv::VideoCapture::read()) while the QImage is in use,
+ *   as cv::Mat::create() reuses the buffer when the size and type are same.
+ */
+QImage mat2Image_refShared(const cv::Mat &mat, QImage::Format format, const QVector<QRgb> &colorTable)
+{
+    format = sharedImageFormat(mat, format);
+    Q_ASSERT(format != QImage::Format_Invalid);
 
-namespace QtOcv {
+    if (mat.empty() || format == QImage::Format_Invalid)
+        return QImage();
 
-/* Convert QImage to cv::Mat
+    QImage img(mat.data, mat.cols, mat.rows, mat.step, format, releaseSharedMat, new cv::Mat(mat));
+    if (format == QImage::Format_Indexed8)
+        setIndexed8ColorTable(img, colorTable);
+    return img;
+}
+#endif
+
+#if CV_MAJOR_VERSION >= 3
+/* Convert QImage to cv::UMat
  *
- * - Supported mat channels are 0, 1, 3, 4,  where 0 means selecting based on QImage's format
+ * - The raw data of QImage is uploaded, and then its channels and depth are converted by
+ *   cv::cvtColor() and convertTo() of cv::UMat, which run as OpenCL kernels when available.
+ * - Formats which cv::cvtColor() can't handle are converted by image2Mat() and then uploaded.
  */
-cv::Mat image2Mat(const QImage &img, int matType, MatChannelOrder matRgbOrder)
+cv::UMat image2UMat(const QImage &img, int matType, MatChannelOrder matRgbOrder)
+{
+    cv::UMat umat;
+    image2UMat(img, umat, matType, matRgbOrder);
+    return umat;
+}
+
+bool image2UMat(const QImage &img, cv::UMat &umat, int matType, MatChannelOrder matRgbOrder)
 {
     Q_ASSERT(CV_MAT_CN(matType) == CV_CN_MAX || CV_MAT_CN(matType)==1 \
              || CV_MAT_CN(matType)==3 || CV_MAT_CN(matType)==4);
 
-    if (img.isNull())
-        return cv::Mat();
-
-    QImage image;
-    switch (img.format()) {
-    case QImage::Format_Indexed8:
-    case QImage::Format_RGB32:
-    case QImage::Format_ARGB32:
-    case QImage::Format_RGB888:
-        image = img;
-        break;
-    case QImage::Format_Mono:
-    case QImage::Format_MonoLSB:
-        image = img.convertToFormat(QImage::Format_Indexed8);
-        break;
-    case QImage::Format_RGB444:
-    case QImage::Format_RGB555:
-    case QImage::Format_RGB666:
-    case QImage::Format_RGB16:
-        image = img.convertToFormat(QImage::Format_RGB888);
-        break;
-    default:
-        image = img.convertToFormat(QImage::Format_RGB32);
-        break;
+    if (img.isNull()) {
+        umat.release();
+        return false;
     }
 
-    const int channels = CV_MAT_CN(matType)==CV_CN_MAX ? image.depth()/8 : CV_MAT_CN(matType);
-    const int type = CV_MAKETYPE(matType, channels);
-    cv::Mat mat;
+    const QImage image = nativeImage(img);
+    const PixelLayout layout = pixelLayout(image.format());
+    const int type = CV_MAKETYPE(matType, CV_MAT_CN(matType)==CV_CN_MAX ? layout.channels : CV_MAT_CN(matType));
+    const DevicePlan plan = image2MatPlan(layout, type, matRgbOrder);
+    if (!plan.valid) {
+        cv::Mat mat;
+        if (!image2Mat(image, mat, type, matRgbOrder)) {
+            umat.release();
+            return false;
+        }
+        mat.copyTo(umat);
+        return true;
+    }
 
-    switch (CV_MAT_DEPTH(matType)) {
-    case CV_8U:
-        mat = image2Mat_<uchar>(image, type, matRgbOrder, 1.0);
-        break;
-    case CV_16U:
-        mat = image2Mat_<quint16>(image, type, matRgbOrder, 65535./255.);
-        break;
-    case CV_32S:
-        mat = image2Mat_<qint32>(image, type, matRgbOrder, 65535./255.);
-        break;
-    case CV_32F:
-        mat = image2Mat_<float>(image, type, matRgbOrder, 1./255.);
-        break;
-    case CV_64F:
-        mat = image2Mat_<double>(image, type, matRgbOrder, 1./255.);
-        break;
-    default:
-        break;
+    const cv::Mat raw = image2Mat_shared(image);
+    const bool scaling = CV_MAT_DEPTH(type) != CV_MAT_DEPTH(plan.rawType) || plan.scale != 1.;
+    if (plan.code < 0 && !scaling) {
+        raw.copyTo(umat);
+        return true;
     }
 
-    return mat;
+    cv::UMat uploaded;
+    raw.copyTo(uploaded);
+    if (!scaling) {
+        cv::cvtColor(uploaded, umat, plan.code);
+    } else if (plan.code < 0) {
+        uploaded.convertTo(umat, type, plan.scale);
+    } else {
+        cv::UMat colored;
+        cv::cvtColor(uploaded, colored, plan.code);
+        colored.convertTo(umat, type, plan.scale);
+    }
+    return true;
 }
 
-/* Convert cv::Mat to QImage
+/* Convert cv::UMat to QImage
  *
- * Channels of cv::Mat should be 1, 3, 4
- * Format of QImage should be ARGB32,RGB32,RGB888,Indexed8 or Invalid(means auto selection),
+ * - The channels and depth are converted on the device, and then the result is downloaded
+ *   into the data of outImage directly, which is reused in the same way as mat2Image().
  */
-QImage mat2Image(const cv::Mat & mat, QImage::Format format, MatChannelOrder matRgbOrder)
+QImage umat2Image(const cv::UMat &umat, QImage::Format format, MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
 {
-    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
-    Q_ASSERT(format == QImage::Format_ARGB32 || format == QImage::Format_RGB32 \
-             || format == QImage::Format_RGB888 || format == QImage::Format_Indexed8 \
-             || format == QImage::Format_Invalid);
+    QImage outImage;
+    umat2Image(umat, outImage, format, matRgbOrder, colorTable);
+    return outImage;
+}
 
-    if (mat.empty())
-        return QImage();
+bool umat2Image(const cv::UMat &umat, QImage &outImage, QImage::Format format, MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    Q_ASSERT(umat.channels()==1 || umat.channels()==3 || umat.channels()==4);
+    Q_ASSERT(format == QImage::Format_Invalid || pixelLayout(format).channels);
 
-    if (format == QImage::Format_Invalid) {
-        if (mat.channels() == 1)
-            format = QImage::Format_Indexed8;
-        else if (mat.channels() == 3)
-            format = QImage::Format_RGB888;
-        else
-            format = QImage::Format_ARGB32;
+    if (umat.empty() || (format != QImage::Format_Invalid && !pixelLayout(format).channels)) {
+        outImage = QImage();
+        return false;
     }
 
-    QImage outImage;
-    switch (mat.depth()) {
-    case CV_8U:
-        outImage = mat2Image_<uchar>(mat, format, matRgbOrder, 1.0);
-        break;
-    case CV_16U:
-        outImage = mat2Image_<quint16>(mat, format, matRgbOrder, 255./65535.);
-        break;
-    case CV_32S:
-        outImage = mat2Image_<qint32>(mat, format, matRgbOrder, 255./65535.);
-        break;
-    case CV_32F:
-        outImage = mat2Image_<float>(mat, format, matRgbOrder, 255.);
-        break;
-    case CV_64F:
-        outImage = mat2Image_<double>(mat, format, matRgbOrder, 255.);
-        break;
-    default:
-        break;
+    if (format == QImage::Format_Invalid)
+        format = defaultImageFormat(umat.channels());
+
+    const DevicePlan plan = mat2ImagePlan(umat.type(), matRgbOrder, pixelLayout(format));
+    if (!plan.valid)
+        return mat2Image(umat.getMat(cv::ACCESS_READ), outImage, format, matRgbOrder, colorTable);
+
+    cv::UMat data = umat;
+    if (umat.depth() != CV_MAT_DEPTH(plan.rawType) || plan.scale != 1.)
+        umat.convertTo(data, CV_MAKETYPE(CV_MAT_DEPTH(plan.rawType), umat.channels()), plan.scale);
+    if (plan.code >= 0) {
+        cv::UMat colored;
+        cv::cvtColor(data, colored, plan.code);
+        data = colored;
+    }
+    if (plan.secondCode >= 0) {
+        cv::UMat colored;
+        cv::cvtColor(data, colored, plan.secondCode);
+        data = colored;
     }
 
-    return outImage;
+    prepareImage(outImage, QSize(umat.cols, umat.rows), format, colorTable);
+    cv::Mat dst = image2Mat_shared(outImage);
+    data.copyTo(dst);
+    return true;
 }
+#endif
 
-/* Convert QImage to cv::Mat without data copy
+#ifdef QTOCV_WITH_CUDA
+/* Convert QImage to cv::cuda::GpuMat
  *
- * - Supported QImage format is QImage::Format_Indexed8, Format_RGB888, Format_RGB32, Format_ARGB32
- * - Type of generated cv::Mat is CV_8UC1, CV_8UC3(R G B order), CV_8UC4 (B G R A order in little endian system)
- *   or CV_8UC4(A R G B order in big endian system)
+ * - Same as image2UMat(), but the channels and depth are converted by CUDA kernels in stream.
+ * - Temporary buffers come from cv::cuda::BufferPool of stream, so enable it by
+ *   cv::cuda::setBufferPoolUsage() to avoid the synchronization of the default allocator.
  */
-cv::Mat image2Mat_shared(const QImage &img)
+bool image2GpuMat(const QImage &img, cv::cuda::GpuMat &gpuMat, int matType, MatChannelOrder matRgbOrder, cv::cuda::Stream &stream)
 {
-    Q_ASSERT(img.format() == QImage::Format_Indexed8 || img.format() == QImage::Format_RGB888
-             || img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32);
+    Q_ASSERT(CV_MAT_CN(matType) == CV_CN_MAX || CV_MAT_CN(matType)==1 \
+             || CV_MAT_CN(matType)==3 || CV_MAT_CN(matType)==4);
 
-    if (img.isNull())
-        return cv::Mat();
+    if (img.isNull()) {
+        gpuMat.release();
+        return false;
+    }
 
-    switch (img.format()) {
-    case QImage::Format_Indexed8:
-    case QImage::Format_RGB888:
-    case QImage::Format_RGB32:
-    case QImage::Format_ARGB32:
-        return cv::Mat(img.height(), img.width(), CV_8UC(img.depth()/8), (uchar*)img.bits(), img.bytesPerLine());
-    default:
-        return cv::Mat();
+    const QImage image = nativeImage(img);
+    const PixelLayout layout = pixelLayout(image.format());
+    const int type = CV_MAKETYPE(matType, CV_MAT_CN(matType)==CV_CN_MAX ? layout.channels : CV_MAT_CN(matType));
+    const DevicePlan plan = image2MatPlan(layout, type, matRgbOrder);
+    if (!plan.valid) {
+        cv::Mat mat;
+        if (!image2Mat(image, mat, type, matRgbOrder)) {
+            gpuMat.release();
+            return false;
+        }
+        gpuMat.upload(mat, stream);
+        return true;
+    }
+
+    const cv::Mat raw = image2Mat_shared(image);
+    const bool scaling = CV_MAT_DEPTH(type) != CV_MAT_DEPTH(plan.rawType) || plan.scale != 1.;
+    if (plan.code < 0 && !scaling) {
+        gpuMat.upload(raw, stream);
+        return true;
+    }
+
+    cv::cuda::BufferPool pool(stream);
+    cv::cuda::GpuMat uploaded = pool.getBuffer(raw.rows, raw.cols, raw.type());
+    uploaded.upload(raw, stream);
+    if (!scaling) {
+        cv::cuda::cvtColor(uploaded, gpuMat, plan.code, 0, stream);
+    } else if (plan.code < 0) {
+        uploaded.convertTo(gpuMat, type, plan.scale, 0., stream);
+    } else {
+        cv::cuda::GpuMat colored = pool.getBuffer(raw.rows, raw.cols, CV_MAKETYPE(raw.depth(), CV_MAT_CN(type)));
+        cv::cuda::cvtColor(uploaded, colored, plan.code, 0, stream);
+        colored.convertTo(gpuMat, type, plan.scale, 0., stream);
     }
+    return true;
 }
 
-/* Convert  cv::Mat to QImage without data copy
+/* Convert cv::cuda::GpuMat to QImage
  *
- * - Supported type of cv::Mat is CV_8UC1, CV_8UC3(R G B order)
- *   , CV_8UC4 (B G R A order, in little endian system)
- *   or CV_8UC4 (A R G B order, in big endian system)
- * - QImage format is QImage::Format_Indexed8, Format_RGB888, Format_ARGB32
+ * - Same as umat2Image(), but the channels and depth are converted by CUDA kernels in stream.
+ * - The data of outImage isn't page-locked, so the download waits for stream.
  */
-QImage mat2Image_shared(const cv::Mat &mat)
+bool gpuMat2Image(const cv::cuda::GpuMat &gpuMat, QImage &outImage, QImage::Format format, MatChannelOrder matRgbOrder,
+                  const QVector<QRgb> &colorTable, cv::cuda::Stream &stream)
 {
-    Q_ASSERT(mat.type() == CV_8UC1 || mat.type() == CV_8UC3 || mat.type() == CV_8UC4);
+    Q_ASSERT(gpuMat.channels()==1 || gpuMat.channels()==3 || gpuMat.channels()==4);
+    Q_ASSERT(format == QImage::Format_Invalid || pixelLayout(format).channels);
 
-    if (mat.empty())
-        return QImage();
+    if (gpuMat.empty() || (format != QImage::Format_Invalid && !pixelLayout(format).channels)) {
+        outImage = QImage();
+        return false;
+    }
 
-    QImage img;
-    if (mat.type() == CV_8UC1) {
-        img = QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_Indexed8);
-        QVector<QRgb> colorTable;
-        for (int i=0; i<256; ++i)
-            colorTable.append(qRgb(i,i,i));
-        img.setColorTable(colorTable);
-    } else if (mat.type() == CV_8UC3) {
-        img = QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_RGB888);
-    } else if (mat.type() == CV_8UC4) {
-        img = QImage(mat.data, mat.cols, mat.rows, mat.step, QImage::Format_ARGB32);
+    if (format == QImage::Format_Invalid)
+        format = defaultImageFormat(gpuMat.channels());
+
+    const PixelLayout layout = pixelLayout(format);
+    const DevicePlan plan = mat2ImagePlan(gpuMat.type(), matRgbOrder, layout);
+    if (!plan.valid) {
+        cv::Mat mat;
+        gpuMat.download(mat, stream);
+        stream.waitForCompletion();
+        return mat2Image(mat, outImage, format, matRgbOrder, colorTable);
     }
 
-    return img;
+    //Buffers of the pool must be released in reverse order, so none of them is reassigned
+    cv::cuda::BufferPool pool(stream);
+    const int depth = CV_MAT_DEPTH(plan.rawType);
+    cv::cuda::GpuMat scaled, colored, opaque;
+    const cv::cuda::GpuMat *data = &gpuMat;
+    if (gpuMat.depth() != depth || plan.scale != 1.) {
+        scaled = pool.getBuffer(gpuMat.rows, gpuMat.cols, CV_MAKETYPE(depth, gpuMat.channels()));
+        gpuMat.convertTo(scaled, scaled.type(), plan.scale, 0., stream);
+        data = &scaled;
+    }
+    if (plan.code >= 0) {
+        colored = pool.getBuffer(gpuMat.rows, gpuMat.cols, CV_MAKETYPE(depth, plan.secondCode >= 0 ? 3 : layout.channels));
+        cv::cuda::cvtColor(*data, colored, plan.code, 0, stream);
+        data = &colored;
+    }
+    if (plan.secondCode >= 0) {
+        opaque = pool.getBuffer(gpuMat.rows, gpuMat.cols, plan.rawType);
+        cv::cuda::cvtColor(*data, opaque, plan.secondCode, 0, stream);
+        data = &opaque;
+    }
+
+    prepareImage(outImage, QSize(gpuMat.cols, gpuMat.rows), format, colorTable);
+    cv::Mat dst = image2Mat_shared(outImage);
+    data->download(dst, stream);
+    return true;
 }
+#endif
 
 } //namespace QtOcv
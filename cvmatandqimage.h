@@ -27,7 +27,12 @@
 #define CVMATANDQIMAGE_H
 
 #include <QImage>
+#include <QRegion>
 #include <opencv2/core/core.hpp>
+#include <vector>
+#ifdef QTOCV_WITH_CUDA
+#include <opencv2/core/cuda.hpp>
+#endif
 
 namespace cv {
 class Mat;
@@ -43,14 +48,220 @@ enum MatChannelOrder
     MCO_BGRA = MCO_BGR
 };
 
+enum NormalizeMode
+{
+    NM_MinMax,
+    NM_LogMinMax
+};
+
+//Layouts of YUV frames, NV12 and NV21 are semi-planar, I420 and YV12 are planar, YUYV and UYVY are packed 4:2:2
+enum YuvFormat
+{
+    YF_NV12,
+    YF_NV21,
+    YF_I420,
+    YF_YV12,
+    YF_YUYV,
+    YF_UYVY
+};
+
+enum TensorLayout
+{
+    TL_NCHW,
+    TL_NHWC
+};
+
 //Standard convert, MatChannelOrder will be skipped if cv::Mat has only one channel
+//colorTable of Indexed8 result is a shared gray table by default, or the palette given by caller
+//Premultiplied formats are premultiplied by mat2Image() and unpremultiplied by image2Mat(), such as ARGB32_Premultiplied for painting
 cv::Mat image2Mat(const QImage &img, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
-QImage mat2Image(const cv::Mat &mat, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR);
+QImage mat2Image(const cv::Mat &mat, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                 const QVector<QRgb> &colorTable = QVector<QRgb>());
+
+//Convert into caller-owned storage, which will be reused when its size and format(type) match the result
+bool image2Mat(const QImage &img, cv::Mat &mat, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+bool mat2Image(const cv::Mat &mat, QImage &img, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+               const QVector<QRgb> &colorTable = QVector<QRgb>());
+
+//Convert a region in place. A ROI of cv::Mat (mat(rect)) can be passed to any function directly.
+//image2Mat reads only rect of img, mat2Image writes mat into img at pos, keeping the rest of img.
+bool image2Mat(const QImage &img, const QRect &rect, cv::Mat &mat, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+bool mat2Image(const cv::Mat &mat, QImage &img, const QPoint &pos, MatChannelOrder matRgbOrder = MCO_BGR);
+
+//Convert only what changed since the previous frame, whose result img holds, such as for the static scenes of fixed
+//cameras. The areas are given by dirtyRects, or found by comparing mat with previousMat in blocks. changed is the area
+//written, for QWidget::update(). img is converted in full when it isn't of the size and format of the result
+bool mat2Image_dirty(const cv::Mat &mat, QImage &img, const std::vector<cv::Rect> &dirtyRects, QRegion &changed,
+                     QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR);
+bool mat2Image_dirty(const cv::Mat &mat, const cv::Mat &previousMat, QImage &img, QRegion &changed,
+                     QImage::Format format = QImage::Format_Invalid, int blockSize = 16, MatChannelOrder matRgbOrder = MCO_BGR);
+
+//Resize and convert, so that no full size QImage is created for a thumbnail.
+//interpolation is one of cv::InterpolationFlags, -1 means INTER_AREA for downscaling and INTER_LINEAR otherwise
+QImage mat2Image_scaled(const cv::Mat &mat, const QSize &size, int interpolation = -1, QImage::Format format = QImage::Format_Invalid,
+                        MatChannelOrder matRgbOrder = MCO_BGR, const QVector<QRgb> &colorTable = QVector<QRgb>());
+bool mat2Image_scaled(const cv::Mat &mat, QImage &img, const QSize &size, int interpolation = -1, QImage::Format format = QImage::Format_Invalid,
+                      MatChannelOrder matRgbOrder = MCO_BGR, const QVector<QRgb> &colorTable = QVector<QRgb>());
+
+//Map values by v*alpha+beta, or the range of values to 0..255, in the same pass as the conversion.
+//The result is in the range of 8-bit values, which is multiplied by 257 for 16-bit formats
+QImage mat2Image_linear(const cv::Mat &mat, double alpha, double beta, QImage::Format format = QImage::Format_Invalid,
+                        MatChannelOrder matRgbOrder = MCO_BGR, const QVector<QRgb> &colorTable = QVector<QRgb>());
+bool mat2Image_linear(const cv::Mat &mat, QImage &img, double alpha, double beta, QImage::Format format = QImage::Format_Invalid,
+                      MatChannelOrder matRgbOrder = MCO_BGR, const QVector<QRgb> &colorTable = QVector<QRgb>());
+QImage mat2Image_normalized(const cv::Mat &mat, NormalizeMode mode = NM_MinMax, QImage::Format format = QImage::Format_Invalid,
+                            MatChannelOrder matRgbOrder = MCO_BGR, const QVector<QRgb> &colorTable = QVector<QRgb>());
+bool mat2Image_normalized(const cv::Mat &mat, QImage &img, NormalizeMode mode = NM_MinMax, QImage::Format format = QImage::Format_Invalid,
+                          MatChannelOrder matRgbOrder = MCO_BGR, const QVector<QRgb> &colorTable = QVector<QRgb>());
+
+//Convert with the types and channel order known at compile time, such as convert<CV_8UC3, QImage::Format_RGB32, MCO_BGR>(mat, img),
+//so each combination is a loop without runtime selection. Provided for CV_8UC1, CV_8UC3, CV_8UC4 and the 8-bit formats:
+//Indexed8, RGB888, RGB32, ARGB32, and RGBX8888, RGBA8888, Grayscale8, BGR888 when provided by Qt
+template<int MatType, QImage::Format Format, MatChannelOrder MatRgbOrder>
+bool convert(const cv::Mat &mat, QImage &img);
+template<QImage::Format Format, int MatType, MatChannelOrder MatRgbOrder>
+bool convert(const QImage &img, cv::Mat &mat);
+
+class Mat2ImageConverterPrivate;
+class Image2MatConverterPrivate;
+
+//Plans of repeated conversions of the same type, size and format, such as the frames of a stream.
+//The kernel, value mapping and color table are resolved once, so run() only checks the size and type and converts.
+//scaleFactor 0 means the default scale of the depth, the other parameters are the same as mat2Image() and image2Mat()
+class Mat2ImageConverter
+{
+public:
+    Mat2ImageConverter(int matType, const QSize &size, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                       double scaleFactor = 0., const QVector<QRgb> &colorTable = QVector<QRgb>());
+    ~Mat2ImageConverter();
+
+    bool isValid() const;
+    int matType() const;
+    QSize size() const;
+    QImage::Format format() const;
+
+    bool run(const cv::Mat &mat, QImage &img) const;
+    //The result shares the buffer of the converter, which is reused by the next run() once the result is released
+    QImage run(const cv::Mat &mat);
+
+private:
+    Q_DISABLE_COPY(Mat2ImageConverter)
+    Mat2ImageConverterPrivate *d;
+};
+
+class Image2MatConverter
+{
+public:
+    Image2MatConverter(QImage::Format format, const QSize &size, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+    ~Image2MatConverter();
+
+    bool isValid() const;
+    QImage::Format format() const;
+    QSize size() const;
+    //The resolved one, whose channels are never CV_CN_MAX
+    int matType() const;
+
+    bool run(const QImage &img, cv::Mat &mat) const;
+    cv::Mat run(const QImage &img) const;
+
+private:
+    Q_DISABLE_COPY(Image2MatConverter)
+    Image2MatConverterPrivate *d;
+};
+
+//Convert a batch of images, such as the crops of detections, in parallel across the images.
+//image2Tensor packs them into one CV_32F tensor of N x C x H x W (or N x H x W x C) with 1 or 3 channels,
+//resized to size (empty means the size of the first one), of (v - mean) * scaleFactor like cv::dnn::blobFromImages()
+bool image2MatBatch(const QVector<QImage> &images, std::vector<cv::Mat> &mats, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+bool image2Tensor(const QVector<QImage> &images, cv::Mat &tensor, const QSize &size = QSize(), TensorLayout tensorLayout = TL_NCHW,
+                  int channels = 3, MatChannelOrder matRgbOrder = MCO_BGR, double scaleFactor = 1./255., const cv::Scalar &mean = cv::Scalar());
+
+//Convert to a planar CV_32F tensor of 1 x C x H x W in one pass, resized to size (empty means no resize),
+//with ((v / 255) - mean) / stddev for each channel in the order of matRgbOrder, such as the DNN input of
+//ImageNet models: mean (0.485, 0.456, 0.406) and stddev (0.229, 0.224, 0.225) in MCO_RGB
+bool image2Mat_planar(const QImage &img, cv::Mat &mat, const cv::Scalar &mean, const cv::Scalar &stddev = cv::Scalar::all(1.),
+                      const QSize &size = QSize(), int channels = 3, MatChannelOrder matRgbOrder = MCO_BGR);
+
+//Convert YUV frames of cameras and decoders to QImage in one pass, without a cv::cvtColor() to BGR first, or
+//the reverse for encoders. BT.601 limited range, the same as cv::COLOR_YUV2BGR_NV12 and so on. cv::Mat has the layout
+//of OpenCV: CV_8UC1 of height * 3 / 2 rows for 4:2:0 (continuous for I420 and YV12), CV_8UC2 of even width for YUYV and UYVY.
+//planes are in the order of the format with their own strides: Y and UV (VU) for NV12 (NV21), Y, U and V for I420,
+//Y, V and U for YV12, and the packed pixels for YUYV and UYVY. Alpha of the QImage is ignored by image2Yuv
+QImage yuv2Image(const cv::Mat &yuv, YuvFormat yuvFormat, QImage::Format format = QImage::Format_RGB32);
+bool yuv2Image(const cv::Mat &yuv, YuvFormat yuvFormat, QImage &img, QImage::Format format = QImage::Format_RGB32);
+bool yuv2Image(const uchar *const planes[3], const int strides[3], const QSize &size, YuvFormat yuvFormat, QImage &img,
+               QImage::Format format = QImage::Format_RGB32);
+bool image2Yuv(const QImage &img, YuvFormat yuvFormat, cv::Mat &yuv);
+bool image2Yuv(const QImage &img, YuvFormat yuvFormat, uchar *const planes[3], const int strides[3]);
+
+//Split the rows of big images, and the images of batches, across threads, 1 (default) means no, 0 means cv::getNumThreads()
+void setConversionThreads(int threads);
+int conversionThreads();
+
+enum ConversionDirection
+{
+    CD_Image2Mat,
+    CD_Mat2Image
+};
+
+//Calls of one direction, QImage format and cv::Mat type. For image2Mat() format is the one of the source,
+//which is converted by QImage first (counted in extraCopyCalls) when it isn't supported natively
+struct ConversionStats
+{
+    ConversionStats() : direction(CD_Image2Mat), matType(0), format(QImage::Format_Invalid), calls(0), bytes(0), nsecs(0)
+      , slowPathCalls(0), extraCopyCalls(0) {}
+
+    ConversionDirection direction;
+    int matType;
+    QImage::Format format;
+    qint64 calls;
+    qint64 bytes;           //of the cv::Mat
+    qint64 nsecs;
+    qint64 slowPathCalls;   //generic per-pixel loops instead of memcpy, SIMD kernels or cv::Mat::convertTo()
+    qint64 extraCopyCalls;  //QImage::convertToFormat() or copy() before the conversion
+};
+
+//Statistics of image2Mat() and mat2Image() (and the functions built on them), disabled by default.
+//The hook is called after each conversion with the stats of that call, such as to emit trace events
+typedef void (*ConversionTraceHook)(const ConversionStats &stats);
+void setConversionStatsEnabled(bool enabled);
+bool conversionStatsEnabled();
+QVector<ConversionStats> conversionStats();
+void resetConversionStats();
+void setConversionTraceHook(ConversionTraceHook hook);
 
 //Convert without data copy. MatChannelOrder should be R G B (3 channels) ,B G R A(4 channels in little endian system)
-//or A R G B (4 channels in big endian system)
+//or A R G B (4 channels in big endian system). Newer Qt formats map to CV_8UC4(R G B A) for RGBA8888,
+//CV_8UC1 for Grayscale8, CV_16UC1 for Grayscale16, CV_8UC3(B G R) for BGR888 and CV_16UC4(R G B A) for RGBA64
 cv::Mat image2Mat_shared(const QImage &img);
-QImage mat2Image_shared(const cv::Mat &mat);
+QImage mat2Image_shared(const cv::Mat &mat, QImage::Format format = QImage::Format_Invalid, const QVector<QRgb> &colorTable = QVector<QRgb>());
+
+//Convert without data copy, the result holds a reference of the source, so it stays valid
+//after the source is destroyed. The source mustn't be overwritten while the result is in use.
+//A cv::Mat wrapping user memory, such as cv::Mat(rows, cols, type, data), has no reference to hold,
+//so mat2Image_refShared() of it is valid only as long as that memory is
+cv::Mat image2Mat_refShared(const QImage &img);
+#if QT_VERSION >= 0x050000
+QImage mat2Image_refShared(const cv::Mat &mat, QImage::Format format = QImage::Format_Invalid, const QVector<QRgb> &colorTable = QVector<QRgb>());
+#endif
+
+#if CV_MAJOR_VERSION >= 3
+//Upload the raw data of QImage, and convert the channels and depth on the device (OpenCL when available), or the reverse
+cv::UMat image2UMat(const QImage &img, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+bool image2UMat(const QImage &img, cv::UMat &umat, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR);
+QImage umat2Image(const cv::UMat &umat, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                  const QVector<QRgb> &colorTable = QVector<QRgb>());
+bool umat2Image(const cv::UMat &umat, QImage &img, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                const QVector<QRgb> &colorTable = QVector<QRgb>());
+#endif
+
+#ifdef QTOCV_WITH_CUDA
+//Same as the cv::UMat versions, but converted by CUDA kernels in stream. Needs opencv_cudaimgproc
+bool image2GpuMat(const QImage &img, cv::cuda::GpuMat &gpuMat, int matType = CV_8UC(0), MatChannelOrder matRgbOrder = MCO_BGR,
+                  cv::cuda::Stream &stream = cv::cuda::Stream::Null());
+bool gpuMat2Image(const cv::cuda::GpuMat &gpuMat, QImage &img, QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                  const QVector<QRgb> &colorTable = QVector<QRgb>(), cv::cuda::Stream &stream = cv::cuda::Stream::Null());
+#endif
 
 } //namespace QtOcv
 
@@ -1,52 +1,200 @@
 #include "cameradevice.h"
-#include <QTimer>
+#include <QThread>
 #include <QImage>
+#include <QMutexLocker>
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "cvmatandqimage.h"
 
-CameraDevice::CameraDevice(QObject *parent) :
-    QObject(parent)
+//Run one of the loops of CameraDevice
+class CameraThread : public QThread
 {
-    m_capture = new cv::VideoCapture;
-    m_timer = new QTimer(this);
+public:
+    typedef void (CameraDevice::*Loop)();
+
+    CameraThread(CameraDevice *device, Loop loop) :
+        QThread(device), m_device(device), m_loop(loop)
+    {
+    }
+
+protected:
+    void run()
+    {
+        (m_device->*m_loop)();
+    }
+
+private:
+    CameraDevice *m_device;
+    Loop m_loop;
+};
+
+namespace {
+//Moving average of the recent frames, in milliseconds
+void average(double &value, qint64 nsecs, qint64 samples)
+{
+    const double ms = nsecs / 1000000.0;
+    value = samples ? value + (ms - value) / 16 : ms;
+}
+} //namespace
 
-    connect(m_timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+CameraDevice::CameraDevice(int cameraIndex, QObject *parent) :
+    QObject(parent), m_cameraIndex(cameraIndex), m_notifyPending(0)
+{
+    m_capture = new cv::VideoCapture;
+    m_captureThread = new CameraThread(this, &CameraDevice::captureLoop);
+    m_convertThread = new CameraThread(this, &CameraDevice::convertLoop);
 }
 
 CameraDevice::~CameraDevice()
 {
+    stop();
     delete m_capture;
     m_capture = NULL;
 }
 
+void CameraDevice::setPreviewSize(const QSize &size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_previewSize = size;
+}
+
+void CameraDevice::setDropPolicy(FrameQueue::DropPolicy policy)
+{
+    m_queue.setDropPolicy(policy);
+}
+
+CaptureStats CameraDevice::stats() const
+{
+    QMutexLocker locker(&m_mutex);
+    CaptureStats stats = m_stats;
+    stats.dropped = m_queue.droppedCount() + m_mailbox.droppedCount();
+    return stats;
+}
+
 bool CameraDevice::start()
 {
-    if (m_capture->isOpened())
+    if (m_captureThread->isRunning())
         return true;
 
-    m_capture->open(CV_CAP_ANY);
-    if (m_capture->isOpened())
-        m_timer->start(40);
+    if (!m_capture->isOpened())
+        m_capture->open(m_cameraIndex);
+    if (!m_capture->isOpened())
+        return false;
 
-    return m_capture->isOpened();
+    m_stats = CaptureStats();
+    m_queue.open();
+    m_clock.start();
+    m_captureThread->start();
+    m_convertThread->start();
+    return true;
 }
 
 bool CameraDevice::stop()
 {
+    m_queue.close();
+    //The capture thread quits once the grab() in progress returns
+    m_convertThread->wait();
+    m_captureThread->wait();
+
     if (m_capture->isOpened())
         m_capture->release();
 
     return true;
 }
 
-void CameraDevice::onTimeout()
+void CameraDevice::onImageConverted()
 {
-    if (!m_capture->isOpened())
+    //Cleared first, so an image published from now on posts another call
+    m_notifyPending.fetchAndStoreOrdered(0);
+    if (!m_mailbox.take())
         return;
 
-    static cv::Mat frame;
-    *m_capture >> frame;
-    if (frame.cols)
-        emit imageReady(QtOcv::mat2Image(frame));
+    //The converter doesn't touch this slot until the next take()
+    const Preview &preview = m_mailbox.readSlot();
+    {
+        QMutexLocker locker(&m_mutex);
+        average(m_stats.latencyMs, m_clock.nsecsElapsed() - preview.grabTime, m_stats.delivered);
+        ++m_stats.delivered;
+    }
+    emit imageReady(preview.image);
+}
+
+void CameraDevice::captureLoop()
+{
+    qint64 sequence = 0;
+    while (!m_queue.isClosed()) {
+        const qint64 startTime = m_clock.nsecsElapsed();
+        //Block until the camera has the next frame, which paces the pipeline at its native rate
+        if (!m_capture->grab())
+            break;
+
+        Frame frame;
+        frame.grabTime = m_clock.nsecsElapsed();
+        frame.mat = m_queue.takeBuffer();
+        if (!m_capture->retrieve(frame.mat) || frame.mat.empty()) {
+            m_queue.recycle(frame.mat);
+            continue;
+        }
+        frame.retrieveTime = m_clock.nsecsElapsed();
+        frame.sequence = sequence++;
+
+        {
+            QMutexLocker locker(&m_mutex);
+            average(m_stats.grabMs, frame.grabTime - startTime, m_stats.captured);
+            average(m_stats.retrieveMs, frame.retrieveTime - frame.grabTime, m_stats.captured);
+            ++m_stats.captured;
+        }
+        m_queue.push(frame);
+    }
+    //Camera lost, or stopped
+    m_queue.close();
+}
+
+void CameraDevice::convertLoop()
+{
+#if QT_VERSION >= 0x050E00
+    //Same bytes order as cv::Mat of highgui, so full size frames are plain copies
+    const QImage::Format format = QImage::Format_BGR888;
+#else
+    const QImage::Format format = QImage::Format_Invalid;
+#endif
+    Frame frame;
+
+    for (;;) {
+        QSize previewSize;
+        {
+            QMutexLocker locker(&m_mutex);
+            previewSize = m_previewSize;
+        }
+        if (!m_queue.pop(frame))
+            break;
+
+        //Written in place, the receiver has released it unless it keeps images
+        Preview &preview = m_mailbox.writeSlot();
+        QImage &image = preview.image;
+
+        const qint64 takeTime = m_clock.nsecsElapsed();
+        const QSize frameSize(frame.mat.cols, frame.mat.rows);
+        if (!previewSize.isEmpty() && (frameSize.width() > previewSize.width() || frameSize.height() > previewSize.height())) {
+            //Only the pixels to be displayed are converted
+            QtOcv::mat2Image_scaled(frame.mat, image, frameSize.scaled(previewSize, Qt::KeepAspectRatio), -1, format);
+        } else {
+            QtOcv::mat2Image(frame.mat, image, format);
+        }
+        const qint64 convertTime = m_clock.nsecsElapsed();
+
+        m_queue.recycle(frame.mat);
+        frame.mat = cv::Mat();
+
+        {
+            QMutexLocker locker(&m_mutex);
+            average(m_stats.queueMs, takeTime - frame.retrieveTime, m_stats.delivered);
+            average(m_stats.convertMs, convertTime - takeTime, m_stats.delivered);
+        }
+
+        preview.grabTime = frame.grabTime;
+        m_mailbox.publish();
+        if (m_notifyPending.testAndSetOrdered(0, 1))
+            QMetaObject::invokeMethod(this, "onImageConverted", Qt::QueuedConnection);
+    }
 }
@@ -2,24 +2,59 @@
 #define CAMERADEVICE_H
 
 #include <QObject>
+#include <QSize>
+#include <QMutex>
+#include <QImage>
+#include <QElapsedTimer>
+#include "framequeue.h"
+#include "framering.h"
 
 QT_BEGIN_NAMESPACE
-class QTimer;
-class QImage;
+class QThread;
 QT_END_NAMESPACE
 
 namespace cv{
     class VideoCapture;
-    class Mat;
 }
 
+//Counters of the pipeline, times are averages of the recent frames in milliseconds
+struct CaptureStats
+{
+    CaptureStats() : captured(0), delivered(0), dropped(0),
+        grabMs(0), retrieveMs(0), queueMs(0), convertMs(0), latencyMs(0) {}
+
+    qint64 captured;
+    qint64 delivered;
+    qint64 dropped;
+
+    double grabMs;      //waiting for the camera and grab()
+    double retrieveMs;  //decoding by retrieve()
+    double queueMs;     //from retrieved to taken by the converter
+    double convertMs;
+    double latencyMs;   //from grabbed to imageReady()
+};
+
+/* Capture frames of one camera, at the rate of the camera.
+ *
+ * - grab() and retrieve() run in a capture thread, frames are converted to QImage
+ *   in a conversion thread, and imageReady() is emitted in the thread of this object.
+ * - The newest image waits for the receiver in a FrameMailbox, and at most one queued call
+ *   is posted to this object for it. A slow receiver gets the newest image only, instead of
+ *   stalling the converter or growing the event queue, and the images are written in place.
+ */
 class CameraDevice : public QObject
 {
     Q_OBJECT
 public:
-    explicit CameraDevice(QObject *parent = 0);
+    explicit CameraDevice(int cameraIndex = 0, QObject *parent = 0);
     ~CameraDevice();
 
+    //Frames are scaled down to fit size before converted, empty means full size
+    void setPreviewSize(const QSize &size);
+    void setDropPolicy(FrameQueue::DropPolicy policy);
+
+    CaptureStats stats() const;
+
 signals:
     void imageReady(const QImage& image);
 
@@ -28,11 +63,35 @@ public slots:
     bool stop();
 
 private slots:
-    void onTimeout();
+    void onImageConverted();
 
 private:
+    friend class CameraThread;
+    //A converted image and the time its frame was grabbed
+    struct Preview
+    {
+        Preview() : grabTime(0) {}
+
+        QImage image;
+        qint64 grabTime;
+    };
+
+    void captureLoop();
+    void convertLoop();
+
+    int m_cameraIndex;
     cv::VideoCapture * m_capture;
-    QTimer * m_timer;
+    QThread * m_captureThread;
+    QThread * m_convertThread;
+    FrameQueue m_queue;
+    QElapsedTimer m_clock;
+    QtOcv::FrameMailbox<Preview> m_mailbox;
+    //Set while a call of onImageConverted() is queued
+    QAtomicInt m_notifyPending;
+
+    mutable QMutex m_mutex;
+    QSize m_previewSize;
+    CaptureStats m_stats;
 };
 
 #endif // CAMERADEVICE_H
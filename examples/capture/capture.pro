@@ -7,9 +7,11 @@ TEMPLATE = app
 
 SOURCES += main.cpp\
         dialog.cpp\
-        cameradevice.cpp
+        cameradevice.cpp\
+        framequeue.cpp
 
 HEADERS  += dialog.h \
-            cameradevice.h
+            cameradevice.h \
+            framequeue.h
 
 FORMS    += dialog.ui
@@ -1,15 +1,23 @@
 #include "dialog.h"
 #include "ui_dialog.h"
 #include "cameradevice.h"
+#include <QTimer>
 
 Dialog::Dialog(QWidget *parent) :
-    QDialog(parent), ui(new Ui::Dialog), m_camera(new CameraDevice(this))
+    QDialog(parent), ui(new Ui::Dialog), m_camera(new CameraDevice(0, this)), m_lastDelivered(0)
 {
     ui->setupUi(this);
+    //Let the view shrink with the dialog, otherwise the pixmap keeps its size
+    ui->view->setMinimumSize(1, 1);
+    ui->view->setAlignment(Qt::AlignCenter);
 
     connect(m_camera, SIGNAL(imageReady(QImage)), this, SLOT(onImageArrival(QImage)));
     connect(ui->startButton, SIGNAL(clicked()), m_camera, SLOT(start()));
     connect(ui->stopButton, SIGNAL(clicked()), m_camera, SLOT(stop()));
+
+    QTimer *statsTimer = new QTimer(this);
+    connect(statsTimer, SIGNAL(timeout()), this, SLOT(onStatsTimeout()));
+    statsTimer->start(1000);
 }
 
 Dialog::~Dialog()
@@ -17,7 +25,26 @@ Dialog::~Dialog()
     delete ui;
 }
 
+void Dialog::resizeEvent(QResizeEvent *event)
+{
+    QDialog::resizeEvent(event);
+    //Frames are converted at the size of the view, instead of being scaled after conversion
+    m_camera->setPreviewSize(ui->view->size());
+}
+
 void Dialog::onImageArrival(const QImage &image)
 {
     ui->view->setPixmap(QPixmap::fromImage(image));
 }
+
+void Dialog::onStatsTimeout()
+{
+    const CaptureStats stats = m_camera->stats();
+    if (stats.delivered < m_lastDelivered)
+        m_lastDelivered = 0;
+    setWindowTitle(tr("%1 fps, %2 dropped, grab %3 ms, retrieve %4 ms, queue %5 ms, convert %6 ms, latency %7 ms")
+                   .arg(stats.delivered - m_lastDelivered).arg(stats.dropped)
+                   .arg(stats.grabMs, 0, 'f', 1).arg(stats.retrieveMs, 0, 'f', 1).arg(stats.queueMs, 0, 'f', 1)
+                   .arg(stats.convertMs, 0, 'f', 1).arg(stats.latencyMs, 0, 'f', 1));
+    m_lastDelivered = stats.delivered;
+}
@@ -17,12 +17,17 @@ public:
     explicit Dialog(QWidget *parent = 0);
     ~Dialog();
 
+protected:
+    void resizeEvent(QResizeEvent *event);
+
 private slots:
     void onImageArrival(const QImage & image);
+    void onStatsTimeout();
 
 private:
     Ui::Dialog *ui;
     CameraDevice * m_camera;
+    qint64 m_lastDelivered;
 };
 
 #endif // DIALOG_H
@@ -0,0 +1,119 @@
+#include "framequeue.h"
+#include <QMutexLocker>
+
+FrameQueue::FrameQueue(int capacity, DropPolicy policy) :
+    m_frames(qMax(capacity, 1)), m_head(0), m_count(0), m_policy(policy), m_closed(false), m_dropped(0)
+{
+}
+
+void FrameQueue::setDropPolicy(DropPolicy policy)
+{
+    QMutexLocker locker(&m_mutex);
+    m_policy = policy;
+}
+
+FrameQueue::DropPolicy FrameQueue::dropPolicy() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_policy;
+}
+
+int FrameQueue::capacity() const
+{
+    return m_frames.size();
+}
+
+cv::Mat FrameQueue::takeBuffer()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_freeBuffers.isEmpty())
+        return cv::Mat();
+    return m_freeBuffers.takeLast();
+}
+
+void FrameQueue::recycle(const cv::Mat &buffer)
+{
+    QMutexLocker locker(&m_mutex);
+    recycle_(buffer);
+}
+
+bool FrameQueue::push(const Frame &frame)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_closed) {
+        recycle_(frame.mat);
+        return false;
+    }
+
+    if (m_count == m_frames.size()) {
+        ++m_dropped;
+        if (m_policy == DropNewest) {
+            recycle_(frame.mat);
+            return false;
+        }
+        recycle_(m_frames[m_head].mat);
+        m_frames[m_head].mat = cv::Mat();
+        m_head = (m_head + 1) % m_frames.size();
+        --m_count;
+    }
+
+    m_frames[(m_head + m_count) % m_frames.size()] = frame;
+    ++m_count;
+    m_notEmpty.wakeOne();
+    return true;
+}
+
+bool FrameQueue::pop(Frame &frame)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_count && !m_closed)
+        m_notEmpty.wait(&m_mutex);
+    if (m_closed)
+        return false;
+
+    frame = m_frames[m_head];
+    //Drop the reference held by the slot, so that the buffer can be recycled by the consumer
+    m_frames[m_head].mat = cv::Mat();
+    m_head = (m_head + 1) % m_frames.size();
+    --m_count;
+    return true;
+}
+
+void FrameQueue::close()
+{
+    QMutexLocker locker(&m_mutex);
+    m_closed = true;
+    m_notEmpty.wakeAll();
+}
+
+void FrameQueue::open()
+{
+    QMutexLocker locker(&m_mutex);
+    for (; m_count; --m_count) {
+        recycle_(m_frames[m_head].mat);
+        m_frames[m_head].mat = cv::Mat();
+        m_head = (m_head + 1) % m_frames.size();
+    }
+    m_head = 0;
+    m_dropped = 0;
+    m_closed = false;
+}
+
+bool FrameQueue::isClosed() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_closed;
+}
+
+qint64 FrameQueue::droppedCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_dropped;
+}
+
+void FrameQueue::recycle_(const cv::Mat &buffer)
+{
+    //One buffer is being retrieved into and one is being converted, besides the queued ones
+    if (!buffer.empty() && m_freeBuffers.size() < m_frames.size() + 2)
+        m_freeBuffers.append(buffer);
+}
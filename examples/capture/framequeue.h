@@ -0,0 +1,73 @@
+#ifndef FRAMEQUEUE_H
+#define FRAMEQUEUE_H
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QList>
+#include "opencv2/core/core.hpp"
+
+//A captured frame, times are QElapsedTimer::nsecsElapsed() of the clock shared by the pipeline
+struct Frame
+{
+    Frame() : sequence(0), grabTime(0), retrieveTime(0) {}
+
+    cv::Mat mat;
+    qint64 sequence;
+    qint64 grabTime;
+    qint64 retrieveTime;
+};
+
+/* Bounded ring buffer of frames, between the capture thread and the conversion thread.
+ *
+ * - When it is full, the oldest queued frame (lowest latency) or the incoming one
+ *   (no gap in a sequence of frames) is dropped, depending on DropPolicy.
+ * - Buffers of dropped and consumed frames are handed out again by takeBuffer(),
+ *   so frames of the same size are retrieved without allocation.
+ */
+class FrameQueue
+{
+public:
+    enum DropPolicy
+    {
+        DropOldest,
+        DropNewest
+    };
+
+    explicit FrameQueue(int capacity = 2, DropPolicy policy = DropOldest);
+
+    void setDropPolicy(DropPolicy policy);
+    DropPolicy dropPolicy() const;
+    int capacity() const;
+
+    //Buffer to retrieve the next frame into, and the way back of buffers no longer used
+    cv::Mat takeBuffer();
+    void recycle(const cv::Mat &buffer);
+
+    //Return false if frame is dropped, or the queue has been closed
+    bool push(const Frame &frame);
+    //Block until a frame is available, return false once the queue is closed
+    bool pop(Frame &frame);
+
+    //Wake up the consumer and reject frames, until open() is called
+    void close();
+    void open();
+    bool isClosed() const;
+
+    qint64 droppedCount() const;
+
+private:
+    void recycle_(const cv::Mat &buffer);
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_notEmpty;
+    QVector<Frame> m_frames;
+    QList<cv::Mat> m_freeBuffers;
+    int m_head;
+    int m_count;
+    DropPolicy m_policy;
+    bool m_closed;
+    qint64 m_dropped;
+};
+
+#endif // FRAMEQUEUE_H
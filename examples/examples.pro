@@ -2,5 +2,8 @@ TEMPLATE = subdirs
 
 SUBDIRS += capture
 
+#QOpenGLWidget is provided by Qt 5.4 and newer
+greaterThan(QT_MAJOR_VERSION, 5)|if(equals(QT_MAJOR_VERSION, 5):greaterThan(QT_MINOR_VERSION, 3)): SUBDIRS += glvideo
+
 SUBDIRS += \
     imagefft
@@ -0,0 +1,60 @@
+#include "framesource.h"
+#include "matvideowidget.h"
+#include <QElapsedTimer>
+#include "opencv2/highgui/highgui.hpp"
+
+#if CV_MAJOR_VERSION >= 3
+static const int fpsProperty = cv::CAP_PROP_FPS;
+#else
+static const int fpsProperty = CV_CAP_PROP_FPS;
+#endif
+
+FrameSource::FrameSource(const QString &source, const QList<MatVideoWidget*> &views, QObject *parent) :
+    QThread(parent), m_source(source), m_views(views), m_stopped(0)
+{
+}
+
+FrameSource::~FrameSource()
+{
+    stop();
+}
+
+void FrameSource::stop()
+{
+    m_stopped.fetchAndStoreOrdered(1);
+    wait();
+}
+
+void FrameSource::run()
+{
+    bool isCamera = false;
+    const int cameraIndex = m_source.toInt(&isCamera);
+    cv::VideoCapture capture;
+    if (isCamera)
+        capture.open(cameraIndex);
+    else
+        capture.open(m_source.toLocal8Bit().constData());
+    if (!capture.isOpened())
+        return;
+
+    const double fps = isCamera ? 0. : capture.get(fpsProperty);
+    QElapsedTimer clock;
+    clock.start();
+    qint64 frames = 0;
+    cv::Mat frame;
+    while (!m_stopped.fetchAndAddOrdered(0)) {
+        //The views still hold the previous one
+        frame = frame.empty() ? cv::Mat() : m_pool.mat(frame.rows, frame.cols, frame.type());
+        if (!capture.read(frame) || frame.empty())
+            break;
+
+        for (int i=0; i<m_views.size(); ++i)
+            m_views[i]->setFrame(frame);
+
+        if (fps > 0.) {
+            const qint64 due = qint64(++frames * 1000 / fps);
+            if (due > clock.elapsed())
+                msleep(due - clock.elapsed());
+        }
+    }
+}
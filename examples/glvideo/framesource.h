@@ -0,0 +1,35 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include <QThread>
+#include <QList>
+#include <QAtomicInt>
+#include "framepool.h"
+
+class MatVideoWidget;
+
+/* Read frames of a camera or a video file in a thread, and show each of them in all the views
+ *
+ * - Cameras pace the thread by themselves, files are played at their frame rate.
+ * - Each frame is read into a new buffer of a FramePool, as the views share it until it is
+ *   uploaded, and the buffers come back once all the views are done with them.
+ */
+class FrameSource : public QThread
+{
+public:
+    FrameSource(const QString &source, const QList<MatVideoWidget*> &views, QObject *parent = 0);
+    ~FrameSource();
+
+    void stop();
+
+protected:
+    void run();
+
+private:
+    QString m_source;
+    QList<MatVideoWidget*> m_views;
+    QtOcv::FramePool m_pool;
+    QAtomicInt m_stopped;
+};
+
+#endif // FRAMESOURCE_H
@@ -0,0 +1,18 @@
+include(../../QtOpenCV.pri)
+add_opencv_modules(core imgproc highgui)
+
+#QOpenGLWidget is provided by Qt 5.4 and newer
+lessThan(QT_MAJOR_VERSION, 5)|if(equals(QT_MAJOR_VERSION, 5):lessThan(QT_MINOR_VERSION, 4)) {
+    error(glvideo needs Qt 5.4 or newer)
+}
+QT += widgets
+greaterThan(QT_MAJOR_VERSION, 5): QT += openglwidgets
+
+TEMPLATE = app
+
+SOURCES += main.cpp\
+        matvideowidget.cpp\
+        framesource.cpp
+
+HEADERS  += matvideowidget.h \
+            framesource.h
@@ -0,0 +1,36 @@
+#include <QApplication>
+#include <QWidget>
+#include <QGridLayout>
+#include <QStringList>
+#include <qmath.h>
+#include "matvideowidget.h"
+#include "framesource.h"
+
+//glvideo [camera index | video file] [views], such as "glvideo wall.mp4 16" for a video wall
+int main(int argc, char *argv[])
+{
+    QApplication a(argc, argv);
+    const QStringList args = a.arguments();
+    const QString source = args.size() > 1 ? args[1] : QString("0");
+    const int viewCount = args.size() > 2 ? qMax(1, args[2].toInt()) : 1;
+
+    QWidget w;
+    QGridLayout *layout = new QGridLayout(&w);
+    layout->setSpacing(2);
+    layout->setContentsMargins(0, 0, 0, 0);
+    const int columns = qCeil(qSqrt(viewCount));
+    QList<MatVideoWidget*> views;
+    for (int i=0; i<viewCount; ++i) {
+        MatVideoWidget *view = new MatVideoWidget(&w);
+        layout->addWidget(view, i / columns, i % columns);
+        views.append(view);
+    }
+    w.resize(1280, 720);
+    w.show();
+
+    FrameSource frameSource(source, views);
+    frameSource.start();
+    const int ret = a.exec();
+    frameSource.stop();
+    return ret;
+}
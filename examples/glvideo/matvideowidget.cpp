@@ -0,0 +1,284 @@
+#include "matvideowidget.h"
+#include <QOpenGLContext>
+#include <QMutexLocker>
+#include <cstring>
+
+namespace {
+const char vertexShader[] =
+        "attribute vec4 vertex;\n"
+        "uniform vec2 scale;\n"
+        "varying vec2 texCoord;\n"
+        "void main()\n"
+        "{\n"
+        "    texCoord = vertex.zw;\n"
+        "    gl_Position = vec4(vertex.xy * scale, 0.0, 1.0);\n"
+        "}\n";
+
+//mode 0: RGB(A), 1: BGR(A), 2: Gray, 3: NV12, 4: I420. YUV is BT.601 of limited range
+const char fragmentShader[] =
+        "#ifdef GL_ES\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "uniform sampler2D plane0;\n"
+        "uniform sampler2D plane1;\n"
+        "uniform sampler2D plane2;\n"
+        "uniform int mode;\n"
+        "varying vec2 texCoord;\n"
+        "void main()\n"
+        "{\n"
+        "    vec3 rgb;\n"
+        "    if (mode == 0) {\n"
+        "        rgb = texture2D(plane0, texCoord).rgb;\n"
+        "    } else if (mode == 1) {\n"
+        "        rgb = texture2D(plane0, texCoord).bgr;\n"
+        "    } else if (mode == 2) {\n"
+        "        rgb = texture2D(plane0, texCoord).rrr;\n"
+        "    } else {\n"
+        "        float y = 1.1644 * (texture2D(plane0, texCoord).r - 0.0625);\n"
+        "        vec2 uv = mode == 3 ? texture2D(plane1, texCoord).ra\n"
+        "                            : vec2(texture2D(plane1, texCoord).r, texture2D(plane2, texCoord).r);\n"
+        "        uv -= 0.5;\n"
+        "        rgb = vec3(y + 1.5960 * uv.y, y - 0.3917 * uv.x - 0.8129 * uv.y, y + 2.0172 * uv.x);\n"
+        "    }\n"
+        "    gl_FragColor = vec4(rgb, 1.0);\n"
+        "}\n";
+
+//x, y and the texture coordinates, row 0 of cv::Mat at the top
+const GLfloat quad[] = {
+    -1.f, -1.f, 0.f, 1.f,
+     1.f, -1.f, 1.f, 1.f,
+    -1.f,  1.f, 0.f, 0.f,
+     1.f,  1.f, 1.f, 0.f
+};
+} //namespace
+
+MatVideoWidget::MatVideoWidget(QWidget *parent) :
+    QOpenGLWidget(parent), m_pendingFormat(Auto), m_dropped(0), m_program(0), m_hasPixelBuffers(false), m_mode(0)
+{
+    for (int i=0; i<MaxPlanes; ++i) {
+        for (int j=0; j<UploadBuffers; ++j)
+            m_planes[i].buffers[j] = QOpenGLBuffer(QOpenGLBuffer::PixelUnpackBuffer);
+    }
+}
+
+MatVideoWidget::~MatVideoWidget()
+{
+    cleanup();
+}
+
+void MatVideoWidget::setFrame(const cv::Mat &mat, PixelFormat format)
+{
+    QMutexLocker locker(&m_mutex);
+    const bool pending = !m_pendingFrame.empty();
+    if (pending)
+        ++m_dropped;
+    m_pendingFrame = mat;
+    m_pendingFormat = format;
+    locker.unlock();
+
+    //One repaint for all the frames which arrive before it
+    if (!pending)
+        QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+}
+
+qint64 MatVideoWidget::droppedCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_dropped;
+}
+
+void MatVideoWidget::initializeGL()
+{
+    initializeOpenGLFunctions();
+    connect(context(), SIGNAL(aboutToBeDestroyed()), this, SLOT(cleanup()));
+
+    //Pixel buffer objects are provided by OpenGL 2.1 and OpenGL ES 3.0
+    const QSurfaceFormat surfaceFormat = context()->format();
+    m_hasPixelBuffers = context()->isOpenGLES() ? surfaceFormat.majorVersion() >= 3
+                                                : surfaceFormat.version() >= qMakePair(2, 1);
+
+    m_program = new QOpenGLShaderProgram;
+    m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader);
+    m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShader);
+    m_program->bindAttributeLocation("vertex", 0);
+    m_program->link();
+    m_program->bind();
+    m_program->setUniformValue("plane0", 0);
+    m_program->setUniformValue("plane1", 1);
+    m_program->setUniformValue("plane2", 2);
+    m_program->release();
+}
+
+void MatVideoWidget::paintGL()
+{
+    m_mutex.lock();
+    cv::Mat frame = m_pendingFrame;
+    const PixelFormat format = m_pendingFormat;
+    m_pendingFrame = cv::Mat();
+    m_mutex.unlock();
+
+    if (!frame.empty())
+        uploadFrame(frame, format);
+    //Released before drawing, such as back to its FramePool
+    frame = cv::Mat();
+
+    glClearColor(0.f, 0.f, 0.f, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (m_frameSize.isEmpty() || !m_program)
+        return;
+
+    //Scaled by the GPU, keeping the aspect ratio of the frame
+    const QSize fitted = m_frameSize.scaled(size(), Qt::KeepAspectRatio);
+    m_program->bind();
+    m_program->setUniformValue("scale", GLfloat(fitted.width()) / width(), GLfloat(fitted.height()) / height());
+    m_program->setUniformValue("mode", m_mode);
+    for (int i=0; i<MaxPlanes; ++i) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, m_planes[i].texture);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    m_program->enableAttributeArray(0);
+    m_program->setAttributeArray(0, GL_FLOAT, quad, 4);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    m_program->disableAttributeArray(0);
+    m_program->release();
+}
+
+/* Upload the planes of mat to the textures
+ *
+ * - Return false if the type or size of mat doesn't match format, the last frame is kept then.
+ */
+bool MatVideoWidget::uploadFrame(const cv::Mat &mat, PixelFormat format)
+{
+    const int channels = mat.channels();
+    if (mat.depth() != CV_8U)
+        return false;
+    if (format == Auto)
+        format = channels == 1 ? Gray : (channels == 3 ? BGR : BGRA);
+
+    const int width = mat.cols;
+    int height = mat.rows;
+    switch (format) {
+    case Gray:
+        if (channels != 1)
+            return false;
+        uploadPlane(m_planes[0], mat.data, mat.step, width, height, GL_LUMINANCE, 1);
+        m_mode = 2;
+        break;
+    case BGR:
+    case RGB:
+        if (channels != 3)
+            return false;
+        uploadPlane(m_planes[0], mat.data, mat.step, width, height, GL_RGB, 3);
+        m_mode = format == BGR ? 1 : 0;
+        break;
+    case BGRA:
+    case RGBA:
+        if (channels != 4)
+            return false;
+        uploadPlane(m_planes[0], mat.data, mat.step, width, height, GL_RGBA, 4);
+        m_mode = format == BGRA ? 1 : 0;
+        break;
+    case NV12:
+    case I420: {
+        if (channels != 1 || mat.rows % 3 || width % 2 || (format == I420 && !mat.isContinuous()))
+            return false;
+        height = mat.rows / 3 * 2;
+        const uchar *chroma = mat.ptr(height);
+        uploadPlane(m_planes[0], mat.data, mat.step, width, height, GL_LUMINANCE, 1);
+        if (format == NV12) {
+            //U and V in the luminance and alpha of one texture
+            uploadPlane(m_planes[1], chroma, mat.step, width / 2, height / 2, GL_LUMINANCE_ALPHA, 2);
+            m_mode = 3;
+        } else {
+            const size_t chromaBytes = size_t(width / 2) * (height / 2);
+            uploadPlane(m_planes[1], chroma, width / 2, width / 2, height / 2, GL_LUMINANCE, 1);
+            uploadPlane(m_planes[2], chroma + chromaBytes, width / 2, width / 2, height / 2, GL_LUMINANCE, 1);
+            m_mode = 4;
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+
+    m_frameSize = QSize(width, height);
+    return true;
+}
+
+void MatVideoWidget::uploadPlane(Plane &plane, const uchar *data, size_t step, int width, int height, GLenum glFormat, int pixelBytes)
+{
+    if (!plane.texture)
+        glGenTextures(1, &plane.texture);
+    glBindTexture(GL_TEXTURE_2D, plane.texture);
+    //Reallocated only when the frame size or format is changed
+    if (plane.width != width || plane.height != height || plane.glFormat != glFormat) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, glFormat, width, height, 0, glFormat, GL_UNSIGNED_BYTE, 0);
+        plane.width = width;
+        plane.height = height;
+        plane.glFormat = glFormat;
+    }
+
+    const size_t rowBytes = size_t(width) * pixelBytes;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (m_hasPixelBuffers) {
+        QOpenGLBuffer &buffer = plane.buffers[plane.nextBuffer];
+        plane.nextBuffer = (plane.nextBuffer + 1) % UploadBuffers;
+        if (!buffer.isCreated()) {
+            buffer.create();
+            buffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+        }
+        buffer.bind();
+        //Orphaned first, so the driver doesn't wait for the copy still reading the old storage
+        buffer.allocate(int(rowBytes * height));
+        uchar *pixels = static_cast<uchar*>(buffer.map(QOpenGLBuffer::WriteOnly));
+        if (pixels) {
+            for (int i=0; i<height; ++i)
+                std::memcpy(pixels + i*rowBytes, data + i*step, rowBytes);
+            buffer.unmap();
+            //Copied from the buffer by the driver, this returns at once
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, glFormat, GL_UNSIGNED_BYTE, 0);
+            buffer.release();
+            return;
+        }
+        //Mapping isn't supported by the context
+        buffer.release();
+        m_hasPixelBuffers = false;
+    }
+
+    //Rows must be packed without OpenGL ES 3 or GL_UNPACK_ROW_LENGTH
+    const uchar *pixels = data;
+    if (step != rowBytes) {
+        m_staging.resize(rowBytes * height);
+        for (int i=0; i<height; ++i)
+            std::memcpy(&m_staging[i*rowBytes], data + i*step, rowBytes);
+        pixels = &m_staging[0];
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, glFormat, GL_UNSIGNED_BYTE, pixels);
+}
+
+void MatVideoWidget::cleanup()
+{
+    if (!m_program)
+        return;
+
+    makeCurrent();
+    for (int i=0; i<MaxPlanes; ++i) {
+        Plane &plane = m_planes[i];
+        if (plane.texture)
+            glDeleteTextures(1, &plane.texture);
+        plane.texture = 0;
+        plane.width = plane.height = 0;
+        for (int j=0; j<UploadBuffers; ++j)
+            plane.buffers[j].destroy();
+    }
+    delete m_program;
+    m_program = 0;
+    m_frameSize = QSize();
+    doneCurrent();
+}
@@ -0,0 +1,91 @@
+#ifndef MATVIDEOWIDGET_H
+#define MATVIDEOWIDGET_H
+
+#include <QOpenGLWidget>
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QOpenGLShaderProgram>
+#include <QMutex>
+#include <vector>
+#include "opencv2/core/core.hpp"
+
+/* Show frames of cv::Mat by uploading them to OpenGL textures, without QImage or QPixmap
+ *
+ * - setFrame() can be called in any thread. Only the newest frame is uploaded at the next
+ *   repaint, so a slow display drops frames instead of queuing them.
+ * - Rows are written to one of a ring of pixel buffer objects, which the driver copies to
+ *   the texture asynchronously, so the upload of one frame doesn't wait for the previous one.
+ *   Without PBOs (OpenGL ES 2) they are uploaded from the cv::Mat directly.
+ * - Channels are swizzled and YUV is converted to RGB by the fragment shader, and the
+ *   frame is scaled to fit the widget by the GPU.
+ */
+class MatVideoWidget : public QOpenGLWidget, protected QOpenGLFunctions
+{
+    Q_OBJECT
+public:
+    enum PixelFormat
+    {
+        Auto,   //Gray, BGR or BGRA by the channels of cv::Mat
+        Gray,
+        BGR,
+        RGB,
+        BGRA,
+        RGBA,
+        NV12,   //CV_8UC1 of height * 3 / 2 rows, Y plane then interleaved U V
+        I420    //CV_8UC1 of height * 3 / 2 rows, Y, U and V planes, must be continuous
+    };
+
+    explicit MatVideoWidget(QWidget *parent = 0);
+    ~MatVideoWidget();
+
+    //The data of mat is shared until it is uploaded, so it mustn't be written afterwards,
+    //such as by retrieving the next frame into it. Take a new buffer from a FramePool instead
+    void setFrame(const cv::Mat &mat, PixelFormat format = Auto);
+
+    //Frames replaced by newer ones before they were uploaded
+    qint64 droppedCount() const;
+
+protected:
+    void initializeGL();
+    void paintGL();
+
+private slots:
+    void cleanup();
+
+private:
+    enum {
+        MaxPlanes = 3,
+        UploadBuffers = 3
+    };
+
+    //One texture of a frame, such as the Y plane of NV12
+    struct Plane
+    {
+        Plane() : texture(0), width(0), height(0), glFormat(0), nextBuffer(0) {}
+
+        GLuint texture;
+        int width;
+        int height;
+        GLenum glFormat;
+        QOpenGLBuffer buffers[UploadBuffers];
+        int nextBuffer;
+    };
+
+    bool uploadFrame(const cv::Mat &mat, PixelFormat format);
+    void uploadPlane(Plane &plane, const uchar *data, size_t step, int width, int height, GLenum glFormat, int pixelBytes);
+
+    mutable QMutex m_mutex;
+    cv::Mat m_pendingFrame;
+    PixelFormat m_pendingFormat;
+    qint64 m_dropped;
+
+    QOpenGLShaderProgram *m_program;
+    bool m_hasPixelBuffers;
+    Plane m_planes[MaxPlanes];
+    //Shader mode of the last frame uploaded, and its size
+    int m_mode;
+    QSize m_frameSize;
+    std::vector<uchar> m_staging;
+};
+
+#endif // MATVIDEOWIDGET_H
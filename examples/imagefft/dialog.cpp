@@ -23,15 +23,12 @@ void calcFFT(const cv::Mat &input, cv::Mat &output)
 
     cv::dft(complexI, complexI);            // this way the result may fit in the source matrix
 
-    // compute the magnitude and switch to logarithmic scale
-    // => log(1 + sqrt(Re(DFT(I))^2 + Im(DFT(I))^2))
+    // compute the magnitude, the logarithmic scale is applied by mat2Image_normalized()
+    // => sqrt(Re(DFT(I))^2 + Im(DFT(I))^2)
     cv::split(complexI, planes);                   // planes[0] = Re(DFT(I), planes[1] = Im(DFT(I))
     cv::magnitude(planes[0], planes[1], planes[0]);// planes[0] = magnitude
     output = planes[0];
 
-    output += cv::Scalar_<float>::all(1);                    // switch to logarithmic scale
-    cv::log(output, output);
-
     // crop the spectrum, if it has an odd number of rows or columns
     output = output(cv::Rect(0, 0, output.cols & -2, output.rows & -2));
 
@@ -53,8 +50,6 @@ void calcFFT(const cv::Mat &input, cv::Mat &output)
     q2.copyTo(q1);
     tmp.copyTo(q2);
 
-    cv::normalize(output, output, 0, 1, CV_MINMAX); // Transform the matrix with float values into a
-                                            // viewable image form (float between values 0 and 1).
     return;
 }
 } //namespace
@@ -92,7 +87,8 @@ void Dialog::onOpenButtonClicked()
     QLabel *fftLabel = new QLabel;
     fftLabel->setWindowTitle(tr("FFT result window"));
     fftLabel->setAttribute(Qt::WA_DeleteOnClose);
-    QImage out_img = QtOcv::mat2Image(out_mat);
+    // log(1 + magnitude - min) is mapped to the viewable range while converting, no cv::normalize() needed
+    QImage out_img = QtOcv::mat2Image_normalized(out_mat, QtOcv::NM_LogMinMax);
     fftLabel->setPixmap(QPixmap::fromImage(out_img));
     fftLabel->show();
 }
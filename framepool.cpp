@@ -0,0 +1,424 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#include "framepool.h"
+#include <QMutex>
+#include <QList>
+
+namespace QtOcv {
+
+/* A buffer handed out by the pool
+ *
+ * - refcount must be the first member, the allocator of OpenCV 2.x gets the buffer back from it.
+ */
+struct PoolBuffer
+{
+    int refcount;
+    FramePoolCore *core;
+    void *data;
+    size_t size;
+};
+
+#if CV_MAJOR_VERSION >= 3
+
+#  if CV_MAJOR_VERSION >= 4
+typedef cv::AccessFlag MatAccessFlag;
+#  else
+typedef int MatAccessFlag;
+#  endif
+
+//Take the buffers of cv::Mat::create() from the pool, and give them back in deallocate()
+class PoolMatAllocator : public cv::MatAllocator
+{
+public:
+    explicit PoolMatAllocator(FramePoolCore *core) : m_core(core) {}
+
+    PoolBuffer *acquire(size_t size) const;
+    void detach();
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           MatAccessFlag flags, cv::UMatUsageFlags usageFlags) const;
+    bool allocate(cv::UMatData *u, MatAccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const;
+    void deallocate(cv::UMatData *u) const;
+
+private:
+    mutable QMutex m_mutex;
+    FramePoolCore *m_core;
+};
+
+#else
+
+class PoolMatAllocator : public cv::MatAllocator
+{
+public:
+    explicit PoolMatAllocator(FramePoolCore *core) : m_core(core) {}
+
+    PoolBuffer *acquire(size_t size) const;
+    void detach();
+
+    void allocate(int dims, const int *sizes, int type, int *&refcount, uchar *&datastart, uchar *&data, size_t *step);
+    void deallocate(int *refcount, uchar *datastart, uchar *data);
+
+private:
+    mutable QMutex m_mutex;
+    FramePoolCore *m_core;
+};
+
+#endif
+
+/* Shared by the FramePool and the buffers in use
+ *
+ * - It is deleted when both the pool and the last buffer in use are gone, so buffers
+ *   can be released after the pool is destroyed.
+ * - The allocator is never deleted, as any cv::Mat may still point to it and be recreated.
+ *   It is detached when the pool is destroyed, and allocates without pooling since then.
+ */
+class FramePoolCore
+{
+public:
+    explicit FramePoolCore(qint64 maxIdleBytes)
+        : allocator(new PoolMatAllocator(this)), maxIdleBytes(maxIdleBytes), idleBytes(0), allocations(0), refs(1), closed(false)
+    {
+    }
+
+    PoolBuffer *acquire(size_t size);
+    void release(PoolBuffer *buffer);
+    void close();
+    void trim();
+
+    PoolMatAllocator *allocator;
+
+    mutable QMutex mutex;
+    //Least recently used first
+    QList<PoolBuffer*> idle;
+    qint64 maxIdleBytes;
+    qint64 idleBytes;
+    int allocations;
+    //The pool and the buffers in use
+    int refs;
+    bool closed;
+};
+
+namespace {
+
+PoolBuffer *newBuffer(FramePoolCore *core, size_t size)
+{
+    PoolBuffer *buffer = new PoolBuffer;
+    buffer->refcount = 0;
+    buffer->core = core;
+    buffer->data = cv::fastMalloc(size);
+    buffer->size = size;
+    return buffer;
+}
+
+void freeBuffer(PoolBuffer *buffer)
+{
+    cv::fastFree(buffer->data);
+    delete buffer;
+}
+
+//Buffers allocated after the pool is destroyed have no core
+void releaseBuffer(PoolBuffer *buffer)
+{
+    if (buffer->core)
+        buffer->core->release(buffer);
+    else
+        freeBuffer(buffer);
+}
+
+#if QT_VERSION >= 0x050000
+//Cleanup function of the QImage created by FramePool::image()
+void releaseImageBuffer(void *info)
+{
+    releaseBuffer(static_cast<PoolBuffer*>(info));
+}
+#endif
+
+//Bytes per pixel of the formats converted by QtOcv, 0 for the others
+int bytesPerPixel(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_Indexed8:
+#if QT_VERSION >= 0x050500
+    case QImage::Format_Grayscale8:
+#endif
+        return 1;
+#if QT_VERSION >= 0x050D00
+    case QImage::Format_Grayscale16:
+        return 2;
+#endif
+    case QImage::Format_RGB888:
+#if QT_VERSION >= 0x050E00
+    case QImage::Format_BGR888:
+#endif
+        return 3;
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+#endif
+        return 4;
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+        return 8;
+#endif
+    default:
+        return 0;
+    }
+}
+
+} //namespace
+
+PoolBuffer *FramePoolCore::acquire(size_t size)
+{
+    QMutexLocker locker(&mutex);
+    ++refs;
+    //The most recently used one is still warm in cache
+    for (int i=idle.size()-1; i>=0; --i) {
+        if (idle[i]->size == size) {
+            idleBytes -= size;
+            return idle.takeAt(i);
+        }
+    }
+    ++allocations;
+    return newBuffer(this, size);
+}
+
+void FramePoolCore::release(PoolBuffer *buffer)
+{
+    mutex.lock();
+    if (closed) {
+        freeBuffer(buffer);
+    } else {
+        idle.append(buffer);
+        idleBytes += buffer->size;
+        trim();
+    }
+    const bool last = --refs == 0;
+    mutex.unlock();
+
+    if (last)
+        delete this;
+}
+
+void FramePoolCore::close()
+{
+    allocator->detach();
+    mutex.lock();
+    closed = true;
+    maxIdleBytes = 0;
+    trim();
+    const bool last = --refs == 0;
+    mutex.unlock();
+
+    if (last)
+        delete this;
+}
+
+//Free the least recently used buffers, the caller should hold the mutex
+void FramePoolCore::trim()
+{
+    while (idleBytes > maxIdleBytes && !idle.isEmpty()) {
+        PoolBuffer *buffer = idle.takeFirst();
+        idleBytes -= buffer->size;
+        freeBuffer(buffer);
+    }
+}
+
+//0 once the pool is destroyed, the core is kept alive by the buffer returned
+PoolBuffer *PoolMatAllocator::acquire(size_t size) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_core ? m_core->acquire(size) : 0;
+}
+
+void PoolMatAllocator::detach()
+{
+    QMutexLocker locker(&m_mutex);
+    m_core = 0;
+}
+
+#if CV_MAJOR_VERSION >= 3
+
+cv::UMatData *PoolMatAllocator::allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                                         MatAccessFlag flags, cv::UMatUsageFlags usageFlags) const
+{
+    //The data of users isn't owned by the pool
+    if (data)
+        return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i=dims-1; i>=0; --i) {
+        if (step)
+            step[i] = total;
+        total *= sizes[i];
+    }
+
+    PoolBuffer *buffer = acquire(total);
+    if (!buffer)
+        return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    cv::UMatData *u = new cv::UMatData(this);
+    u->data = u->origdata = static_cast<uchar*>(buffer->data);
+    u->size = total;
+    u->userdata = buffer;
+    return u;
+}
+
+bool PoolMatAllocator::allocate(cv::UMatData *u, MatAccessFlag /*accessFlags*/, cv::UMatUsageFlags /*usageFlags*/) const
+{
+    return u != 0;
+}
+
+void PoolMatAllocator::deallocate(cv::UMatData *u) const
+{
+    if (!u || u->refcount != 0 || u->urefcount != 0)
+        return;
+    PoolBuffer *buffer = static_cast<PoolBuffer*>(u->userdata);
+    delete u;
+    releaseBuffer(buffer);
+}
+
+#else
+
+void PoolMatAllocator::allocate(int dims, const int *sizes, int type, int *&refcount, uchar *&datastart, uchar *&data, size_t *step)
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i=dims-1; i>=0; --i) {
+        step[i] = total;
+        total *= sizes[i];
+    }
+
+    PoolBuffer *buffer = acquire(total);
+    if (!buffer)
+        buffer = newBuffer(0, total);
+    buffer->refcount = 1;
+    refcount = &buffer->refcount;
+    datastart = data = static_cast<uchar*>(buffer->data);
+}
+
+void PoolMatAllocator::deallocate(int *refcount, uchar * /*datastart*/, uchar * /*data*/)
+{
+    releaseBuffer(reinterpret_cast<PoolBuffer*>(refcount));
+}
+
+#endif
+
+FramePool::FramePool(qint64 maxIdleBytes)
+    : d(new FramePoolCore(maxIdleBytes))
+{
+}
+
+FramePool::~FramePool()
+{
+    d->close();
+}
+
+/* QImage of size and format, whose data goes back to the pool when the last copy of it is destroyed
+ *
+ * - The data is uninitialized, and the color table of Indexed8 is empty, same as QImage(size, format).
+ */
+QImage FramePool::image(const QSize &size, QImage::Format format)
+{
+#if QT_VERSION >= 0x050000
+    const int bpp = bytesPerPixel(format);
+    if (bpp && !size.isEmpty()) {
+        //Scanlines are 32-bit aligned, same as the ones allocated by QImage
+        const int bytesPerLine = (size.width() * bpp + 3) & ~3;
+        PoolBuffer *buffer = d->acquire(size_t(bytesPerLine) * size.height());
+        return QImage(static_cast<uchar*>(buffer->data), size.width(), size.height(), bytesPerLine, format,
+                      releaseImageBuffer, buffer);
+    }
+#endif
+    return QImage(size, format);
+}
+
+//cv::Mat of rows x cols and type, whose data goes back to the pool when the last reference is released
+cv::Mat FramePool::mat(int rows, int cols, int type)
+{
+    cv::Mat mat;
+    mat.allocator = d->allocator;
+    mat.create(rows, cols, type);
+    return mat;
+}
+
+cv::MatAllocator *FramePool::matAllocator() const
+{
+    return d->allocator;
+}
+
+void FramePool::reserve(const QSize &size, QImage::Format format, int count)
+{
+    QList<QImage> images;
+    for (int i=0; i<count; ++i)
+        images.append(image(size, format));
+}
+
+void FramePool::reserve(int rows, int cols, int type, int count)
+{
+    QList<cv::Mat> mats;
+    for (int i=0; i<count; ++i)
+        mats.append(mat(rows, cols, type));
+}
+
+void FramePool::setMaxIdleBytes(qint64 bytes)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maxIdleBytes = bytes;
+    d->trim();
+}
+
+qint64 FramePool::maxIdleBytes() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maxIdleBytes;
+}
+
+qint64 FramePool::idleBytes() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->idleBytes;
+}
+
+int FramePool::allocationCount() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->allocations;
+}
+
+void FramePool::clear()
+{
+    QMutexLocker locker(&d->mutex);
+    const qint64 maxIdleBytes = d->maxIdleBytes;
+    d->maxIdleBytes = 0;
+    d->trim();
+    d->maxIdleBytes = maxIdleBytes;
+}
+
+} //namespace QtOcv
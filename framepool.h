@@ -0,0 +1,78 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QImage>
+#include <opencv2/core/core.hpp>
+
+namespace QtOcv {
+
+class FramePoolCore;
+
+/* Buffers of QImage and cv::Mat, which go back to the pool when the last reference is dropped
+ *
+ * - Buffers are allocated by cv::fastMalloc() and keyed by their size in bytes, so a QImage and a
+ *   cv::Mat of the same size (such as 1080p RGB32 and CV_8UC4) use the same buffers.
+ * - Passing them to mat2Image() and image2Mat() as the caller-owned storage, or retrieving
+ *   frames into them, makes a pipeline run without allocation once it is warmed up.
+ * - Thread safe, buffers can be released in any thread. The idle buffers least recently used are
+ *   freed first when there are more than maxIdleBytes, so an old resolution doesn't stay forever.
+ */
+class FramePool
+{
+public:
+    explicit FramePool(qint64 maxIdleBytes = qint64(256) << 20);
+    ~FramePool();
+
+    //The formats converted by QtOcv are pooled with Qt5, others are allocated as usual
+    QImage image(const QSize &size, QImage::Format format);
+    cv::Mat mat(int rows, int cols, int type);
+
+    //Allocator of the cv::Mat created by mat(), which keeps pooling when the cv::Mat is recreated.
+    //It can be set to other cv::Mat too. Once the pool is destroyed, it allocates without pooling
+    cv::MatAllocator *matAllocator() const;
+
+    //Allocate buffers up front, such as before frames start to arrive
+    void reserve(const QSize &size, QImage::Format format, int count);
+    void reserve(int rows, int cols, int type, int count);
+
+    void setMaxIdleBytes(qint64 bytes);
+    qint64 maxIdleBytes() const;
+    qint64 idleBytes() const;
+    //Buffers allocated by the pool since it was created, which stops to grow in a steady state
+    int allocationCount() const;
+    //Free the idle buffers
+    void clear();
+
+private:
+    Q_DISABLE_COPY(FramePool)
+    FramePoolCore *d;
+};
+
+} //namespace QtOcv
+
+#endif // FRAMEPOOL_H
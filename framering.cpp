@@ -0,0 +1,70 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#include "framering.h"
+#include <climits>
+
+namespace QtOcv {
+
+FrameWaiter::FrameWaiter()
+    : m_sleeping(0)
+{
+}
+
+void FrameWaiter::wake()
+{
+    //Ordered, so it isn't moved before the value is published
+    if (!m_sleeping.fetchAndAddOrdered(0))
+        return;
+    interrupt();
+}
+
+void FrameWaiter::interrupt()
+{
+    QMutexLocker locker(&m_mutex);
+    m_condition.wakeAll();
+}
+
+void FrameWaiter::prepare()
+{
+    m_mutex.lock();
+    //Ordered, so the consumer checks its queue after the producer can see the flag
+    m_sleeping.fetchAndStoreOrdered(1);
+}
+
+void FrameWaiter::cancel()
+{
+    m_sleeping.fetchAndStoreOrdered(0);
+    m_mutex.unlock();
+}
+
+bool FrameWaiter::sleep(int msecs)
+{
+    const bool woken = m_condition.wait(&m_mutex, msecs < 0 ? ULONG_MAX : static_cast<unsigned long>(msecs));
+    cancel();
+    return woken;
+}
+
+} //namespace QtOcv
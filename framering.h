@@ -0,0 +1,260 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+#include <vector>
+
+namespace QtOcv {
+
+//Acquire and release accesses of QAtomicInt, which Qt4 has only as read-modify-write operations
+inline int atomicLoadAcquire(const QAtomicInt &value)
+{
+#if QT_VERSION >= 0x050000
+    return value.loadAcquire();
+#else
+    return const_cast<QAtomicInt&>(value).fetchAndAddAcquire(0);
+#endif
+}
+
+inline void atomicStoreRelease(QAtomicInt &value, int newValue)
+{
+#if QT_VERSION >= 0x050000
+    value.storeRelease(newValue);
+#else
+    value.fetchAndStoreRelease(newValue);
+#endif
+}
+
+/* Wake up a consumer sleeping until the producer publishes something
+ *
+ * - The producer only reads a flag in wake() unless the consumer is really sleeping, so
+ *   publishing costs no mutex while the consumer is busy or polling.
+ * - The consumer calls prepare(), checks its queue, then either sleep() or cancel().
+ */
+class FrameWaiter
+{
+public:
+    FrameWaiter();
+
+    //Producer
+    void wake();
+    //Wake the consumer even if nothing is published, such as to stop it
+    void interrupt();
+
+    //Consumer
+    void prepare();
+    void cancel();
+    //Return false if msecs elapsed, -1 means no timeout
+    bool sleep(int msecs);
+
+private:
+    Q_DISABLE_COPY(FrameWaiter)
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QAtomicInt m_sleeping;
+};
+
+/* Lock-free ring between one producer thread and one consumer thread
+ *
+ * - push() and pop() take no mutex and allocate nothing, a full ring drops the incoming
+ *   value, so memory and the latency of the queued values are bounded by capacity.
+ * - beginWrite() / endWrite() and beginRead() / endRead() give the slots in place. A slot keeps
+ *   its value after it is read, so the cv::Mat or QImage in it can be written again by the
+ *   producer without allocation, such as by cv::VideoCapture::retrieve() or mat2Image().
+ *   Slots can be filled up front with the buffers of a FramePool.
+ * - The consumer polls with pop(), or sleeps in wait() until a value is pushed.
+ */
+template <typename T>
+class FrameRing
+{
+public:
+    explicit FrameRing(int capacity = 4)
+        : m_slots(qMax(capacity, 1) + 1), m_head(0), m_tail(0), m_dropped(0)
+    {
+    }
+
+    int capacity() const { return int(m_slots.size()) - 1; }
+    //Values in the ring, which may be changed immediately by the other thread
+    int count() const
+    {
+        const int size = int(m_slots.size());
+        return (atomicLoadAcquire(m_tail) - atomicLoadAcquire(m_head) + size) % size;
+    }
+    bool isEmpty() const { return atomicLoadAcquire(m_head) == atomicLoadAcquire(m_tail); }
+    //Values dropped by push() since the ring was created
+    int droppedCount() const { return atomicLoadAcquire(m_dropped); }
+
+    //Producer: slot to be written, 0 if the ring is full. endWrite() publishes it
+    T *beginWrite()
+    {
+        const int tail = atomicLoadAcquire(m_tail);
+        if (next(tail) == atomicLoadAcquire(m_head))
+            return 0;
+        return &m_slots[tail];
+    }
+
+    void endWrite()
+    {
+        atomicStoreRelease(m_tail, next(atomicLoadAcquire(m_tail)));
+        m_waiter.wake();
+    }
+
+    //Return false if the ring is full, and value is dropped
+    bool push(const T &value)
+    {
+        T *slot = beginWrite();
+        if (!slot) {
+            m_dropped.ref();
+            return false;
+        }
+        *slot = value;
+        endWrite();
+        return true;
+    }
+
+    //Consumer: the oldest slot, 0 if the ring is empty. endRead() gives it back to the producer
+    T *beginRead()
+    {
+        const int head = atomicLoadAcquire(m_head);
+        if (head == atomicLoadAcquire(m_tail))
+            return 0;
+        return &m_slots[head];
+    }
+
+    void endRead()
+    {
+        atomicStoreRelease(m_head, next(atomicLoadAcquire(m_head)));
+    }
+
+    //Return false if the ring is empty
+    bool pop(T &value)
+    {
+        T *slot = beginRead();
+        if (!slot)
+            return false;
+        value = *slot;
+        endRead();
+        return true;
+    }
+
+    //Block until a value is available, or msecs elapsed or interrupt() is called
+    bool wait(int msecs = -1)
+    {
+        m_waiter.prepare();
+        if (!isEmpty()) {
+            m_waiter.cancel();
+            return true;
+        }
+        m_waiter.sleep(msecs);
+        return !isEmpty();
+    }
+
+    void interrupt() { m_waiter.interrupt(); }
+
+private:
+    Q_DISABLE_COPY(FrameRing)
+    int next(int index) const { return index + 1 == int(m_slots.size()) ? 0 : index + 1; }
+
+    std::vector<T> m_slots;
+    QAtomicInt m_head;
+    QAtomicInt m_tail;
+    QAtomicInt m_dropped;
+    FrameWaiter m_waiter;
+};
+
+/* Latest value wins, between one producer thread and one consumer thread
+ *
+ * - A lock-free triple buffer: the producer writes writeSlot() and publish() swaps it with the
+ *   shared slot, replacing the value not taken yet. The consumer take() swaps the shared slot
+ *   with readSlot(), which stays valid and untouched by the producer until the next take().
+ * - The three slots are written in place again, so a steady stream allocates nothing.
+ * - The consumer is never behind more than one value, however slow it is.
+ */
+template <typename T>
+class FrameMailbox
+{
+public:
+    FrameMailbox() : m_write(0), m_shared(1), m_read(2), m_dropped(0) {}
+
+    //Values replaced before taken since the mailbox was created
+    int droppedCount() const { return atomicLoadAcquire(m_dropped); }
+    bool hasNew() const { return (atomicLoadAcquire(m_shared) & Fresh) != 0; }
+
+    //Producer
+    T &writeSlot() { return m_slots[m_write]; }
+    void publish()
+    {
+        const int previous = m_shared.fetchAndStoreOrdered(m_write | Fresh);
+        if (previous & Fresh)
+            m_dropped.ref();
+        m_write = previous & IndexMask;
+        m_waiter.wake();
+    }
+
+    //Consumer: return false if nothing has been published since the last take()
+    bool take()
+    {
+        if (!hasNew())
+            return false;
+        //Only the producer changes the shared slot in the meantime, which keeps it fresh
+        m_read = m_shared.fetchAndStoreOrdered(m_read) & IndexMask;
+        return true;
+    }
+    T &readSlot() { return m_slots[m_read]; }
+
+    //Block until a new value is published, or msecs elapsed or interrupt() is called
+    bool wait(int msecs = -1)
+    {
+        m_waiter.prepare();
+        if (hasNew()) {
+            m_waiter.cancel();
+            return true;
+        }
+        m_waiter.sleep(msecs);
+        return hasNew();
+    }
+
+    void interrupt() { m_waiter.interrupt(); }
+
+private:
+    Q_DISABLE_COPY(FrameMailbox)
+    enum { IndexMask = 3, Fresh = 4 };
+
+    T m_slots[3];
+    int m_write;        //owned by the producer
+    QAtomicInt m_shared;
+    int m_read;         //owned by the consumer
+    QAtomicInt m_dropped;
+    FrameWaiter m_waiter;
+};
+
+} //namespace QtOcv
+
+#endif // FRAMERING_H
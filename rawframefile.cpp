@@ -0,0 +1,373 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#include "rawframefile.h"
+#include <climits>
+#include <cstring>
+
+namespace QtOcv {
+
+namespace {
+
+const char fileMagic[8] = {'Q', 'T', 'O', 'C', 'V', 'R', 'A', 'W'};
+const quint32 fileVersion = 1;
+//Read back as 0x04030201 by a system of the other byte order
+const quint32 byteOrderMark = 0x01020304;
+const quint32 frameMagic = 0x52464f51;
+//Size of the headers, and alignment of the records and the data
+const qint64 blockSize = 64;
+
+struct FileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    char reserved[48];
+};
+
+struct FrameHeader
+{
+    quint32 magic;
+    qint32 colorCount;
+    qint32 width;
+    qint32 height;
+    qint64 step;
+    qint32 matType;
+    qint32 format;
+    qint32 matRgbOrder;
+    qint32 stream;
+    qint64 timestamp;
+    qint64 dataOffset;  //from the start of the record
+    qint64 recordSize;
+};
+
+qint64 alignBlock(qint64 size)
+{
+    return (size + blockSize - 1) & ~(blockSize - 1);
+}
+
+//Channel order of the cv::Mat returned by image2Mat_shared()
+MatChannelOrder sharedChannelOrder(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGB888:
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+#endif
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+#endif
+        return MCO_RGB;
+    default:
+        return MCO_BGR;
+    }
+}
+
+/* Whether the header of the record at pos, which comes from the file, can be trusted
+ *
+ * - Every size is checked against the bytes left before it is multiplied or added, so a corrupt
+ *   header can't overflow, and the color table, the cv::Mat and the QImage all stay in the record.
+ */
+bool validFrame(const FrameHeader &frame, qint64 pos, qint64 size, QVector<int> &depths)
+{
+    const qint64 available = size - pos;
+    if (frame.magic != frameMagic || frame.width <= 0 || frame.height <= 0 || frame.step <= 0
+            || frame.colorCount < 0 || frame.colorCount > 256
+            || frame.recordSize <= 0 || frame.recordSize > available
+            || frame.dataOffset < qint64(sizeof(FrameHeader)) + frame.colorCount * qint64(sizeof(QRgb))
+            || frame.dataOffset > frame.recordSize
+            || frame.step < qint64(frame.width) * qint64(CV_ELEM_SIZE(frame.matType))
+            || frame.step > (frame.recordSize - frame.dataOffset) / frame.height)
+        return false;
+
+    if (frame.format != QImage::Format_Invalid) {
+        if (frame.format < 0 || frame.format >= QImage::NImageFormats)
+            return false;
+        if (depths.isEmpty())
+            depths.fill(-1, QImage::NImageFormats);
+        int &depth = depths[frame.format];
+        if (depth < 0)
+            depth = QImage(1, 1, QImage::Format(frame.format)).depth();
+        if (frame.step > INT_MAX || frame.step < (qint64(frame.width) * depth + 7) / 8)
+            return false;
+    }
+    return true;
+}
+
+bool writePadding(QIODevice *device, qint64 size)
+{
+    static const char zeros[blockSize] = {0};
+    return size == 0 || device->write(zeros, size) == size;
+}
+
+} //namespace
+
+RawFrameWriter::RawFrameWriter(QIODevice *device)
+    : m_device(device), m_headerChecked(false)
+{
+}
+
+/* Append mat as a frame
+ *
+ * - The rows are stored without padding, ROIs can be written too.
+ * - Return false if mat is empty or the device fails.
+ */
+bool RawFrameWriter::write(const cv::Mat &mat, int stream, qint64 timestamp, QImage::Format format, MatChannelOrder matRgbOrder)
+{
+    if (mat.empty() || mat.dims != 2)
+        return false;
+
+    RawFrameInfo info;
+    info.width = mat.cols;
+    info.height = mat.rows;
+    info.step = mat.cols * mat.elemSize();
+    info.matType = mat.type();
+    info.format = format;
+    info.matRgbOrder = matRgbOrder;
+    info.stream = stream;
+    info.timestamp = timestamp;
+    return writeFrame(mat.data, mat.step, info.step, info, QVector<QRgb>());
+}
+
+/* Append img as a frame, with the type of cv::Mat returned by image2Mat_shared()
+ *
+ * - The scanlines are stored with the stride of img, so the frame can be shared with a QImage,
+ *   and the color table of Indexed8 is stored too.
+ */
+bool RawFrameWriter::write(const QImage &img, int stream, qint64 timestamp)
+{
+    const cv::Mat mat = image2Mat_shared(img);
+    if (mat.empty())
+        return false;
+
+    RawFrameInfo info;
+    info.width = img.width();
+    info.height = img.height();
+    info.step = img.bytesPerLine();
+    info.matType = mat.type();
+    info.format = img.format();
+    info.matRgbOrder = sharedChannelOrder(img.format());
+    info.stream = stream;
+    info.timestamp = timestamp;
+    return writeFrame(img.constBits(), img.bytesPerLine(), img.bytesPerLine(), info,
+                      img.format() == QImage::Format_Indexed8 ? img.colorTable() : QVector<QRgb>());
+}
+
+bool RawFrameWriter::writeFrame(const uchar *data, size_t dataStep, size_t rowBytes, const RawFrameInfo &info, const QVector<QRgb> &colorTable)
+{
+    Q_ASSERT(m_device);
+    Q_ASSERT(sizeof(FileHeader) == blockSize && sizeof(FrameHeader) == blockSize);
+
+    if (!m_headerChecked) {
+        //Appending to an existing file otherwise
+        if (m_device->size() == 0) {
+            FileHeader header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+            header.version = fileVersion;
+            header.byteOrder = byteOrderMark;
+            if (m_device->write(reinterpret_cast<const char*>(&header), sizeof(header)) != qint64(sizeof(header)))
+                return false;
+        }
+        m_headerChecked = true;
+    }
+
+    FrameHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = frameMagic;
+    header.colorCount = colorTable.size();
+    header.width = info.width;
+    header.height = info.height;
+    header.step = info.step;
+    header.matType = info.matType;
+    header.format = info.format;
+    header.matRgbOrder = info.matRgbOrder;
+    header.stream = info.stream;
+    header.timestamp = info.timestamp;
+    const qint64 tableBytes = qint64(colorTable.size()) * sizeof(QRgb);
+    header.dataOffset = alignBlock(sizeof(header) + tableBytes);
+    const qint64 dataBytes = qint64(info.step) * info.height;
+    header.recordSize = alignBlock(header.dataOffset + dataBytes);
+
+    if (m_device->write(reinterpret_cast<const char*>(&header), sizeof(header)) != qint64(sizeof(header))
+            || (tableBytes && m_device->write(reinterpret_cast<const char*>(colorTable.constData()), tableBytes) != tableBytes)
+            || !writePadding(m_device, header.dataOffset - sizeof(header) - tableBytes))
+        return false;
+
+    for (int i=0; i<info.height; ++i) {
+        if (m_device->write(reinterpret_cast<const char*>(data + i*dataStep), rowBytes) != qint64(rowBytes))
+            return false;
+    }
+    return writePadding(m_device, header.recordSize - header.dataOffset - dataBytes);
+}
+
+RawFrameReader::RawFrameReader(const QString &fileName)
+    : m_file(fileName), m_map(0), m_size(0)
+{
+}
+
+RawFrameReader::~RawFrameReader()
+{
+    close();
+}
+
+void RawFrameReader::setFileName(const QString &fileName)
+{
+    close();
+    m_file.setFileName(fileName);
+}
+
+/* Map the file and index its frames
+ *
+ * - A truncated record at the end, such as the one of a recording which was killed, is skipped.
+ * - Return false if the file can't be mapped, or it isn't a raw frame file of this system's byte order.
+ */
+bool RawFrameReader::open()
+{
+    close();
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    m_size = m_file.size();
+    if (m_size >= blockSize) {
+#if QT_VERSION >= 0x050400
+        m_map = m_file.map(0, m_size, QFileDevice::MapPrivateOption);
+#else
+        m_map = m_file.map(0, m_size);
+#endif
+    }
+
+    FileHeader header;
+    if (m_map)
+        std::memcpy(&header, m_map, sizeof(header));
+    if (!m_map || std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0
+            || header.version != fileVersion || header.byteOrder != byteOrderMark) {
+        close();
+        return false;
+    }
+
+    //Bits per pixel of the formats found so far
+    QVector<int> depths;
+    for (qint64 pos = blockSize; pos + blockSize <= m_size; ) {
+        FrameHeader frame;
+        std::memcpy(&frame, m_map + pos, sizeof(frame));
+        if (!validFrame(frame, pos, m_size, depths))
+            break;
+        m_offsets.append(pos);
+        pos += frame.recordSize;
+    }
+    return true;
+}
+
+void RawFrameReader::close()
+{
+    if (m_map)
+        m_file.unmap(m_map);
+    m_map = 0;
+    m_size = 0;
+    m_offsets.clear();
+    m_file.close();
+}
+
+bool RawFrameReader::isOpen() const
+{
+    return m_map != 0;
+}
+
+int RawFrameReader::frameCount() const
+{
+    return m_offsets.size();
+}
+
+RawFrameInfo RawFrameReader::frameInfo(int index) const
+{
+    Q_ASSERT(index >= 0 && index < m_offsets.size());
+
+    RawFrameInfo info;
+    if (index < 0 || index >= m_offsets.size())
+        return info;
+
+    FrameHeader frame;
+    std::memcpy(&frame, m_map + m_offsets[index], sizeof(frame));
+    info.width = frame.width;
+    info.height = frame.height;
+    info.step = frame.step;
+    info.matType = frame.matType;
+    info.format = QImage::Format(frame.format);
+    info.matRgbOrder = MatChannelOrder(frame.matRgbOrder);
+    info.stream = frame.stream;
+    info.timestamp = frame.timestamp;
+    return info;
+}
+
+const uchar *RawFrameReader::frameData(int index) const
+{
+    FrameHeader frame;
+    std::memcpy(&frame, m_map + m_offsets[index], sizeof(frame));
+    return m_map + m_offsets[index] + frame.dataOffset;
+}
+
+//The frame as a cv::Mat which shares the data of the mapping
+cv::Mat RawFrameReader::mat(int index) const
+{
+    const RawFrameInfo info = frameInfo(index);
+    if (!info.width)
+        return cv::Mat();
+
+    return cv::Mat(info.height, info.width, info.matType, const_cast<uchar*>(frameData(index)), info.step);
+}
+
+/* The frame as a QImage which shares the data of the mapping
+ *
+ * - Frames which can't be shared, whose format is Format_Invalid, are converted by mat2Image().
+ */
+QImage RawFrameReader::image(int index) const
+{
+    const RawFrameInfo info = frameInfo(index);
+    if (!info.width)
+        return QImage();
+
+    if (info.format == QImage::Format_Invalid)
+        return mat2Image(mat(index), QImage::Format_Invalid, info.matRgbOrder);
+
+#if QT_VERSION >= 0x050400
+    QImage img(const_cast<uchar*>(frameData(index)), info.width, info.height, int(info.step), info.format);
+#else
+    QImage img(frameData(index), info.width, info.height, int(info.step), info.format);
+#endif
+    FrameHeader frame;
+    std::memcpy(&frame, m_map + m_offsets[index], sizeof(frame));
+    if (frame.colorCount > 0) {
+        const QRgb *table = reinterpret_cast<const QRgb*>(m_map + m_offsets[index] + sizeof(frame));
+        QVector<QRgb> colorTable(frame.colorCount);
+        std::memcpy(colorTable.data(), table, frame.colorCount * sizeof(QRgb));
+        img.setColorTable(colorTable);
+    }
+    return img;
+}
+
+} //namespace QtOcv
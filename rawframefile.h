@@ -0,0 +1,114 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef RAWFRAMEFILE_H
+#define RAWFRAMEFILE_H
+
+#include "cvmatandqimage.h"
+#include <QFile>
+
+/* A raw container of frames, which can be memory mapped and used without decoding
+ *
+ * - File header of 64 bytes: "QTOCVRAW", version and byte order mark.
+ * - Then one record for each frame: a header of 64 bytes (size, stride, cv type, QImage format,
+ *   channel order, stream and timestamp), the color table of Indexed8, and the rows
+ *   starting from a 64-byte boundary.
+ * - Frames of several streams (cameras) and sizes can be mixed in one file.
+ */
+
+namespace QtOcv {
+
+struct RawFrameInfo
+{
+    RawFrameInfo() : width(0), height(0), step(0), matType(0), format(QImage::Format_Invalid)
+      , matRgbOrder(MCO_BGR), stream(0), timestamp(0) {}
+
+    int width;
+    int height;
+    size_t step;
+    int matType;
+    QImage::Format format;      //Format_Invalid means the data can't be shared with a QImage
+    MatChannelOrder matRgbOrder;
+    int stream;
+    qint64 timestamp;
+};
+
+//Append frames to a QIODevice, the file header is written when device is empty
+class RawFrameWriter
+{
+public:
+    explicit RawFrameWriter(QIODevice *device);
+
+    //format is the QImage format which the data of mat can be shared with, such as Format_BGR888 for CV_8UC3 (B G R)
+    bool write(const cv::Mat &mat, int stream = 0, qint64 timestamp = 0, QImage::Format format = QImage::Format_Invalid,
+               MatChannelOrder matRgbOrder = MCO_BGR);
+    //Formats of image2Mat_shared() are supported
+    bool write(const QImage &img, int stream = 0, qint64 timestamp = 0);
+
+private:
+    bool writeFrame(const uchar *data, size_t dataStep, size_t rowBytes, const RawFrameInfo &info, const QVector<QRgb> &colorTable);
+
+    QIODevice *m_device;
+    bool m_headerChecked;
+};
+
+/* Read a raw frame file through one memory mapping of the whole file
+ *
+ * - mat() and image() are headers of the mapping without data copy, which are valid until the
+ *   reader is closed. The mapping is private with Qt5.4 or newer, so they can be written without
+ *   changing the file; with older Qt they must not be written.
+ * - image() converts the frames whose data can't be shared.
+ */
+class RawFrameReader
+{
+public:
+    explicit RawFrameReader(const QString &fileName = QString());
+    ~RawFrameReader();
+
+    void setFileName(const QString &fileName);
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    int frameCount() const;
+    RawFrameInfo frameInfo(int index) const;
+    cv::Mat mat(int index) const;
+    QImage image(int index) const;
+
+private:
+    RawFrameReader(const RawFrameReader &);
+    RawFrameReader &operator=(const RawFrameReader &);
+
+    const uchar *frameData(int index) const;
+
+    QFile m_file;
+    uchar *m_map;
+    qint64 m_size;
+    QVector<qint64> m_offsets;
+};
+
+} //namespace QtOcv
+
+#endif // RAWFRAMEFILE_H
@@ -0,0 +1,274 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef ROWKERNELS_H
+#define ROWKERNELS_H
+
+#include <QtGlobal>
+#include <cstring>
+
+namespace QtOcv {
+
+/* Scalar row kernels of the conversions, which are header-only and inline
+ *
+ * - These are the kernels used by cvmatandqimage.cpp on the paths without SIMD, and the ones its SIMD
+ *   kernels are tested against, so the results are bit-exact to the ones of the conversion functions.
+ * - They are plain loops of integer or float math on contiguous rows, without calls or runtime
+ *   dispatch, so a loop of the caller can inline them, vectorized for the -march of the caller, or
+ *   fused with its own processing. No library or LTO is needed for that.
+ * - src and dst rows mustn't overlap, but src == dst is supported by swizzleRow3To3_, swizzleRow4To4_,
+ *   premultiplyRow4To4_ and grayRow_, which read each pixel before writing it, so they convert in place.
+ */
+namespace RowKernels {
+
+/* Swizzle 8-bit pixels of 3 or 4 channels
+ *
+ * - swapRB exchanges byte 0 and byte 2 of each pixel, the 4th byte is alpha, 255 when opaque is set.
+ */
+template<bool swapRB>
+void swizzleRow3To3_(const uchar *src, uchar *dst, int width)
+{
+    if (!swapRB) {
+        if (src != dst)
+            std::memcpy(dst, src, width*3);
+        return;
+    }
+    for (int x=0; x<width; ++x, src+=3, dst+=3) {
+        const uchar r = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = r;
+    }
+}
+
+template<bool swapRB>
+void swizzleRow3To4_(const uchar *src, uchar *dst, int width)
+{
+    for (int x=0; x<width; ++x, src+=3, dst+=4) {
+        dst[0] = src[swapRB ? 2 : 0];
+        dst[1] = src[1];
+        dst[2] = src[swapRB ? 0 : 2];
+        dst[3] = 255;
+    }
+}
+
+template<bool swapRB>
+void swizzleRow4To3_(const uchar *src, uchar *dst, int width)
+{
+    for (int x=0; x<width; ++x, src+=4, dst+=3) {
+        dst[0] = src[swapRB ? 2 : 0];
+        dst[1] = src[1];
+        dst[2] = src[swapRB ? 0 : 2];
+    }
+}
+
+template<bool swapRB, bool opaque>
+void swizzleRow4To4_(const uchar *src, uchar *dst, int width)
+{
+    if (!swapRB && !opaque) {
+        if (src != dst)
+            std::memcpy(dst, src, width*4);
+        return;
+    }
+    for (int x=0; x<width; ++x, src+=4, dst+=4) {
+        const uchar r = src[0];
+        dst[0] = src[swapRB ? 2 : 0];
+        dst[1] = src[1];
+        dst[2] = swapRB ? r : src[2];
+        dst[3] = opaque ? 255 : src[3];
+    }
+}
+
+/* Multiply the colors of 4 channels pixels by their alpha, which is the last component
+ *
+ * - Same rounding as qPremultiply() and qUnpremultiply().
+ */
+inline uchar premultiply8(uint c, uint a)
+{
+    const uint t = c * a;
+    return uchar((t + (t >> 8) + 0x80u) >> 8);
+}
+
+inline quint16 premultiply16(uint c, uint a)
+{
+    const uint t = c * a;
+    return quint16((t + (t >> 16) + 0x8000u) >> 16);
+}
+
+inline uchar unpremultiply8(uint c, uint a)
+{
+    //(c * (0x00ff00ff / a)) >> 16 equals to c * 255 / a, rounded
+    return a ? uchar(qMin(255u, (c * (0x00ff00ffu / a) + 0x8000u) >> 16)) : 0;
+}
+
+inline quint16 unpremultiply16(uint c, uint a)
+{
+    return a ? quint16(qMin(65535u, (c * 65535u + a / 2) / a)) : 0;
+}
+
+template<bool swapRB>
+void premultiplyRow4To4_(const uchar *src, uchar *dst, int width)
+{
+    for (int x=0; x<width; ++x, src+=4, dst+=4) {
+        const uint a = src[3];
+        const uchar r = premultiply8(src[swapRB ? 2 : 0], a);
+        const uchar g = premultiply8(src[1], a);
+        const uchar b = premultiply8(src[swapRB ? 0 : 2], a);
+        dst[0] = r;
+        dst[1] = g;
+        dst[2] = b;
+        dst[3] = uchar(a);
+    }
+}
+
+//Fixed-point ITU-R BT.601 luma, same coefficients and rounding as cv::cvtColor()
+inline int grayPixel(int r, int g, int b)
+{
+    return (r * 4899 + g * 9617 + b * 1868 + (1 << 13)) >> 14;
+}
+
+template<int srcChannels, int redIndex>
+void grayRow_(const uchar *src, uchar *dst, int width)
+{
+    for (int x=0; x<width; ++x, src+=srcChannels)
+        dst[x] = grayPixel(src[redIndex], src[1], src[2-redIndex]);
+}
+
+//v * scale + offset of component index[c] of each pixel, to planes[c] of float
+inline float planarValue(uchar v, float scale, float offset)
+{
+    //Keep the product rounded, same as the SIMD versions which don't fuse it
+    const float product = float(v) * scale;
+    return product + offset;
+}
+
+template<int srcChannels>
+void planarRow_(const uchar *src, int width, const int *index, const float *scale, const float *offset, float * const *planes)
+{
+    for (int c=0; c<3; ++c) {
+        const uchar * s = src + index[c];
+        float * d = planes[c];
+        for (int x=0; x<width; ++x)
+            d[x] = planarValue(s[x*srcChannels], scale[c], offset[c]);
+    }
+}
+
+/* BT.601 limited range YUV to 4 channels pixels of alpha 255, with R at redIndex
+ *
+ * - Chroma is shared by each 2 pixels, and its samples are uvStep bytes apart, 1 for planar rows and
+ *   2 for interleaved ones. The 13-bit fixed point gives the same results as the SIMD versions.
+ */
+enum {
+    YuvShift = 13,
+    YuvCY = 9539,       //1.164383
+    YuvCVR = 13075,     //1.596027
+    YuvCUG = -3209,     //-0.391762
+    YuvCVG = -6660,     //-0.812968
+    YuvCUB = 16525      //2.017232
+};
+
+inline uchar yuvClamp(int v)
+{
+    return uchar(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+template<int redIndex>
+void yuvRow_(const uchar *y, const uchar *u, const uchar *v, int uvStep, uchar *dst, int width)
+{
+    const int round = 1 << (YuvShift - 1);
+    for (int x=0; x<width; ++x, dst+=4) {
+        const int yy = qMax(int(y[x]) - 16, 0) * YuvCY;
+        const int uu = int(u[(x >> 1) * uvStep]) - 128;
+        const int vv = int(v[(x >> 1) * uvStep]) - 128;
+        dst[redIndex] = yuvClamp((yy + YuvCVR*vv + round) >> YuvShift);
+        dst[1] = yuvClamp((yy + YuvCUG*uu + YuvCVG*vv + round) >> YuvShift);
+        dst[2 - redIndex] = yuvClamp((yy + YuvCUB*uu + round) >> YuvShift);
+        dst[3] = 255;
+    }
+}
+
+/* Y of each pixel, and U V of each 2 x 2 pixels (or the 1 x 2 pixels of the last odd row) of
+ * 4:2:0 and 4:2:2, from pixels of channels with R at redIndex. Rows are in the same fixed
+ * point as the above.
+ */
+enum {
+    YuvYR = 2104,       //0.256788
+    YuvYG = 4130,       //0.504129
+    YuvYB = 802,        //0.097906
+    YuvUR = -1214,      //-0.148223
+    YuvUG = -2384,      //-0.290993
+    YuvUB = 3598,       //0.439216
+    YuvVR = 3598,       //0.439216
+    YuvVG = -3013,      //-0.367788
+    YuvVB = -585        //-0.071427
+};
+
+inline uchar rgbToY(int r, int g, int b)
+{
+    return yuvClamp((YuvYR*r + YuvYG*g + YuvYB*b + (16 << YuvShift) + (1 << (YuvShift - 1))) >> YuvShift);
+}
+
+//U or V of the sums of samples pixels
+inline uchar rgbToChroma(int r, int g, int b, int samples, int cr, int cg, int cb)
+{
+    const int shift = YuvShift + (samples == 4 ? 2 : (samples == 2 ? 1 : 0));
+    return yuvClamp((cr*r + cg*g + cb*b + (128 << shift) + (1 << (shift - 1))) >> shift);
+}
+
+/* Convert the rows row0 and row1 (null for the last odd row) to Y, and their chroma to one
+ * row of u and v, which are uvStep bytes apart. y1 is ignored when row1 is null.
+ */
+inline void rgbRowsToYuv(const uchar *row0, const uchar *row1, int channels, int redIndex, int width,
+                         uchar *y0, uchar *y1, uchar *u, uchar *v, int uvStep)
+{
+    const int blueIndex = 2 - redIndex;
+    for (int x=0; x<width; x+=2) {
+        const int pixels = qMin(2, width - x);
+        int r = 0, g = 0, b = 0;
+        for (int i=0; i<pixels; ++i) {
+            const uchar *p0 = row0 + (x + i)*channels;
+            y0[x + i] = rgbToY(p0[redIndex], p0[1], p0[blueIndex]);
+            r += p0[redIndex];
+            g += p0[1];
+            b += p0[blueIndex];
+            if (row1) {
+                const uchar *p1 = row1 + (x + i)*channels;
+                y1[x + i] = rgbToY(p1[redIndex], p1[1], p1[blueIndex]);
+                r += p1[redIndex];
+                g += p1[1];
+                b += p1[blueIndex];
+            }
+        }
+        const int samples = pixels * (row1 ? 2 : 1);
+        u[(x/2)*uvStep] = rgbToChroma(r, g, b, samples, YuvUR, YuvUG, YuvUB);
+        v[(x/2)*uvStep] = rgbToChroma(r, g, b, samples, YuvVR, YuvVG, YuvVB);
+    }
+}
+
+} //namespace RowKernels
+
+} //namespace QtOcv
+
+#endif // ROWKERNELS_H
@@ -0,0 +1,155 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#include "stripconversion.h"
+#include <QIODevice>
+#include <QFile>
+
+namespace QtOcv {
+
+namespace {
+
+//Read size bytes, waiting for sequential devices such as pipes and sockets
+bool readFully(QIODevice *device, char *data, qint64 size)
+{
+    while (size > 0) {
+        const qint64 n = device->read(data, size);
+        if (n < 0 || (n == 0 && !(device->isSequential() && device->waitForReadyRead(-1))))
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+} //namespace
+
+DeviceStripReader::DeviceStripReader(QIODevice *device, qint64 offset, size_t step)
+    : m_device(device), m_offset(offset), m_step(step), m_map(0)
+{
+}
+
+DeviceStripReader::~DeviceStripReader()
+{
+    unmap();
+}
+
+void DeviceStripReader::unmap()
+{
+    if (m_map)
+        static_cast<QFile*>(m_device)->unmap(m_map);
+    m_map = 0;
+}
+
+bool DeviceStripReader::read(int row, cv::Mat &strip)
+{
+    Q_ASSERT(m_device);
+
+    const size_t rowBytes = strip.cols * strip.elemSize();
+    const size_t step = m_step ? m_step : rowBytes;
+    const qint64 pos = m_offset + qint64(row) * step;
+    //The padding after the last row may be missing at the end of the file
+    const qint64 bytes = qint64(step) * (strip.rows - 1) + rowBytes;
+
+    unmap();
+    if (QFile *file = qobject_cast<QFile*>(m_device)) {
+        m_map = file->map(pos, bytes);
+        if (m_map) {
+            strip = cv::Mat(strip.rows, strip.cols, strip.type(), m_map, step);
+            return true;
+        }
+    }
+
+    //Sequential devices are at pos already, as the rows are read in order
+    if (!m_device->isSequential() && !m_device->seek(pos))
+        return false;
+    for (int i=0; i<strip.rows; ++i) {
+        if (!readFully(m_device, reinterpret_cast<char*>(strip.ptr(i)), rowBytes))
+            return false;
+        if (step == rowBytes || i == strip.rows-1)
+            continue;
+        if (m_device->isSequential()) {
+            char padding[64];
+            for (qint64 left = step - rowBytes; left > 0; left -= qMin<qint64>(left, sizeof(padding))) {
+                if (!readFully(m_device, padding, qMin<qint64>(left, sizeof(padding))))
+                    return false;
+            }
+        } else if (!m_device->seek(pos + qint64(i+1) * step)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+DeviceStripWriter::DeviceStripWriter(QIODevice *device)
+    : m_device(device)
+{
+}
+
+bool DeviceStripWriter::write(int /*row*/, const QImage &strip)
+{
+    Q_ASSERT(m_device);
+
+    const qint64 rowBytes = qint64(strip.width()) * strip.depth() / 8;
+    for (int i=0; i<strip.height(); ++i) {
+        if (m_device->write(reinterpret_cast<const char*>(strip.constScanLine(i)), rowBytes) != rowBytes)
+            return false;
+    }
+    return true;
+}
+
+/* Convert a cv::Mat of size and matType, which is read from reader strip by strip, to QImage strips
+ *
+ * - The strips are converted by mat2Image(), so each of them is a QImage of stripRows
+ *   rows (fewer for the last one) and the full width, which is passed to writer.
+ * - The buffers of the source strip and the QImage strip are reused.
+ */
+bool mat2Image_strips(MatStripReader &reader, ImageStripWriter &writer, const cv::Size &size, int matType, int stripRows,
+                      QImage::Format format, MatChannelOrder matRgbOrder, const QVector<QRgb> &colorTable)
+{
+    Q_ASSERT(size.width > 0 && size.height > 0 && stripRows > 0);
+
+    if (size.width <= 0 || size.height <= 0 || stripRows <= 0)
+        return false;
+
+    cv::Mat buffer(qMin(stripRows, size.height), size.width, matType);
+    QImage image;
+    for (int row=0; row<size.height; row+=stripRows) {
+        //A ROI of buffer, so that the last strip doesn't reallocate
+        cv::Mat strip = buffer.rowRange(0, qMin(stripRows, size.height - row));
+        const int rows = strip.rows;
+        if (!reader.read(row, strip))
+            return false;
+        Q_ASSERT(strip.rows == rows && strip.cols == size.width && strip.type() == buffer.type());
+        if (strip.rows != rows || strip.cols != size.width || strip.type() != buffer.type())
+            return false;
+
+        if (!mat2Image(strip, image, format, matRgbOrder, colorTable) || !writer.write(row, image))
+            return false;
+    }
+    return true;
+}
+
+} //namespace QtOcv
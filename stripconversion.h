@@ -0,0 +1,105 @@
+/****************************************************************************
+** Copyright (c) 2012 Debao Zhang <hello@debao.me>
+** All right reserved.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+** NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+** LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+** OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+** WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+****************************************************************************/
+
+#ifndef STRIPCONVERSION_H
+#define STRIPCONVERSION_H
+
+#include "cvmatandqimage.h"
+
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
+
+namespace QtOcv {
+
+//Source of the rows of a cv::Mat which is not held in memory as a whole
+class MatStripReader
+{
+public:
+    virtual ~MatStripReader() {}
+    //Fill strip with the rows starting from row. strip has been allocated with the rows, cols and type
+    //to be read, and may be replaced by a header of the same size and type, which is valid until the next read
+    virtual bool read(int row, cv::Mat &strip) = 0;
+};
+
+//Sink of the converted strips, strip is reused by the next one unless it is kept
+class ImageStripWriter
+{
+public:
+    virtual ~ImageStripWriter() {}
+    virtual bool write(int row, const QImage &strip) = 0;
+};
+
+/* Raw rows stored in a QIODevice, starting from offset, whose stride is step (0 means packed)
+ *
+ * - QFile is memory mapped strip by strip, so the strips are headers of the mapping.
+ * - Other devices, including sequential ones, are read into the strip. Rows of sequential
+ *   devices must be read in order.
+ */
+class DeviceStripReader : public MatStripReader
+{
+public:
+    explicit DeviceStripReader(QIODevice *device, qint64 offset = 0, size_t step = 0);
+    ~DeviceStripReader();
+
+    bool read(int row, cv::Mat &strip);
+
+private:
+    DeviceStripReader(const DeviceStripReader &);
+    DeviceStripReader &operator=(const DeviceStripReader &);
+
+    void unmap();
+
+    QIODevice *m_device;
+    qint64 m_offset;
+    size_t m_step;
+    uchar *m_map;
+};
+
+//Write the scanlines of the strips to a QIODevice without padding, such as the body of a PPM/PGM file
+class DeviceStripWriter : public ImageStripWriter
+{
+public:
+    explicit DeviceStripWriter(QIODevice *device);
+
+    bool write(int row, const QImage &strip);
+
+private:
+    QIODevice *m_device;
+};
+
+/* Convert a cv::Mat of size and matType to QImage strip by strip
+ *
+ * - At most stripRows rows of the source and of the result are in memory at the same time.
+ * - Converted by the same kernels as mat2Image(), with format, matRgbOrder and colorTable.
+ * - Return false if reader or writer fails, or the parameters are invalid.
+ */
+bool mat2Image_strips(MatStripReader &reader, ImageStripWriter &writer, const cv::Size &size, int matType, int stripRows = 64,
+                      QImage::Format format = QImage::Format_Invalid, MatChannelOrder matRgbOrder = MCO_BGR,
+                      const QVector<QRgb> &colorTable = QVector<QRgb>());
+
+} //namespace QtOcv
+
+#endif // STRIPCONVERSION_H
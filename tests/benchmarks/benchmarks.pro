@@ -5,3 +5,6 @@ SUBDIRS += \
 
 SUBDIRS += \
     FloatMatAndQImage
+
+SUBDIRS += \
+    conversionmatrix
@@ -0,0 +1,15 @@
+include (../../../opencv.pri)
+INCLUDEPATH += ../../..
+QT       += testlib
+
+add_opencv_modules(core imgproc)
+
+TARGET = tst_conversionmatrix_benchmark
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += tst_conversionmatrixbenchmark.cpp
+HEADERS += ../../conversiontest.h
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
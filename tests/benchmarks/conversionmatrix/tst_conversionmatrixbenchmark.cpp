@@ -0,0 +1,248 @@
+#include "../../../cvmatandqimage.cpp"
+#include "../../conversiontest.h"
+#include <QString>
+#include <QStringList>
+#include <QtTest>
+#include <QImage>
+#include <QDebug>
+#include <opencv2/core/core.hpp>
+
+using namespace QtOcv;
+using namespace ConversionTest;
+
+/* Throughput of all the conversions
+ *
+ * - Rows: depth x channels x QImage format x channel order x resolution x path,
+ *   where path is "scalar" (cv::setUseOptimized(false)), "simd" or "parallel".
+ * - One row can be selected as usual, such as: mat2Image:"8UC3 BGR RGB888 FHD simd"
+ * - Results are written to tst_conversionmatrix.json, or the file given by
+ *   QTOCV_BENCHMARK_JSON. QTOCV_BENCHMARK_MIN_TIME is the time(ms) spent on each row.
+ */
+Q_DECLARE_METATYPE(QImage::Format)
+Q_DECLARE_METATYPE(MatChannelOrder)
+
+namespace {
+
+struct Resolution
+{
+    const char *name;
+    int width;
+    int height;
+};
+
+const Resolution resolutions[] = {
+    {"VGA", 640, 480},
+    {"HD", 1280, 720},
+    {"FHD", 1920, 1080},
+    {"4K", 3840, 2160},
+    {"8K", 7680, 4320}
+};
+
+} //namespace
+
+class ConversionMatrixBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    ConversionMatrixBenchmark();
+
+private Q_SLOTS:
+    void cleanupTestCase();
+
+    void mat2Image_data();
+    void mat2Image();
+    void image2Mat_data();
+    void image2Mat();
+    void mat2ImageShared_data();
+    void mat2ImageShared();
+    void image2MatShared_data();
+    void image2MatShared();
+
+private:
+    void addMatrix();
+    void addSharedMatrix();
+    template<typename Func>
+    void measure(const Func &func, int pixels, double bytes);
+
+    int m_minTime;
+    QStringList m_results;
+};
+
+ConversionMatrixBenchmark::ConversionMatrixBenchmark()
+{
+    m_minTime = minTime(200);
+}
+
+/* Write the results in the same layout as the JSON of Google Benchmark
+ */
+void ConversionMatrixBenchmark::cleanupTestCase()
+{
+    selectPath(QLatin1String("simd"));
+    writeJson(m_results, "tst_conversionmatrix.json");
+}
+
+//The channel order only matters for cv::Mat with 3 or 4 channels
+void ConversionMatrixBenchmark::addMatrix()
+{
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<MatChannelOrder>("order");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+    QTest::addColumn<QString>("path");
+
+    const int channels[] = {1, 3, 4};
+    for (int d=0; d<arraySize(depths); ++d) {
+        for (int c=0; c<arraySize(channels); ++c) {
+            for (int f=0; f<arraySize(formats); ++f) {
+                for (int o=0; o<(channels[c] == 1 ? 1 : 2); ++o) {
+                    const MatChannelOrder order = o ? MCO_RGB : MCO_BGR;
+                    for (int r=0; r<arraySize(resolutions); ++r) {
+                        for (int p=0; p<arraySize(paths); ++p) {
+                            const QString tag = QString::fromLatin1("%1C%2 %3 %4 %5 %6")
+                                    .arg(QLatin1String(depthName(depths[d]))).arg(channels[c])
+                                    .arg(QLatin1String(o ? "RGB" : "BGR"))
+                                    .arg(QLatin1String(formats[f].name))
+                                    .arg(QLatin1String(resolutions[r].name))
+                                    .arg(QLatin1String(paths[p]));
+                            QTest::newRow(tag.toLatin1().constData())
+                                    << int(CV_MAKETYPE(depths[d], channels[c])) << formats[f].format << order
+                                    << resolutions[r].width << resolutions[r].height << QString::fromLatin1(paths[p]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+//Only the type and format pairs which can share data
+void ConversionMatrixBenchmark::addSharedMatrix()
+{
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+
+    for (int f=0; f<arraySize(formats); ++f) {
+        const PixelLayout layout = pixelLayout(formats[f].format);
+        for (int r=0; r<arraySize(resolutions); ++r) {
+            const QString tag = QString::fromLatin1("%1 %2").arg(QLatin1String(formats[f].name))
+                    .arg(QLatin1String(resolutions[r].name));
+            QTest::newRow(tag.toLatin1().constData()) << sharedMatType(layout) << formats[f].format
+                                          << resolutions[r].width << resolutions[r].height;
+        }
+    }
+}
+
+/* Run func repeatedly for at least m_minTime ms, then report the time of one call
+ *
+ * - bytes is the size of source and destination, which are both touched once.
+ */
+template<typename Func>
+void ConversionMatrixBenchmark::measure(const Func &func, int pixels, double bytes)
+{
+    qint64 iterations = 0;
+    const double seconds = ConversionTest::measure(func, m_minTime, &iterations);
+
+    const double megapixelsPerSecond = pixels / seconds * 1e-6;
+    const double bytesPerSecond = bytes / seconds;
+    QTest::setBenchmarkResult(bytesPerSecond, QTest::BytesPerSecond);
+    qDebug("%.1f MP/s, %.1f MB/s", megapixelsPerSecond, bytesPerSecond * 1e-6);
+
+    m_results << QString::fromLatin1("    {\n      \"name\": \"%1/%2\",\n      \"iterations\": %3,\n"
+                                     "      \"real_time\": %4,\n      \"time_unit\": \"ns\",\n"
+                                     "      \"megapixels_per_second\": %5,\n      \"bytes_per_second\": %6\n    }")
+                 .arg(QLatin1String(QTest::currentTestFunction()))
+                 .arg(QLatin1String(QTest::currentDataTag()))
+                 .arg(iterations)
+                 .arg(seconds * 1e9, 0, 'f', 0)
+                 .arg(megapixelsPerSecond, 0, 'f', 3)
+                 .arg(bytesPerSecond, 0, 'f', 0);
+}
+
+void ConversionMatrixBenchmark::mat2Image_data()
+{
+    addMatrix();
+}
+
+void ConversionMatrixBenchmark::mat2Image()
+{
+    QFETCH(int, matType);
+    QFETCH(QImage::Format, format);
+    QFETCH(MatChannelOrder, order);
+    QFETCH(int, width);
+    QFETCH(int, height);
+    QFETCH(QString, path);
+
+    selectPath(path);
+    const cv::Mat mat = randomMat(height, width, matType);
+    QImage image;
+    QVERIFY(QtOcv::mat2Image(mat, image, format, order));
+
+    measure([&]() { QtOcv::mat2Image(mat, image, format, order); },
+            width * height, double(mat.total() * mat.elemSize()) + double(image.bytesPerLine()) * image.height());
+}
+
+void ConversionMatrixBenchmark::image2Mat_data()
+{
+    addMatrix();
+}
+
+void ConversionMatrixBenchmark::image2Mat()
+{
+    QFETCH(int, matType);
+    QFETCH(QImage::Format, format);
+    QFETCH(MatChannelOrder, order);
+    QFETCH(int, width);
+    QFETCH(int, height);
+    QFETCH(QString, path);
+
+    selectPath(path);
+    const QImage image = randomImage(width, height, format);
+    cv::Mat mat;
+    QVERIFY(QtOcv::image2Mat(image, mat, matType, order));
+
+    measure([&]() { QtOcv::image2Mat(image, mat, matType, order); },
+            width * height, double(mat.total() * mat.elemSize()) + double(image.bytesPerLine()) * image.height());
+}
+
+void ConversionMatrixBenchmark::mat2ImageShared_data()
+{
+    addSharedMatrix();
+}
+
+void ConversionMatrixBenchmark::mat2ImageShared()
+{
+    QFETCH(int, matType);
+    QFETCH(QImage::Format, format);
+    QFETCH(int, width);
+    QFETCH(int, height);
+
+    const cv::Mat mat = randomMat(height, width, matType);
+    QImage image;
+    measure([&]() { image = mat2Image_shared(mat, format); }, width * height, 0);
+    QVERIFY(!image.isNull());
+}
+
+void ConversionMatrixBenchmark::image2MatShared_data()
+{
+    addSharedMatrix();
+}
+
+void ConversionMatrixBenchmark::image2MatShared()
+{
+    QFETCH(QImage::Format, format);
+    QFETCH(int, width);
+    QFETCH(int, height);
+
+    const QImage image = randomImage(width, height, format);
+    cv::Mat mat;
+    measure([&]() { mat = image2Mat_shared(image); }, width * height, 0);
+    QVERIFY(!mat.empty());
+}
+
+QTEST_MAIN(ConversionMatrixBenchmark)
+
+#include "tst_conversionmatrixbenchmark.moc"
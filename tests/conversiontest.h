@@ -0,0 +1,171 @@
+#ifndef CONVERSIONTEST_H
+#define CONVERSIONTEST_H
+
+#include "cvmatandqimage.h"
+#include <QString>
+#include <QStringList>
+#include <QImage>
+#include <QFile>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <opencv2/core/core.hpp>
+
+/* The matrix of conversions and the timing shared by the benchmarks and the differential tests
+ *
+ * - Both suites run the same formats, depths and paths, so their results can be compared.
+ * - JSON results are written in the layout of Google Benchmark, to the file given by
+ *   QTOCV_BENCHMARK_JSON. QTOCV_BENCHMARK_MIN_TIME is the time(ms) spent on each measurement.
+ */
+namespace ConversionTest {
+
+struct Format
+{
+    const char *name;
+    QImage::Format format;
+};
+
+const Format formats[] = {
+    {"Indexed8", QImage::Format_Indexed8},
+    {"RGB888", QImage::Format_RGB888},
+    {"RGB32", QImage::Format_RGB32},
+    {"ARGB32", QImage::Format_ARGB32},
+    {"ARGB32_Premultiplied", QImage::Format_ARGB32_Premultiplied},
+#if QT_VERSION >= 0x050200
+    {"RGBX8888", QImage::Format_RGBX8888},
+    {"RGBA8888", QImage::Format_RGBA8888},
+    {"RGBA8888_Premultiplied", QImage::Format_RGBA8888_Premultiplied},
+#endif
+#if QT_VERSION >= 0x050500
+    {"Grayscale8", QImage::Format_Grayscale8},
+#endif
+#if QT_VERSION >= 0x050C00
+    {"RGBX64", QImage::Format_RGBX64},
+    {"RGBA64", QImage::Format_RGBA64},
+    {"RGBA64_Premultiplied", QImage::Format_RGBA64_Premultiplied},
+#endif
+#if QT_VERSION >= 0x050D00
+    {"Grayscale16", QImage::Format_Grayscale16},
+#endif
+#if QT_VERSION >= 0x050E00
+    {"BGR888", QImage::Format_BGR888},
+#endif
+};
+
+const int depths[] = {CV_8U, CV_16U, CV_32S, CV_32F, CV_64F};
+
+//"scalar" is cv::setUseOptimized(false), "simd" the default, "parallel" all the threads of OpenCV
+const char * const paths[] = {"scalar", "simd", "parallel"};
+
+template<typename T, int N>
+int arraySize(const T (&)[N])
+{
+    return N;
+}
+
+inline const char *depthName(int depth)
+{
+    switch (depth) {
+    case CV_8U: return "8U";
+    case CV_16U: return "16U";
+    case CV_32S: return "32S";
+    case CV_32F: return "32F";
+    default: return "64F";
+    }
+}
+
+inline void selectPath(const QString &path)
+{
+    cv::setUseOptimized(path != QLatin1String("scalar"));
+    QtOcv::setConversionThreads(path == QLatin1String("parallel") ? 0 : 1);
+}
+
+//Values outside of the range of QImage too, so that saturation is taken, and its branches are not always hit the same way
+inline cv::Mat randomMat(int rows, int cols, int type)
+{
+    cv::Mat mat(rows, cols, type);
+    switch (CV_MAT_DEPTH(type)) {
+    case CV_8U:
+        cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(256));
+        break;
+    case CV_16U:
+        cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(65536));
+        break;
+    case CV_32S:
+        cv::randu(mat, cv::Scalar::all(-1000), cv::Scalar::all(70000));
+        break;
+    default:
+        cv::randu(mat, cv::Scalar::all(-0.25), cv::Scalar::all(1.25));
+        break;
+    }
+    return mat;
+}
+
+inline QImage randomImage(int width, int height, QImage::Format format)
+{
+    QImage image(width, height, format);
+    cv::Mat mat = QtOcv::image2Mat_shared(image);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(mat.depth() == CV_16U ? 65536 : 256));
+    if (format == QImage::Format_Indexed8) {
+        QVector<QRgb> colorTable;
+        for (int i=0; i<256; ++i)
+            colorTable.append(qRgb(i, i, i));
+        image.setColorTable(colorTable);
+    }
+    return image;
+}
+
+//QTOCV_BENCHMARK_MIN_TIME, or defaultTime
+inline int minTime(int defaultTime)
+{
+    const int time = qgetenv("QTOCV_BENCHMARK_MIN_TIME").toInt();
+    return time > 0 ? time : defaultTime;
+}
+
+/* Run func repeatedly for at least minTime ms, then return the time of one call in seconds
+ */
+template<typename Func>
+double measure(const Func &func, int minTime, qint64 *iterationCount = 0)
+{
+    func(); //warm up, the first call allocates the output
+
+    QElapsedTimer timer;
+    qint64 iterations = 0;
+    timer.start();
+    do {
+        func();
+        ++iterations;
+    } while (timer.elapsed() < minTime);
+    if (iterationCount)
+        *iterationCount = iterations;
+    return timer.nsecsElapsed() * 1e-9 / iterations;
+}
+
+/* Write the results, one JSON object each, to QTOCV_BENCHMARK_JSON or defaultFileName
+ */
+inline void writeJson(const QStringList &results, const char *defaultFileName)
+{
+    QString fileName = QString::fromLocal8Bit(qgetenv("QTOCV_BENCHMARK_JSON"));
+    if (fileName.isEmpty())
+        fileName = QLatin1String(defaultFileName);
+
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+        qWarning() << "Can not write" << fileName;
+        return;
+    }
+
+    QTextStream out(&file);
+    out << "{\n  \"context\": {\n"
+        << "    \"qt_version\": \"" << QT_VERSION_STR << "\",\n"
+        << "    \"opencv_version\": \"" << CV_VERSION << "\",\n"
+        << "    \"num_cpus\": " << cv::getNumberOfCPUs() << ",\n"
+        << "    \"threads\": " << cv::getNumThreads() << "\n"
+        << "  },\n  \"benchmarks\": [\n"
+        << results.join(QLatin1String(",\n"))
+        << "\n  ]\n}\n";
+}
+
+} //namespace ConversionTest
+
+#endif // CONVERSIONTEST_H
@@ -0,0 +1,15 @@
+include (../../opencv.pri)
+INCLUDEPATH += ../..
+QT       += testlib
+
+add_opencv_modules(core imgproc)
+
+TARGET = tst_differential
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += tst_differential.cpp
+HEADERS += ../conversiontest.h
+DEFINES += SRCDIR=\\\"$$PWD/\\\"
@@ -0,0 +1,566 @@
+#include "../../cvmatandqimage.cpp"
+#include "../conversiontest.h"
+#include <QString>
+#include <QStringList>
+#include <QtTest>
+#include <QImage>
+#include <QDebug>
+#include <functional>
+#include <opencv2/core/core.hpp>
+
+using namespace QtOcv;
+using namespace ConversionTest;
+
+/* Differential tests of the optimized paths against the scalar ones, and their speedup
+ *
+ * - rowKernels: each SIMD row kernel supported by the cpu against its scalar version, for all widths
+ *   up to 100 and a few bigger ones, at unaligned addresses. Bytes around the output are checked too.
+ * - mat2Image / image2Mat: randomized data of every depth, channels, QImage format and channel order,
+ *   of tiny, odd and big sizes, with padded strides on both sides. The "simd" (default) and "parallel"
+ *   paths must be bit-exact to the "scalar" one (cv::setUseOptimized(false)), which must agree with
+ *   the generic per-pixel templates within one 8-bit step.
+ * - speedup: time of the scalar, simd and parallel paths of the common FHD conversions. Results are
+ *   written to tst_differential.json, or the file given by QTOCV_BENCHMARK_JSON.
+ *   QTOCV_BENCHMARK_MIN_TIME is the time(ms) spent on each path.
+ */
+Q_DECLARE_METATYPE(QImage::Format)
+Q_DECLARE_METATYPE(MatChannelOrder)
+
+namespace {
+
+typedef std::function<void(const uchar *src, uchar *dst, int width)> RowKernel;
+
+//Tiny, odd, around the SIMD widths, and big enough to be converted in parallel
+const cv::Size sizes[] = {cv::Size(1, 1), cv::Size(2, 1), cv::Size(3, 2), cv::Size(7, 5), cv::Size(15, 3),
+                          cv::Size(16, 4), cv::Size(17, 5), cv::Size(31, 2), cv::Size(33, 7), cv::Size(65, 3),
+                          cv::Size(1031, 259)};
+
+//The data of the bigger cv::Mat or buffer around the result keeps the strides padded and the rows unaligned
+cv::Mat paddedMat(int rows, int cols, int type, cv::Mat &parent)
+{
+    parent = randomMat(rows + 2, cols + 3, type);
+    return parent(cv::Rect(1, 1, cols, rows));
+}
+
+QImage paddedImage(int width, int height, QImage::Format format, std::vector<uchar> &buffer)
+{
+    //Scanlines must be 32-bit aligned
+    const int bytesPerLine = ((width * QImage(1, 1, format).depth() / 8 + 3) & ~3) + 12;
+    buffer.resize(size_t(bytesPerLine) * height);
+    cv::Mat bytes(height, bytesPerLine, CV_8UC1, &buffer[0]);
+    cv::randu(bytes, cv::Scalar::all(0), cv::Scalar::all(256));
+    QImage image(&buffer[0], width, height, bytesPerLine, format);
+    if (format == QImage::Format_Indexed8)
+        setIndexed8ColorTable(image, QVector<QRgb>());
+    return image;
+}
+
+/* Largest difference of the pixels of a and b, in 8-bit steps
+ *
+ * - Only the bytes of the pixels are compared, not the padding of the scanlines.
+ */
+double imageDiff(const QImage &a, const QImage &b)
+{
+    if (a.size() != b.size() || a.format() != b.format())
+        return 1e9;
+
+    const PixelLayout layout = pixelLayout(a.format());
+    const int values = a.width() * layout.channels;
+    double diff = 0;
+    for (int i=0; i<a.height(); ++i) {
+        for (int j=0; j<values; ++j) {
+            if (layout.depth16) {
+                const int d = qAbs(int(reinterpret_cast<const quint16*>(a.constScanLine(i))[j])
+                                   - int(reinterpret_cast<const quint16*>(b.constScanLine(i))[j]));
+                diff = qMax(diff, d / 257.);
+            } else {
+                diff = qMax(diff, double(qAbs(int(a.constScanLine(i)[j]) - int(b.constScanLine(i)[j]))));
+            }
+        }
+    }
+    return diff;
+}
+
+//Largest difference of a and b, in the steps of the 8-bit values scaled by scaleFactor
+double matDiff(const cv::Mat &a, const cv::Mat &b, double scaleFactor)
+{
+    if (a.size() != b.size() || a.type() != b.type())
+        return 1e9;
+    return cv::norm(a, b, cv::NORM_INF) / scaleFactor;
+}
+
+/* Run ref and opt on the same random source, at each width and alignment
+ *
+ * - Outputs start filled with the same bytes and are compared as a whole, so the writes
+ *   beyond width are caught as well. Return the first mismatch, or an empty string.
+ */
+QString compareRowKernels(const char *name, const RowKernel &ref, const RowKernel &opt, int srcBytes, int dstBytes,
+                          int dstAlign = 1)
+{
+    std::vector<int> widths;
+    for (int width=0; width<=100; ++width)
+        widths.push_back(width);
+    widths.push_back(257);
+    widths.push_back(1000);
+
+    for (size_t w=0; w<widths.size(); ++w) {
+        const int width = widths[w];
+        for (int offset=0; offset<4; ++offset) {
+            cv::Mat src(1, width * srcBytes + 64, CV_8UC1);
+            cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+            cv::Mat refDst(1, width * dstBytes + 64, CV_8UC1, cv::Scalar::all(0xcd));
+            cv::Mat optDst = refDst.clone();
+            const int dstOffset = offset * dstAlign % 16;
+            ref(src.data + offset, refDst.data + dstOffset, width);
+            opt(src.data + offset, optDst.data + dstOffset, width);
+            if (std::memcmp(refDst.data, optDst.data, refDst.cols))
+                return QString::fromLatin1("%1: width %2, offset %3").arg(QLatin1String(name)).arg(width).arg(offset);
+        }
+    }
+    return QString();
+}
+
+//The generic per-pixel conversion of the depth of mat
+void referenceMat2Image(const cv::Mat &mat, QImage &image, MatChannelOrder order, double scaleFactor)
+{
+    const PixelLayout layout = pixelLayout(image.format());
+    const ValueMapping mapping = makeMapping(scaleFactor);
+    switch (mat.depth()) {
+    case CV_8U:
+        mat2ImageMapped_<uchar>(mat, image.bits(), image.bytesPerLine(), layout, order, mapping);
+        break;
+    case CV_16U:
+        mat2ImageMapped_<quint16>(mat, image.bits(), image.bytesPerLine(), layout, order, mapping);
+        break;
+    case CV_32S:
+        mat2ImageMapped_<qint32>(mat, image.bits(), image.bytesPerLine(), layout, order, mapping);
+        break;
+    case CV_32F:
+        mat2ImageMapped_<float>(mat, image.bits(), image.bytesPerLine(), layout, order, mapping);
+        break;
+    default:
+        mat2ImageMapped_<double>(mat, image.bits(), image.bytesPerLine(), layout, order, mapping);
+        break;
+    }
+}
+
+template<typename T>
+void referenceImage2Mat_(const QImage &image, cv::Mat &mat, MatChannelOrder order, double scaleFactor)
+{
+    const PixelLayout layout = pixelLayout(image.format());
+    if (layout.depth16)
+        image2MatWith_<quint16, T>(image.constBits(), image.bytesPerLine(), layout, mat, order, ScaleTo<T>(scaleFactor / 257.));
+    else
+        image2MatWith_<uchar, T>(image.constBits(), image.bytesPerLine(), layout, mat, order, ScaleTo<T>(scaleFactor));
+}
+
+void referenceImage2Mat(const QImage &image, cv::Mat &mat, MatChannelOrder order, double scaleFactor)
+{
+    switch (mat.depth()) {
+    case CV_8U:
+        referenceImage2Mat_<uchar>(image, mat, order, scaleFactor);
+        break;
+    case CV_16U:
+        referenceImage2Mat_<quint16>(image, mat, order, scaleFactor);
+        break;
+    case CV_32S:
+        referenceImage2Mat_<qint32>(image, mat, order, scaleFactor);
+        break;
+    case CV_32F:
+        referenceImage2Mat_<float>(image, mat, order, scaleFactor);
+        break;
+    default:
+        referenceImage2Mat_<double>(image, mat, order, scaleFactor);
+        break;
+    }
+}
+
+QString caseName(const cv::Size &size, const char *path)
+{
+    return QString::fromLatin1("%1x%2 %3").arg(size.width).arg(size.height).arg(QLatin1String(path));
+}
+
+} //namespace
+
+class DifferentialTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    DifferentialTest();
+
+private Q_SLOTS:
+    void cleanup();
+    void cleanupTestCase();
+
+    void rowKernels();
+    void mat2Image_data();
+    void mat2Image();
+    void image2Mat_data();
+    void image2Mat();
+    void speedup_data();
+    void speedup();
+
+private:
+    void addMatrix();
+    int m_minTime;
+    QStringList m_results;
+};
+
+DifferentialTest::DifferentialTest()
+{
+    m_minTime = minTime(100);
+}
+
+void DifferentialTest::cleanup()
+{
+    selectPath(QLatin1String("simd"));
+}
+
+//Same layout as the JSON of Google Benchmark, with the speedups of each conversion
+void DifferentialTest::cleanupTestCase()
+{
+    if (m_results.isEmpty())
+        return;
+
+    writeJson(m_results, "tst_differential.json");
+}
+
+/* Each SIMD kernel against the scalar one of the same table entry
+ */
+void DifferentialTest::rowKernels()
+{
+    struct Kernel
+    {
+        QString name;
+        RowKernel ref;
+        RowKernel opt;
+        int srcBytes;
+        int dstBytes;
+        int dstAlign;
+    };
+    std::vector<Kernel> kernels;
+    const auto add = [&kernels](const QString &name, const RowKernel &ref, const RowKernel &opt, int srcBytes, int dstBytes,
+                                int dstAlign) {
+        Kernel kernel = {name, ref, opt, srcBytes, dstBytes, dstAlign};
+        kernels.push_back(kernel);
+    };
+
+    //Swizzle tables, entry by entry
+    const auto addSwizzle = [&add](const char *isa, const RowSwizzleTable &table) {
+        for (int swapRB=0; swapRB<2; ++swapRB) {
+            const QString suffix = QString::fromLatin1(" %1 swapRB=%2").arg(QLatin1String(isa)).arg(swapRB);
+            add(QLatin1String("swizzle 3to3") + suffix, swizzleTable_scalar.c3ToC3[swapRB], table.c3ToC3[swapRB], 3, 3, 1);
+            add(QLatin1String("swizzle 3to4") + suffix, swizzleTable_scalar.c3ToC4[swapRB], table.c3ToC4[swapRB], 3, 4, 1);
+            add(QLatin1String("swizzle 4to3") + suffix, swizzleTable_scalar.c4ToC3[swapRB], table.c4ToC3[swapRB], 4, 3, 1);
+            for (int opaque=0; opaque<2; ++opaque)
+                add(QLatin1String("swizzle 4to4") + suffix + QString::fromLatin1(" opaque=%1").arg(opaque),
+                    swizzleTable_scalar.c4ToC4[swapRB][opaque], table.c4ToC4[swapRB][opaque], 4, 4, 1);
+        }
+    };
+
+    //Planes of float are written at 4-byte aligned addresses, one after another
+    const auto planar = [](RowPlanarFunc func, int srcChannels) -> RowKernel {
+        return [func, srcChannels](const uchar *src, uchar *dst, int width) {
+            static const int index[3] = {2, 1, 0};
+            static const float scale[3] = {1.f / 255.f, 2.f / 255.f, -0.5f};
+            static const float offset[3] = {-0.485f, 0.f, 10.f};
+            float *data = reinterpret_cast<float*>(dst);
+            float * const planes[3] = {data, data + width, data + 2 * width};
+            func(src, width, index, scale, offset, planes);
+        };
+    };
+
+    //Y of width bytes, then the chroma, planar or interleaved
+    const auto yuv = [](RowYuvFunc func, int uvStep, bool vFirst) -> RowKernel {
+        return [func, uvStep, vFirst](const uchar *src, uchar *dst, int width) {
+            const uchar *chroma = src + width;
+            const uchar *u = uvStep == 1 ? chroma : chroma + (vFirst ? 1 : 0);
+            const uchar *v = uvStep == 1 ? chroma + (width + 1) / 2 : chroma + (vFirst ? 0 : 1);
+            func(src, u, v, uvStep, dst, width);
+        };
+    };
+
+    const auto addIsa = [&](const char *isa) {
+        const QString name = QLatin1String(isa);
+        for (int swapRB=0; swapRB<2; ++swapRB) {
+            const QString suffix = QString::fromLatin1(" %1 swapRB=%2").arg(name).arg(swapRB);
+#if defined(QTOCV_X86_SIMD)
+            if (name == QLatin1String("sse2"))
+                add(QLatin1String("premultiply") + suffix, swapRB ? premultiplyRow4To4_<true> : premultiplyRow4To4_<false>,
+                    swapRB ? premultiplyRow4To4_sse2<true> : premultiplyRow4To4_sse2<false>, 4, 4, 1);
+#elif defined(QTOCV_NEON_SIMD)
+            add(QLatin1String("premultiply") + suffix, swapRB ? premultiplyRow4To4_<true> : premultiplyRow4To4_<false>,
+                swapRB ? premultiplyRow4To4_neon<true> : premultiplyRow4To4_neon<false>, 4, 4, 1);
+#endif
+        }
+        for (int redIndex=0; redIndex<=2; redIndex+=2) {
+            const QString suffix = QString::fromLatin1(" %1 red=%2").arg(name).arg(redIndex);
+            const RowGrayFunc gray3 = redIndex ? grayRow_<3, 2> : grayRow_<3, 0>;
+            const RowGrayFunc gray4 = redIndex ? grayRow_<4, 2> : grayRow_<4, 0>;
+            const RowYuvFunc yuvRef = redIndex ? yuvRow_<2> : yuvRow_<0>;
+            RowGrayFunc optGray3 = 0;
+            RowGrayFunc optGray4 = 0;
+            RowYuvFunc optYuv = 0;
+#if defined(QTOCV_X86_SIMD)
+            if (name == QLatin1String("sse2")) {
+                optGray4 = redIndex ? grayRow_sse2<4, 2> : grayRow_sse2<4, 0>;
+                optYuv = redIndex ? yuvRow_sse2<2> : yuvRow_sse2<0>;
+            } else if (name == QLatin1String("ssse3")) {
+                optGray3 = redIndex ? grayRow_ssse3<3, 2> : grayRow_ssse3<3, 0>;
+                optGray4 = redIndex ? grayRow_ssse3<4, 2> : grayRow_ssse3<4, 0>;
+            }
+#elif defined(QTOCV_NEON_SIMD)
+            optGray3 = redIndex ? grayRow_neon<3, 2> : grayRow_neon<3, 0>;
+            optGray4 = redIndex ? grayRow_neon<4, 2> : grayRow_neon<4, 0>;
+            optYuv = redIndex ? yuvRow_neon<2> : yuvRow_neon<0>;
+#endif
+            if (optGray3)
+                add(QLatin1String("gray 3") + suffix, gray3, optGray3, 3, 1, 1);
+            if (optGray4)
+                add(QLatin1String("gray 4") + suffix, gray4, optGray4, 4, 1, 1);
+            if (optYuv) {
+                add(QLatin1String("yuv planar") + suffix, yuv(yuvRef, 1, false), yuv(optYuv, 1, false), 3, 4, 1);
+                add(QLatin1String("yuv nv12") + suffix, yuv(yuvRef, 2, false), yuv(optYuv, 2, false), 3, 4, 1);
+                add(QLatin1String("yuv nv21") + suffix, yuv(yuvRef, 2, true), yuv(optYuv, 2, true), 3, 4, 1);
+            }
+        }
+        RowPlanarFunc optPlanar3 = 0;
+        RowPlanarFunc optPlanar4 = 0;
+#if defined(QTOCV_X86_SIMD)
+        if (name == QLatin1String("sse2")) {
+            optPlanar4 = planarRow_sse2<4>;
+        } else if (name == QLatin1String("ssse3")) {
+            optPlanar3 = planarRow_ssse3<3>;
+            optPlanar4 = planarRow_ssse3<4>;
+        }
+#elif defined(QTOCV_NEON_SIMD)
+        optPlanar3 = planarRow_neon<3>;
+        optPlanar4 = planarRow_neon<4>;
+#endif
+        if (optPlanar3)
+            add(QLatin1String("planar 3 ") + name, planar(planarRow_<3>, 3), planar(optPlanar3, 3), 3, 12, 4);
+        if (optPlanar4)
+            add(QLatin1String("planar 4 ") + name, planar(planarRow_<4>, 4), planar(optPlanar4, 4), 4, 12, 4);
+    };
+
+    cv::setUseOptimized(true);
+#if defined(QTOCV_X86_SIMD)
+    if (cv::checkHardwareSupport(CV_CPU_SSE2)) {
+        addSwizzle("sse2", swizzleTable_sse2);
+        addIsa("sse2");
+    }
+    if (cv::checkHardwareSupport(CV_CPU_SSSE3)) {
+        addSwizzle("ssse3", swizzleTable_ssse3);
+        addIsa("ssse3");
+    }
+#  ifdef CV_CPU_AVX2
+    if (cv::checkHardwareSupport(CV_CPU_AVX2))
+        addSwizzle("avx2", swizzleTable_avx2);
+#  endif
+#elif defined(QTOCV_NEON_SIMD)
+    addSwizzle("neon", swizzleTable_neon);
+    addIsa("neon");
+#endif
+    for (size_t i=0; i<kernels.size(); ++i) {
+        const Kernel &kernel = kernels[i];
+        const QString error = compareRowKernels(qPrintable(kernel.name), kernel.ref, kernel.opt, kernel.srcBytes,
+                                                kernel.dstBytes, kernel.dstAlign);
+        QVERIFY2(error.isEmpty(), qPrintable(error));
+    }
+    qDebug("%d kernels compared", int(kernels.size()));
+}
+
+//The channel order only matters for cv::Mat with 3 or 4 channels
+void DifferentialTest::addMatrix()
+{
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<MatChannelOrder>("order");
+
+    const int channels[] = {1, 3, 4};
+    for (int d=0; d<arraySize(depths); ++d) {
+        for (int c=0; c<arraySize(channels); ++c) {
+            for (int f=0; f<arraySize(formats); ++f) {
+                for (int o=0; o<(channels[c] == 1 ? 1 : 2); ++o) {
+                    const QString tag = QString::fromLatin1("%1C%2 %3 %4")
+                            .arg(QLatin1String(depthName(depths[d]))).arg(channels[c])
+                            .arg(QLatin1String(o ? "RGB" : "BGR"))
+                            .arg(QLatin1String(formats[f].name));
+                    QTest::newRow(tag.toLatin1().constData())
+                            << int(CV_MAKETYPE(depths[d], channels[c])) << formats[f].format << (o ? MCO_RGB : MCO_BGR);
+                }
+            }
+        }
+    }
+}
+
+void DifferentialTest::mat2Image_data()
+{
+    addMatrix();
+}
+
+void DifferentialTest::mat2Image()
+{
+    QFETCH(int, matType);
+    QFETCH(QImage::Format, format);
+    QFETCH(MatChannelOrder, order);
+
+    Mat2ImageFunc func;
+    double scaleFactor;
+    QVERIFY(mat2ImageFunc(CV_MAT_DEPTH(matType), func, scaleFactor));
+    const PixelLayout layout = pixelLayout(format);
+
+    for (int s=0; s<arraySize(sizes); ++s) {
+        const cv::Size size = sizes[s];
+        cv::Mat parent;
+        const cv::Mat mat = paddedMat(size.height, size.width, matType, parent);
+
+        //Premultiplied formats are compared with the straight result premultiplied by QImage
+        QImage reference(size.width, size.height, layout.premultiplied ? straightFormat(format) : format);
+        if (format == QImage::Format_Indexed8)
+            setIndexed8ColorTable(reference, QVector<QRgb>());
+        referenceMat2Image(mat, reference, order, scaleFactor);
+        if (layout.premultiplied)
+            reference = reference.convertToFormat(format);
+
+        QImage scalar;
+        for (int p=0; p<arraySize(paths); ++p) {
+            selectPath(QLatin1String(paths[p]));
+            const QString name = caseName(size, paths[p]);
+
+            QImage image;
+            QVERIFY2(QtOcv::mat2Image(mat, image, format, order), qPrintable(name));
+            //Into the padded scanlines of an existing QImage
+            std::vector<uchar> buffer;
+            QImage padded = paddedImage(size.width, size.height, format, buffer);
+            QVERIFY2(QtOcv::mat2Image(mat, padded, QPoint(0, 0), order), qPrintable(name));
+            QVERIFY2(imageDiff(padded, image) == 0, qPrintable(name + QLatin1String(" padded")));
+
+            if (p == 0) {
+                scalar = image;
+                const double diff = imageDiff(image, reference);
+                QVERIFY2(diff <= 1, qPrintable(name + QString::fromLatin1(" generic diff %1").arg(diff)));
+            } else {
+                QVERIFY2(imageDiff(image, scalar) == 0, qPrintable(name));
+            }
+
+            //Plans resolve the kernels once, of the path selected then
+            Mat2ImageConverter converter(matType, QSize(size.width, size.height), format, order);
+            QVERIFY2(converter.isValid() && imageDiff(converter.run(mat), scalar) == 0, qPrintable(name + QLatin1String(" plan")));
+        }
+    }
+}
+
+void DifferentialTest::image2Mat_data()
+{
+    addMatrix();
+}
+
+void DifferentialTest::image2Mat()
+{
+    QFETCH(int, matType);
+    QFETCH(QImage::Format, format);
+    QFETCH(MatChannelOrder, order);
+
+    Image2MatFunc func;
+    double scaleFactor;
+    QVERIFY(image2MatFunc(CV_MAT_DEPTH(matType), func, scaleFactor));
+    const PixelLayout layout = pixelLayout(format);
+
+    for (int s=0; s<arraySize(sizes); ++s) {
+        const cv::Size size = sizes[s];
+        std::vector<uchar> buffer;
+        const QImage image = paddedImage(size.width, size.height, format, buffer);
+
+        //Premultiplied formats are unpremultiplied by QImage for the generic conversion
+        const QImage straight = layout.premultiplied ? image.convertToFormat(straightFormat(format)) : image;
+        cv::Mat reference(size, matType);
+        referenceImage2Mat(straight, reference, order, scaleFactor);
+
+        cv::Mat scalar;
+        for (int p=0; p<arraySize(paths); ++p) {
+            selectPath(QLatin1String(paths[p]));
+            const QString name = caseName(size, paths[p]);
+
+            cv::Mat mat;
+            QVERIFY2(QtOcv::image2Mat(image, mat, matType, order), qPrintable(name));
+            //Into a ROI, whose rows are padded
+            cv::Mat parent;
+            cv::Mat roi = paddedMat(size.height, size.width, matType, parent);
+            const uchar *roiData = roi.data;
+            QVERIFY2(QtOcv::image2Mat(image, roi, matType, order), qPrintable(name));
+            QVERIFY2(roi.data == roiData && matDiff(roi, mat, 1) == 0, qPrintable(name + QLatin1String(" padded")));
+
+            if (p == 0) {
+                scalar = mat;
+                const double diff = matDiff(mat, reference, scaleFactor);
+                QVERIFY2(diff <= 1.0001, qPrintable(name + QString::fromLatin1(" generic diff %1").arg(diff)));
+            } else {
+                QVERIFY2(matDiff(mat, scalar, 1) == 0, qPrintable(name));
+            }
+
+            Image2MatConverter converter(format, QSize(size.width, size.height), matType, order);
+            QVERIFY2(converter.isValid() && matDiff(converter.run(image), scalar, 1) == 0, qPrintable(name + QLatin1String(" plan")));
+        }
+    }
+}
+
+//The conversions of the common pipelines
+void DifferentialTest::speedup_data()
+{
+    QTest::addColumn<bool>("toImage");
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<QImage::Format>("format");
+
+    QTest::newRow("mat2Image 8UC3 RGB888") << true << int(CV_8UC3) << QImage::Format_RGB888;
+    QTest::newRow("mat2Image 8UC3 RGB32") << true << int(CV_8UC3) << QImage::Format_RGB32;
+    QTest::newRow("mat2Image 8UC4 ARGB32") << true << int(CV_8UC4) << QImage::Format_ARGB32;
+    QTest::newRow("mat2Image 8UC4 ARGB32_Premultiplied") << true << int(CV_8UC4) << QImage::Format_ARGB32_Premultiplied;
+    QTest::newRow("mat2Image 8UC3 Indexed8") << true << int(CV_8UC3) << QImage::Format_Indexed8;
+    QTest::newRow("mat2Image 16UC3 RGB888") << true << int(CV_16UC3) << QImage::Format_RGB888;
+    QTest::newRow("mat2Image 32FC3 RGB32") << true << int(CV_32FC3) << QImage::Format_RGB32;
+    QTest::newRow("image2Mat RGB888 8UC3") << false << int(CV_8UC3) << QImage::Format_RGB888;
+    QTest::newRow("image2Mat RGB32 8UC3") << false << int(CV_8UC3) << QImage::Format_RGB32;
+    QTest::newRow("image2Mat ARGB32 8UC4") << false << int(CV_8UC4) << QImage::Format_ARGB32;
+    QTest::newRow("image2Mat RGB32 8UC1") << false << int(CV_8UC1) << QImage::Format_RGB32;
+    QTest::newRow("image2Mat RGB32 32FC3") << false << int(CV_32FC3) << QImage::Format_RGB32;
+}
+
+void DifferentialTest::speedup()
+{
+    QFETCH(bool, toImage);
+    QFETCH(int, matType);
+    QFETCH(QImage::Format, format);
+
+    const cv::Mat mat = randomMat(1080, 1920, matType);
+    std::vector<uchar> buffer;
+    const QImage source = paddedImage(1920, 1080, format, buffer).copy();
+    QImage image;
+    cv::Mat result;
+
+    double seconds[3];
+    for (int p=0; p<arraySize(paths); ++p) {
+        selectPath(QLatin1String(paths[p]));
+        if (toImage)
+            seconds[p] = measure([&]() { QtOcv::mat2Image(mat, image, format); }, m_minTime);
+        else
+            seconds[p] = measure([&]() { QtOcv::image2Mat(source, result, matType); }, m_minTime);
+    }
+
+    qDebug("scalar %.2f ms, simd %.2f ms (%.1fx), parallel %.2f ms (%.1fx)", seconds[0] * 1e3,
+           seconds[1] * 1e3, seconds[0] / seconds[1], seconds[2] * 1e3, seconds[0] / seconds[2]);
+    m_results << QString::fromLatin1("    {\n      \"name\": \"%1\",\n      \"scalar_time\": %2,\n"
+                                     "      \"simd_time\": %3,\n      \"parallel_time\": %4,\n      \"time_unit\": \"ns\",\n"
+                                     "      \"simd_speedup\": %5,\n      \"parallel_speedup\": %6\n    }")
+                 .arg(QLatin1String(QTest::currentDataTag()))
+                 .arg(seconds[0] * 1e9, 0, 'f', 0)
+                 .arg(seconds[1] * 1e9, 0, 'f', 0)
+                 .arg(seconds[2] * 1e9, 0, 'f', 0)
+                 .arg(seconds[0] / seconds[1], 0, 'f', 2)
+                 .arg(seconds[0] / seconds[2], 0, 'f', 2);
+}
+
+QTEST_MAIN(DifferentialTest)
+
+#include "tst_differential.moc"
@@ -1,9 +1,18 @@
 #include "cvmatandqimage.h"
+#include "framepool.h"
+#include "stripconversion.h"
+#include "rawframefile.h"
+#include "asyncconversion.h"
+#include "framering.h"
+#include "rowkernels.h"
 #include <QString>
 #include <QtTest>
 #include <QTemporaryFile>
+#include <QBuffer>
+#include <QThread>
 #include <QDebug>
 #include <vector>
+#include <algorithm>
 #include <math.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -90,6 +99,46 @@ static bool lenientCompare(const cv::Mat &actual, const cv::Mat &expected)
     return true;
 }
 
+static bool isSameMat(const cv::Mat &actual, const cv::Mat &expected)
+{
+    return actual.type() == expected.type() && actual.size() == expected.size()
+            && cv::norm(actual, expected, cv::NORM_INF) == 0;
+}
+
+//Rows of a cv::Mat in memory, checking that they are read strip by strip
+class MatRowsReader : public MatStripReader
+{
+public:
+    explicit MatRowsReader(const cv::Mat &mat) : m_mat(mat), m_maxRows(0) {}
+    bool read(int row, cv::Mat &strip)
+    {
+        m_maxRows = qMax(m_maxRows, strip.rows);
+        m_mat.rowRange(row, row + strip.rows).copyTo(strip);
+        return true;
+    }
+    int maxRows() const { return m_maxRows; }
+
+private:
+    cv::Mat m_mat;
+    int m_maxRows;
+};
+
+//Assemble the strips into one QImage
+class ImageStripsCollector : public ImageStripWriter
+{
+public:
+    ImageStripsCollector(const QSize &size, QImage::Format format) : image(size, format) {}
+    bool write(int row, const QImage &strip)
+    {
+        if (image.format() == QImage::Format_Indexed8)
+            image.setColorTable(strip.colorTable());
+        for (int i=0; i<strip.height(); ++i)
+            memcpy(image.scanLine(row + i), strip.constScanLine(i), strip.bytesPerLine());
+        return true;
+    }
+    QImage image;
+};
+
 class CvMatAndImageTest : public QObject
 {
     Q_OBJECT
@@ -104,13 +153,46 @@ private Q_SLOTS:
 
     void testMat2QImage();
     void testMat2QImageShared();
+    void testMat2QImageRefShared();
     void testMat2QImageChannelsOrder_data();
     void testMat2QImageChannelsOrder();
+    void testMat2QImageReuseBuffer();
+    void testMat2QImageOddWidth_data();
+    void testMat2QImageOddWidth();
 
     void testQImage2Mat();
     void testQImage2MatShared();
+    void testQImage2MatRefShared();
     void testQImage2MatChannelsOrder_data();
     void testQImage2MatChannelsOrder();
+    void testQImage2MatReuseBuffer();
+    void testQImage2MatOddWidth_data();
+    void testQImage2MatOddWidth();
+
+    void testParallelConversion();
+    void testDepthConversion();
+    void testGrayConversion();
+    void testIndexed8ColorTable();
+    void testModernFormats();
+    void testRegionConversion();
+    void testScaledConversion();
+    void testValueMapping();
+    void testUMatConversion();
+    void testGpuMatConversion();
+    void testFramePool();
+    void testStaticConversion();
+    void testStripConversion();
+    void testRawFrameFile();
+    void testBatchConversion();
+    void testPlanarConversion();
+    void testPremultipliedFormats();
+    void testConversionStats();
+    void testConverterPlans();
+    void testAsyncConversion();
+    void testYuvConversion();
+    void testDirtyConversion();
+    void testFrameRing();
+    void testRowKernels();
 };
 
 CvMatAndImageTest::CvMatAndImageTest()
@@ -276,6 +358,33 @@ void CvMatAndImageTest::testMat2QImageShared()
     QVERIFY(lenientCompare(img0, img1));
 }
 
+void CvMatAndImageTest::testMat2QImageRefShared()
+{
+#if QT_VERSION >= 0x050000
+    QImage img_rgb888;
+    QImage img_index8;
+    const uchar *data;
+    {
+        cv::Mat mat_8UC3(30, 50, CV_8UC3, cv::Scalar(11, 22, 33));
+        data = mat_8UC3.data;
+        img_rgb888 = mat2Image_refShared(mat_8UC3);
+        img_index8 = mat2Image_refShared(cv::Mat(30, 50, CV_8UC1, cv::Scalar(77)));
+    }
+
+    //The data is still alive after the cv::Mat is destroyed
+    QCOMPARE(img_rgb888.constBits(), data);
+    QCOMPARE(img_rgb888.format(), QImage::Format_RGB888);
+    QCOMPARE(img_rgb888.pixel(49, 29), qRgb(11, 22, 33));
+    QCOMPARE(img_index8.pixel(3, 5), qRgb(77, 77, 77));
+
+    QImage img_copy = img_rgb888;
+    img_rgb888 = QImage();
+    QCOMPARE(img_copy.pixel(10, 10), qRgb(11, 22, 33));
+
+    QVERIFY(mat2Image_refShared(cv::Mat()).isNull());
+#endif
+}
+
 void CvMatAndImageTest::testMat2QImageChannelsOrder_data()
 {
     QTest::addColumn<int>("channels");
@@ -358,6 +467,80 @@ void CvMatAndImageTest::testMat2QImageChannelsOrder()
     QCOMPARE(image_32F.pixel(1,1), expect);
 }
 
+void CvMatAndImageTest::testMat2QImageReuseBuffer()
+{
+    cv::Mat mat_8UC3(100, 200, CV_8UC3, cv::Scalar_<uchar>(0, 1, 254));
+    QImage img;
+
+    //First call allocates the buffer
+    QVERIFY(mat2Image(mat_8UC3, img, QImage::Format_RGB32));
+    QCOMPARE(img.format(), QImage::Format_RGB32);
+    QCOMPARE(img.size(), QSize(200, 100));
+    QCOMPARE(img.pixel(1,1), qRgb(254, 1, 0));
+    const uchar *bits = img.constBits();
+
+    //Same size and format, the buffer should be reused
+    mat_8UC3.setTo(cv::Scalar_<uchar>(10, 20, 30));
+    QVERIFY(mat2Image(mat_8UC3, img, QImage::Format_RGB32));
+    QCOMPARE(img.constBits(), bits);
+    QCOMPARE(img.pixel(1,1), qRgb(30, 20, 10));
+    QCOMPARE(img, mat2Image(mat_8UC3, QImage::Format_RGB32));
+
+    //The buffer must not be written when it's shared by others
+    QImage other = img;
+    QVERIFY(mat2Image(mat_8UC3, img, QImage::Format_RGB32));
+    QVERIFY(img.constBits() != other.constBits());
+
+    //Different format leads to reallocation
+    QVERIFY(mat2Image(mat_8UC3, img, QImage::Format_RGB888));
+    QCOMPARE(img.format(), QImage::Format_RGB888);
+    QCOMPARE(img.pixel(1,1), qRgb(30, 20, 10));
+
+    //Empty mat
+    QVERIFY(!mat2Image(cv::Mat(), img));
+    QVERIFY(img.isNull());
+}
+
+void CvMatAndImageTest::testMat2QImageOddWidth_data()
+{
+    QTest::addColumn<int>("width");
+
+    //Make sure both the SIMD body and the scalar tail of the row kernels are used
+    QTest::newRow("1") << 1;
+    QTest::newRow("5") << 5;
+    QTest::newRow("6") << 6;
+    QTest::newRow("11") << 11;
+    QTest::newRow("37") << 37;
+    QTest::newRow("101") << 101;
+}
+
+void CvMatAndImageTest::testMat2QImageOddWidth()
+{
+    QFETCH(int, width);
+
+    const QImage::Format formats[] = {QImage::Format_ARGB32, QImage::Format_RGB32, QImage::Format_RGB888};
+    const MatChannelOrder orders[] = {MCO_BGR, MCO_RGB};
+
+    for (int channels=3; channels<=4; ++channels) {
+        cv::Mat mat(3, width, CV_8UC(channels));
+        cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(256));
+
+        for (int f=0; f<3; ++f) {
+            for (int o=0; o<2; ++o) {
+                QImage img = mat2Image(mat, formats[f], orders[o]);
+                const int r = orders[o] == MCO_BGR ? 2 : 0;
+                for (int y=0; y<mat.rows; ++y) {
+                    for (int x=0; x<mat.cols; ++x) {
+                        const uchar *p = mat.ptr(y) + x*channels;
+                        const int a = (channels == 4 && formats[f] == QImage::Format_ARGB32) ? p[3] : 255;
+                        QCOMPARE(img.pixel(x, y), qRgba(p[r], p[1], p[2-r], a));
+                    }
+                }
+            }
+        }
+    }
+}
+
 void CvMatAndImageTest::testQImage2Mat()
 {
     QImage img_rgb32 = QImage(100, 100, QImage::Format_RGB32);
@@ -425,6 +608,40 @@ void CvMatAndImageTest::testQImage2MatShared()
     QCOMPARE(mat_8UC3.at<cv::Vec3b>(1,1), cv::Vec3b(254,1,0));
 }
 
+void CvMatAndImageTest::testQImage2MatRefShared()
+{
+    cv::Mat mat_8UC3;
+    cv::Mat mat_8UC1;
+    const uchar *data;
+    {
+        QImage img_rgb888(50, 30, QImage::Format_RGB888);
+        img_rgb888.fill(QColor(255, 0, 0));
+        data = img_rgb888.constBits();
+        mat_8UC3 = image2Mat_refShared(img_rgb888);
+
+        QImage img_index8(50, 30, QImage::Format_Indexed8);
+        img_index8.fill(66);
+        mat_8UC1 = image2Mat_refShared(img_index8);
+    }
+
+    //The data is still alive after the QImage is destroyed
+    QVERIFY(mat_8UC3.ptr() == data);
+    QCOMPARE(mat_8UC3.type(), CV_8UC3);
+    QCOMPARE(mat_8UC3.at<cv::Vec3b>(29, 49), cv::Vec3b(255, 0, 0));
+    QCOMPARE(mat_8UC1.at<uchar>(3, 5), uchar(66));
+
+    cv::Mat mat_copy = mat_8UC3;
+    mat_8UC3.release();
+    QCOMPARE(mat_copy.at<cv::Vec3b>(10, 10), cv::Vec3b(255, 0, 0));
+
+    //New data created by cv::Mat itself
+    mat_copy.create(10, 10, CV_8UC1);
+    mat_copy.setTo(cv::Scalar(5));
+    QCOMPARE(mat_copy.at<uchar>(9, 9), uchar(5));
+
+    QVERIFY(image2Mat_refShared(QImage()).empty());
+}
+
 void CvMatAndImageTest::testQImage2MatChannelsOrder_data()
 {
     QTest::addColumn<int>("channels");
@@ -517,6 +734,1231 @@ void CvMatAndImageTest::testQImage2MatChannelsOrder(){
     QVERIFY(lenientCompare<float>(mat_32F, mat_32F_expected));
 }
 
+void CvMatAndImageTest::testQImage2MatReuseBuffer()
+{
+    QImage img(200, 100, QImage::Format_RGB32);
+    img.fill(QColor(254, 1, 0));
+    cv::Mat mat;
+
+    //First call allocates the buffer
+    QVERIFY(image2Mat(img, mat, CV_8UC3));
+    QCOMPARE(mat.type(), CV_8UC3);
+    QCOMPARE(mat.at<cv::Vec3b>(1,1), cv::Vec3b(0,1,254));
+    const uchar *data = mat.data;
+
+    //Same size and type, the buffer should be reused
+    img.fill(QColor(30, 20, 10));
+    QVERIFY(image2Mat(img, mat, CV_8UC3));
+    QVERIFY(mat.data == data);
+    QCOMPARE(mat.at<cv::Vec3b>(1,1), cv::Vec3b(10,20,30));
+
+    //Different type leads to reallocation
+    QVERIFY(image2Mat(img, mat, CV_32FC3));
+    QCOMPARE(mat.type(), CV_32FC3);
+    QCOMPARE(mat.at<cv::Vec3f>(1,1)[0], float(10/255.0));
+
+    //Null image
+    QVERIFY(!image2Mat(QImage(), mat));
+    QVERIFY(mat.empty());
+}
+
+void CvMatAndImageTest::testQImage2MatOddWidth_data()
+{
+    testMat2QImageOddWidth_data();
+}
+
+void CvMatAndImageTest::testQImage2MatOddWidth()
+{
+    QFETCH(int, width);
+
+    const QImage::Format formats[] = {QImage::Format_ARGB32, QImage::Format_RGB32, QImage::Format_RGB888};
+    const MatChannelOrder orders[] = {MCO_BGR, MCO_RGB};
+
+    for (int f=0; f<3; ++f) {
+        QImage img(width, 3, formats[f]);
+        for (int y=0; y<img.height(); ++y) {
+            for (int x=0; x<img.width(); ++x)
+                img.setPixel(x, y, qRgba(qrand()%256, qrand()%256, qrand()%256, qrand()%256));
+        }
+
+        for (int channels=3; channels<=4; ++channels) {
+            for (int o=0; o<2; ++o) {
+                cv::Mat mat = image2Mat(img, CV_8UC(channels), orders[o]);
+                const int r = orders[o] == MCO_BGR ? 2 : 0;
+                for (int y=0; y<mat.rows; ++y) {
+                    for (int x=0; x<mat.cols; ++x) {
+                        const uchar *p = mat.ptr(y) + x*channels;
+                        const QRgb pixel = img.pixel(x, y);
+                        QCOMPARE(int(p[r]), qRed(pixel));
+                        QCOMPARE(int(p[1]), qGreen(pixel));
+                        QCOMPARE(int(p[2-r]), qBlue(pixel));
+                        if (channels == 4)
+                            QCOMPARE(int(p[3]), qAlpha(pixel));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void CvMatAndImageTest::testParallelConversion()
+{
+    //Big enough to be split across threads
+    cv::Mat mat_32FC3(1023, 1027, CV_32FC3);
+    cv::randu(mat_32FC3, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::Mat mat_8UC4(1023, 1027, CV_8UC4);
+    cv::randu(mat_8UC4, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    QCOMPARE(conversionThreads(), 1);
+    const QImage img_argb32 = mat2Image(mat_32FC3, QImage::Format_ARGB32);
+    const QImage img_rgb888 = mat2Image(mat_8UC4, QImage::Format_RGB888, MCO_RGBA);
+    const cv::Mat mat_32FC1 = image2Mat(img_argb32, CV_32FC1);
+    const cv::Mat mat_16UC3 = image2Mat(img_rgb888, CV_16UC3);
+
+    setConversionThreads(4);
+    QCOMPARE(conversionThreads(), 4);
+    QCOMPARE(mat2Image(mat_32FC3, QImage::Format_ARGB32), img_argb32);
+    QCOMPARE(mat2Image(mat_8UC4, QImage::Format_RGB888, MCO_RGBA), img_rgb888);
+    QCOMPARE(cv::countNonZero(image2Mat(img_argb32, CV_32FC1) != mat_32FC1), 0);
+    QCOMPARE(cv::countNonZero(image2Mat(img_rgb888, CV_16UC3).reshape(1) != mat_16UC3.reshape(1)), 0);
+
+    setConversionThreads(0);
+    QCOMPARE(mat2Image(mat_32FC3, QImage::Format_ARGB32), img_argb32);
+
+    setConversionThreads(1);
+}
+
+void CvMatAndImageTest::testDepthConversion()
+{
+    //All the 16-bit values, the result must be the same as the floating point version
+    cv::Mat mat_16UC1(256, 256, CV_16UC1);
+    for (int i=0; i<65536; ++i)
+        mat_16UC1.at<quint16>(i/256, i%256) = quint16(i);
+
+    QImage img_index8 = mat2Image(mat_16UC1, QImage::Format_Indexed8);
+    for (int i=0; i<65536; ++i)
+        QCOMPARE(img_index8.pixelIndex(i%256, i/256), int(cv::saturate_cast<uchar>(i * (255./65535.))));
+
+    //All the 8-bit values
+    QImage img_gradient(256, 1, QImage::Format_Indexed8);
+    QVector<QRgb> table;
+    for (int i=0; i<256; ++i) {
+        table.push_back(qRgb(i,i,i));
+        img_gradient.scanLine(0)[i] = uchar(i);
+    }
+    img_gradient.setColorTable(table);
+
+    cv::Mat mat_16U = image2Mat(img_gradient, CV_16UC1);
+    cv::Mat mat_32F = image2Mat(img_gradient, CV_32FC1);
+    cv::Mat mat_32FC3 = image2Mat(img_gradient, CV_32FC3);
+    for (int i=0; i<256; ++i) {
+        QCOMPARE(mat_16U.at<quint16>(0, i), quint16(i*257));
+        QCOMPARE(mat_32F.at<float>(0, i), float(i * (1./255.)));
+        QCOMPARE(mat_32FC3.at<cv::Vec3f>(0, i)[1], float(i * (1./255.)));
+    }
+}
+
+void CvMatAndImageTest::testGrayConversion()
+{
+    //The gray value must be the same as cv::cvtColor() whichever direction we convert
+    cv::Mat mat_8UC3(13, 67, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_8UC4;
+    cv::cvtColor(mat_8UC3, mat_8UC4, CV_BGR2BGRA);
+    cv::Mat mat_16UC3;
+    mat_8UC3.convertTo(mat_16UC3, CV_16U, 257);
+    cv::Mat mat_gray;
+    cv::cvtColor(mat_8UC3, mat_gray, CV_BGR2GRAY);
+
+    QImage img_c3 = mat2Image(mat_8UC3, QImage::Format_Indexed8);
+    QImage img_c4 = mat2Image(mat_8UC4, QImage::Format_Indexed8);
+    QImage img_16u = mat2Image(mat_16UC3, QImage::Format_Indexed8);
+    cv::Mat mat_from888 = image2Mat(mat2Image(mat_8UC3, QImage::Format_RGB888), CV_8UC1);
+    cv::Mat mat_from32 = image2Mat(mat2Image(mat_8UC3, QImage::Format_RGB32), CV_8UC1);
+    cv::Mat mat_32F = image2Mat(mat2Image(mat_8UC3, QImage::Format_ARGB32), CV_32FC1);
+    for (int i=0; i<mat_gray.rows; ++i) {
+        for (int j=0; j<mat_gray.cols; ++j) {
+            const int gray = mat_gray.at<uchar>(i, j);
+            QCOMPARE(img_c3.pixelIndex(j, i), gray);
+            QCOMPARE(img_c4.pixelIndex(j, i), gray);
+            QCOMPARE(img_16u.pixelIndex(j, i), gray);
+            QCOMPARE(int(mat_from888.at<uchar>(i, j)), gray);
+            QCOMPARE(int(mat_from32.at<uchar>(i, j)), gray);
+            QCOMPARE(mat_32F.at<float>(i, j), float(gray * (1./255.)));
+        }
+    }
+}
+
+void CvMatAndImageTest::testIndexed8ColorTable()
+{
+    cv::Mat mat(3, 5, CV_8UC1);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    //The gray table is shared by all the results
+    QImage img1 = mat2Image(mat);
+    QImage img2 = mat2Image_shared(mat);
+    QCOMPARE(img1.colorCount(), 256);
+    QCOMPARE(img1.color(200), qRgb(200, 200, 200));
+    QVERIFY(img1.colorTable().constData() == img2.colorTable().constData());
+
+    //Palette given by caller
+    QVector<QRgb> palette;
+    for (int i=0; i<256; ++i)
+        palette.append(qRgb(i, 255-i, 0));
+    QImage img3 = mat2Image(mat, QImage::Format_Indexed8, MCO_BGR, palette);
+    QImage img4 = mat2Image_shared(mat, QImage::Format_Indexed8, palette);
+    QVERIFY(img3.colorTable().constData() == palette.constData());
+    QVERIFY(img4.colorTable().constData() == palette.constData());
+    QCOMPARE(img3.pixel(2, 1), palette[mat.at<uchar>(1, 2)]);
+    QCOMPARE(img4.pixel(4, 2), palette[mat.at<uchar>(2, 4)]);
+
+    //Switch back to gray when the buffer is reused
+    QVERIFY(mat2Image(mat, img3));
+    QCOMPARE(img3.colorTable(), img1.colorTable());
+}
+
+void CvMatAndImageTest::testModernFormats()
+{
+#if QT_VERSION >= 0x050E00
+    cv::Mat mat_8UC3(7, 11, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_8UC4;
+    cv::cvtColor(mat_8UC3, mat_8UC4, CV_BGR2RGBA);
+    cv::Mat mat_16UC1(7, 11, CV_16UC1);
+    cv::randu(mat_16UC1, cv::Scalar::all(0), cv::Scalar::all(65536));
+    cv::Mat mat_16UC4(7, 11, CV_16UC4);
+    cv::randu(mat_16UC4, cv::Scalar::all(0), cv::Scalar::all(65536));
+
+    //B G R data of OpenCV can be shared with QImage::Format_BGR888
+    QImage img_bgr888 = mat2Image_shared(mat_8UC3, QImage::Format_BGR888);
+    QCOMPARE(img_bgr888.format(), QImage::Format_BGR888);
+    QVERIFY(img_bgr888.constBits() == mat_8UC3.data);
+    const cv::Vec3b &bgr = mat_8UC3.at<cv::Vec3b>(3, 5);
+    QCOMPARE(img_bgr888.pixel(5, 3), qRgb(bgr[2], bgr[1], bgr[0]));
+    QVERIFY(image2Mat_shared(img_bgr888).data == mat_8UC3.data);
+    QVERIFY(isSameMat(image2Mat(img_bgr888), mat_8UC3));
+    QCOMPARE(mat2Image(mat_8UC3, QImage::Format_BGR888).pixel(5, 3), img_bgr888.pixel(5, 3));
+
+    //R G B A
+    QImage img_rgba8888 = mat2Image(mat_8UC4, QImage::Format_RGBA8888, MCO_RGBA);
+    QCOMPARE(img_rgba8888.pixel(5, 3), qRgb(bgr[2], bgr[1], bgr[0]));
+    QCOMPARE(image2Mat_shared(img_rgba8888).type(), CV_8UC4);
+    QVERIFY(isSameMat(image2Mat_shared(img_rgba8888), mat_8UC4));
+    QVERIFY(isSameMat(image2Mat(img_rgba8888, CV_8UC3), mat_8UC3));
+    QVERIFY(mat2Image_shared(mat_8UC3, QImage::Format_RGBA8888).isNull());
+
+    //Gray
+    cv::Mat mat_gray;
+    cv::cvtColor(mat_8UC3, mat_gray, CV_BGR2GRAY);
+    QImage img_gray8 = mat2Image(mat_8UC3, QImage::Format_Grayscale8);
+    QCOMPARE(img_gray8.format(), QImage::Format_Grayscale8);
+    QCOMPARE(img_gray8.colorCount(), 0);
+    QVERIFY(isSameMat(image2Mat_shared(img_gray8), mat_gray));
+    QVERIFY(isSameMat(image2Mat(img_bgr888, CV_8UC1), mat_gray));
+
+    //16-bit data
+    QImage img_gray16 = mat2Image_shared(mat_16UC1);
+    QCOMPARE(img_gray16.format(), QImage::Format_Grayscale16);
+    QVERIFY(isSameMat(image2Mat(img_gray16, CV_16UC(0)), mat_16UC1));
+    cv::Mat mat_8UC1;
+    mat_16UC1.convertTo(mat_8UC1, CV_8U, 255./65535.);
+    QVERIFY(isSameMat(image2Mat(img_gray16), mat_8UC1));
+    QVERIFY(isSameMat(image2Mat(mat2Image(mat_8UC1, QImage::Format_Grayscale16), CV_8UC1), mat_8UC1));
+
+    QImage img_rgba64 = mat2Image_shared(mat_16UC4);
+    QCOMPARE(img_rgba64.format(), QImage::Format_RGBA64);
+    QVERIFY(isSameMat(image2Mat(img_rgba64, CV_16UC4, MCO_RGBA), mat_16UC4));
+    QVERIFY(isSameMat(image2Mat_shared(mat2Image(mat_16UC4, QImage::Format_RGBA64, MCO_RGBA)), mat_16UC4));
+#endif
+}
+
+void CvMatAndImageTest::testRegionConversion()
+{
+    cv::Mat mat(20, 30, CV_8UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(256));
+    const cv::Rect rect(3, 4, 11, 7);
+    cv::Mat roi = mat(rect);
+
+    //ROI of cv::Mat as source
+    QImage img = mat2Image(roi);
+    QCOMPARE(img.size(), QSize(11, 7));
+    QVERIFY(isSameMat(image2Mat(img), roi.clone()));
+
+    //Area of QImage as source
+    QImage img_full = mat2Image(mat, QImage::Format_RGB32);
+    cv::Mat mat_area;
+    QVERIFY(image2Mat(img_full, QRect(3, 4, 11, 7), mat_area, CV_8UC3));
+    QVERIFY(isSameMat(mat_area, roi));
+    QVERIFY(image2Mat(img_full, QRect(25, 15, 10, 10), mat_area, CV_8UC3));
+    QCOMPARE(mat_area.cols, 5);
+    QCOMPARE(mat_area.rows, 5);
+    QVERIFY(!image2Mat(img_full, QRect(30, 0, 5, 5), mat_area));
+
+    //ROI of cv::Mat as destination
+    cv::Mat canvas = cv::Mat::zeros(20, 30, CV_8UC3);
+    cv::Mat canvas_roi = canvas(rect);
+    const uchar *data = canvas_roi.data;
+    QVERIFY(image2Mat(img, canvas_roi));
+    QVERIFY(canvas_roi.data == data);
+    QVERIFY(isSameMat(canvas(rect), roi));
+    QCOMPARE(cv::countNonZero(canvas.reshape(1)), cv::countNonZero(roi.clone().reshape(1)));
+
+    //Area of QImage as destination
+    QImage img_canvas(30, 20, QImage::Format_ARGB32);
+    img_canvas.fill(0);
+    QVERIFY(mat2Image(roi, img_canvas, QPoint(3, 4)));
+    QCOMPARE(img_canvas.format(), QImage::Format_ARGB32);
+    QCOMPARE(img_canvas.pixel(2, 4), QRgb(0));
+    QCOMPARE(img_canvas.pixel(14, 10), QRgb(0));
+    QVERIFY(image2Mat(img_canvas, QRect(3, 4, 11, 7), mat_area, CV_8UC3));
+    QVERIFY(isSameMat(mat_area, roi));
+
+    //Clipped to the QImage
+    QVERIFY(mat2Image(roi, img_canvas, QPoint(25, -2)));
+    QVERIFY(image2Mat(img_canvas, QRect(25, 0, 5, 5), mat_area, CV_8UC3));
+    QVERIFY(isSameMat(mat_area, roi(cv::Rect(0, 2, 5, 5))));
+    QVERIFY(!mat2Image(roi, img_canvas, QPoint(30, 0)));
+}
+
+void CvMatAndImageTest::testScaledConversion()
+{
+    cv::Mat mat_8UC3(40, 60, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_8UC4;
+    cv::cvtColor(mat_8UC3, mat_8UC4, CV_BGR2BGRA);
+    cv::Mat mat_8UC1;
+    cv::cvtColor(mat_8UC3, mat_8UC1, CV_BGR2GRAY);
+
+    cv::Mat scaled_8UC3, scaled_8UC4, scaled_8UC1;
+    cv::resize(mat_8UC3, scaled_8UC3, cv::Size(30, 20), 0, 0, cv::INTER_AREA);
+    cv::resize(mat_8UC4, scaled_8UC4, cv::Size(30, 20), 0, 0, cv::INTER_AREA);
+    cv::resize(mat_8UC1, scaled_8UC1, cv::Size(30, 20), 0, 0, cv::INTER_AREA);
+
+    //Resized then converted
+    QImage img = mat2Image_scaled(mat_8UC3, QSize(30, 20));
+    QCOMPARE(img.format(), QImage::Format_RGB888);
+    QCOMPARE(img.size(), QSize(30, 20));
+    QVERIFY(isSameMat(image2Mat(img), scaled_8UC3));
+    img = mat2Image_scaled(mat_8UC4, QSize(30, 20), -1, QImage::Format_RGB32);
+    QVERIFY(isSameMat(image2Mat(img, CV_8UC3), scaled_8UC3));
+    QCOMPARE(qAlpha(img.pixel(3, 3)), 255);
+
+    //Resized into the QImage directly
+    img = mat2Image_scaled(mat_8UC4, QSize(30, 20));
+    QCOMPARE(img.format(), QImage::Format_ARGB32);
+    QVERIFY(isSameMat(image2Mat(img), scaled_8UC4));
+    img = mat2Image_scaled(mat_8UC1, QSize(30, 20));
+    QCOMPARE(img.format(), QImage::Format_Indexed8);
+    QCOMPARE(img.colorCount(), 256);
+    QVERIFY(isSameMat(image2Mat(img), scaled_8UC1));
+
+    //The buffer is reused
+    const uchar *data = img.constBits();
+    QVERIFY(mat2Image_scaled(mat_8UC1, img, QSize(30, 20), cv::INTER_NEAREST));
+    QVERIFY(img.constBits() == data);
+
+    //Same size means no resizing
+    QVERIFY(isSameMat(image2Mat(mat2Image_scaled(mat_8UC3, QSize(60, 40))), mat_8UC3));
+    QVERIFY(mat2Image_scaled(mat_8UC3, QSize()).isNull());
+}
+
+void CvMatAndImageTest::testValueMapping()
+{
+    cv::Mat mat_32FC1(30, 40, CV_32FC1);
+    cv::randu(mat_32FC1, cv::Scalar::all(-5), cv::Scalar::all(20));
+    cv::Mat mat_32FC3(30, 40, CV_32FC3);
+    cv::randu(mat_32FC3, cv::Scalar::all(-5), cv::Scalar::all(20));
+
+    //Same as convertTo(), allowing the rounding of float math
+    cv::Mat expected;
+    mat_32FC1.convertTo(expected, CV_8U, 10, 30);
+    QImage img = mat2Image_linear(mat_32FC1, 10, 30);
+    QCOMPARE(img.format(), QImage::Format_Indexed8);
+    QVERIFY(cv::norm(image2Mat(img), expected, cv::NORM_INF) <= 1);
+    mat_32FC3.convertTo(expected, CV_8U, 10, 30);
+    QVERIFY(cv::norm(image2Mat(mat2Image_linear(mat_32FC3, 10, 30)), expected, cv::NORM_INF) <= 1);
+    QVERIFY(cv::norm(image2Mat(mat2Image_linear(mat_32FC3, 10, 30, QImage::Format_RGB888, MCO_RGB), CV_8UC3, MCO_RGB),
+                     expected, cv::NORM_INF) <= 1);
+
+    //8-bit data can be mapped too
+    cv::Mat mat_8UC1;
+    mat_32FC1.convertTo(mat_8UC1, CV_8U, 10, 30);
+    mat_8UC1.convertTo(expected, CV_8U, 0.5, 10);
+    QVERIFY(isSameMat(image2Mat(mat2Image_linear(mat_8UC1, 0.5, 10)), expected));
+
+    //Same as normalize(NORM_MINMAX)
+    cv::normalize(mat_32FC1, expected, 0, 255, cv::NORM_MINMAX, CV_8U);
+    QVERIFY(mat2Image_normalized(mat_32FC1, img));
+    QVERIFY(cv::norm(image2Mat(img), expected, cv::NORM_INF) <= 1);
+    cv::normalize(mat_32FC3.reshape(1), expected, 0, 255, cv::NORM_MINMAX, CV_8U);
+    QVERIFY(cv::norm(image2Mat(mat2Image_normalized(mat_32FC3)).reshape(1), expected, cv::NORM_INF) <= 1);
+
+    //log(1 + v - min), then normalize(NORM_MINMAX)
+    double minVal;
+    cv::minMaxLoc(mat_32FC1, &minVal);
+    cv::Mat logged = mat_32FC1 - minVal + 1;
+    cv::log(logged, logged);
+    cv::normalize(logged, expected, 0, 255, cv::NORM_MINMAX, CV_8U);
+    QVERIFY(cv::norm(image2Mat(mat2Image_normalized(mat_32FC1, NM_LogMinMax)), expected, cv::NORM_INF) <= 1);
+
+    //All the same values
+    cv::Mat mat_const(3, 4, CV_64FC1, cv::Scalar(7.5));
+    QVERIFY(isSameMat(image2Mat(mat2Image_normalized(mat_const)), cv::Mat::zeros(3, 4, CV_8UC1)));
+}
+
+void CvMatAndImageTest::testUMatConversion()
+{
+#if CV_MAJOR_VERSION >= 3
+    cv::Mat mat_8UC3(7, 11, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_8UC4;
+    cv::cvtColor(mat_8UC3, mat_8UC4, CV_BGR2BGRA);
+    const QImage img_rgb888 = mat2Image(mat_8UC3);
+    const QImage img_argb32 = mat2Image(mat_8UC4);
+
+    //Same results as the ones converted on the host, except the rounding of floating point
+    const int types[] = {CV_8UC1, CV_8UC3, CV_8UC4, CV_16UC3, CV_32FC4};
+    for (int i=0; i<5; ++i) {
+        for (int order=MCO_BGR; order<=MCO_RGB; ++order) {
+            const MatChannelOrder rgbOrder = MatChannelOrder(order);
+            cv::Mat expected = image2Mat(img_rgb888, types[i], rgbOrder);
+            QVERIFY(cv::norm(image2UMat(img_rgb888, types[i], rgbOrder).getMat(cv::ACCESS_READ), expected, cv::NORM_INF) <= 1);
+            expected = image2Mat(img_argb32, types[i], rgbOrder);
+            QVERIFY(cv::norm(image2UMat(img_argb32, types[i], rgbOrder).getMat(cv::ACCESS_READ), expected, cv::NORM_INF) <= 1);
+        }
+    }
+
+    cv::UMat umat_8UC3;
+    mat_8UC3.copyTo(umat_8UC3);
+    cv::UMat umat_8UC4;
+    mat_8UC4.copyTo(umat_8UC4);
+    QCOMPARE(umat2Image(umat_8UC3), img_rgb888);
+    QCOMPARE(umat2Image(umat_8UC4), img_argb32);
+    QCOMPARE(umat2Image(umat_8UC4, QImage::Format_RGB32), mat2Image(mat_8UC4, QImage::Format_RGB32));
+    QCOMPARE(umat2Image(umat_8UC3, QImage::Format_Indexed8), mat2Image(mat_8UC3, QImage::Format_Indexed8));
+
+    cv::Mat mat_32FC3;
+    mat_8UC3.convertTo(mat_32FC3, CV_32F, 1./255.);
+    cv::UMat umat_32FC3;
+    mat_32FC3.copyTo(umat_32FC3);
+    QImage img;
+    QVERIFY(umat2Image(umat_32FC3, img, QImage::Format_ARGB32, MCO_RGB));
+    QVERIFY(isSameMat(image2Mat(img, CV_8UC3, MCO_RGB), mat_8UC3));
+    QVERIFY(!image2UMat(QImage(), umat_8UC3));
+    QVERIFY(umat_8UC3.empty());
+#endif
+}
+
+void CvMatAndImageTest::testGpuMatConversion()
+{
+#if defined(QTOCV_WITH_CUDA) && QT_VERSION >= 0x050000
+    if (!cv::cuda::getCudaEnabledDeviceCount())
+        QSKIP("No CUDA device");
+
+    cv::Mat mat_8UC3(7, 11, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    const QImage img_rgb888 = mat2Image(mat_8UC3);
+
+    cv::cuda::Stream stream;
+    cv::cuda::GpuMat gpuMat;
+    QVERIFY(image2GpuMat(img_rgb888, gpuMat, CV_32FC4, MCO_RGB, stream));
+    cv::Mat mat;
+    gpuMat.download(mat, stream);
+    stream.waitForCompletion();
+    QVERIFY(cv::norm(mat, image2Mat(img_rgb888, CV_32FC4, MCO_RGB), cv::NORM_INF) <= 1./255.);
+
+    QImage img;
+    QVERIFY(gpuMat2Image(gpuMat, img, QImage::Format_RGB888, MCO_RGB, QVector<QRgb>(), stream));
+    stream.waitForCompletion();
+    QCOMPARE(img, img_rgb888);
+#endif
+}
+
+void CvMatAndImageTest::testFramePool()
+{
+    cv::Mat mat_8UC4(7, 11, CV_8UC4);
+    cv::randu(mat_8UC4, cv::Scalar::all(0), cv::Scalar::all(256));
+    const QImage img_argb32 = mat2Image(mat_8UC4);
+
+    FramePool pool;
+    int allocations = 0;
+    for (int i=0; i<3; ++i) {
+        QImage img = pool.image(img_argb32.size(), QImage::Format_ARGB32);
+        QVERIFY(mat2Image(mat_8UC4, img, QImage::Format_ARGB32));
+        QCOMPARE(img, img_argb32);
+        cv::Mat mat = pool.mat(7, 11, CV_8UC4);
+        const uchar *data = mat.data;
+        QVERIFY(image2Mat(img, mat, CV_8UC4));
+        QVERIFY(mat.data == data);
+        QVERIFY(isSameMat(mat, mat_8UC4));
+
+        //No more allocation once the buffers are back to the pool
+        if (i == 0)
+            allocations = pool.allocationCount();
+        QCOMPARE(pool.allocationCount(), allocations);
+    }
+    QVERIFY(pool.idleBytes() > 0);
+
+    //cv::Mat recreated in another size is pooled too
+    cv::Mat mat = pool.mat(7, 11, CV_8UC4);
+    mat.create(14, 22, CV_8UC4);
+    QCOMPARE(pool.allocationCount(), allocations + 1);
+
+    pool.clear();
+    QCOMPARE(pool.idleBytes(), qint64(0));
+
+    //Buffers in use outlive the pool
+    QImage img;
+    {
+        FramePool other;
+        img = other.image(img_argb32.size(), QImage::Format_ARGB32);
+        mat = other.mat(7, 11, CV_8UC3);
+    }
+    img.fill(0);
+    mat.setTo(cv::Scalar::all(0));
+
+    //And they can be recreated once the pool is gone
+    mat.create(14, 22, CV_8UC3);
+    mat.setTo(cv::Scalar::all(0));
+    mat.create(7, 11, CV_8UC4);
+    mat.release();
+}
+
+void CvMatAndImageTest::testStaticConversion()
+{
+    cv::Mat mat_8UC3(7, 11, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_8UC1;
+    cv::cvtColor(mat_8UC3, mat_8UC1, CV_BGR2GRAY);
+    cv::Mat mat_8UC4;
+    cv::cvtColor(mat_8UC3, mat_8UC4, CV_BGR2RGBA);
+
+    //Same results as the runtime selected ones
+    QImage img;
+    QVERIFY((convert<CV_8UC3, QImage::Format_RGB32, MCO_BGR>(mat_8UC3, img)));
+    QCOMPARE(img, mat2Image(mat_8UC3, QImage::Format_RGB32));
+    QVERIFY((convert<CV_8UC1, QImage::Format_RGB888, MCO_BGR>(mat_8UC1, img)));
+    QCOMPARE(img, mat2Image(mat_8UC1, QImage::Format_RGB888));
+    QVERIFY((convert<CV_8UC4, QImage::Format_ARGB32, MCO_RGBA>(mat_8UC4, img)));
+    QCOMPARE(img, mat2Image(mat_8UC4, QImage::Format_ARGB32, MCO_RGBA));
+    QVERIFY((convert<CV_8UC3, QImage::Format_Indexed8, MCO_BGR>(mat_8UC3, img)));
+    QCOMPARE(img, mat2Image(mat_8UC3, QImage::Format_Indexed8));
+
+    const QImage img_rgb888 = mat2Image(mat_8UC3);
+    cv::Mat mat;
+    QVERIFY((convert<QImage::Format_RGB888, CV_8UC3, MCO_BGR>(img_rgb888, mat)));
+    QVERIFY(isSameMat(mat, mat_8UC3));
+    QVERIFY((convert<QImage::Format_RGB888, CV_8UC1, MCO_BGR>(img_rgb888, mat)));
+    QVERIFY(isSameMat(mat, image2Mat(img_rgb888, CV_8UC1)));
+    const QImage img_indexed8 = mat2Image(mat_8UC1);
+    QVERIFY((convert<QImage::Format_Indexed8, CV_8UC4, MCO_RGBA>(img_indexed8, mat)));
+    QVERIFY(isSameMat(mat, image2Mat(img_indexed8, CV_8UC4, MCO_RGBA)));
+
+    //Type or format mismatch
+    QVERIFY(!(convert<QImage::Format_RGB32, CV_8UC3, MCO_BGR>(QImage(), mat)));
+    QVERIFY(mat.empty());
+}
+
+void CvMatAndImageTest::testStripConversion()
+{
+    cv::Mat mat_8UC3(37, 11, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_16UC1(37, 11, CV_16UC1);
+    cv::randu(mat_16UC1, cv::Scalar::all(0), cv::Scalar::all(65536));
+
+    //Same results as the whole ones, with at most stripRows rows in memory
+    MatRowsReader reader(mat_8UC3);
+    ImageStripsCollector collector(QSize(11, 37), QImage::Format_RGB32);
+    QVERIFY(mat2Image_strips(reader, collector, mat_8UC3.size(), CV_8UC3, 8, QImage::Format_RGB32));
+    QCOMPARE(collector.image, mat2Image(mat_8UC3, QImage::Format_RGB32));
+    QCOMPARE(reader.maxRows(), 8);
+
+    MatRowsReader grayReader(mat_16UC1);
+    ImageStripsCollector grayCollector(QSize(11, 37), QImage::Format_Indexed8);
+    QVERIFY(mat2Image_strips(grayReader, grayCollector, mat_16UC1.size(), CV_16UC1, 5));
+    QCOMPARE(grayCollector.image, mat2Image(mat_16UC1));
+
+    //Raw rows with padding, read from a QBuffer and a memory mapped QFile
+    const size_t step = 11 * 3 + 5;
+    QByteArray raw(int(step) * 37 + 7, '\0');
+    for (int i=0; i<37; ++i)
+        memcpy(raw.data() + 7 + i*step, mat_8UC3.ptr(i), 11 * 3);
+    const QImage expected = mat2Image(mat_8UC3);
+
+    QBuffer buffer(&raw);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    DeviceStripReader bufferReader(&buffer, 7, step);
+    QByteArray converted;
+    QBuffer output(&converted);
+    QVERIFY(output.open(QIODevice::WriteOnly));
+    DeviceStripWriter writer(&output);
+    QVERIFY(mat2Image_strips(bufferReader, writer, mat_8UC3.size(), CV_8UC3, 16));
+    QCOMPARE(converted.size(), 11 * 3 * 37);
+    for (int i=0; i<37; ++i)
+        QVERIFY(memcmp(converted.constData() + i*11*3, expected.constScanLine(i), 11 * 3) == 0);
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QCOMPARE(file.write(raw), qint64(raw.size()));
+    QVERIFY(file.flush());
+    DeviceStripReader fileReader(&file, 7, step);
+    ImageStripsCollector fileCollector(QSize(11, 37), QImage::Format_RGB888);
+    QVERIFY(mat2Image_strips(fileReader, fileCollector, mat_8UC3.size(), CV_8UC3, 16));
+    QCOMPARE(fileCollector.image, expected);
+
+    //Truncated source
+    buffer.close();
+    raw.chop(100);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    QVERIFY(!mat2Image_strips(bufferReader, writer, mat_8UC3.size(), CV_8UC3, 16));
+}
+
+void CvMatAndImageTest::testRawFrameFile()
+{
+    cv::Mat mat_8UC3(17, 23, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_32FC1(9, 5, CV_32FC1);
+    cv::randu(mat_32FC1, cv::Scalar::all(0), cv::Scalar::all(1));
+    const QImage img_indexed8 = mat2Image(cv::Mat(mat_8UC3, cv::Rect(1, 0, 13, 17)).clone().reshape(1), QImage::Format_Indexed8);
+    QImage img_rgb32(7, 3, QImage::Format_RGB32);
+    img_rgb32.fill(qRgb(10, 20, 30));
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    RawFrameWriter writer(&file);
+    //ROI, rows are stored without padding
+    QVERIFY(writer.write(cv::Mat(mat_8UC3, cv::Rect(2, 1, 19, 15)), 0, 100));
+    QVERIFY(writer.write(mat_32FC1, 1, 101));
+    QVERIFY(writer.write(img_indexed8, 0, 102));
+    QVERIFY(writer.write(img_rgb32, 2, 103));
+    QVERIFY(!writer.write(cv::Mat()));
+    QVERIFY(file.flush());
+
+    RawFrameReader reader(file.fileName());
+    QVERIFY(reader.open());
+    QCOMPARE(reader.frameCount(), 4);
+
+    RawFrameInfo info = reader.frameInfo(1);
+    QCOMPARE(info.matType, int(CV_32FC1));
+    QCOMPARE(info.stream, 1);
+    QCOMPARE(info.timestamp, qint64(101));
+    QCOMPARE(info.format, QImage::Format_Invalid);
+
+    QVERIFY(isSameMat(reader.mat(0), cv::Mat(mat_8UC3, cv::Rect(2, 1, 19, 15))));
+    QCOMPARE(size_t(reader.mat(0).data - reader.mat(0).datastart) % 64, size_t(0));
+    QVERIFY(isSameMat(reader.mat(1), mat_32FC1));
+    QCOMPARE(reader.image(1), mat2Image(mat_32FC1));
+
+    //Frames of QImage are shared with the mapping
+    const QImage indexed8 = reader.image(2);
+    QCOMPARE(indexed8, img_indexed8);
+    QCOMPARE(indexed8.constBits(), reader.mat(2).data);
+    QCOMPARE(reader.image(3), img_rgb32);
+    QCOMPARE(reader.frameInfo(3).stream, 2);
+
+    //Truncated record at the end
+    reader.close();
+    QVERIFY(file.resize(file.size() - 1));
+    QVERIFY(reader.open());
+    QCOMPARE(reader.frameCount(), 3);
+
+    //Not a raw frame file
+    QVERIFY(file.resize(0));
+    QCOMPARE(file.write("not a raw frame file, not a raw frame file, not a raw frame file, ..."), qint64(69));
+    QVERIFY(file.flush());
+    QVERIFY(!reader.open());
+    QVERIFY(!reader.isOpen());
+
+    //Corrupt headers are rejected instead of being read past the record: a color table
+    //bigger than the space for it, a step which overflows, and a format wider than the step
+    QVERIFY(file.resize(0));
+    QVERIFY(file.seek(0));
+    RawFrameWriter rewriter(&file);
+    QVERIFY(rewriter.write(img_indexed8, 0, 104));
+    QVERIFY(file.flush());
+    const qint32 colorCount = 100000;
+    const qint64 step = qint64(1) << 62;
+    const qint32 format = QImage::Format_ARGB32;
+    const char *values[3] = {reinterpret_cast<const char*>(&colorCount), reinterpret_cast<const char*>(&step),
+                             reinterpret_cast<const char*>(&format)};
+    const qint64 offsets[3] = {64 + 4, 64 + 16, 64 + 28};
+    const int sizes[3] = {4, 8, 4};
+    for (int i=0; i<3; ++i) {
+        QVERIFY(file.seek(offsets[i]));
+        const QByteArray original = file.read(sizes[i]);
+        QVERIFY(file.seek(offsets[i]));
+        QCOMPARE(file.write(values[i], sizes[i]), qint64(sizes[i]));
+        QVERIFY(file.flush());
+        QVERIFY(reader.open());
+        QCOMPARE(reader.frameCount(), 0);
+        reader.close();
+        QVERIFY(file.seek(offsets[i]));
+        QCOMPARE(file.write(original), qint64(sizes[i]));
+        QVERIFY(file.flush());
+    }
+    QVERIFY(reader.open());
+    QCOMPARE(reader.frameCount(), 1);
+    QCOMPARE(reader.image(0), img_indexed8);
+}
+
+void CvMatAndImageTest::testBatchConversion()
+{
+    cv::Mat mat_8UC3(12, 20, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    QVector<QImage> images;
+    images.append(mat2Image(mat_8UC3, QImage::Format_RGB32));
+    images.append(mat2Image(mat_8UC3, QImage::Format_RGB888));
+    images.append(mat2Image(mat_8UC3.reshape(1), QImage::Format_Indexed8));
+
+    //Same results as image2Mat(), in parallel
+    setConversionThreads(0);
+    std::vector<cv::Mat> mats;
+    QVERIFY(image2MatBatch(images, mats, CV_8UC3));
+    QCOMPARE(int(mats.size()), images.size());
+    for (int i=0; i<images.size(); ++i)
+        QVERIFY(isSameMat(mats[i], image2Mat(images[i], CV_8UC3)));
+    images.append(QImage());
+    QVERIFY(!image2MatBatch(images, mats));
+    QVERIFY(mats[3].empty());
+
+    //Planes of the same values as image2Mat(), with the mean subtracted
+    cv::Mat tensor;
+    images.resize(2);
+    QVERIFY(image2Tensor(images, tensor, QSize(), TL_NCHW, 3, MCO_RGB, 1./255., cv::Scalar(255, 0, 0)));
+    QCOMPARE(tensor.dims, 4);
+    QCOMPARE(tensor.size[0], 2);
+    QCOMPARE(tensor.size[1], 3);
+    QCOMPARE(tensor.size[2], 12);
+    QCOMPARE(tensor.size[3], 20);
+    std::vector<cv::Mat> planes;
+    cv::split(image2Mat(images[0], CV_32FC3, MCO_RGB), planes);
+    planes[0] -= 1.f;
+    for (int n=0; n<2; ++n) {
+        for (int c=0; c<3; ++c)
+            QVERIFY(cv::norm(cv::Mat(12, 20, CV_32F, tensor.ptr<float>(n, c)), planes[c], cv::NORM_INF) < 1e-6);
+    }
+
+    //Resized, interleaved and gray
+    QVERIFY(image2Tensor(images, tensor, QSize(10, 6), TL_NHWC));
+    QCOMPARE(tensor.size[1], 6);
+    QCOMPARE(tensor.size[3], 3);
+    cv::Mat resized;
+    cv::resize(image2Mat(images[1], CV_8UC3), resized, cv::Size(10, 6), 0, 0, cv::INTER_AREA);
+    resized.convertTo(resized, CV_32FC3, 1./255.);
+    QVERIFY(cv::norm(cv::Mat(6, 10, CV_32FC3, tensor.ptr<float>(1)), resized, cv::NORM_INF) < 1e-6);
+
+    QVERIFY(image2Tensor(images, tensor, QSize(), TL_NCHW, 1, MCO_BGR, 1.));
+    cv::Mat gray;
+    image2Mat(images[0], CV_8UC1).convertTo(gray, CV_32F);
+    QVERIFY(isSameMat(cv::Mat(12, 20, CV_32F, tensor.ptr<float>(0)), gray));
+    setConversionThreads(1);
+
+    QVERIFY(!image2Tensor(QVector<QImage>(), tensor));
+    QVERIFY(tensor.empty());
+}
+
+void CvMatAndImageTest::testPlanarConversion()
+{
+    cv::Mat mat_8UC3(13, 37, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    const cv::Scalar mean(0.485, 0.456, 0.406);
+    const cv::Scalar stddev(0.229, 0.224, 0.225);
+
+    //Planes of ((v / 255) - mean) / stddev, for 3 and 4 channels formats
+    std::vector<cv::Mat> planes;
+    cv::split(image2Mat(mat2Image(mat_8UC3), CV_32FC3, MCO_RGB), planes);
+    for (int c=0; c<3; ++c)
+        planes[c] = (planes[c] - mean[c]) / stddev[c];
+
+    const QImage images[] = {mat2Image(mat_8UC3, QImage::Format_RGB888), mat2Image(mat_8UC3, QImage::Format_ARGB32)};
+    for (int i=0; i<2; ++i) {
+        cv::Mat mat;
+        QVERIFY(image2Mat_planar(images[i], mat, mean, stddev, QSize(), 3, MCO_RGB));
+        QCOMPARE(mat.dims, 4);
+        QCOMPARE(mat.size[1], 3);
+        for (int c=0; c<3; ++c)
+            QVERIFY(cv::norm(cv::Mat(13, 37, CV_32F, mat.ptr<float>(0, c)), planes[c], cv::NORM_INF) < 1e-5);
+    }
+
+    //Same values as the tensor of a batch
+    cv::Mat mat;
+    QVERIFY(image2Mat_planar(images[1], mat, cv::Scalar(), cv::Scalar::all(1.), QSize(16, 8)));
+    cv::Mat tensor;
+    QVERIFY(image2Tensor(QVector<QImage>() << images[1], tensor, QSize(16, 8)));
+    QVERIFY(cv::norm(mat, tensor, cv::NORM_INF) < 1e-6);
+
+    //Gray
+    QVERIFY(image2Mat_planar(images[0], mat, cv::Scalar(0.5), cv::Scalar(0.5), QSize(), 1));
+    QCOMPARE(mat.size[1], 1);
+    cv::Mat gray;
+    image2Mat(images[0], CV_32FC1).convertTo(gray, CV_32F, 2., -1.);
+    QVERIFY(cv::norm(cv::Mat(13, 37, CV_32F, mat.data), gray, cv::NORM_INF) < 1e-5);
+
+    QVERIFY(!image2Mat_planar(QImage(), mat, mean, stddev));
+    QVERIFY(mat.empty());
+}
+
+void CvMatAndImageTest::testPremultipliedFormats()
+{
+    cv::Mat mat_8UC4(9, 37, CV_8UC4);
+    cv::randu(mat_8UC4, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_32FC4;
+    mat_8UC4.convertTo(mat_32FC4, CV_32F, 1./255.);
+
+    //Same results as the ones converted by Qt, with the fused kernels and the generic path
+    const QImage straight = mat2Image(mat_8UC4, QImage::Format_ARGB32);
+    const QImage expected = straight.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QCOMPARE(mat2Image(mat_8UC4, QImage::Format_ARGB32_Premultiplied), expected);
+    QCOMPARE(mat2Image(mat_8UC4, QImage::Format_ARGB32_Premultiplied, MCO_RGBA), mat2Image(mat_8UC4, QImage::Format_ARGB32, MCO_RGBA).convertToFormat(QImage::Format_ARGB32_Premultiplied));
+    QCOMPARE(mat2Image(mat_32FC4, QImage::Format_ARGB32_Premultiplied), expected);
+    //Opaque without alpha
+    cv::Mat mat_8UC3;
+    cv::cvtColor(mat_8UC4, mat_8UC3, CV_BGRA2BGR);
+    QCOMPARE(mat2Image(mat_8UC3, QImage::Format_ARGB32_Premultiplied), mat2Image(mat_8UC3, QImage::Format_ARGB32).convertToFormat(QImage::Format_ARGB32_Premultiplied));
+
+    //Unpremultiplied, which premultiplies back to the same data
+    const cv::Mat mat = image2Mat(expected, CV_8UC4);
+    QCOMPARE(mat2Image(mat, QImage::Format_ARGB32_Premultiplied), expected);
+    QVERIFY(isSameMat(image2Mat(expected, CV_8UC3), image2Mat(QImage(mat2Image(mat, QImage::Format_ARGB32)), CV_8UC3)));
+#if QT_VERSION >= 0x050300
+    for (int x=0; x<expected.width(); ++x) {
+        const QRgb rgb = qUnpremultiply(reinterpret_cast<const QRgb*>(expected.constScanLine(3))[x]);
+        const cv::Vec4b &v = mat.at<cv::Vec4b>(3, x);
+        QCOMPARE(int(v[0]), qBlue(rgb));
+        QCOMPARE(int(v[1]), qGreen(rgb));
+        QCOMPARE(int(v[2]), qRed(rgb));
+        QCOMPARE(int(v[3]), qAlpha(rgb));
+    }
+#endif
+
+#if QT_VERSION >= 0x050200
+    const QImage expected_rgba = mat2Image(mat_8UC4, QImage::Format_RGBA8888).convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+    QCOMPARE(mat2Image(mat_8UC4, QImage::Format_RGBA8888_Premultiplied), expected_rgba);
+    QCOMPARE(mat2Image(mat_32FC4, QImage::Format_RGBA8888_Premultiplied), expected_rgba);
+    QVERIFY(isSameMat(image2Mat(expected_rgba, CV_8UC4), mat));
+#endif
+}
+
+namespace {
+int traceHookCalls = 0;
+void countTraceHook(const ConversionStats &stats)
+{
+    if (stats.calls == 1 && stats.nsecs >= 0)
+        ++traceHookCalls;
+}
+} //namespace
+
+void CvMatAndImageTest::testConversionStats()
+{
+    cv::Mat mat_8UC3(12, 20, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_16UC3;
+    mat_8UC3.convertTo(mat_16UC3, CV_16U, 257.);
+
+    //Nothing is collected by default
+    resetConversionStats();
+    QVERIFY(!conversionStatsEnabled());
+    mat2Image(mat_8UC3, QImage::Format_RGB888);
+    QVERIFY(conversionStats().isEmpty());
+
+    setConversionStatsEnabled(true);
+    setConversionTraceHook(countTraceHook);
+    traceHookCalls = 0;
+    mat2Image(mat_8UC3, QImage::Format_RGB888);
+    mat2Image(mat_8UC3, QImage::Format_RGB888);
+    mat2Image(mat_16UC3, QImage::Format_RGB888);
+    image2Mat(QImage(20, 12, QImage::Format_RGB16), CV_8UC3);
+    setConversionTraceHook(0);
+    setConversionStatsEnabled(false);
+    QCOMPARE(traceHookCalls, 4);
+
+    const QVector<ConversionStats> stats = conversionStats();
+    QCOMPARE(stats.size(), 3);
+    bool found[3] = {false, false, false};
+    for (int i=0; i<stats.size(); ++i) {
+        const ConversionStats &s = stats[i];
+        if (s.direction == CD_Mat2Image && s.matType == CV_8UC3) {
+            found[0] = true;
+            QCOMPARE(s.format, QImage::Format_RGB888);
+            QCOMPARE(s.calls, qint64(2));
+            QCOMPARE(s.bytes, qint64(2 * 12 * 20 * 3));
+            QCOMPARE(s.slowPathCalls, qint64(0));
+            QCOMPARE(s.extraCopyCalls, qint64(0));
+        } else if (s.direction == CD_Mat2Image && s.matType == CV_16UC3) {
+            found[1] = true;
+            QCOMPARE(s.calls, qint64(1));
+            QCOMPARE(s.slowPathCalls, qint64(1));
+        } else if (s.direction == CD_Image2Mat) {
+            //Converted by QImage first
+            found[2] = true;
+            QCOMPARE(s.format, QImage::Format_RGB16);
+            QCOMPARE(s.matType, int(CV_8UC3));
+            QCOMPARE(s.extraCopyCalls, qint64(1));
+        }
+    }
+    QVERIFY(found[0] && found[1] && found[2]);
+
+    resetConversionStats();
+    QVERIFY(conversionStats().isEmpty());
+}
+
+void CvMatAndImageTest::testConverterPlans()
+{
+    cv::Mat mat_8UC4(11, 37, CV_8UC4);
+    cv::randu(mat_8UC4, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_8UC3, mat_8UC1, mat_16UC3;
+    cv::cvtColor(mat_8UC4, mat_8UC3, CV_BGRA2BGR);
+    cv::cvtColor(mat_8UC4, mat_8UC1, CV_BGRA2GRAY);
+    mat_8UC3.convertTo(mat_16UC3, CV_16U, 257.);
+
+    //Same results as mat2Image() and image2Mat(), through each of the resolved kernels
+    const cv::Mat mats[] = {mat_8UC1, mat_8UC3, mat_8UC4, mat_16UC3};
+    const QImage::Format formats[] = {QImage::Format_Indexed8, QImage::Format_RGB888, QImage::Format_RGB32,
+                                      QImage::Format_ARGB32, QImage::Format_ARGB32_Premultiplied};
+    for (int m=0; m<4; ++m) {
+        for (int f=0; f<5; ++f) {
+            for (int o=0; o<2; ++o) {
+                const MatChannelOrder order = o ? MCO_RGB : MCO_BGR;
+                Mat2ImageConverter toImage(mats[m].type(), QSize(37, 11), formats[f], order);
+                QVERIFY(toImage.isValid());
+                const QImage img = toImage.run(mats[m]);
+                QCOMPARE(img, mat2Image(mats[m], formats[f], order));
+
+                Image2MatConverter toMat(formats[f], QSize(37, 11), mats[m].type(), order);
+                QVERIFY(toMat.isValid());
+                cv::Mat mat;
+                QVERIFY(toMat.run(img, mat));
+                QVERIFY(isSameMat(mat, image2Mat(img, mats[m].type(), order)));
+            }
+        }
+    }
+
+    //Buffer of the converter is reused once the previous result is released
+    Mat2ImageConverter toImage(CV_8UC3, QSize(37, 11), QImage::Format_RGB32);
+    QCOMPARE(toImage.format(), QImage::Format_RGB32);
+    const uchar *bits = toImage.run(mat_8UC3).constBits();
+    QCOMPARE(toImage.run(mat_8UC3).constBits(), bits);
+
+    //ROI and scale
+    cv::Mat roi = mat_8UC4(cv::Rect(3, 2, 20, 7));
+    Mat2ImageConverter toImageRoi(CV_8UC4, QSize(20, 7), QImage::Format_RGB888);
+    QCOMPARE(toImageRoi.run(roi), mat2Image(roi, QImage::Format_RGB888));
+    Mat2ImageConverter toImageScaled(CV_16UC3, QSize(37, 11), QImage::Format_RGB888, MCO_BGR, 1./257.);
+    QCOMPARE(toImageScaled.run(mat_16UC3), mat2Image(mat_8UC3, QImage::Format_RGB888));
+
+    //Default format and type
+    QCOMPARE(Mat2ImageConverter(CV_8UC4, QSize(37, 11)).format(), QImage::Format_ARGB32);
+    QCOMPARE(Image2MatConverter(QImage::Format_RGB888, QSize(37, 11)).matType(), int(CV_8UC3));
+    //Formats without PixelLayout are converted by QImage first
+    const QImage rgb16 = mat2Image(mat_8UC3, QImage::Format_RGB888).convertToFormat(QImage::Format_RGB16);
+    QVERIFY(isSameMat(Image2MatConverter(QImage::Format_RGB16, QSize(37, 11), CV_8UC3).run(rgb16), image2Mat(rgb16, CV_8UC3)));
+
+    QVERIFY(!Mat2ImageConverter(CV_8UC3, QSize()).isValid());
+    QVERIFY(!Image2MatConverter(QImage::Format_RGB888, QSize(37, 11), CV_8SC3).isValid());
+}
+
+void CvMatAndImageTest::testAsyncConversion()
+{
+    cv::Mat mat(480, 640, CV_8UC3);
+    cv::randu(mat, cv::Scalar::all(0), cv::Scalar::all(256));
+    const QImage expected = mat2Image(mat, QImage::Format_RGB32);
+
+    //Frames submitted faster than converted are superseded, the newest one is always converted
+    {
+        ConversionPool pool(1, 1);
+        QList<QFuture<QImage> > futures;
+        for (int i=0; i<20; ++i)
+            futures.append(pool.mat2Image(mat, QImage::Format_RGB32));
+        pool.waitForDone();
+
+        int canceled = 0;
+        for (int i=0; i<futures.size(); ++i) {
+            QVERIFY(futures[i].isFinished());
+            if (futures[i].isCanceled())
+                ++canceled;
+            else
+                QCOMPARE(futures[i].result(), expected);
+        }
+        QVERIFY(!futures.last().isCanceled());
+        QCOMPARE(pool.droppedCount(), qint64(canceled));
+    }
+
+    //Nothing is dropped while the queue has room
+    ConversionPool pool(2, 8);
+    QCOMPARE(pool.maxThreads(), 2);
+    QCOMPARE(pool.maxPending(), 8);
+    QList<QFuture<cv::Mat> > futures;
+    for (int i=0; i<8; ++i)
+        futures.append(pool.image2Mat(expected, CV_8UC3));
+    for (int i=0; i<futures.size(); ++i) {
+        futures[i].waitForFinished();
+        QVERIFY(!futures[i].isCanceled());
+        QVERIFY(isSameMat(futures[i].result(), mat));
+    }
+    QCOMPARE(pool.droppedCount(), qint64(0));
+
+    //Global pool, and failures are reported as empty results
+    QCOMPARE(mat2ImageAsync(mat, QImage::Format_ARGB32).result(), mat2Image(mat, QImage::Format_ARGB32));
+    QVERIFY(isSameMat(image2MatAsync(expected).result(), image2Mat(expected)));
+    QVERIFY(mat2ImageAsync(cv::Mat()).result().isNull());
+}
+
+void CvMatAndImageTest::testYuvConversion()
+{
+    cv::Mat mat_8UC3(48, 66, CV_8UC3);
+    cv::randu(mat_8UC3, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat nv12;
+    cv::cvtColor(mat_8UC3, nv12, CV_BGR2YUV_I420);
+
+    //The same as cv::cvtColor() within the rounding of fixed point
+    const int codes[] = {CV_YUV2BGR_NV12, CV_YUV2BGR_NV21, CV_YUV2BGR_I420, CV_YUV2BGR_YV12};
+    const YuvFormat formats[] = {YF_NV12, YF_NV21, YF_I420, YF_YV12};
+    for (int i=0; i<4; ++i) {
+        cv::Mat bgr;
+        cv::cvtColor(nv12, bgr, codes[i]);
+        QVERIFY(cv::norm(image2Mat(yuv2Image(nv12, formats[i], QImage::Format_RGB32), CV_8UC3), bgr, cv::NORM_INF) <= 2);
+        QVERIFY(cv::norm(image2Mat(yuv2Image(nv12, formats[i], QImage::Format_RGB888), CV_8UC3), bgr, cv::NORM_INF) <= 2);
+    }
+
+    cv::Mat yuyv(48, 66, CV_8UC2);
+    cv::randu(yuyv, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat bgr;
+    cv::cvtColor(yuyv, bgr, CV_YUV2BGR_YUYV);
+    QVERIFY(cv::norm(image2Mat(yuv2Image(yuyv, YF_YUYV), CV_8UC3), bgr, cv::NORM_INF) <= 2);
+    cv::cvtColor(yuyv, bgr, CV_YUV2BGR_UYVY);
+    QVERIFY(cv::norm(image2Mat(yuv2Image(yuyv, YF_UYVY), CV_8UC3), bgr, cv::NORM_INF) <= 2);
+
+    //Planes with their own strides give the same result as cv::Mat
+    const uchar *planes[3] = {nv12.data, nv12.ptr(48), nv12.ptr(48)};
+    const int strides[3] = {nv12.cols, nv12.cols, nv12.cols};
+    QImage image;
+    QVERIFY(yuv2Image(planes, strides, QSize(66, 48), YF_NV12, image));
+    QCOMPARE(image, yuv2Image(nv12, YF_NV12));
+
+    //Round trip, chroma is shared by each 2 x 2 pixels, so a smooth image is used
+    QImage gradient(66, 48, QImage::Format_RGB32);
+    for (int y=0; y<gradient.height(); ++y)
+        for (int x=0; x<gradient.width(); ++x)
+            gradient.setPixel(x, y, qRgb(x * 3 + 30, y * 4 + 20, 200 - x - y));
+    for (int i=0; i<6; ++i) {
+        cv::Mat yuv;
+        QVERIFY(image2Yuv(gradient, YuvFormat(i), yuv));
+        QCOMPARE(yuv.type(), i < 4 ? int(CV_8UC1) : int(CV_8UC2));
+        const QImage back = yuv2Image(yuv, YuvFormat(i));
+        QVERIFY(cv::norm(image2Mat(back, CV_8UC3), image2Mat(gradient, CV_8UC3), cv::NORM_INF) <= 4);
+    }
+
+    //Premultiplied colors are unpremultiplied first, same as image2Mat()
+    cv::Mat mat_8UC4(48, 66, CV_8UC4);
+    cv::randu(mat_8UC4, cv::Scalar::all(0), cv::Scalar::all(256));
+    const QImage premultiplied = mat2Image(mat_8UC4, QImage::Format_ARGB32_Premultiplied);
+    cv::Mat fromPremultiplied, fromStraight;
+    QVERIFY(image2Yuv(premultiplied, YF_NV12, fromPremultiplied));
+    QVERIFY(image2Yuv(premultiplied.convertToFormat(QImage::Format_ARGB32), YF_NV12, fromStraight));
+    QVERIFY(isSameMat(fromPremultiplied, fromStraight));
+
+    //Odd sizes can't be stored in the layout of OpenCV
+    cv::Mat yuv;
+    QVERIFY(!image2Yuv(QImage(65, 48, QImage::Format_RGB32), YF_NV12, yuv));
+    QVERIFY(yuv.empty());
+
+    //The pixels of YUYV and UYVY are in pairs, so an odd width is rejected instead of written past the row
+    std::vector<uchar> packedData(65 * 2 * 48 + 2, 7);
+    uchar *packedPlanes[3] = {&packedData[0], &packedData[0], &packedData[0]};
+    const int packedStrides[3] = {65 * 2, 65 * 2, 65 * 2};
+    for (int i=4; i<6; ++i) {
+        QVERIFY(!image2Yuv(gradient.copy(0, 0, 65, 48), YuvFormat(i), packedPlanes, packedStrides));
+        QVERIFY(packedData[65 * 2 * 48] == 7 && packedData[65 * 2 * 48 + 1] == 7);
+        const uchar *constPlanes[3] = {&packedData[0], &packedData[0], &packedData[0]};
+        QVERIFY(!yuv2Image(constPlanes, packedStrides, QSize(65, 48), YuvFormat(i), image));
+        QVERIFY(image.isNull());
+        QVERIFY(!yuv2Image(yuyv.colRange(0, 65).clone(), YuvFormat(i), image));
+        QVERIFY(image.isNull());
+    }
+}
+
+void CvMatAndImageTest::testDirtyConversion()
+{
+    cv::Mat previous(120, 160, CV_8UC3);
+    cv::randu(previous, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    //The first frame is converted in full
+    QImage image;
+    QRegion changed;
+    QVERIFY(mat2Image_dirty(previous, cv::Mat(), image, changed, QImage::Format_RGB32));
+    QCOMPARE(changed, QRegion(image.rect()));
+    QCOMPARE(image, mat2Image(previous, QImage::Format_RGB32));
+
+    //A small object moves, only the blocks covering it are converted
+    cv::Mat mat = previous.clone();
+    mat(cv::Rect(70, 40, 5, 20)).setTo(cv::Scalar(255, 0, 0));
+    const QImage shown = image;
+    QVERIFY(mat2Image_dirty(mat, previous, image, changed, QImage::Format_RGB32, 16));
+    QCOMPARE(changed, QRegion(QRect(64, 32, 16, 32)));
+    QCOMPARE(image, mat2Image(mat, QImage::Format_RGB32));
+    //The image in use by the painter isn't touched
+    QCOMPARE(shown, mat2Image(previous, QImage::Format_RGB32));
+
+    //Nothing changed
+    QVERIFY(mat2Image_dirty(mat, mat.clone(), image, changed, QImage::Format_RGB32));
+    QVERIFY(changed.isEmpty());
+
+    //Dirty rects given by the producer are clipped to the frame
+    cv::Mat next = mat.clone();
+    next(cv::Rect(150, 110, 10, 10)).setTo(cv::Scalar::all(7));
+    std::vector<cv::Rect> rects(1, cv::Rect(150, 110, 30, 30));
+    QVERIFY(mat2Image_dirty(next, image, rects, changed, QImage::Format_RGB32));
+    QCOMPARE(changed, QRegion(QRect(150, 110, 10, 10)));
+    QCOMPARE(image, mat2Image(next, QImage::Format_RGB32));
+
+    //Another format means a full conversion
+    QVERIFY(mat2Image_dirty(next, mat, image, changed, QImage::Format_RGB888));
+    QCOMPARE(changed, QRegion(image.rect()));
+    QCOMPARE(image, mat2Image(next, QImage::Format_RGB888));
+
+    //Only the converted rects are counted by the statistics
+    resetConversionStats();
+    setConversionStatsEnabled(true);
+    cv::Mat next_16UC3;
+    next.convertTo(next_16UC3, CV_16U, 257.);
+    QVERIFY(mat2Image_dirty(next_16UC3, image, rects, changed, QImage::Format_RGB888));
+    setConversionStatsEnabled(false);
+    const QVector<ConversionStats> stats = conversionStats();
+    QCOMPARE(stats.size(), 1);
+    QCOMPARE(stats[0].matType, int(CV_16UC3));
+    QCOMPARE(stats[0].bytes, qint64(10 * 10 * 6));
+    QCOMPARE(stats[0].slowPathCalls, qint64(1));
+    resetConversionStats();
+
+    //A previous image of a format which can't be converted to is rejected
+    QImage rgb16(160, 120, QImage::Format_RGB16);
+    rgb16.fill(0);
+    QVERIFY(!mat2Image_dirty(next, rgb16, rects, changed, QImage::Format_RGB16));
+    QVERIFY(changed.isEmpty());
+}
+
+//Push the numbers 0 .. count-1 into ring from another thread
+class RingProducer : public QThread
+{
+public:
+    RingProducer(FrameRing<int> *ring, int count) : m_ring(ring), m_count(count) {}
+
+protected:
+    void run()
+    {
+        for (int i=0; i<m_count; ) {
+            int *slot = m_ring->beginWrite();
+            if (!slot) {
+                yieldCurrentThread();
+                continue;
+            }
+            *slot = i++;
+            m_ring->endWrite();
+        }
+    }
+
+private:
+    FrameRing<int> *m_ring;
+    int m_count;
+};
+
+void CvMatAndImageTest::testFrameRing()
+{
+    //A full ring drops the incoming value, slots keep their buffers for the producer
+    FrameRing<cv::Mat> ring(2);
+    QCOMPARE(ring.capacity(), 2);
+    QVERIFY(ring.isEmpty());
+    const cv::Mat mat(4, 4, CV_8UC3, cv::Scalar::all(1));
+    QVERIFY(ring.push(mat));
+    QVERIFY(ring.push(mat.clone()));
+    QVERIFY(!ring.push(mat));
+    QCOMPARE(ring.count(), 2);
+    QCOMPARE(ring.droppedCount(), 1);
+    cv::Mat *slot = ring.beginRead();
+    QVERIFY(slot && slot->data == mat.data);
+    ring.endRead();
+    cv::Mat popped;
+    QVERIFY(ring.pop(popped));
+    QVERIFY(!ring.pop(popped));
+    QVERIFY(!ring.wait(1));
+
+    //Values arrive in order from another thread
+    {
+        FrameRing<int> numbers(4);
+        RingProducer producer(&numbers, 100000);
+        producer.start();
+        int expected = 0;
+        while (expected < 100000) {
+            int value;
+            if (numbers.pop(value))
+                QCOMPARE(value, expected++);
+            else
+                numbers.wait(100);
+        }
+        producer.wait();
+        QVERIFY(numbers.isEmpty());
+    }
+
+    //The latest value wins, the one being read isn't touched by the producer
+    FrameMailbox<QImage> mailbox;
+    QVERIFY(!mailbox.take());
+    for (int i=0; i<3; ++i) {
+        mat2Image(cv::Mat(4, 4, CV_8UC3, cv::Scalar::all(i)), mailbox.writeSlot(), QImage::Format_RGB32);
+        mailbox.publish();
+    }
+    QCOMPARE(mailbox.droppedCount(), 2);
+    QVERIFY(mailbox.wait(0));
+    QVERIFY(mailbox.take());
+    QCOMPARE(mailbox.readSlot().pixel(0, 0), qRgb(2, 2, 2));
+    QVERIFY(!mailbox.take());
+    mat2Image(cv::Mat(4, 4, CV_8UC3, cv::Scalar::all(3)), mailbox.writeSlot(), QImage::Format_RGB32);
+    mailbox.publish();
+    QCOMPARE(mailbox.readSlot().pixel(0, 0), qRgb(2, 2, 2));
+    QVERIFY(mailbox.take());
+    QCOMPARE(mailbox.readSlot().pixel(0, 0), qRgb(3, 3, 3));
+}
+
+void CvMatAndImageTest::testRowKernels()
+{
+    //The inline kernels give the same bytes as the conversions
+    cv::Mat mat_8UC4(9, 37, CV_8UC4);
+    cv::randu(mat_8UC4, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat mat_8UC3;
+    cv::cvtColor(mat_8UC4, mat_8UC3, CV_BGRA2BGR);
+
+    const QImage rgb = mat2Image(mat_8UC3, QImage::Format_RGB888);
+    const QImage gray = mat2Image(mat_8UC3, QImage::Format_Indexed8);
+    std::vector<uchar> row(mat_8UC4.cols * 4);
+    for (int y=0; y<mat_8UC3.rows; ++y) {
+        RowKernels::swizzleRow3To3_<true>(mat_8UC3.ptr(y), &row[0], mat_8UC3.cols);
+        QVERIFY(memcmp(&row[0], rgb.constScanLine(y), mat_8UC3.cols * 3) == 0);
+        RowKernels::grayRow_<3, 2>(mat_8UC3.ptr(y), &row[0], mat_8UC3.cols);
+        QVERIFY(memcmp(&row[0], gray.constScanLine(y), mat_8UC3.cols) == 0);
+    }
+#if QT_VERSION >= 0x050200
+    const QImage premultiplied = mat2Image(mat_8UC4, QImage::Format_RGBA8888_Premultiplied);
+    for (int y=0; y<mat_8UC4.rows; ++y) {
+        RowKernels::premultiplyRow4To4_<true>(mat_8UC4.ptr(y), &row[0], mat_8UC4.cols);
+        QVERIFY(memcmp(&row[0], premultiplied.constScanLine(y), mat_8UC4.cols * 4) == 0);
+    }
+#endif
+
+    //src == dst, in place
+    for (int y=0; y<mat_8UC3.rows; ++y) {
+        std::copy(mat_8UC3.ptr(y), mat_8UC3.ptr(y) + mat_8UC3.cols * 3, row.begin());
+        RowKernels::swizzleRow3To3_<true>(&row[0], &row[0], mat_8UC3.cols);
+        QVERIFY(memcmp(&row[0], rgb.constScanLine(y), mat_8UC3.cols * 3) == 0);
+        std::copy(mat_8UC3.ptr(y), mat_8UC3.ptr(y) + mat_8UC3.cols * 3, row.begin());
+        RowKernels::grayRow_<3, 2>(&row[0], &row[0], mat_8UC3.cols);
+        QVERIFY(memcmp(&row[0], gray.constScanLine(y), mat_8UC3.cols) == 0);
+    }
+    for (int y=0; y<mat_8UC4.rows; ++y) {
+        std::copy(mat_8UC4.ptr(y), mat_8UC4.ptr(y) + mat_8UC4.cols * 4, row.begin());
+        RowKernels::swizzleRow4To4_<false, false>(&row[0], &row[0], mat_8UC4.cols);
+        QVERIFY(memcmp(&row[0], mat_8UC4.ptr(y), mat_8UC4.cols * 4) == 0);
+    }
+}
+
 QTEST_MAIN(CvMatAndImageTest)
 
 #include "tst_testcvmatandimagetest.moc"
@@ -2,4 +2,5 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
     testcvmatandimage \
+    differential \
     benchmarks